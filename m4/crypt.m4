@@ -8,4 +8,9 @@ AC_DEFUN([DOVECOT_CRYPT], [
     ])
   ])
   AC_SUBST(CRYPT_LIBS)
+
+  old_LIBS=$LIBS
+  LIBS="$CRYPT_LIBS $LIBS"
+  AC_CHECK_FUNCS(crypt_r)
+  LIBS=$old_LIBS
 ])
@@ -0,0 +1,19 @@
+dnl * POSIX threads, used for offloading CPU-bound and blocking work
+AC_DEFUN([DOVECOT_PTHREAD], [
+  PTHREAD_LIBS=
+  AC_CHECK_HEADER(pthread.h, [
+    AC_CHECK_FUNC(pthread_create, [
+      have_pthread=yes
+    ], [
+      AC_CHECK_LIB(pthread, pthread_create, [
+        PTHREAD_LIBS="-lpthread"
+        have_pthread=yes
+      ])
+    ])
+  ])
+  AS_IF([test "$have_pthread" = yes], [
+    AC_DEFINE(HAVE_PTHREAD,, [Define if you have POSIX threads])
+    AUTH_LIBS="$AUTH_LIBS $PTHREAD_LIBS"
+  ])
+  AC_SUBST(PTHREAD_LIBS)
+])
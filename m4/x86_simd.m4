@@ -0,0 +1,35 @@
+dnl * x86 SIMD code with runtime CPU feature detection
+AC_DEFUN([DOVECOT_X86_SIMD], [
+  AC_CACHE_CHECK([whether x86 SIMD code can be built],i_cv_have_x86_simd,[
+    AC_LINK_IFELSE([AC_LANG_PROGRAM([[
+      #include <immintrin.h>
+
+      __attribute__((target("avx2")))
+      static int test_avx2(const void *p)
+      {
+        __m256i v = _mm256_loadu_si256(p);
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, v));
+      }
+      __attribute__((target("sse4.2,pclmul")))
+      static int test_pclmul(const void *p)
+      {
+        __m128i v = _mm_loadu_si128(p);
+        return _mm_cvtsi128_si32(_mm_clmulepi64_si128(v, v, 0));
+      }
+    ]], [[
+      char buf[32] = { 0 };
+
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") &&
+          __builtin_cpu_supports("pclmul"))
+        return test_avx2(buf) + test_pclmul(buf);
+    ]])],[
+      i_cv_have_x86_simd=yes
+    ], [
+      i_cv_have_x86_simd=no
+    ])
+  ])
+  AS_IF([test $i_cv_have_x86_simd = yes], [
+    AC_DEFINE(HAVE_X86_SIMD,, [Define if x86 SIMD code with runtime CPU feature detection can be built])
+  ])
+])
@@ -0,0 +1,486 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "crc32.h"
+#include "file-lock.h"
+#include "mmap-util.h"
+#include "safe-mkstemp.h"
+#include "auth-cache-shm.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/stat.h>
+
+#define AUTH_CACHE_SHM_MAGIC 0x41434853 /* "ACHS" */
+#define AUTH_CACHE_SHM_VERSION 1
+#define AUTH_CACHE_SHM_PROBE_COUNT 8
+#define AUTH_CACHE_SHM_LOCK_TIMEOUT_SECS 5
+/* How many times to retry reading a slot that is being modified. The
+   writer normally finishes within a few hundred nanoseconds, so spin first.
+   After that give the CPU away in case the writer was preempted. If the
+   slot is still being modified, the writer has most likely died and the
+   lookup is a cache miss. */
+#define AUTH_CACHE_SHM_READ_SPIN_COUNT 100
+#define AUTH_CACHE_SHM_READ_RETRIES (AUTH_CACHE_SHM_READ_SPIN_COUNT + 10)
+
+struct auth_cache_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t slot_count;
+	/* Updated only while the file is locked */
+	uint32_t used_count;
+	uint32_t unused[11];
+};
+
+struct auth_cache_shm_slot {
+	/* Sequence lock: odd while the slot is being modified. Readers retry
+	   if it changed while they were copying the record. */
+	uint32_t seq;
+	uint32_t hash;
+	int64_t created;
+	/* Updated by lookups without locking. Used only for choosing the
+	   record to replace. */
+	uint32_t last_used;
+	/* Size of data, 0 if the slot is unused */
+	uint16_t data_size;
+	uint8_t last_success;
+	uint8_t unused;
+	char data[AUTH_CACHE_SHM_MAX_DATA_SIZE];
+};
+static_assert(sizeof(struct auth_cache_shm_slot) == 512,
+	      "auth cache slot size changed");
+
+struct auth_cache_shm {
+	char *path;
+	int fd;
+
+	void *mmap_base;
+	size_t mmap_size;
+	struct auth_cache_shm_header *hdr;
+	struct auth_cache_shm_slot *slots;
+	unsigned int slot_count;
+
+	/* Lookup result is copied here */
+	char data[AUTH_CACHE_SHM_MAX_DATA_SIZE + 1];
+};
+
+static unsigned int auth_cache_shm_slot_count(size_t max_size)
+{
+	size_t count = max_size / sizeof(struct auth_cache_shm_slot);
+
+	return I_MAX(I_MIN(count, UINT32_MAX / 2), AUTH_CACHE_SHM_PROBE_COUNT);
+}
+
+static size_t auth_cache_shm_file_size(unsigned int slot_count)
+{
+	return sizeof(struct auth_cache_shm_header) +
+		(size_t)slot_count * sizeof(struct auth_cache_shm_slot);
+}
+
+static bool
+auth_cache_shm_header_is_valid(const struct auth_cache_shm_header *hdr,
+			       unsigned int slot_count)
+{
+	return hdr->magic == AUTH_CACHE_SHM_MAGIC &&
+		hdr->version == AUTH_CACHE_SHM_VERSION &&
+		hdr->slot_size == sizeof(struct auth_cache_shm_slot) &&
+		hdr->slot_count == slot_count;
+}
+
+static int
+auth_cache_shm_create(const char *path, unsigned int slot_count,
+		      const char **error_r)
+{
+	struct auth_cache_shm_header hdr;
+	string_t *temp_path = t_str_new(256);
+	int fd;
+
+	/* Create the file under a temporary name and rename() it, so the
+	   other processes never see a partially initialized file. The slots
+	   are zeros, i.e. unused. */
+	str_append(temp_path, path);
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("safe_mkstemp(%s) failed: %m",
+					   str_c(temp_path));
+		return -1;
+	}
+
+	i_zero(&hdr);
+	hdr.magic = AUTH_CACHE_SHM_MAGIC;
+	hdr.version = AUTH_CACHE_SHM_VERSION;
+	hdr.slot_size = sizeof(struct auth_cache_shm_slot);
+	hdr.slot_count = slot_count;
+	if (ftruncate(fd, auth_cache_shm_file_size(slot_count)) < 0) {
+		*error_r = t_strdup_printf("ftruncate(%s) failed: %m",
+					   str_c(temp_path));
+	} else if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+		*error_r = t_strdup_printf("pwrite(%s) failed: %m",
+					   str_c(temp_path));
+	} else if (rename(str_c(temp_path), path) < 0) {
+		*error_r = t_strdup_printf("rename(%s, %s) failed: %m",
+					   str_c(temp_path), path);
+	} else {
+		i_close_fd(&fd);
+		return 0;
+	}
+	i_unlink(str_c(temp_path));
+	i_close_fd(&fd);
+	return -1;
+}
+
+static int
+auth_cache_shm_try_map(struct auth_cache_shm *shm, unsigned int slot_count,
+		       const char **error_r)
+{
+	struct stat st;
+
+	shm->fd = open(shm->path, O_RDWR);
+	if (shm->fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		*error_r = t_strdup_printf("open(%s) failed: %m", shm->path);
+		return -1;
+	}
+	if (fstat(shm->fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", shm->path);
+		return -1;
+	}
+	if ((uoff_t)st.st_size != auth_cache_shm_file_size(slot_count)) {
+		/* created with a different size */
+		i_close_fd(&shm->fd);
+		return 0;
+	}
+
+	shm->mmap_size = st.st_size;
+	shm->mmap_base = mmap(NULL, shm->mmap_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, shm->fd, 0);
+	if (shm->mmap_base == MAP_FAILED) {
+		shm->mmap_base = NULL;
+		*error_r = t_strdup_printf("mmap(%s) failed: %m", shm->path);
+		return -1;
+	}
+	shm->hdr = shm->mmap_base;
+	if (!auth_cache_shm_header_is_valid(shm->hdr, slot_count)) {
+		if (munmap(shm->mmap_base, shm->mmap_size) < 0)
+			i_error("munmap(%s) failed: %m", shm->path);
+		shm->mmap_base = NULL;
+		shm->hdr = NULL;
+		i_close_fd(&shm->fd);
+		return 0;
+	}
+	shm->slots = PTR_OFFSET(shm->mmap_base,
+				sizeof(struct auth_cache_shm_header));
+	shm->slot_count = slot_count;
+	return 1;
+}
+
+int auth_cache_shm_open(const char *path, size_t max_size,
+			struct auth_cache_shm **shm_r, const char **error_r)
+{
+	struct auth_cache_shm *shm;
+	unsigned int i, slot_count = auth_cache_shm_slot_count(max_size);
+	int ret;
+
+	shm = i_new(struct auth_cache_shm, 1);
+	shm->path = i_strdup(path);
+	shm->fd = -1;
+
+	/* If another process replaces the file at the same time, try again
+	   with its file. */
+	for (i = 0;; i++) {
+		ret = auth_cache_shm_try_map(shm, slot_count, error_r);
+		if (ret != 0 || i == 2)
+			break;
+		if (auth_cache_shm_create(path, slot_count, error_r) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	if (ret <= 0) {
+		if (ret == 0) {
+			*error_r = t_strdup_printf(
+				"%s: File keeps getting replaced", path);
+		}
+		auth_cache_shm_close(&shm);
+		return -1;
+	}
+	*shm_r = shm;
+	return 0;
+}
+
+void auth_cache_shm_close(struct auth_cache_shm **_shm)
+{
+	struct auth_cache_shm *shm = *_shm;
+
+	*_shm = NULL;
+	if (shm->mmap_base != NULL) {
+		if (munmap(shm->mmap_base, shm->mmap_size) < 0)
+			i_error("munmap(%s) failed: %m", shm->path);
+	}
+	i_close_fd(&shm->fd);
+	i_free(shm->path);
+	i_free(shm);
+}
+
+static int
+auth_cache_shm_lock(struct auth_cache_shm *shm, struct file_lock **lock_r)
+{
+	const struct file_lock_settings lock_set = {
+		.lock_method = FILE_LOCK_METHOD_FCNTL,
+	};
+	const char *error;
+	int ret;
+
+	ret = file_wait_lock(shm->fd, shm->path, F_WRLCK, &lock_set,
+			     AUTH_CACHE_SHM_LOCK_TIMEOUT_SECS, lock_r, &error);
+	if (ret <= 0) {
+		i_error("auth cache: %s", error);
+		return -1;
+	}
+	return 0;
+}
+
+static inline struct auth_cache_shm_slot *
+auth_cache_shm_slot(struct auth_cache_shm *shm, uint32_t hash, unsigned int i)
+{
+	return &shm->slots[(hash + i) % shm->slot_count];
+}
+
+static void
+auth_cache_shm_slot_write_begin(struct auth_cache_shm_slot *slot)
+{
+	/* The seq may already be odd if a process died while modifying it. */
+	__atomic_store_n(&slot->seq, slot->seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+auth_cache_shm_slot_write_end(struct auth_cache_shm_slot *slot)
+{
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void auth_cache_shm_read_wait(unsigned int retry)
+{
+	if (retry >= AUTH_CACHE_SHM_READ_SPIN_COUNT)
+		(void)sched_yield();
+#if defined(__i386__) || defined(__x86_64__)
+	else
+		__builtin_ia32_pause();
+#endif
+}
+
+static bool
+auth_cache_shm_slot_read(struct auth_cache_shm *shm,
+			 struct auth_cache_shm_slot *slot, uint32_t hash,
+			 const char *key, struct auth_cache_shm_record *rec_r)
+{
+	uint32_t seq;
+	unsigned int i;
+	size_t size;
+
+	for (i = 0; i < AUTH_CACHE_SHM_READ_RETRIES; i++) {
+		if (i > 0)
+			auth_cache_shm_read_wait(i);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) != 0)
+			continue;
+		if (slot->hash != hash || slot->data_size == 0)
+			return FALSE;
+
+		size = I_MIN(slot->data_size, sizeof(slot->data));
+		memcpy(shm->data, slot->data, size);
+		rec_r->created = slot->created;
+		rec_r->last_success = slot->last_success != 0;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		/* the copy is consistent, but verify it anyway in case the
+		   file is corrupted */
+		shm->data[size] = '\0';
+		if (strcmp(shm->data, key) != 0)
+			return FALSE;
+		size_t key_len = strlen(shm->data);
+		if (key_len + 1 >= size || shm->data[size - 1] != '\0')
+			return FALSE;
+		rec_r->key = shm->data;
+		rec_r->value = shm->data + key_len + 1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+bool auth_cache_shm_lookup(struct auth_cache_shm *shm, const char *key,
+			   struct auth_cache_shm_record *rec_r)
+{
+	struct auth_cache_shm_slot *slot;
+	uint32_t hash = crc32_str(key);
+	unsigned int i;
+
+	for (i = 0; i < AUTH_CACHE_SHM_PROBE_COUNT; i++) {
+		slot = auth_cache_shm_slot(shm, hash, i);
+		if (auth_cache_shm_slot_read(shm, slot, hash, key, rec_r)) {
+			__atomic_store_n(&slot->last_used, (uint32_t)ioloop_time,
+					 __ATOMIC_RELAXED);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static struct auth_cache_shm_slot *
+auth_cache_shm_find_locked(struct auth_cache_shm *shm, uint32_t hash,
+			   const char *key)
+{
+	struct auth_cache_shm_slot *slot;
+	size_t key_len = strlen(key);
+	unsigned int i;
+
+	for (i = 0; i < AUTH_CACHE_SHM_PROBE_COUNT; i++) {
+		slot = auth_cache_shm_slot(shm, hash, i);
+		if (slot->data_size > key_len && slot->hash == hash &&
+		    memcmp(slot->data, key, key_len + 1) == 0)
+			return slot;
+	}
+	return NULL;
+}
+
+static void
+auth_cache_shm_slot_clear_locked(struct auth_cache_shm *shm,
+				 struct auth_cache_shm_slot *slot)
+{
+	i_assert(slot->data_size != 0);
+
+	auth_cache_shm_slot_write_begin(slot);
+	slot->data_size = 0;
+	auth_cache_shm_slot_write_end(slot);
+	if (shm->hdr->used_count > 0)
+		shm->hdr->used_count--;
+}
+
+bool auth_cache_shm_insert(struct auth_cache_shm *shm, const char *key,
+			   const char *value, time_t created,
+			   bool last_success)
+{
+	struct auth_cache_shm_slot *slot, *best = NULL;
+	struct file_lock *lock;
+	uint32_t hash = crc32_str(key);
+	size_t key_len = strlen(key), value_len = strlen(value);
+	unsigned int i;
+
+	if (auth_cache_shm_lock(shm, &lock) < 0)
+		return FALSE;
+
+	slot = auth_cache_shm_find_locked(shm, hash, key);
+	if (key_len + 1 + value_len + 1 > sizeof(slot->data)) {
+		/* too large - make sure the old record isn't used either */
+		if (slot != NULL)
+			auth_cache_shm_slot_clear_locked(shm, slot);
+		file_unlock(&lock);
+		return FALSE;
+	}
+	if (slot == NULL) {
+		/* use an unused slot or replace the least recently used one */
+		for (i = 0; i < AUTH_CACHE_SHM_PROBE_COUNT; i++) {
+			slot = auth_cache_shm_slot(shm, hash, i);
+			if (slot->data_size == 0) {
+				best = slot;
+				break;
+			}
+			if (best == NULL || slot->last_used < best->last_used)
+				best = slot;
+		}
+		slot = best;
+		if (slot->data_size == 0)
+			shm->hdr->used_count++;
+	}
+
+	auth_cache_shm_slot_write_begin(slot);
+	slot->hash = hash;
+	slot->created = created;
+	slot->last_used = created;
+	slot->last_success = last_success ? 1 : 0;
+	memcpy(slot->data, key, key_len + 1);
+	memcpy(slot->data + key_len + 1, value, value_len + 1);
+	slot->data_size = key_len + 1 + value_len + 1;
+	auth_cache_shm_slot_write_end(slot);
+
+	file_unlock(&lock);
+	return TRUE;
+}
+
+void auth_cache_shm_set_last_success(struct auth_cache_shm *shm,
+				     const char *key, bool last_success)
+{
+	struct auth_cache_shm_slot *slot;
+	struct file_lock *lock;
+
+	if (auth_cache_shm_lock(shm, &lock) < 0)
+		return;
+	slot = auth_cache_shm_find_locked(shm, crc32_str(key), key);
+	if (slot != NULL && (slot->last_success != 0) != last_success) {
+		auth_cache_shm_slot_write_begin(slot);
+		slot->last_success = last_success ? 1 : 0;
+		auth_cache_shm_slot_write_end(slot);
+	}
+	file_unlock(&lock);
+}
+
+void auth_cache_shm_remove(struct auth_cache_shm *shm, const char *key)
+{
+	struct auth_cache_shm_slot *slot;
+	struct file_lock *lock;
+
+	if (auth_cache_shm_lock(shm, &lock) < 0)
+		return;
+	slot = auth_cache_shm_find_locked(shm, crc32_str(key), key);
+	if (slot != NULL)
+		auth_cache_shm_slot_clear_locked(shm, slot);
+	file_unlock(&lock);
+}
+
+unsigned int
+auth_cache_shm_clear(struct auth_cache_shm *shm,
+		     auth_cache_shm_match_callback_t *callback, void *context)
+{
+	struct auth_cache_shm_slot *slot;
+	struct file_lock *lock;
+	unsigned int i, count = 0;
+
+	if (auth_cache_shm_lock(shm, &lock) < 0)
+		return 0;
+	for (i = 0; i < shm->slot_count; i++) {
+		slot = &shm->slots[i];
+		if (slot->data_size == 0)
+			continue;
+		if (callback != NULL) {
+			memcpy(shm->data, slot->data, sizeof(slot->data));
+			shm->data[sizeof(slot->data)] = '\0';
+			if (!callback(shm->data, context))
+				continue;
+		}
+		auth_cache_shm_slot_clear_locked(shm, slot);
+		count++;
+	}
+	file_unlock(&lock);
+	return count;
+}
+
+void auth_cache_shm_get_usage(struct auth_cache_shm *shm,
+			      unsigned int *used_count_r,
+			      size_t *used_size_r, size_t *max_size_r)
+{
+	*used_count_r = shm->hdr->used_count;
+	*used_size_r = (size_t)*used_count_r *
+		sizeof(struct auth_cache_shm_slot);
+	*max_size_r = (size_t)shm->slot_count *
+		sizeof(struct auth_cache_shm_slot);
+}
@@ -0,0 +1,59 @@
+#ifndef AUTH_CACHE_SHM_H
+#define AUTH_CACHE_SHM_H
+
+/* Auth cache records stored in a shared mmap()ed file. The file survives
+   auth process restarts and can be used by multiple processes at the same
+   time. Lookups don't lock the file. Modifications lock it with fcntl().
+
+   The file consists of fixed size slots. Records that don't fit into a slot
+   aren't cached. Each key can be in one of the AUTH_CACHE_SHM_PROBE_COUNT
+   slots following its hash position. When all of them are in use, the least
+   recently used one is replaced. */
+
+/* Maximum size of the "key \0 value \0" data in a record */
+#define AUTH_CACHE_SHM_MAX_DATA_SIZE (512 - 24)
+
+struct auth_cache_shm;
+
+struct auth_cache_shm_record {
+	time_t created;
+	bool last_success;
+	/* key \0 value \0 */
+	const char *key, *value;
+};
+
+/* Returns TRUE if the record should be removed. */
+typedef bool auth_cache_shm_match_callback_t(const char *key, void *context);
+
+/* Open or create the cache file. If the existing file was created with a
+   different max_size, it's replaced with an empty one. */
+int auth_cache_shm_open(const char *path, size_t max_size,
+			struct auth_cache_shm **shm_r, const char **error_r);
+void auth_cache_shm_close(struct auth_cache_shm **shm);
+
+/* Look up the key. The returned record is valid until the next
+   auth_cache_shm_*() call. */
+bool auth_cache_shm_lookup(struct auth_cache_shm *shm, const char *key,
+			   struct auth_cache_shm_record *rec_r);
+/* Insert or replace the key. Returns FALSE if the record is too large to be
+   cached or the file couldn't be locked. */
+bool auth_cache_shm_insert(struct auth_cache_shm *shm, const char *key,
+			   const char *value, time_t created,
+			   bool last_success);
+/* Update last_success for the key if it still exists. */
+void auth_cache_shm_set_last_success(struct auth_cache_shm *shm,
+				     const char *key, bool last_success);
+/* Remove the key from the cache. */
+void auth_cache_shm_remove(struct auth_cache_shm *shm, const char *key);
+/* Remove all the records for which the callback returns TRUE, or all records
+   if callback is NULL. Returns the number of removed records. */
+unsigned int
+auth_cache_shm_clear(struct auth_cache_shm *shm,
+		     auth_cache_shm_match_callback_t *callback, void *context);
+
+/* Returns the number of used slots and the total size of the slots. */
+void auth_cache_shm_get_usage(struct auth_cache_shm *shm,
+			      unsigned int *used_count_r,
+			      size_t *used_size_r, size_t *max_size_r);
+
+#endif
@@ -9,6 +9,7 @@
 #include "wildcard-match.h"
 #include "auth-request.h"
 #include "auth-cache.h"
+#include "auth-cache-shm.h"
 
 #include <time.h>
 
@@ -17,6 +18,10 @@ struct auth_cache {
 	struct auth_cache_node *head, *tail;
 	struct event *event;
 
+	/* Shared cache file. If set, the hash and the node list are unused,
+	   and the looked up nodes are copied to the request's pool. */
+	struct auth_cache_shm *shm;
+
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
 
@@ -208,7 +213,7 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 	struct auth_cache *cache;
 
 	cache = i_new(struct auth_cache, 1);
-	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create_open(&cache->hash, default_pool, 0, str_hash, strcmp);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
@@ -218,12 +223,32 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 	return cache;
 }
 
+int auth_cache_new_shared(const char *path, size_t max_size,
+			  unsigned int ttl_secs, unsigned int neg_ttl_secs,
+			  struct auth_cache **cache_r, const char **error_r)
+{
+	struct auth_cache *cache;
+	struct auth_cache_shm *shm;
+
+	if (auth_cache_shm_open(path, max_size, &shm, error_r) < 0)
+		return -1;
+
+	cache = auth_cache_new(max_size, ttl_secs, neg_ttl_secs);
+	cache->shm = shm;
+	*cache_r = cache;
+	return 0;
+}
+
 void auth_cache_free(struct auth_cache **_cache)
 {
 	struct auth_cache *cache = *_cache;
 
 	*_cache = NULL;
 
+	if (cache->shm != NULL) {
+		/* keep the shared records */
+		auth_cache_shm_close(&cache->shm);
+	}
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
 	event_unref(&cache->event);
@@ -240,8 +265,16 @@ void auth_cache_get_status(const struct auth_cache *cache,
 	status_r->neg_entries = cache->neg_entries;
 	status_r->pos_size = cache->pos_size;
 	status_r->neg_size = cache->neg_size;
-	status_r->max_size = cache->max_size;
-	status_r->used_size = cache->max_size - cache->size_left;
+	if (cache->shm != NULL) {
+		unsigned int used_count;
+
+		auth_cache_shm_get_usage(cache->shm, &used_count,
+					 &status_r->used_size,
+					 &status_r->max_size);
+	} else {
+		status_r->max_size = cache->max_size;
+		status_r->used_size = cache->max_size - cache->size_left;
+	}
 }
 
 void auth_cache_reset_counters(struct auth_cache *cache)
@@ -255,16 +288,17 @@ unsigned int auth_cache_clear(struct auth_cache *cache)
 {
 	unsigned int ret = hash_table_count(cache->hash);
 
+	if (cache->shm != NULL)
+		return auth_cache_shm_clear(cache->shm, NULL, NULL);
+
 	while (cache->tail != NULL)
 		auth_cache_node_destroy(cache, cache->tail);
 	hash_table_clear(cache->hash, FALSE);
 	return ret;
 }
 
-static bool auth_cache_node_is_user(struct auth_cache_node *node,
-				    const char *user_mask)
+static bool auth_cache_key_is_user(const char *data, const char *user_mask)
 {
-	const char *data = node->data;
 	bool ret = FALSE;
 
 	/* The cache nodes begin with "P"/"U", passdb/userdb ID, optional
@@ -294,27 +328,40 @@ static bool auth_cache_node_is_user(struct auth_cache_node *node,
 	return ret;
 }
 
-static bool auth_cache_node_is_one_of_users(struct auth_cache_node *node,
-					    const char *const *user_masks)
+static bool auth_cache_key_is_one_of_users(const char *key,
+					   const char *const *user_masks)
 {
 	unsigned int i;
 
 	for (i = 0; user_masks[i] != NULL; i++) {
-		if (auth_cache_node_is_user(node, user_masks[i]))
+		if (auth_cache_key_is_user(key, user_masks[i]))
 			return TRUE;
 	}
 	return FALSE;
 }
 
+static bool auth_cache_shm_key_is_one_of_users(const char *key, void *context)
+{
+	const char *const *user_masks = context;
+
+	return auth_cache_key_is_one_of_users(key, user_masks);
+}
+
 unsigned int auth_cache_clear_users(struct auth_cache *cache,
 				    const char *const *user_masks)
 {
 	struct auth_cache_node *node, *next;
 	unsigned int ret = 0;
 
+	if (cache->shm != NULL) {
+		return auth_cache_shm_clear(cache->shm,
+			auth_cache_shm_key_is_one_of_users,
+			(void *)user_masks);
+	}
+
 	for (node = cache->tail; node != NULL; node = next) {
 		next = node->next;
-		if (auth_cache_node_is_one_of_users(node, user_masks)) {
+		if (auth_cache_key_is_one_of_users(node->data, user_masks)) {
 			auth_cache_node_destroy(cache, node);
 			ret++;
 		}
@@ -368,6 +415,30 @@ auth_request_expand_cache_key(const struct auth_request *request,
 	return str_c(value);
 }
 
+static struct auth_cache_node *
+auth_cache_shm_lookup_node(struct auth_cache *cache,
+			   const struct auth_request *request, const char *key)
+{
+	struct auth_cache_node *node;
+	struct auth_cache_shm_record rec;
+	size_t key_len, value_len;
+
+	if (!auth_cache_shm_lookup(cache->shm, key, &rec))
+		return NULL;
+
+	/* @UNSAFE */
+	key_len = strlen(rec.key);
+	value_len = strlen(rec.value);
+	i_assert(key_len + 1 + value_len + 1 <= AUTH_CACHE_SHM_MAX_DATA_SIZE);
+	node = p_malloc(request->pool, sizeof(*node) +
+			key_len + 1 + value_len + 1);
+	node->created = rec.created;
+	node->last_success = rec.last_success;
+	memcpy(node->data, rec.key, key_len + 1);
+	memcpy(node->data + key_len + 1, rec.value, value_len + 1);
+	return node;
+}
+
 const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
@@ -382,7 +453,10 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	*neg_expired_r = FALSE;
 
 	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
-	node = hash_table_lookup(cache->hash, key);
+	if (cache->shm != NULL)
+		node = auth_cache_shm_lookup_node(cache, request, key);
+	else
+		node = hash_table_lookup(cache->hash, key);
 	if (node == NULL) {
 		cache->miss_count++;
 		return NULL;
@@ -398,7 +472,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		*expired_r = TRUE;
 	} else {
 		/* move to head */
-		if (node != cache->head) {
+		if (cache->shm == NULL && node != cache->head) {
 			auth_cache_node_unlink(cache, node);
 			auth_cache_node_link_head(cache, node);
 		}
@@ -413,6 +487,19 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	return value;
 }
 
+static void
+auth_cache_count_insert(struct auth_cache *cache, const char *value,
+			size_t alloc_size)
+{
+	if (*value != '\0') {
+		cache->pos_entries++;
+		cache->pos_size += alloc_size;
+	} else {
+		cache->neg_entries++;
+		cache->neg_size += alloc_size;
+	}
+}
+
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success)
 {
@@ -426,6 +513,15 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	}
 
 	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
+	if (cache->shm != NULL) {
+		if (!auth_cache_shm_insert(cache->shm, key, value, time(NULL),
+					   last_success))
+			return;
+		alloc_size = sizeof(struct auth_cache_node) +
+			strlen(key) + 1 + value_len + 1;
+		auth_cache_count_insert(cache, value, alloc_size);
+		return;
+	}
 	key_len = strlen(key);
 
 	data_size = key_len + 1 + value_len + 1;
@@ -454,13 +550,17 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	cache->size_left -= alloc_size;
 	hash_key = node->data;
 	hash_table_insert(cache->hash, hash_key, node);
+	auth_cache_count_insert(cache, value, alloc_size);
+}
 
-	if (*value != '\0') {
-		cache->pos_entries++;
-		cache->pos_size += alloc_size;
-	} else {
-		cache->neg_entries++;
-		cache->neg_size += alloc_size;
+void auth_cache_set_last_success(struct auth_cache *cache,
+				 struct auth_cache_node *node,
+				 bool last_success)
+{
+	node->last_success = last_success;
+	if (cache->shm != NULL) {
+		auth_cache_shm_set_last_success(cache->shm, node->data,
+						last_success);
 	}
 }
 
@@ -470,6 +570,10 @@ void auth_cache_remove(struct auth_cache *cache,
 	struct auth_cache_node *node;
 
 	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
+	if (cache->shm != NULL) {
+		auth_cache_shm_remove(cache->shm, key);
+		return;
+	}
 	node = hash_table_lookup(cache->hash, key);
 	if (node == NULL)
 		return;
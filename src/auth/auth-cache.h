@@ -38,6 +38,14 @@ int auth_cache_parse_key_and_fields(pool_t pool, const char *query,
    neg_ttl_secs specifies the TTL for negative entries. */
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 				  unsigned int neg_ttl_secs);
+/* Create a new cache, which stores the records in a shared mmap()ed file at
+   path. The records survive process restarts and are visible to all the
+   processes using the same file. Records larger than
+   AUTH_CACHE_SHM_MAX_DATA_SIZE aren't cached. Returns 0 on success, -1 if the
+   file couldn't be opened or created. */
+int auth_cache_new_shared(const char *path, size_t max_size,
+			  unsigned int ttl_secs, unsigned int neg_ttl_secs,
+			  struct auth_cache **cache_r, const char **error_r);
 void auth_cache_free(struct auth_cache **cache);
 
 /* Clear the cache. Returns how many entries were removed. */
@@ -60,6 +68,11 @@ const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
 		  bool *expired_r, bool *neg_expired_r);
+/* Update the node's last_success. The node must have been returned by
+   auth_cache_lookup(). */
+void auth_cache_set_last_success(struct auth_cache *cache,
+				 struct auth_cache_node *node,
+				 bool last_success);
 /* Insert key => value into cache. "" value means negative cache entry. */
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success);
@@ -22,6 +22,7 @@
 #include "auth-client-connection.h"
 #include "auth-master-connection.h"
 #include "auth-policy.h"
+#include "auth-verify-pool.h"
 #include "passdb.h"
 #include "passdb-blocking.h"
 #include "passdb-cache.h"
@@ -2639,58 +2640,67 @@ auth_request_password_verify(struct auth_request *request,
 						crypted_password, scheme, TRUE);
 }
 
-enum passdb_result
-auth_request_password_verify_log(struct auth_request *request,
-				 struct event *event,
-				 const char *plain_password,
-				 const char *crypted_password,
-				 const char *scheme,
-				 bool log_password_mismatch)
+/* Returns TRUE if the password needs to be verified against raw_password_r,
+   FALSE if the result_r is already known. */
+static bool
+auth_request_password_verify_prepare(struct auth_request *request,
+				     struct event *event,
+				     const char *crypted_password,
+				     const char *scheme,
+				     const unsigned char **raw_password_r,
+				     size_t *raw_password_size_r,
+				     enum passdb_result *result_r)
 {
-	enum passdb_result result;
-	const unsigned char *raw_password;
-	size_t raw_password_size;
 	const char *error;
 	int ret;
-	struct password_generate_params gen_params = {
-		.user = request->fields.original_username,
-		.rounds = 0
-	};
 
 	if (request->fields.skip_password_check) {
 		/* passdb continue* rule after a successful authentication */
-		return PASSDB_RESULT_OK;
+		*result_r = PASSDB_RESULT_OK;
+		return FALSE;
 	}
 
 	if (request->passdb->set->deny) {
 		/* this is a deny database, we don't care about the password */
-		return PASSDB_RESULT_PASSWORD_MISMATCH;
+		*result_r = PASSDB_RESULT_PASSWORD_MISMATCH;
+		return FALSE;
 	}
 
 	if (auth_fields_exists(request->fields.extra_fields, "nopassword")) {
 		e_debug(event, "Allowing any password");
-		return PASSDB_RESULT_OK;
+		*result_r = PASSDB_RESULT_OK;
+		return FALSE;
 	}
 
 	ret = password_decode(crypted_password, scheme,
-			      &raw_password, &raw_password_size, &error);
+			      raw_password_r, raw_password_size_r, &error);
 	if (ret <= 0) {
 		if (ret < 0) {
 			e_error(event,
 				"Password data is not valid for scheme %s: %s",
 				scheme, error);
+			*result_r = PASSDB_RESULT_INTERNAL_FAILURE;
 		} else {
 			e_error(event, "Unknown scheme %s", scheme);
-			return PASSDB_RESULT_SCHEME_NOT_AVAILABLE;
+			*result_r = PASSDB_RESULT_SCHEME_NOT_AVAILABLE;
 		}
-		return PASSDB_RESULT_INTERNAL_FAILURE;
+		return FALSE;
 	}
+	return TRUE;
+}
+
+static enum passdb_result
+auth_request_password_verify_result(struct auth_request *request,
+				    struct event *event,
+				    const char *plain_password,
+				    const char *crypted_password,
+				    const char *scheme,
+				    const struct password_generate_params *gen_params,
+				    int ret, const char *error,
+				    bool log_password_mismatch)
+{
+	enum passdb_result result;
 
-	/* Use original_username since it may be important for some
-	   password schemes (eg. digest-md5). Otherwise the username is used
-	   only for logging purposes. */
-	ret = password_verify(plain_password, &gen_params,
-			      scheme, raw_password, raw_password_size, &error);
 	if (ret < 0) {
 		const char *password_str = request->set->debug_passwords ?
 			t_strdup_printf(" '%s'", crypted_password) : "";
@@ -2706,11 +2716,139 @@ auth_request_password_verify_log(struct auth_request *request,
 	}
 	if (ret <= 0 && request->set->debug_passwords) T_BEGIN {
 		log_password_failure(event, plain_password, crypted_password,
-				     scheme, &gen_params);
+				     scheme, gen_params);
 	} T_END;
 	return result;
 }
 
+enum passdb_result
+auth_request_password_verify_log(struct auth_request *request,
+				 struct event *event,
+				 const char *plain_password,
+				 const char *crypted_password,
+				 const char *scheme,
+				 bool log_password_mismatch)
+{
+	enum passdb_result result;
+	const unsigned char *raw_password;
+	size_t raw_password_size;
+	const char *error;
+	int ret;
+	struct password_generate_params gen_params = {
+		.user = request->fields.original_username,
+		.rounds = 0
+	};
+
+	if (!auth_request_password_verify_prepare(request, event,
+						  crypted_password, scheme,
+						  &raw_password,
+						  &raw_password_size, &result))
+		return result;
+
+	/* Use original_username since it may be important for some
+	   password schemes (eg. digest-md5). Otherwise the username is used
+	   only for logging purposes. */
+	ret = password_verify(plain_password, &gen_params,
+			      scheme, raw_password, raw_password_size, &error);
+	return auth_request_password_verify_result(request, event,
+		plain_password, crypted_password, scheme, &gen_params,
+		ret, error, log_password_mismatch);
+}
+
+struct auth_request_verify_ctx {
+	struct auth_request *request;
+	char *plain_password;
+	const char *crypted_password, *scheme;
+	verify_plain_callback_t *callback;
+};
+
+static void
+auth_request_db_password_verify_callback(int ret,
+	const struct auth_verify_pool_stats *stats,
+	struct auth_request_verify_ctx *ctx)
+{
+	struct auth_request *request = ctx->request;
+	struct event *event = authdb_event(request);
+	enum passdb_result result;
+	const char *error = AUTH_LOG_MSG_PASSWORD_MISMATCH;
+	struct password_generate_params gen_params = {
+		.user = request->fields.original_username,
+		.rounds = 0
+	};
+
+	event_add_int(event, "verify_queue_depth", stats->queue_depth);
+	event_add_int(event, "verify_queue_usecs", stats->queue_usecs);
+	event_add_int(event, "verify_usecs", stats->verify_usecs);
+
+	if (stats->aborted) {
+		/* Don't verify the queued passwords inline while shutting
+		   down */
+		e_error(event, "Password verification aborted: "
+			"Auth process is shutting down");
+		result = PASSDB_RESULT_INTERNAL_FAILURE;
+	} else {
+		e_debug(event, "Password verified in thread pool "
+			"(queue depth %u, waited %"PRIu64" us, "
+			"took %"PRIu64" us)", stats->queue_depth,
+			stats->queue_usecs, stats->verify_usecs);
+		if (ret < 0) {
+			/* The thread-safe functions don't return an error
+			   message. Don't verify again just to get it. */
+			error = t_strdup_printf("%s verification failed",
+						ctx->scheme);
+		}
+		result = auth_request_password_verify_result(request, event,
+			ctx->plain_password, ctx->crypted_password,
+			ctx->scheme, &gen_params, ret, error, TRUE);
+	}
+	safe_memset(ctx->plain_password, 0, strlen(ctx->plain_password));
+
+	ctx->callback(result, request);
+	auth_request_unref(&request);
+}
+
+void auth_request_db_password_verify_async(struct auth_request *request,
+					   const char *plain_password,
+					   const char *crypted_password,
+					   const char *scheme,
+					   verify_plain_callback_t *callback)
+{
+	struct event *event = authdb_event(request);
+	struct auth_request_verify_ctx *ctx;
+	password_verify_threadsafe_func_t *verify_func;
+	const unsigned char *raw_password;
+	size_t raw_password_size;
+	enum passdb_result result;
+
+	if (!auth_verify_pool_is_running() ||
+	    (verify_func = password_scheme_get_verify_threadsafe(scheme)) == NULL) {
+		result = auth_request_db_password_verify(request,
+			plain_password, crypted_password, scheme);
+		callback(result, request);
+		return;
+	}
+
+	if (!auth_request_password_verify_prepare(request, event,
+						  crypted_password, scheme,
+						  &raw_password,
+						  &raw_password_size, &result)) {
+		callback(result, request);
+		return;
+	}
+
+	ctx = p_new(request->pool, struct auth_request_verify_ctx, 1);
+	ctx->request = request;
+	ctx->plain_password = p_strdup(request->pool, plain_password);
+	ctx->crypted_password = p_strdup(request->pool, crypted_password);
+	ctx->scheme = p_strdup(request->pool, scheme);
+	ctx->callback = callback;
+	auth_request_ref(request);
+
+	auth_verify_pool_verify(verify_func, plain_password, raw_password,
+				raw_password_size,
+				auth_request_db_password_verify_callback, ctx);
+}
+
 enum passdb_result
 auth_request_db_password_verify(struct auth_request *request,
 				const char *plain_password,
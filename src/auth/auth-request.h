@@ -396,6 +396,14 @@ auth_request_db_password_verify_log(struct auth_request *request,
 				    const char *scheme,
 				    bool log_password_mismatch)
 				    ATTR_WARN_UNUSED_RESULT;
+/* Same as auth_request_db_password_verify(), but the CPU-intensive password
+   schemes are verified in the auth_verify_pool threads. The callback may be
+   called immediately. */
+void auth_request_db_password_verify_async(struct auth_request *request,
+					   const char *plain_password,
+					   const char *crypted_password,
+					   const char *scheme,
+					   verify_plain_callback_t *callback);
 enum passdb_result auth_request_password_missing(struct auth_request *request);
 
 void auth_request_log_password_mismatch(struct auth_request *request,
@@ -303,6 +303,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(SIZE, cache_size),
 	DEF(TIME, cache_ttl),
 	DEF(TIME, cache_negative_ttl),
+	DEF(STR, cache_shared_path),
 	DEF(BOOL, cache_verify_password_with_worker),
 	DEF(STR, username_chars),
 	DEF(STR_HIDDEN, username_translation),
@@ -321,6 +322,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(STR, proxy_self),
 	DEF(TIME, failure_delay),
 	DEF(TIME_MSECS, internal_failure_delay),
+	DEF(UINT, password_verify_threads),
 
 	{ .type = SET_FILTER_NAME, .key = "auth_policy", },
 	DEF(STR, policy_server_url),
@@ -370,6 +372,7 @@ static const struct auth_settings auth_default_settings = {
 	.cache_size = 0,
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
+	.cache_shared_path = "",
 	.cache_verify_password_with_worker = FALSE,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
@@ -382,6 +385,7 @@ static const struct auth_settings auth_default_settings = {
 	.proxy_self = "",
 	.failure_delay = 2,
 	.internal_failure_delay = 2000,
+	.password_verify_threads = 0,
 
 	.policy_server_url = "",
 	.policy_server_api_header = "",
@@ -59,6 +59,7 @@ struct auth_settings {
 	uoff_t cache_size;
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
+	const char *cache_shared_path;
 	bool cache_verify_password_with_worker;
 	const char *username_chars;
 	const char *username_translation;
@@ -71,6 +72,7 @@ struct auth_settings {
 	const char *proxy_self;
 	unsigned int failure_delay;
 	unsigned int internal_failure_delay;
+	unsigned int password_verify_threads;
 
 	const char *policy_server_url;
 	const char *policy_server_api_header;
@@ -0,0 +1,275 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "llist.h"
+#include "safe-memset.h"
+#include "time-util.h"
+#include "auth-verify-pool.h"
+
+#ifdef HAVE_PTHREAD
+
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+struct auth_verify_job {
+	struct auth_verify_job *prev, *next;
+
+	password_verify_threadsafe_func_t *func;
+	char *plaintext, *raw_password;
+	int ret;
+
+	uint64_t queued_usecs, started_usecs, finished_usecs;
+	unsigned int queue_depth;
+
+	auth_verify_pool_callback_t *callback;
+	void *context;
+};
+
+struct auth_verify_pool {
+	pthread_t *threads;
+	unsigned int thread_count;
+
+	/* Everything below is protected by the mutex */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* Jobs waiting for a thread */
+	struct auth_verify_job *queue_head, *queue_tail;
+	/* Jobs waiting for the callback to be called */
+	struct auth_verify_job *done_head, *done_tail;
+	/* Number of queued and running jobs */
+	unsigned int pending_count;
+	bool stopping;
+
+	/* Threads write a byte here to wake up the main thread */
+	int fd_notify[2];
+	struct io *io;
+};
+
+static struct auth_verify_pool *verify_pool = NULL;
+
+static void auth_verify_job_free(struct auth_verify_job *job)
+{
+	safe_memset(job->plaintext, 0, strlen(job->plaintext));
+	safe_memset(job->raw_password, 0, strlen(job->raw_password));
+	i_free(job->plaintext);
+	i_free(job->raw_password);
+	i_free(job);
+}
+
+static void auth_verify_job_callback(struct auth_verify_job *job)
+{
+	struct auth_verify_pool_stats stats = {
+		.queue_depth = job->queue_depth,
+	};
+
+	if (job->started_usecs != 0) {
+		stats.queue_usecs = job->started_usecs - job->queued_usecs;
+		stats.verify_usecs = job->finished_usecs - job->started_usecs;
+	} else {
+		/* failed by auth_verify_pool_deinit() */
+		stats.aborted = TRUE;
+	}
+	job->callback(job->ret, &stats, job->context);
+	auth_verify_job_free(job);
+}
+
+static void *auth_verify_thread(void *context)
+{
+	struct auth_verify_pool *pool = context;
+	struct auth_verify_job *job;
+	bool notify;
+
+	/* NOTE: This thread must not use data stack, memory pools or
+	   logging. */
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->queue_head == NULL && !pool->stopping)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (pool->stopping)
+			break;
+
+		job = pool->queue_head;
+		DLLIST2_REMOVE(&pool->queue_head, &pool->queue_tail, job);
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->started_usecs = i_microseconds();
+		job->ret = job->func(job->plaintext, job->raw_password);
+		job->finished_usecs = i_microseconds();
+
+		pthread_mutex_lock(&pool->mutex);
+		notify = pool->done_head == NULL;
+		DLLIST2_APPEND(&pool->done_head, &pool->done_tail, job);
+		if (notify) {
+			/* Wake up the main thread. It takes all the finished
+			   jobs at once, so one byte per batch is enough. */
+			ssize_t ret ATTR_UNUSED =
+				write(pool->fd_notify[1], "", 1);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void auth_verify_pool_notify(struct auth_verify_pool *pool)
+{
+	struct auth_verify_job *job, *next;
+	char buf[128];
+
+	if (read(pool->fd_notify[0], buf, sizeof(buf)) < 0 &&
+	    errno != EAGAIN)
+		i_error("read(auth verify pool notify pipe) failed: %m");
+
+	pthread_mutex_lock(&pool->mutex);
+	job = pool->done_head;
+	pool->done_head = pool->done_tail = NULL;
+	for (next = job; next != NULL; next = next->next)
+		pool->pending_count--;
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (; job != NULL; job = next) {
+		next = job->next;
+		auth_verify_job_callback(job);
+	}
+}
+
+void auth_verify_pool_init(unsigned int thread_count)
+{
+	struct auth_verify_pool *pool;
+	sigset_t sigset, old_sigset;
+	unsigned int i;
+	int ret;
+
+	i_assert(verify_pool == NULL);
+
+	if (thread_count == 0)
+		return;
+
+	pool = i_new(struct auth_verify_pool, 1);
+	if (pipe(pool->fd_notify) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(pool->fd_notify[0], TRUE);
+	fd_set_nonblock(pool->fd_notify[1], TRUE);
+	fd_close_on_exec(pool->fd_notify[0], TRUE);
+	fd_close_on_exec(pool->fd_notify[1], TRUE);
+	pool->io = io_add(pool->fd_notify[0], IO_READ,
+			  auth_verify_pool_notify, pool);
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	/* Signals are handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+	pool->threads = i_new(pthread_t, thread_count);
+	for (i = 0; i < thread_count; i++) {
+		ret = pthread_create(&pool->threads[i], NULL,
+				     auth_verify_thread, pool);
+		if (ret != 0) {
+			errno = ret;
+			i_fatal("pthread_create() failed: %m");
+		}
+		pool->thread_count++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+	verify_pool = pool;
+}
+
+void auth_verify_pool_deinit(void)
+{
+	struct auth_verify_pool *pool = verify_pool;
+	struct auth_verify_job *job, *next;
+	unsigned int i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = TRUE;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 0; i < pool->thread_count; i++)
+		(void)pthread_join(pool->threads[i], NULL);
+	verify_pool = NULL;
+
+	/* No more threads, so no locking needed. Finish the verified jobs
+	   and fail the rest. */
+	for (job = pool->done_head; job != NULL; job = next) {
+		next = job->next;
+		auth_verify_job_callback(job);
+	}
+	for (job = pool->queue_head; job != NULL; job = next) {
+		next = job->next;
+		job->ret = -1;
+		auth_verify_job_callback(job);
+	}
+
+	io_remove(&pool->io);
+	i_close_fd(&pool->fd_notify[0]);
+	i_close_fd(&pool->fd_notify[1]);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	i_free(pool->threads);
+	i_free(pool);
+}
+
+bool auth_verify_pool_is_running(void)
+{
+	return verify_pool != NULL;
+}
+
+#undef auth_verify_pool_verify
+void auth_verify_pool_verify(password_verify_threadsafe_func_t *func,
+			     const char *plaintext,
+			     const unsigned char *raw_password, size_t size,
+			     auth_verify_pool_callback_t *callback,
+			     void *context)
+{
+	struct auth_verify_pool *pool = verify_pool;
+	struct auth_verify_job *job;
+
+	i_assert(pool != NULL);
+
+	job = i_new(struct auth_verify_job, 1);
+	job->func = func;
+	job->plaintext = i_strdup(plaintext);
+	job->raw_password = i_strndup(raw_password, size);
+	job->callback = callback;
+	job->context = context;
+	job->queued_usecs = i_microseconds();
+
+	pthread_mutex_lock(&pool->mutex);
+	job->queue_depth = ++pool->pending_count;
+	DLLIST2_APPEND(&pool->queue_head, &pool->queue_tail, job);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+#else
+
+void auth_verify_pool_init(unsigned int thread_count ATTR_UNUSED)
+{
+}
+
+void auth_verify_pool_deinit(void)
+{
+}
+
+bool auth_verify_pool_is_running(void)
+{
+	return FALSE;
+}
+
+#undef auth_verify_pool_verify
+void auth_verify_pool_verify(password_verify_threadsafe_func_t *func ATTR_UNUSED,
+			     const char *plaintext ATTR_UNUSED,
+			     const unsigned char *raw_password ATTR_UNUSED,
+			     size_t size ATTR_UNUSED,
+			     auth_verify_pool_callback_t *callback ATTR_UNUSED,
+			     void *context ATTR_UNUSED)
+{
+	i_unreached();
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef AUTH_VERIFY_POOL_H
+#define AUTH_VERIFY_POOL_H
+
+#include "password-scheme.h"
+
+/* Thread pool for running the CPU-intensive password verification functions
+   (e.g. BLF-CRYPT, SHA512-CRYPT, ARGON2) while the auth process continues
+   handling other requests. The threads run only the schemes'
+   password_verify_threadsafe() functions. The callbacks are called from the
+   ioloop in the main thread. */
+
+struct auth_verify_pool_stats {
+	/* Number of queued and running verifications when this one was
+	   added (including this one) */
+	unsigned int queue_depth;
+	/* Time spent waiting in the queue */
+	uint64_t queue_usecs;
+	/* Time spent verifying the password */
+	uint64_t verify_usecs;
+	/* The pool was deinitialized before the verification was started.
+	   ret is -1. */
+	bool aborted;
+};
+
+/* ret is the password_verify_threadsafe() result: 1 = matched,
+   0 = didn't match, -1 = internal error. */
+typedef void
+auth_verify_pool_callback_t(int ret,
+			    const struct auth_verify_pool_stats *stats,
+			    void *context);
+
+/* Start the threads. If thread_count is 0 or threads aren't supported, the
+   pool isn't used. */
+void auth_verify_pool_init(unsigned int thread_count);
+/* Stop the threads. The running verifications are finished, and the
+   callbacks of the ones that haven't started yet are called with ret=-1 and
+   stats->aborted=TRUE. */
+void auth_verify_pool_deinit(void);
+
+/* Returns TRUE if auth_verify_pool_verify() can be used. */
+bool auth_verify_pool_is_running(void);
+/* Verify the password in a thread. The plaintext and raw_password are
+   copied. */
+void auth_verify_pool_verify(password_verify_threadsafe_func_t *func,
+			     const char *plaintext,
+			     const unsigned char *raw_password, size_t size,
+			     auth_verify_pool_callback_t *callback,
+			     void *context);
+#define auth_verify_pool_verify(func, plaintext, raw_password, size, \
+				callback, context) \
+	auth_verify_pool_verify(func, plaintext, raw_password, size - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			int, const struct auth_verify_pool_stats *, \
+			typeof(context))), \
+		(auth_verify_pool_callback_t *)callback, context)
+
+#endif
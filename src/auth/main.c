@@ -30,6 +30,7 @@
 #include "auth-master-connection.h"
 #include "auth-client-connection.h"
 #include "auth-policy.h"
+#include "auth-verify-pool.h"
 #include "db-oauth2.h"
 
 #include <unistd.h>
@@ -238,6 +239,8 @@ static void main_init(void)
 	} else {
 		/* caching is handled only by the main auth process */
 		passdb_cache_init(global_auth_settings);
+		auth_verify_pool_init(
+			global_auth_settings->password_verify_threads);
 		if (global_auth_settings->allow_weak_schemes)
 			i_warning("Weak password schemes are allowed "
 				  "(auth_allow_weak_schemes=yes)");
@@ -255,6 +258,8 @@ static void main_deinit(void)
 	}
 	/* deinit auth workers, which aborts pending requests */
         auth_worker_connection_deinit();
+	/* finish the pending password verifications */
+	auth_verify_pool_deinit();
 	/* deinit passdbs and userdbs. it aborts any pending async requests. */
 	auths_deinit();
 	/* flush pending request failures */
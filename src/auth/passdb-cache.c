@@ -37,7 +37,7 @@ passdb_cache_use_password_mismatch(enum passdb_result result,
 		   that the password was changed and cache is expired.
 		   b) negative TTL reached, use it for password
 		   mismatches too. */
-		node->last_success = FALSE;
+		auth_cache_set_last_success(passdb_cache, node, FALSE);
 		return FALSE;
 	}
 	return TRUE;
@@ -202,7 +202,8 @@ void passdb_cache_verify_plain(struct auth_request *request, const char *key,
 			return;
 		}
 	}
-	node->last_success = ret == PASSDB_RESULT_OK;
+	auth_cache_set_last_success(passdb_cache, node,
+				    ret == PASSDB_RESULT_OK);
 
 	/* save the extra_fields only after we know we're using the
 	   cached data */
@@ -248,6 +249,7 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 
 void passdb_cache_init(const struct auth_settings *set)
 {
+	const char *error;
 	rlim_t limit;
 
 	if (set->cache_size == 0 || set->cache_ttl == 0)
@@ -260,8 +262,18 @@ void passdb_cache_init(const struct auth_settings *set)
 			  set->cache_size/1024/1024,
 			  (uoff_t)(limit/1024/1024));
 	}
-	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
-				      set->cache_negative_ttl);
+	if (set->cache_shared_path[0] == '\0') {
+		passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
+					      set->cache_negative_ttl);
+	} else if (auth_cache_new_shared(set->cache_shared_path,
+					 set->cache_size, set->cache_ttl,
+					 set->cache_negative_ttl,
+					 &passdb_cache, &error) < 0) {
+		i_error("auth_cache_shared_path: %s - "
+			"using process-private cache", error);
+		passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
+					      set->cache_negative_ttl);
+	}
 }
 
 void passdb_cache_deinit(void)
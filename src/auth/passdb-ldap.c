@@ -103,13 +103,13 @@ ldap_lookup_finish(struct auth_request *auth_request,
 			auth_request);
 	} else {
 		if (password != NULL) {
-			passdb_result = auth_request_db_password_verify(
-				auth_request, auth_request->mech_password,
-				password, scheme);
+			auth_request_db_password_verify_async(auth_request,
+				auth_request->mech_password, password, scheme,
+				ldap_request->callback.verify_plain);
+		} else {
+			ldap_request->callback.verify_plain(passdb_result,
+							    auth_request);
 		}
-
-		ldap_request->callback.verify_plain(passdb_result,
-						    auth_request);
 	}
 }
 
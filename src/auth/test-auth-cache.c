@@ -4,11 +4,17 @@
 #include "str.h"
 #include "auth-request.h"
 #include "auth-cache.h"
+#include "auth-cache-shm.h"
 #include "test-common.h"
 
+#include <unistd.h>
+
+#define TEST_SHM_PATH ".test-auth-cache-shm"
+
 const struct var_expand_table
 auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 	{ .key = "user", .value = NULL },
+	{ .key = "id", .value = "1" },
 
 	{ .key = "a", .value = NULL },
 	{ .key = "b", .value = NULL },
@@ -23,7 +29,8 @@ auth_request_get_var_expand_table_full(const struct auth_request *auth_request A
 				       const char *username ATTR_UNUSED,
 				       unsigned int *count ATTR_UNUSED)
 {
-	i_unreached();
+	/* auth_request_var_expand_with_table() uses the static table */
+	return t_new(struct var_expand_table, 1);
 }
 
 static int mock_get_passdb(const char *key, const char **value_r,
@@ -137,6 +144,162 @@ static void test_auth_cache_parse_key_errors(void)
 	test_end();
 }
 
+static bool test_shm_key_match(const char *key, void *context)
+{
+	const char *prefix = context;
+
+	return str_begins_with(key, prefix);
+}
+
+static void test_auth_cache_shm(void)
+{
+	struct auth_cache_shm *shm, *shm2;
+	struct auth_cache_shm_record rec;
+	unsigned int i, found, used_count;
+	size_t used_size, max_size;
+	const char *error;
+	char large[AUTH_CACHE_SHM_MAX_DATA_SIZE];
+
+	test_begin("auth cache shared");
+	i_unlink_if_exists(TEST_SHM_PATH);
+
+	test_assert(auth_cache_shm_open(TEST_SHM_PATH, 64 * 1024, &shm,
+					&error) == 0);
+	test_assert(auth_cache_shm_open(TEST_SHM_PATH, 64 * 1024, &shm2,
+					&error) == 0);
+	test_assert(!auth_cache_shm_lookup(shm, "key1", &rec));
+
+	/* records are visible to the other process */
+	test_assert(auth_cache_shm_insert(shm, "key1", "value1", 1000, TRUE));
+	test_assert(auth_cache_shm_insert(shm2, "key2", "", 2000, FALSE));
+	test_assert(auth_cache_shm_lookup(shm2, "key1", &rec));
+	test_assert_strcmp(rec.key, "key1");
+	test_assert_strcmp(rec.value, "value1");
+	test_assert(rec.created == 1000);
+	test_assert(rec.last_success);
+	test_assert(auth_cache_shm_lookup(shm, "key2", &rec));
+	test_assert_strcmp(rec.value, "");
+	test_assert(rec.created == 2000);
+	test_assert(!rec.last_success);
+
+	auth_cache_shm_set_last_success(shm2, "key1", FALSE);
+	test_assert(auth_cache_shm_lookup(shm, "key1", &rec));
+	test_assert(!rec.last_success);
+
+	/* replace */
+	test_assert(auth_cache_shm_insert(shm2, "key1", "value1b", 3000, TRUE));
+	test_assert(auth_cache_shm_lookup(shm, "key1", &rec));
+	test_assert_strcmp(rec.value, "value1b");
+	auth_cache_shm_get_usage(shm, &used_count, &used_size, &max_size);
+	test_assert(used_count == 2);
+	test_assert(max_size == 64 * 1024);
+
+	/* too large records aren't cached and the old record is dropped */
+	memset(large, 'x', sizeof(large) - 1);
+	large[sizeof(large) - 1] = '\0';
+	test_assert(!auth_cache_shm_insert(shm, "key1", large, 4000, TRUE));
+	test_assert(!auth_cache_shm_lookup(shm2, "key1", &rec));
+
+	auth_cache_shm_remove(shm2, "key2");
+	test_assert(!auth_cache_shm_lookup(shm, "key2", &rec));
+	auth_cache_shm_get_usage(shm, &used_count, &used_size, &max_size);
+	test_assert(used_count == 0);
+
+	/* the cache is full - the latest records are still found */
+	for (i = 0; i < 1000; i++) {
+		test_assert_idx(auth_cache_shm_insert(shm,
+			t_strdup_printf("user%u", i), "value", i, TRUE), i);
+		test_assert_idx(auth_cache_shm_lookup(shm2,
+			t_strdup_printf("user%u", i), &rec), i);
+	}
+	auth_cache_shm_get_usage(shm, &used_count, &used_size, &max_size);
+	test_assert(used_count == 128);
+
+	for (i = 990, found = 0; i < 1000; i++) {
+		if (auth_cache_shm_lookup(shm2, t_strdup_printf("user%u", i),
+					  &rec))
+			found++;
+	}
+	test_assert(found > 0);
+	test_assert(auth_cache_shm_clear(shm, test_shm_key_match,
+					 "user99") == found);
+	test_assert(!auth_cache_shm_lookup(shm2, "user999", &rec));
+	test_assert(auth_cache_shm_insert(shm2, "user999", "value", 1, TRUE));
+	auth_cache_shm_close(&shm2);
+	auth_cache_shm_close(&shm);
+
+	/* the records survive reopening */
+	test_assert(auth_cache_shm_open(TEST_SHM_PATH, 64 * 1024, &shm,
+					&error) == 0);
+	test_assert(auth_cache_shm_lookup(shm, "user999", &rec));
+	test_assert(auth_cache_shm_clear(shm, NULL, NULL) == 128 - found + 1);
+	test_assert(!auth_cache_shm_lookup(shm, "user999", &rec));
+	test_assert(auth_cache_shm_insert(shm, "key1", "value1", 1000, TRUE));
+	auth_cache_shm_close(&shm);
+
+	/* changing the size recreates the file */
+	test_assert(auth_cache_shm_open(TEST_SHM_PATH, 32 * 1024, &shm,
+					&error) == 0);
+	test_assert(!auth_cache_shm_lookup(shm, "key1", &rec));
+	auth_cache_shm_get_usage(shm, &used_count, &used_size, &max_size);
+	test_assert(used_count == 0);
+	test_assert(max_size == 32 * 1024);
+	auth_cache_shm_close(&shm);
+
+	i_unlink(TEST_SHM_PATH);
+	test_end();
+}
+
+static void test_auth_cache_shared_lookup(void)
+{
+	struct auth_cache *cache;
+	struct auth_cache_node *node1, *node2;
+	struct auth_request request = {
+		.fields = { .translated_username = "user" },
+	};
+	const char *value1, *value2, *error;
+	bool expired, neg_expired;
+
+	test_begin("auth cache shared lookup");
+	i_unlink_if_exists(TEST_SHM_PATH);
+	request.pool = pool_alloconly_create("test auth request", 1024);
+	request.event = event_create(NULL);
+	test_assert(auth_cache_new_shared(TEST_SHM_PATH, 64 * 1024, 3600, 3600,
+					  &cache, &error) == 0);
+
+	auth_cache_insert(cache, &request, "key1", "value1", TRUE);
+	auth_cache_insert(cache, &request, "key2", "value2", FALSE);
+
+	/* the earlier lookup results stay valid */
+	value1 = auth_cache_lookup(cache, &request, "key1", &node1,
+				   &expired, &neg_expired);
+	value2 = auth_cache_lookup(cache, &request, "key2", &node2,
+				   &expired, &neg_expired);
+	test_assert(node1 != NULL && node2 != NULL && node1 != node2);
+	test_assert_strcmp(value1, "value1");
+	test_assert_strcmp(value2, "value2");
+	test_assert(node1->last_success);
+	test_assert(!node2->last_success);
+	test_assert(!expired && !neg_expired);
+
+	/* updating the first node changes the shared record */
+	auth_cache_set_last_success(cache, node1, FALSE);
+	test_assert(auth_cache_lookup(cache, &request, "key1", &node2,
+				      &expired, &neg_expired) != NULL);
+	test_assert(!node2->last_success);
+
+	auth_cache_remove(cache, &request, "key1");
+	test_assert(auth_cache_lookup(cache, &request, "key1", &node1,
+				      &expired, &neg_expired) == NULL);
+	test_assert_strcmp(value2, "value2");
+
+	auth_cache_free(&cache);
+	event_unref(&request.event);
+	pool_unref(&request.pool);
+	i_unlink(TEST_SHM_PATH);
+	test_end();
+}
+
 int main(void)
 {
 	lib_init();
@@ -144,6 +307,8 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
 		test_auth_cache_parse_key_errors,
+		test_auth_cache_shm,
+		test_auth_cache_shared_lookup,
 		NULL
 	};
 
@@ -0,0 +1,238 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "test-auth.h"
+#include "ioloop.h"
+#include "auth-common.h"
+#include "auth-settings.h"
+#include "auth-request.h"
+#include "auth-verify-pool.h"
+#include "password-scheme.h"
+
+#define TEST_VERIFY_THREAD_COUNT 4
+#define TEST_VERIFY_JOB_COUNT 16
+#define TEST_VERIFY_TIMEOUT_MSECS (30*1000)
+#define TEST_VERIFY_SCHEME "BLF-CRYPT"
+#define TEST_VERIFY_PASSWORD "password"
+
+struct test_verify_job {
+	bool match;
+	bool called;
+	bool aborted;
+	int ret;
+	enum passdb_result result;
+};
+
+static struct auth_settings test_verify_auth_set = {
+	.master_user_separator = "",
+	.default_domain = "",
+	.username_format = "",
+	.verbose_passwords = "no",
+};
+
+static struct test_verify_job test_jobs[TEST_VERIFY_JOB_COUNT];
+static unsigned int test_jobs_pending;
+
+static const char *test_verify_crypted_password(void)
+{
+	const struct password_generate_params params = {
+		.user = "testuser",
+		/* the minimum - keep the test fast */
+		.rounds = 4,
+	};
+	const char *crypted;
+
+	if (!password_generate_encoded(TEST_VERIFY_PASSWORD, &params,
+				       TEST_VERIFY_SCHEME, &crypted))
+		i_unreached();
+	return crypted;
+}
+
+static void test_verify_jobs_init(void)
+{
+	i_zero(&test_jobs);
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++)
+		test_jobs[i].match = i % 2 == 0;
+	test_jobs_pending = N_ELEMENTS(test_jobs);
+}
+
+static const char *test_verify_job_password(const struct test_verify_job *job)
+{
+	return job->match ? TEST_VERIFY_PASSWORD : "wrong password";
+}
+
+static void test_verify_job_finished(struct test_verify_job *job)
+{
+	test_assert(!job->called);
+	job->called = TRUE;
+	i_assert(test_jobs_pending > 0);
+	if (--test_jobs_pending == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_verify_timeout(void *context ATTR_UNUSED)
+{
+	i_error("Timed out waiting for %u verifications", test_jobs_pending);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_verify_jobs_wait(struct ioloop *ioloop)
+{
+	struct timeout *to;
+
+	if (test_jobs_pending == 0)
+		return;
+	to = timeout_add(TEST_VERIFY_TIMEOUT_MSECS, test_verify_timeout, NULL);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+}
+
+static void
+test_verify_pool_callback(int ret, const struct auth_verify_pool_stats *stats,
+			  struct test_verify_job *job)
+{
+	test_assert(stats->queue_depth > 0);
+	test_assert(!stats->aborted || ret == -1);
+	job->ret = ret;
+	job->aborted = stats->aborted;
+	test_verify_job_finished(job);
+}
+
+static void test_auth_verify_pool_concurrent(struct ioloop *ioloop)
+{
+	password_verify_threadsafe_func_t *verify_func =
+		password_scheme_get_verify_threadsafe(TEST_VERIFY_SCHEME);
+	const char *crypted = test_verify_crypted_password();
+
+	test_begin("auth verify pool concurrent verifies");
+	test_assert(verify_func != NULL);
+	test_verify_jobs_init();
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++) {
+		auth_verify_pool_verify(verify_func,
+			test_verify_job_password(&test_jobs[i]),
+			(const unsigned char *)crypted, strlen(crypted),
+			test_verify_pool_callback, &test_jobs[i]);
+	}
+	test_verify_jobs_wait(ioloop);
+
+	test_assert(test_jobs_pending == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++) {
+		test_assert_idx(test_jobs[i].called, i);
+		test_assert_idx(!test_jobs[i].aborted, i);
+		test_assert_idx(test_jobs[i].ret ==
+				(test_jobs[i].match ? 1 : 0), i);
+	}
+	test_end();
+}
+
+static void test_auth_verify_pool_deinit_pending(void)
+{
+	password_verify_threadsafe_func_t *verify_func =
+		password_scheme_get_verify_threadsafe(TEST_VERIFY_SCHEME);
+	const char *crypted = test_verify_crypted_password();
+
+	test_begin("auth verify pool deinit with pending verifies");
+	test_verify_jobs_init();
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++) {
+		auth_verify_pool_verify(verify_func,
+			test_verify_job_password(&test_jobs[i]),
+			(const unsigned char *)crypted, strlen(crypted),
+			test_verify_pool_callback, &test_jobs[i]);
+	}
+	/* the verifications that were already started get their real
+	   result, the rest are aborted */
+	auth_verify_pool_deinit();
+	test_assert(!auth_verify_pool_is_running());
+
+	test_assert(test_jobs_pending == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++) {
+		test_assert_idx(test_jobs[i].called, i);
+		if (test_jobs[i].aborted)
+			test_assert_idx(test_jobs[i].ret == -1, i);
+		else {
+			test_assert_idx(test_jobs[i].ret ==
+					(test_jobs[i].match ? 1 : 0), i);
+		}
+	}
+	test_end();
+}
+
+static void
+test_verify_request_callback(enum passdb_result result,
+			     struct auth_request *request)
+{
+	struct test_verify_job *job = request->context;
+
+	job->result = result;
+	test_verify_job_finished(job);
+}
+
+static struct auth_request *
+test_verify_request_new(struct test_verify_job *job)
+{
+	const char *error;
+	struct auth_request *request = auth_request_new(NULL);
+	request->set = global_auth_settings;
+	struct event *event = event_create(request->event);
+	array_push_back(&request->authdb_event, &event);
+	request->passdb = passdb_mock();
+	request->context = job;
+	test_assert(auth_request_set_username(request, "testuser", &error));
+	return request;
+}
+
+static void test_auth_verify_pool_request(struct ioloop *ioloop)
+{
+	struct auth_request *requests[TEST_VERIFY_JOB_COUNT];
+	const char *crypted = test_verify_crypted_password();
+
+	test_begin(t_strdup_printf("auth request verify async (%s)",
+		auth_verify_pool_is_running() ? "threads" : "no threads"));
+	test_verify_jobs_init();
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++) {
+		requests[i] = test_verify_request_new(&test_jobs[i]);
+		auth_request_db_password_verify_async(requests[i],
+			test_verify_job_password(&test_jobs[i]),
+			crypted, TEST_VERIFY_SCHEME,
+			test_verify_request_callback);
+	}
+	test_verify_jobs_wait(ioloop);
+
+	test_assert(test_jobs_pending == 0);
+	for (unsigned int i = 0; i < N_ELEMENTS(test_jobs); i++) {
+		test_assert_idx(test_jobs[i].called, i);
+		test_assert_idx(test_jobs[i].result == (test_jobs[i].match ?
+				PASSDB_RESULT_OK :
+				PASSDB_RESULT_PASSWORD_MISMATCH), i);
+
+		i_free(requests[i]->passdb);
+		auth_request_passdb_lookup_end(requests[i],
+					       test_jobs[i].result);
+		auth_request_unref(&requests[i]);
+	}
+	test_end();
+}
+
+void test_auth_verify_pool(void)
+{
+	const struct auth_settings *old_set = global_auth_settings;
+	struct ioloop *ioloop;
+
+	memset(test_verify_auth_set.username_chars_map, 0xff,
+	       sizeof(test_verify_auth_set.username_chars_map));
+	global_auth_settings = &test_verify_auth_set;
+	ioloop = io_loop_create();
+
+	/* without the pool the verifications are done synchronously */
+	test_auth_verify_pool_request(ioloop);
+
+	auth_verify_pool_init(TEST_VERIFY_THREAD_COUNT);
+	if (auth_verify_pool_is_running()) {
+		test_auth_verify_pool_concurrent(ioloop);
+		test_auth_verify_pool_request(ioloop);
+		test_auth_verify_pool_deinit_pending();
+	}
+	auth_verify_pool_deinit();
+
+	io_loop_destroy(&ioloop);
+	global_auth_settings = old_set;
+}
@@ -22,6 +22,7 @@ int main(int argc, char *argv[])
 		TEST_NAMED(test_auth_request_var_expand)
 		TEST_NAMED(test_auth_request_fields)
 		TEST_NAMED(test_username_filter)
+		TEST_NAMED(test_auth_verify_pool)
 #if defined(HAVE_LUA)
 		TEST_NAMED(test_db_lua)
 #endif
@@ -36,7 +37,7 @@ int main(int argc, char *argv[])
 	master_service_init_finish(master_service);
 
 	auth_event = event_create(NULL);
-	password_schemes_init();
+	password_schemes_register_all();
 	passdbs_init();
 	passdb_mock_mod_init();
 
@@ -8,6 +8,8 @@
 #include "istream.h"
 #include "istream-dot.h"
 #include "istream-seekable.h"
+#include "ostream.h"
+#include "write-full.h"
 #include "str.h"
 #include "strescape.h"
 #include "unichar.h"
@@ -15,6 +17,7 @@
 #include "wildcard-match.h"
 #include "settings.h"
 #include "master-service.h"
+#include "auth-master.h"
 #include "mail-user.h"
 #include "mail-namespace.h"
 #include "mail-storage.h"
@@ -33,6 +36,8 @@
 #include "doveadm-mail.h"
 
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #define DOVEADM_MAIL_CMD_INPUT_TIMEOUT_MSECS (5*60*1000)
 
@@ -42,6 +47,12 @@ struct force_resync_cmd_context {
 	bool fsck;
 };
 
+struct force_resync_box {
+	struct mail_namespace *ns;
+	const char *vname;
+};
+ARRAY_DEFINE_TYPE(force_resync_box, struct force_resync_box);
+
 void (*hook_doveadm_mail_init)(struct doveadm_mail_cmd_context *ctx);
 struct doveadm_mail_cmd_module_register
 	doveadm_mail_cmd_module_register = { 0 };
@@ -296,7 +307,7 @@ doveadm_mail_build_search_args(const char *const args[])
 }
 
 static int cmd_force_resync_box(struct doveadm_mail_cmd_context *_ctx,
-				const struct mailbox_info *info)
+				const struct force_resync_box *info)
 {
 	struct force_resync_cmd_context *ctx =
 		container_of(_ctx, struct force_resync_cmd_context, ctx);
@@ -340,6 +351,95 @@ static int cmd_force_resync_prerun(struct doveadm_mail_cmd_context *ctx ATTR_UNU
 	return 0;
 }
 
+/* Resync the mailboxes in parallel with job_count forked processes. The
+   mailboxes are only listed before forking, so the processes share just the
+   mailbox list index's fds. The storages are opened by each process
+   separately. If fork() fails, the mailboxes of the processes that couldn't
+   be created are resynced by this process after the others have finished. */
+static int
+cmd_force_resync_boxes_parallel(struct force_resync_cmd_context *ctx,
+				const ARRAY_TYPE(force_resync_box) *boxes)
+{
+	const struct force_resync_box *box_list;
+	unsigned int i, j, box_count, job_count, started_count;
+	pid_t *pids;
+	int status, ret = 0;
+
+	box_list = array_get(boxes, &box_count);
+	job_count = I_MIN(ctx->ctx.job_count, box_count);
+	pids = t_new(pid_t, job_count);
+
+	for (i = 0; i < job_count; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			e_warning(ctx->ctx.cctx->event,
+				  "fork() failed: %m - "
+				  "resyncing the rest of the mailboxes without it");
+			break;
+		}
+		if (pids[i] > 0)
+			continue;
+
+		/* child - the ioloop's epoll/io_uring instance is shared with
+		   the parent process */
+		io_loop_recreate(current_ioloop);
+		for (j = i; j < box_count && !doveadm_is_killed();
+		     j += job_count) T_BEGIN {
+			if (cmd_force_resync_box(&ctx->ctx, &box_list[j]) < 0)
+				ret = -1;
+		} T_END;
+		/* the parent process still owns the mail user, so don't
+		   deinitialize anything here */
+		_exit(ret == 0 ? EX_OK :
+		      (ctx->ctx.exit_code != 0 ? ctx->ctx.exit_code :
+		       EX_TEMPFAIL));
+	}
+
+	started_count = i;
+
+	for (i = 0; i < started_count; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			e_error(ctx->ctx.cctx->event,
+				"waitpid(%s) failed: %m", dec2str(pids[i]));
+			doveadm_mail_failed_error(&ctx->ctx, MAIL_ERROR_TEMP);
+			ret = -1;
+		} else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			/* the process already logged the error */
+			ctx->ctx.exit_code = WEXITSTATUS(status);
+			ret = -1;
+		} else if (status != 0) {
+			e_error(ctx->ctx.cctx->event,
+				"Resync process %s exited with status %d",
+				dec2str(pids[i]), status);
+			doveadm_mail_failed_error(&ctx->ctx, MAIL_ERROR_TEMP);
+			ret = -1;
+		}
+	}
+
+	for (i = started_count; i < job_count; i++) {
+		for (j = i; j < box_count && !doveadm_is_killed();
+		     j += job_count) T_BEGIN {
+			if (cmd_force_resync_box(&ctx->ctx, &box_list[j]) < 0)
+				ret = -1;
+		} T_END;
+	}
+	return ret;
+}
+
+static bool
+cmd_force_resync_can_fork(struct force_resync_cmd_context *ctx,
+			  struct mail_user *user)
+{
+	const struct mail_storage_settings *mail_set =
+		mailbox_list_get_mail_set(user->namespaces->list);
+
+	if (ctx->ctx.job_count <= 1)
+		return FALSE;
+	/* flock() locks are shared by the fds inherited from the parent
+	   process, so the forked processes wouldn't exclude each other. */
+	return mail_set->parsed_lock_method != FILE_LOCK_METHOD_FLOCK;
+}
+
 static int cmd_force_resync_run(struct doveadm_mail_cmd_context *_ctx,
 				struct mail_user *user)
 {
@@ -355,20 +455,27 @@ static int cmd_force_resync_run(struct doveadm_mail_cmd_context *_ctx,
 	const enum mail_namespace_type ns_mask = MAIL_NAMESPACE_TYPE_MASK_ALL;
 	struct mailbox_list_iterate_context *iter;
 	const struct mailbox_info *info;
+	ARRAY_TYPE(force_resync_box) boxes;
+	const struct force_resync_box *box;
+	struct force_resync_box *new_box;
+	pool_t pool;
 	int ret = 0;
 
 	const char *const patterns[] = {
 		ctx->mailbox,
 		NULL
 	};
+	pool = pool_alloconly_create("force-resync mailboxes", 1024);
+	p_array_init(&boxes, pool, 32);
 	iter = mailbox_list_iter_init_namespaces(
 		user->namespaces, patterns, ns_mask, iter_flags);
 	while ((info = mailbox_list_iter_next(iter)) != NULL) {
 		if ((info->flags & (MAILBOX_NOSELECT |
-				    MAILBOX_NONEXISTENT)) == 0) T_BEGIN {
-			if (cmd_force_resync_box(_ctx, info) < 0)
-				ret = -1;
-		} T_END;
+				    MAILBOX_NONEXISTENT)) == 0) {
+			new_box = array_append_space(&boxes);
+			new_box->ns = info->ns;
+			new_box->vname = p_strdup(pool, info->vname);
+		}
 	}
 	if (mailbox_list_iter_deinit(&iter) < 0) {
 		e_error(ctx->ctx.cctx->event,
@@ -377,6 +484,19 @@ static int cmd_force_resync_run(struct doveadm_mail_cmd_context *_ctx,
 		doveadm_mail_failed_list(_ctx, user->namespaces->list);
 		ret = -1;
 	}
+
+	if (array_count(&boxes) > 1 && cmd_force_resync_can_fork(ctx, user)) {
+		T_BEGIN {
+			if (cmd_force_resync_boxes_parallel(ctx, &boxes) < 0)
+				ret = -1;
+		} T_END;
+	} else {
+		array_foreach(&boxes, box) T_BEGIN {
+			if (cmd_force_resync_box(_ctx, box) < 0)
+				ret = -1;
+		} T_END;
+	}
+	pool_unref(&pool);
 	return ret;
 }
 
@@ -540,13 +660,387 @@ int doveadm_mail_single_user(struct doveadm_mail_cmd_context *ctx,
 	return doveadm_mail_next_user(ctx, error_r);
 }
 
+/* Users are processed in parallel by forked worker processes (-j). The
+   parent process sends usernames to the workers via a pipe, one at a time.
+   The workers write the printed values back in the doveadm server protocol
+   format, followed by a status line. The parent prints the values with the
+   real formatter in the order the users were sent. */
+struct doveadm_mail_job_user {
+	char *username;
+	/* Tab-escaped printed values */
+	char *output;
+	int ret, exit_code;
+	bool finished;
+};
+
+struct doveadm_mail_job_worker {
+	struct doveadm_mail_jobs *jobs;
+	pid_t pid;
+	/* fd_in reads the worker's output, fd_out sends it usernames */
+	int fd_in, fd_out;
+	struct istream *input;
+	struct io *io;
+
+	struct doveadm_mail_job_user *user;
+	bool user_output_read;
+};
+
+struct doveadm_mail_jobs {
+	struct doveadm_mail_cmd_context *ctx;
+	ARRAY(struct doveadm_mail_job_worker *) workers;
+	/* Users being processed or waiting to be printed, in the order they
+	   were sent to the workers */
+	ARRAY(struct doveadm_mail_job_user *) users;
+	unsigned int busy_count, alive_count;
+	bool failed;
+};
+
+static void ATTR_NORETURN
+doveadm_mail_job_worker_run(struct doveadm_mail_cmd_context *ctx, int fd)
+{
+	struct doveadm_cmd_context *cctx = ctx->cctx;
+	struct istream *input;
+	const char *line, *error;
+	int ret;
+
+	/* The ioloop's epoll/io_uring instance is shared with the parent
+	   process */
+	io_loop_recreate(current_ioloop);
+	/* The auth connection is shared with the parent process */
+	if (mail_user_auth_master_conn != NULL)
+		auth_master_disconnect(mail_user_auth_master_conn);
+	if (doveadm_print_is_initialized())
+		doveadm_print_switch_to_server();
+	/* Each worker processes its users sequentially. Don't let the
+	   commands fork more processes (e.g. force-resync). */
+	ctx->job_count = 0;
+
+	input = i_stream_create_fd(fd, SIZE_MAX);
+	while (!doveadm_is_killed() &&
+	       (line = i_stream_read_next_line(input)) != NULL) {
+		ctx->exit_code = 0;
+		T_BEGIN {
+			cctx->username = t_strdup(line);
+			ret = doveadm_mail_next_user(ctx, &error);
+			if (ret < 0)
+				e_error(ctx->cctx->event, "%s", error);
+			else if (ret == 0)
+				e_info(ctx->cctx->event,
+				       "User no longer exists, skipping");
+			doveadm_print_flush();
+			o_stream_nsend_str(doveadm_print_ostream,
+				t_strdup_printf("\n%d\t%d\n",
+						ret, ctx->exit_code));
+			doveadm_print_flush();
+		} T_END;
+		if (doveadm_print_ostream->stream_errno != 0)
+			break;
+	}
+	if (input->stream_errno != 0) {
+		e_error(ctx->cctx->event, "read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+	}
+	i_stream_destroy(&input);
+
+	doveadm_mail_cmd_deinit(ctx);
+	doveadm_print_flush();
+	mail_storage_service_deinit(&ctx->storage_service);
+	lib_exit(EX_OK);
+}
+
+static void
+doveadm_mail_job_worker_finish_user(struct doveadm_mail_job_worker *worker,
+				    int ret, int exit_code)
+{
+	struct doveadm_mail_job_user *user = worker->user;
+
+	user->ret = ret;
+	user->exit_code = exit_code;
+	user->finished = TRUE;
+	worker->user = NULL;
+	worker->user_output_read = FALSE;
+	worker->jobs->busy_count--;
+	io_loop_stop(current_ioloop);
+}
+
+static void
+doveadm_mail_job_worker_close(struct doveadm_mail_job_worker *worker)
+{
+	if (worker->fd_out == -1)
+		return;
+	worker->jobs->alive_count--;
+	io_remove(&worker->io);
+	i_stream_destroy(&worker->input);
+	i_close_fd(&worker->fd_in);
+	i_close_fd(&worker->fd_out);
+}
+
+static void
+doveadm_mail_job_worker_failed(struct doveadm_mail_job_worker *worker)
+{
+	struct doveadm_mail_cmd_context *ctx = worker->jobs->ctx;
+
+	if (worker->user != NULL) {
+		e_error(ctx->cctx->event,
+			"Worker process %s failed while processing user %s",
+			dec2str(worker->pid), worker->user->username);
+		doveadm_mail_job_worker_finish_user(worker, -1, EX_TEMPFAIL);
+	}
+	doveadm_mail_job_worker_close(worker);
+	io_loop_stop(current_ioloop);
+}
+
+static void doveadm_mail_job_worker_input(struct doveadm_mail_job_worker *worker)
+{
+	const char *line, *const *args;
+	int ret, exit_code;
+
+	if (i_stream_read(worker->input) < 0) {
+		if (worker->input->stream_errno != 0) {
+			e_error(worker->jobs->ctx->cctx->event,
+				"read(%s) failed: %s",
+				i_stream_get_name(worker->input),
+				i_stream_get_error(worker->input));
+		}
+		doveadm_mail_job_worker_failed(worker);
+		return;
+	}
+
+	while ((line = i_stream_next_line(worker->input)) != NULL) {
+		if (worker->user == NULL) {
+			e_error(worker->jobs->ctx->cctx->event,
+				"Worker process %s sent unexpected output",
+				dec2str(worker->pid));
+			doveadm_mail_job_worker_failed(worker);
+			return;
+		}
+		if (!worker->user_output_read) {
+			worker->user->output = i_strdup(line);
+			worker->user_output_read = TRUE;
+			continue;
+		}
+		args = t_strsplit_tabescaped(line);
+		if (str_array_length(args) != 2 ||
+		    str_to_int(args[0], &ret) < 0 ||
+		    str_to_int(args[1], &exit_code) < 0) {
+			e_error(worker->jobs->ctx->cctx->event,
+				"Worker process %s sent invalid status: %s",
+				dec2str(worker->pid), line);
+			doveadm_mail_job_worker_failed(worker);
+			return;
+		}
+		doveadm_mail_job_worker_finish_user(worker, ret, exit_code);
+	}
+}
+
+static void doveadm_mail_jobs_print_finished(struct doveadm_mail_jobs *jobs)
+{
+	struct doveadm_mail_job_user *user;
+	const char *const *values;
+	unsigned int i, count;
+
+	while (array_count(&jobs->users) > 0) {
+		user = array_idx_elem(&jobs->users, 0);
+		if (!user->finished)
+			break;
+
+		if (user->output != NULL && user->output[0] != '\0') T_BEGIN {
+			/* Each value ends with a tab */
+			doveadm_print_sticky("username", user->username);
+			values = t_strsplit_tabescaped_inplace(user->output);
+			count = str_array_length(values);
+			for (i = 0; i + 1 < count; i++)
+				doveadm_print(values[i]);
+		} T_END;
+		doveadm_print_flush();
+
+		if (user->exit_code != 0)
+			jobs->ctx->exit_code = user->exit_code;
+		if (user->ret < 0)
+			jobs->failed = TRUE;
+		array_pop_front(&jobs->users);
+		i_free(user->username);
+		i_free(user->output);
+		i_free(user);
+	}
+}
+
+static struct doveadm_mail_jobs *
+doveadm_mail_jobs_init(struct doveadm_mail_cmd_context *ctx)
+{
+	struct doveadm_mail_jobs *jobs;
+	struct doveadm_mail_job_worker *worker;
+	int fd_user[2], fd_output[2];
+	pid_t pid;
+
+	/* Flush everything, so the workers won't write it again */
+	doveadm_print_flush();
+	fflush(stdout);
+
+	jobs = i_new(struct doveadm_mail_jobs, 1);
+	jobs->ctx = ctx;
+	i_array_init(&jobs->workers, ctx->job_count);
+	i_array_init(&jobs->users, ctx->job_count);
+
+	for (unsigned int i = 0; i < ctx->job_count; i++) {
+		if (pipe(fd_user) < 0) {
+			e_warning(ctx->cctx->event, "pipe() failed: %m - "
+				  "using only %u worker processes", i);
+			break;
+		}
+		if (pipe(fd_output) < 0) {
+			e_warning(ctx->cctx->event, "pipe() failed: %m - "
+				  "using only %u worker processes", i);
+			i_close_fd(&fd_user[0]);
+			i_close_fd(&fd_user[1]);
+			break;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			e_warning(ctx->cctx->event, "fork() failed: %m - "
+				  "using only %u worker processes", i);
+			i_close_fd(&fd_user[0]);
+			i_close_fd(&fd_user[1]);
+			i_close_fd(&fd_output[0]);
+			i_close_fd(&fd_output[1]);
+			break;
+		}
+		if (pid == 0) {
+			/* child - close the other workers' pipes, so they
+			   see EOF when the parent closes them */
+			array_foreach_elem(&jobs->workers, worker) {
+				i_close_fd(&worker->fd_in);
+				i_close_fd(&worker->fd_out);
+			}
+			i_close_fd(&fd_user[1]);
+			i_close_fd(&fd_output[0]);
+			if (dup2(fd_output[1], STDOUT_FILENO) < 0)
+				i_fatal("dup2() failed: %m");
+			i_close_fd(&fd_output[1]);
+			doveadm_mail_job_worker_run(ctx, fd_user[0]);
+		}
+
+		i_close_fd(&fd_user[0]);
+		i_close_fd(&fd_output[1]);
+		worker = i_new(struct doveadm_mail_job_worker, 1);
+		worker->jobs = jobs;
+		worker->pid = pid;
+		worker->fd_in = fd_output[0];
+		worker->fd_out = fd_user[1];
+		array_push_back(&jobs->workers, &worker);
+		jobs->alive_count++;
+	}
+	if (jobs->alive_count == 0) {
+		/* process the users sequentially */
+		array_free(&jobs->workers);
+		array_free(&jobs->users);
+		i_free(jobs);
+		return NULL;
+	}
+
+	array_foreach_elem(&jobs->workers, worker) {
+		fd_set_nonblock(worker->fd_in, TRUE);
+		fd_close_on_exec(worker->fd_in, TRUE);
+		fd_close_on_exec(worker->fd_out, TRUE);
+		worker->input = i_stream_create_fd(worker->fd_in, SIZE_MAX);
+		i_stream_set_name(worker->input, t_strdup_printf(
+			"worker %s output", dec2str(worker->pid)));
+		worker->io = io_add(worker->fd_in, IO_READ,
+				    doveadm_mail_job_worker_input, worker);
+	}
+	return jobs;
+}
+
+static void doveadm_mail_jobs_wait(struct doveadm_mail_jobs *jobs)
+{
+	io_loop_run(current_ioloop);
+	doveadm_mail_jobs_print_finished(jobs);
+}
+
+static int
+doveadm_mail_jobs_add_user(struct doveadm_mail_jobs *jobs, const char *username)
+{
+	struct doveadm_mail_job_worker *worker, *w;
+	struct doveadm_mail_job_user *user;
+
+	while (jobs->busy_count == jobs->alive_count && jobs->alive_count > 0)
+		doveadm_mail_jobs_wait(jobs);
+	if (jobs->failed || jobs->alive_count == 0)
+		return -1;
+
+	worker = NULL;
+	array_foreach_elem(&jobs->workers, w) {
+		if (w->fd_out != -1 && w->user == NULL) {
+			worker = w;
+			break;
+		}
+	}
+	i_assert(worker != NULL);
+
+	user = i_new(struct doveadm_mail_job_user, 1);
+	user->username = i_strdup(username);
+	array_push_back(&jobs->users, &user);
+	worker->user = user;
+	jobs->busy_count++;
+
+	if (write_full(worker->fd_out, t_strconcat(username, "\n", NULL),
+		       strlen(username) + 1) < 0) {
+		e_error(jobs->ctx->cctx->event,
+			"write(worker %s input) failed: %m",
+			dec2str(worker->pid));
+		doveadm_mail_job_worker_failed(worker);
+	}
+	return 0;
+}
+
+static int doveadm_mail_jobs_deinit(struct doveadm_mail_jobs **_jobs)
+{
+	struct doveadm_mail_jobs *jobs = *_jobs;
+	struct doveadm_mail_job_worker *worker;
+	int status;
+	int ret = 0;
+
+	*_jobs = NULL;
+
+	while (jobs->busy_count > 0)
+		doveadm_mail_jobs_wait(jobs);
+	doveadm_mail_jobs_print_finished(jobs);
+	i_assert(array_count(&jobs->users) == 0);
+
+	/* closing the pipes makes the workers exit */
+	array_foreach_elem(&jobs->workers, worker)
+		doveadm_mail_job_worker_close(worker);
+	array_foreach_elem(&jobs->workers, worker) {
+		if (waitpid(worker->pid, &status, 0) < 0) {
+			e_error(jobs->ctx->cctx->event,
+				"waitpid(%s) failed: %m", dec2str(worker->pid));
+			ret = -1;
+		} else if (status != 0) {
+			e_error(jobs->ctx->cctx->event,
+				"Worker process %s exited with status %d",
+				dec2str(worker->pid), status);
+			ret = -1;
+		}
+		i_free(worker);
+	}
+	if (jobs->failed)
+		ret = -1;
+	array_free(&jobs->workers);
+	array_free(&jobs->users);
+	i_free(jobs);
+	return ret;
+}
+
 static void
 doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 		       const char *wildcard_user)
 {
 	struct doveadm_cmd_context *cctx = ctx->cctx;
+	struct doveadm_mail_jobs *jobs = NULL;
 	unsigned int user_idx;
 	const char *ip, *user, *error;
+	bool parallel;
 	int ret;
 
 	ctx->service_flags |= MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP;
@@ -562,12 +1056,26 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 		return;
 	doveadm_print_header_disallow(TRUE);
 
+	/* fork the workers before the user iteration is started, so they
+	   won't inherit its auth connection. The hook is called before
+	   forking, so the workers are initialized the same way. */
+	parallel = ctx->job_count > 1;
+	if (parallel) {
+		if (hook_doveadm_mail_init != NULL)
+			hook_doveadm_mail_init(ctx);
+		jobs = doveadm_mail_jobs_init(ctx);
+		if (jobs == NULL) {
+			/* couldn't start any workers */
+			ctx->job_count = 0;
+		}
+	}
+
 	if (wildcard_user != NULL) {
 		mail_storage_service_all_init_mask(ctx->storage_service,
 						   wildcard_user);
 	}
 
-	if (hook_doveadm_mail_init != NULL)
+	if (!parallel && hook_doveadm_mail_init != NULL)
 		hook_doveadm_mail_init(ctx);
 
 	user_idx = 0;
@@ -576,16 +1084,23 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 			if (!wildcard_match_icase(user, wildcard_user))
 				continue;
 		}
-		cctx->username = user;
-		T_BEGIN {
-			ret = doveadm_mail_next_user(ctx, &error);
-			doveadm_print_flush();
-			if (ret < 0)
-				e_error(ctx->cctx->event, "%s", error);
-			else if (ret == 0)
-				e_info(ctx->cctx->event,
-				       "User no longer exists, skipping");
-		} T_END;
+		if (jobs != NULL) {
+			if (doveadm_mail_jobs_add_user(jobs, user) < 0) {
+				ret = -1;
+				break;
+			}
+		} else {
+			cctx->username = user;
+			T_BEGIN {
+				ret = doveadm_mail_next_user(ctx, &error);
+				doveadm_print_flush();
+				if (ret < 0)
+					e_error(ctx->cctx->event, "%s", error);
+				else if (ret == 0)
+					e_info(ctx->cctx->event,
+					       "User no longer exists, skipping");
+			} T_END;
+		}
 		if (ret == -1)
 			break;
 		if (doveadm_verbose) {
@@ -599,6 +1114,8 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 			break;
 		}
 	}
+	if (jobs != NULL && doveadm_mail_jobs_deinit(&jobs) < 0)
+		ret = -1;
 	if (doveadm_verbose)
 		printf("\n");
 	ip = net_ip2addr(&cctx->remote_ip);
@@ -925,6 +1442,17 @@ doveadm_cmdv2_wrapper_parse_common_options(struct doveadm_mail_cmd_context *mctx
 		i_stream_ref(mctx->cmd_input);
 
 	(void)doveadm_cmd_param_uint32(cctx, "trans-flags", &mctx->transaction_flags);
+
+	if (doveadm_cmd_param_uint32(cctx, "jobs", &mctx->job_count) &&
+	    mctx->job_count > 1) {
+		if (cctx->conn_type != DOVEADM_CONNECTION_TYPE_CLI) {
+			/* don't fork inside doveadm-server */
+			mctx->job_count = 0;
+		} else if (mctx->set->doveadm_worker_count > 0) {
+			i_fatal_status(EX_USAGE,
+				"-j can't be used with doveadm servers (-S)");
+		}
+	}
 }
 
 static void
@@ -936,6 +1464,7 @@ doveadm_cmdv2_wrapper_generate_full_arg(struct doveadm_mail_cmd_context *mctx,
 	if (!arg->value_set ||
 	    strcmp(arg->name, "socket-path") == 0 ||
 	    strcmp(arg->name, "trans-flags") == 0 ||
+	    strcmp(arg->name, "jobs") == 0 ||
 	    strcmp(arg->name, "file") == 0 ||
 	    strcmp(arg->name, "all-users") == 0 ||
 	    strcmp(arg->name, "user-file") == 0 ||
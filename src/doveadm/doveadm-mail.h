@@ -72,6 +72,8 @@ struct doveadm_mail_cmd_context {
 	struct mail_search_args *search_args;
 	struct istream *users_list_input;
 	int proxy_ttl;
+	/* Number of users to process in parallel in forked processes (-j) */
+	unsigned int job_count;
 	/* forward_fields sent by the connecting doveadm proxy. */
 	ARRAY_TYPE(const_string) proxy_forward_fields;
 	/* forward_fields set by the last passdb lookup. These will be sent to
@@ -233,9 +235,10 @@ DOVEADM_CMD_PARAM('S', "socket-path", CMD_PARAM_STR, 0) \
 DOVEADM_CMD_PARAM('u', "user", CMD_PARAM_STR, 0) \
 DOVEADM_CMD_PARAM('\0', "trans-flags", CMD_PARAM_INT64, 0) \
 DOVEADM_CMD_PARAM('\0', "no-userdb-lookup", CMD_PARAM_BOOL, 0) \
-DOVEADM_CMD_PARAM('F', "user-file", CMD_PARAM_ISTREAM, 0)
+DOVEADM_CMD_PARAM('F', "user-file", CMD_PARAM_ISTREAM, 0) \
+DOVEADM_CMD_PARAM('j', "jobs", CMD_PARAM_INT64, CMD_PARAM_FLAG_UNSIGNED)
 
 #define DOVEADM_CMD_MAIL_USAGE_PREFIX \
-	"[-u <user>|-A] [-S <socket_path>] "
+	"[-u <user>|-A] [-S <socket_path>] [-j <jobs>] "
 
 #endif
@@ -19,6 +19,7 @@ struct doveadm_print_context {
 
 	unsigned int header_idx;
 	bool print_stream_open;
+	bool hide_sticky;
 };
 
 bool doveadm_print_hide_titles = FALSE;
@@ -76,7 +77,8 @@ static void doveadm_print_sticky_headers(void)
 		if (ctx->header_idx == count)
 			ctx->header_idx = 0;
 		else if (headers[ctx->header_idx].sticky) {
-			ctx->v->print(headers[ctx->header_idx].sticky_value);
+			if (!ctx->hide_sticky)
+				ctx->v->print(headers[ctx->header_idx].sticky_value);
 			ctx->header_idx++;
 		} else {
 			break;
@@ -216,6 +218,30 @@ void doveadm_print_deinit(void)
 	doveadm_print_header_disallowed = FALSE;
 }
 
+void doveadm_print_switch_to_server(void)
+{
+	const struct doveadm_print_header_context *hdr_ctx;
+	struct doveadm_print_header hdr;
+
+	i_assert(ctx != NULL);
+	i_assert(!ctx->print_stream_open);
+
+	/* The old formatter's state was inherited from the parent process.
+	   Don't deinit it, since it might write something. */
+	ctx->v = &doveadm_print_server_vfuncs;
+	ctx->v->init();
+	ctx->hide_sticky = TRUE;
+	ctx->header_idx = 0;
+	array_foreach(&ctx->headers, hdr_ctx) {
+		if (hdr_ctx->sticky)
+			continue;
+		i_zero(&hdr);
+		hdr.key = hdr_ctx->key;
+		hdr.title = hdr_ctx->key;
+		ctx->v->header(&hdr);
+	}
+}
+
 void doveadm_print_init_disallow(bool disallow)
 {
 	doveadm_print_init_disallowed = disallow;
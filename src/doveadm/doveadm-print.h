@@ -53,6 +53,12 @@ void doveadm_print_init_disallow(bool disallow);
    also by doveadm_print_deinit(). */
 void doveadm_print_header_disallow(bool disallow);
 
+/* Replace the current formatter with the doveadm server protocol formatter,
+   which writes the values tab-escaped to doveadm_print_ostream. Sticky
+   header values aren't written, since the reader sets them. This is used by
+   the forked doveadm mail worker processes. */
+void doveadm_print_switch_to_server(void);
+
 void doveadm_print_formatted_set_format(const char *format);
 
 #endif
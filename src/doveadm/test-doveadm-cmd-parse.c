@@ -4,6 +4,7 @@
 #include "test-common.h"
 #include "doveadm.h"
 #include "doveadm-cmd-parse.h"
+#include "doveadm-mail.h"
 
 static inline void
 assert_param_bool(struct doveadm_cmd_context *cctx, const char *name,
@@ -12,6 +13,18 @@ assert_param_bool(struct doveadm_cmd_context *cctx, const char *name,
 	test_assert_cmp(expected, ==, doveadm_cmd_param_flag(cctx, name));
 }
 
+static void
+assert_param_uint32(struct doveadm_cmd_context *cctx, const char *name,
+		    bool expected_set, uint32_t expected)
+{
+	uint32_t value;
+
+	test_assert_cmp(expected_set, ==,
+			doveadm_cmd_param_uint32(cctx, name, &value));
+	if (expected_set)
+		test_assert_cmp(expected, ==, value);
+}
+
 static void
 assert_param_str(struct doveadm_cmd_context *cctx, const char *name,
 		 const char* expected)
@@ -94,6 +107,14 @@ DOVEADM_CMD_PARAM('\0', "pos2", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
 
+struct doveadm_cmd_ver2 cmdv2_mail = {
+	.flags = 0,
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('\0', "pos1", CMD_PARAM_STR, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
+
 static void assert_no_pos_args(struct doveadm_cmd_context *cctx)
 {
 	assert_param_str(cctx, "pos1", NULL);
@@ -193,6 +214,20 @@ static void assert_switch12_1_pos_args(struct doveadm_cmd_context *cctx)
 	assert_switch12(cctx);
 }
 
+static void assert_mail_no_jobs(struct doveadm_cmd_context *cctx)
+{
+	assert_param_bool(cctx, "all-users", TRUE);
+	assert_param_uint32(cctx, "jobs", FALSE, 0);
+	assert_param_str(cctx, "pos1", "arg1");
+}
+
+static void assert_mail_jobs4(struct doveadm_cmd_context *cctx)
+{
+	assert_param_bool(cctx, "all-users", TRUE);
+	assert_param_uint32(cctx, "jobs", TRUE, 4);
+	assert_param_str(cctx, "pos1", "arg1");
+}
+
 static void assert_not_execd(struct doveadm_cmd_context *cctx ATTR_UNUSED)
 {
 	test_failed("doveadm_cmdline_run() expected to fail and not execute the cmd");
@@ -272,11 +307,30 @@ static void test_switches(void)
 		line("cmd arg1 -2 value2 -1"));
 }
 
+static void test_mail_jobs(void)
+{
+	test_case("mail_no_jobs", 0, assert_mail_no_jobs, &cmdv2_mail,
+		line("cmd -A arg1"));
+	test_case("mail_jobs_before", 0, assert_mail_jobs4, &cmdv2_mail,
+		line("cmd -A -j 4 arg1"));
+	test_case("mail_jobs_after", 0, assert_mail_jobs4, &cmdv2_mail,
+		line("cmd arg1 -j 4 -A"));
+	test_case("mail_jobs_long", 0, assert_mail_jobs4, &cmdv2_mail,
+		line("cmd --jobs 4 -A arg1"));
+	test_case("mail_jobs_negative", -1, assert_not_execd, &cmdv2_mail,
+		line("cmd -A -j -1 arg1"));
+	test_case("mail_jobs_invalid", -1, assert_not_execd, &cmdv2_mail,
+		line("cmd -A -j four arg1"));
+	test_case("mail_jobs_missing", -1, assert_not_execd, &cmdv2_mail,
+		line("cmd -A arg1 -j"));
+}
+
 static void (*const test_functions[])(void) = {
 	test_posargs,
 	test_kvargs,
 	test_kvpos,
 	test_switches,
+	test_mail_jobs,
 	NULL
 };
 
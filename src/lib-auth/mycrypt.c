@@ -14,6 +14,8 @@
 #  define _XPG6 /* Some Solaris versions require this, some break with this */
 #endif
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #ifdef HAVE_CRYPT_H
 # include <crypt.h>
 #endif
@@ -24,3 +26,37 @@ char *mycrypt(const char *key, const char *salt)
 {
 	return crypt(key, salt);
 }
+
+int mycrypt_r(const char *key, const char *salt,
+	      char *result, size_t result_size)
+{
+#if defined(HAVE_CRYPT_R) && defined(HAVE_CRYPT_H)
+	struct crypt_data *data;
+	const char *crypted;
+	size_t len;
+	int ret = -1;
+
+	/* struct crypt_data can be large, so don't put it to stack */
+	data = calloc(1, sizeof(*data));
+	if (data == NULL)
+		return -1;
+	crypted = crypt_r(key, salt, data);
+	if (crypted != NULL) {
+		len = strlen(crypted);
+		if (len < result_size) {
+			memcpy(result, crypted, len + 1);
+			ret = 0;
+		}
+	}
+	/* don't leave the password's hash lying around in freed memory */
+	memset(data, 0, sizeof(*data));
+	free(data);
+	return ret;
+#else
+	(void)key;
+	(void)salt;
+	(void)result;
+	(void)result_size;
+	return -1;
+#endif
+}
@@ -4,5 +4,10 @@
 /* A simple wrapper to crypt(). Problem with it is that it requires
    _XOPEN_SOURCE define which breaks other things. */
 char *mycrypt(const char *key, const char *salt);
+/* Thread-safe version of mycrypt(). The result is written to result, which
+   is NUL-terminated. Returns 0 on success, -1 if crypt() failed, the result
+   didn't fit or crypt_r() isn't available. */
+int mycrypt_r(const char *key, const char *salt,
+	      char *result, size_t result_size);
 
 #endif
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "mycrypt.h"
+#include "safe-memset.h"
 #include "password-scheme.h"
 #include "password-scheme-private.h"
 #include "crypt-blowfish.h"
@@ -19,6 +20,7 @@
 #define CRYPT_SHA2_ROUNDS_MIN 1000
 #define CRYPT_SHA2_ROUNDS_MAX 999999999
 #define CRYPT_SHA2_SALT_LEN 16
+#define CRYPT_RESULT_BUFFER_LEN 256
 
 static int crypt_verify(const char *plaintext, const struct password_generate_params *params ATTR_UNUSED,
 		 const unsigned char *raw_password, size_t size,
@@ -57,6 +59,55 @@ static int crypt_verify(const char *plaintext, const struct password_generate_pa
 	return str_equals_timing_almost_safe(crypted, password) ? 1 : 0;
 }
 
+static int
+crypt_verify_blowfish_threadsafe(const char *plaintext, const char *password)
+{
+	char salt[CRYPT_BLF_PREFIX_LEN + 1];
+	char crypted[CRYPT_BLF_BUFFER_LEN];
+	int ret;
+
+	if (strlen(password) < CRYPT_BLF_PREFIX_LEN ||
+	    password[0] != '$' || password[1] != '2' ||
+	    password[2] < 'a' || password[2] > 'z' ||
+	    password[3] != '$')
+		return -1;
+
+	memcpy(salt, password, CRYPT_BLF_PREFIX_LEN);
+	salt[CRYPT_BLF_PREFIX_LEN] = '\0';
+	if (crypt_blowfish_rn(plaintext, salt, crypted,
+			      CRYPT_BLF_BUFFER_LEN) == NULL)
+		return -1;
+	ret = str_equals_timing_almost_safe(crypted, password) ? 1 : 0;
+	safe_memset(crypted, 0, sizeof(crypted));
+	return ret;
+}
+
+#ifdef HAVE_CRYPT_R
+static int
+crypt_verify_threadsafe(const char *plaintext, const char *password)
+{
+	char crypted[CRYPT_RESULT_BUFFER_LEN];
+	int ret;
+
+	if (password[0] == '$' && password[1] == '2' &&
+	    password[2] != '\0' && password[3] == '$')
+		return crypt_verify_blowfish_threadsafe(plaintext, password);
+	if (password[0] == '\0') {
+		/* the default mycrypt() handler would return match */
+		return 0;
+	}
+	if (password[1] != '\0' && !password_schemes_weak_allowed() &&
+	    (password[0] != '$' || password[1] == '1'))
+		return -1;
+
+	if (mycrypt_r(plaintext, password, crypted, sizeof(crypted)) < 0)
+		return -1;
+	ret = str_equals_timing_almost_safe(crypted, password) ? 1 : 0;
+	safe_memset(crypted, 0, sizeof(crypted));
+	return ret;
+}
+#endif
+
 static void
 crypt_generate_des(const char *plaintext, const struct password_generate_params *params ATTR_UNUSED,
 		   const unsigned char **raw_password_r, size_t *size_r)
@@ -205,6 +256,9 @@ static const struct password_scheme crypt_schemes[] = {
 		.weak = TRUE,
 		.password_verify = crypt_verify,
 		.password_generate = crypt_generate_des,
+#ifdef HAVE_CRYPT_R
+		.password_verify_threadsafe = crypt_verify_threadsafe,
+#endif
 	},
 	{
 		.name = "SHA256-CRYPT",
@@ -212,6 +266,9 @@ static const struct password_scheme crypt_schemes[] = {
 		.raw_password_len = 0,
 		.password_verify = crypt_verify,
 		.password_generate = crypt_generate_sha256,
+#ifdef HAVE_CRYPT_R
+		.password_verify_threadsafe = crypt_verify_threadsafe,
+#endif
 	},
 	{
 		.name = "SHA512-CRYPT",
@@ -219,6 +276,9 @@ static const struct password_scheme crypt_schemes[] = {
 		.raw_password_len = 0,
 		.password_verify = crypt_verify,
 		.password_generate = crypt_generate_sha512,
+#ifdef HAVE_CRYPT_R
+		.password_verify_threadsafe = crypt_verify_threadsafe,
+#endif
 	},
 };
 
@@ -228,6 +288,7 @@ static const struct password_scheme blf_crypt_scheme = {
 	.raw_password_len = 0,
 	.password_verify = crypt_verify_blowfish,
 	.password_generate = crypt_generate_blowfish,
+	.password_verify_threadsafe = crypt_verify_blowfish_threadsafe,
 };
 
 static const struct password_scheme default_crypt_scheme = {
@@ -236,6 +297,9 @@ static const struct password_scheme default_crypt_scheme = {
 	.raw_password_len = 0,
 	.password_verify = crypt_verify,
 	.password_generate = crypt_generate_blowfish,
+#ifdef HAVE_CRYPT_R
+	.password_verify_threadsafe = crypt_verify_threadsafe,
+#endif
 };
 
 void password_scheme_register_crypt(void)
@@ -72,6 +72,14 @@ verify_argon2(const char *plaintext, const struct password_generate_params *para
 	return 1;
 }
 
+static int
+verify_argon2_threadsafe(const char *plaintext, const char *raw_password)
+{
+	if (crypto_pwhash_str_verify(raw_password, plaintext,
+				     strlen(plaintext)) < 0)
+		return 0;
+	return 1;
+}
 
 static const struct password_scheme sodium_schemes[] = {
 	{
@@ -80,6 +88,7 @@ static const struct password_scheme sodium_schemes[] = {
 		.raw_password_len = 0,
 		.password_verify = verify_argon2,
 		.password_generate = generate_argon2i,
+		.password_verify_threadsafe = verify_argon2_threadsafe,
 	},
 #ifdef crypto_pwhash_ALG_ARGON2ID13
 	{
@@ -88,6 +97,7 @@ static const struct password_scheme sodium_schemes[] = {
 		.raw_password_len = 0,
 		.password_verify = verify_argon2,
 		.password_generate = generate_argon2id,
+		.password_verify_threadsafe = verify_argon2_threadsafe,
 	},
 	{
 		.name = "ARGON2",
@@ -95,6 +105,7 @@ static const struct password_scheme sodium_schemes[] = {
 		.raw_password_len = 0,
 		.password_verify = verify_argon2,
 		.password_generate = generate_argon2id,
+		.password_verify_threadsafe = verify_argon2_threadsafe,
 	},
 #endif
 };
@@ -115,6 +115,18 @@ int password_verify(const char *plaintext,
 	return ret;
 }
 
+password_verify_threadsafe_func_t *
+password_scheme_get_verify_threadsafe(const char *scheme)
+{
+	const struct password_scheme *s;
+	enum password_encoding encoding;
+
+	s = password_scheme_lookup(scheme, &encoding);
+	if (s == NULL || (s->weak && !g_allow_weak))
+		return NULL;
+	return s->password_verify_threadsafe;
+}
+
 const char *password_get_scheme(const char **password)
 {
 	const char *p, *suffix, *scheme;
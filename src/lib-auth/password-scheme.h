@@ -16,6 +16,10 @@ struct password_generate_params {
 	unsigned int rounds;
 };
 
+/* Returns 1 = matched, 0 = didn't match, -1 = internal error. */
+typedef int password_verify_threadsafe_func_t(const char *plaintext,
+					      const char *raw_password);
+
 struct password_scheme {
 	const char *name;
 	enum password_encoding default_encoding;
@@ -34,6 +38,10 @@ struct password_scheme {
 				  const struct password_generate_params *params,
 				  const unsigned char **raw_password_r,
 				  size_t *size_r);
+	/* If set, this can be used instead of password_verify() in any
+	   thread. It must not use data stack, memory pools or logging.
+	   raw_password is NUL-terminated. */
+	password_verify_threadsafe_func_t *password_verify_threadsafe;
 };
 ARRAY_DEFINE_TYPE(password_scheme_p, const struct password_scheme *);
 void password_schemes_get(ARRAY_TYPE(password_scheme_p) *schemes_r);
@@ -48,6 +56,13 @@ int password_verify(const char *plaintext,
 		    const unsigned char *raw_password, size_t size,
 		    const char **error_r);
 
+/* Returns the function that can verify passwords of the given scheme in any
+   thread, or NULL if the scheme doesn't have one. NULL is also returned for
+   unknown and refused weak schemes, so that password_verify() can return the
+   error. */
+password_verify_threadsafe_func_t *
+password_scheme_get_verify_threadsafe(const char *scheme);
+
 /* Extracts scheme from password, or returns NULL if it isn't found.
    If auth_request is given, it's used for debug logging. */
 const char *password_get_scheme(const char **password);
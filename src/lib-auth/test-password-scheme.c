@@ -37,6 +37,7 @@ test_password_scheme(const char *scheme, const char *crypted,
 		.user = "testuser1",
 		.rounds = 0,
 	};
+	password_verify_threadsafe_func_t *verify_threadsafe;
 	const unsigned char *raw_password;
 	size_t siz;
 	const char *error, *scheme2;
@@ -53,6 +54,13 @@ test_password_scheme(const char *scheme, const char *crypted,
 	test_assert(password_decode(crypted, scheme, &raw_password, &siz, &error) == 1);
 	test_assert(password_verify(plaintext, &params, scheme, raw_password, siz, &error) == 1);
 
+	verify_threadsafe = password_scheme_get_verify_threadsafe(scheme);
+	if (verify_threadsafe != NULL) {
+		const char *raw = t_strndup(raw_password, siz);
+		test_assert(verify_threadsafe(plaintext, raw) == 1);
+		test_assert(verify_threadsafe("wrong", raw) == 0);
+	}
+
 	scheme2 = password_scheme_detect(plaintext, crypted, &params);
 
 	test_assert(scheme2 != NULL &&
@@ -13,6 +13,7 @@
 #include "message-parser.h"
 #include "message-decoder.h"
 #include "message-part-data.h"
+#include "message-part-serialize.h"
 #include "mail-storage-private.h"
 #include "mail-namespace.h"
 #include "imap-bodystructure.h"
@@ -516,17 +517,131 @@ imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 	result->input = input2;
 }
 
+static bool imap_msgpart_want_rfc822_child(const struct imap_msgpart *msgpart)
+{
+	switch (msgpart->fetch_type) {
+	case FETCH_MIME:
+		/* What to do if this is a message/rfc822? Does it have
+		   MIME headers or not? Possibilities are: a) no, return
+		   empty string (UW-IMAP does this), b) return the same as
+		   HEADER. Dovecot has done b) for a long time and it's not
+		   very clear which one is correct, so we'll just continue
+		   with b) */
+	case FETCH_FULL:
+	case FETCH_MIME_BODY:
+		break;
+	case FETCH_HEADER:
+	case FETCH_HEADER_FIELDS:
+	case FETCH_HEADER_FIELDS_NOT:
+	case FETCH_BODY:
+		/* fetching message/rfc822 part's header/body */
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static int
+imap_msgpart_find_serialized(struct mail *mail,
+			     const struct imap_msgpart *msgpart,
+			     struct message_part *part_r)
+{
+	struct message_part_deserialize_cursor cursor;
+	buffer_t *parts_buf;
+	const char *path, *error;
+	unsigned int num;
+	int ret;
+
+	parts_buf = t_buffer_create(128);
+	if (mail_get_serialized_parts(mail, parts_buf) <= 0)
+		return -1;
+	if (!message_part_deserialize_cursor_init(&cursor, parts_buf->data,
+						  parts_buf->used, &error))
+		goto corrupted;
+
+	/* same as imap_msgpart_find(), but walk the serialized parts */
+	path = msgpart->section_number;
+	while (*path >= '0' && *path <= '9') {
+		num = 0;
+		while (*path != '\0' && *path != '.') {
+			num = num*10 + (*path - '0');
+			path++;
+		}
+		if (*path == '.')
+			path++;
+
+		if ((cursor.part.flags & MESSAGE_PART_FLAG_MULTIPART) != 0) {
+			ret = message_part_deserialize_cursor_child(&cursor,
+				num > 1 ? num - 1 : 0, &error);
+			if (ret < 0)
+				goto corrupted;
+			if (ret == 0)
+				return 0;
+		} else if (num != 1) {
+			return 0;
+		} else if (*path != '\0' &&
+			   (cursor.part.flags &
+			    MESSAGE_PART_FLAG_MESSAGE_RFC822) == 0) {
+			return 0;
+		}
+
+		if ((cursor.part.flags &
+		     MESSAGE_PART_FLAG_MESSAGE_RFC822) != 0 &&
+		    (*path >= '0' && *path <= '9')) {
+			ret = message_part_deserialize_cursor_child(&cursor, 0,
+								    &error);
+			if (ret < 0)
+				goto corrupted;
+			if (ret == 0)
+				return 0;
+		}
+	}
+
+	if (imap_msgpart_want_rfc822_child(msgpart)) {
+		if ((cursor.part.flags & MESSAGE_PART_FLAG_MESSAGE_RFC822) == 0)
+			return 0;
+		ret = message_part_deserialize_cursor_child(&cursor, 0, &error);
+		if (ret < 0)
+			goto corrupted;
+		if (ret == 0)
+			return 0;
+	}
+	*part_r = cursor.part;
+	return 1;
+
+corrupted:
+	mail_set_cache_corrupted(mail, MAIL_FETCH_MESSAGE_PARTS,
+		t_strdup_printf("Corrupted cached mime.parts data: %s", error));
+	return -1;
+}
+
+/* Find the MIME part for the section. If part_buf isn't NULL, the caller
+   doesn't need the whole parts tree and the part may be looked up directly
+   from the cached serialized parts into part_buf. */
 static int
 imap_msgpart_find_part(struct mail *mail, const struct imap_msgpart *msgpart,
+		       struct message_part *part_buf,
 		       struct message_part **part_r)
 {
 	struct message_part *parts, *part = NULL;
+	int ret;
 
 	if (*msgpart->section_number == '\0') {
 		*part_r = NULL;
 		return 1;
 	}
 
+	if (part_buf != NULL) {
+		T_BEGIN {
+			ret = imap_msgpart_find_serialized(mail, msgpart,
+							   part_buf);
+		} T_END;
+		if (ret >= 0) {
+			*part_r = ret > 0 ? part_buf : NULL;
+			return ret;
+		}
+		/* not cached - fallback to the full parts tree */
+	}
+
 	if (mail_get_parts(mail, &parts) < 0)
 		return -1;
 	part = imap_msgpart_find(parts, msgpart->section_number);
@@ -536,22 +651,7 @@ imap_msgpart_find_part(struct mail *mail, const struct imap_msgpart *msgpart,
 		return 0;
 	}
 
-	switch (msgpart->fetch_type) {
-	case FETCH_MIME:
-		/* What to do if this is a message/rfc822? Does it have
-		   MIME headers or not? Possibilities are: a) no, return
-		   empty string (UW-IMAP does this), b) return the same as
-		   HEADER. Dovecot has done b) for a long time and it's not
-		   very clear which one is correct, so we'll just continue
-		   with b) */
-	case FETCH_FULL:
-	case FETCH_MIME_BODY:
-		break;
-	case FETCH_HEADER:
-	case FETCH_HEADER_FIELDS:
-	case FETCH_HEADER_FIELDS_NOT:
-	case FETCH_BODY:
-		/* fetching message/rfc822 part's header/body */
+	if (imap_msgpart_want_rfc822_child(msgpart)) {
 		if ((part->flags & MESSAGE_PART_FLAG_MESSAGE_RFC822) == 0) {
 			*part_r = NULL;
 			return 0;
@@ -559,7 +659,6 @@ imap_msgpart_find_part(struct mail *mail, const struct imap_msgpart *msgpart,
 		i_assert(part->children != NULL &&
 			 part->children->next == NULL);
 		part = part->children;
-		break;
 	}
 	*part_r = part;
 	return 1;
@@ -673,15 +772,23 @@ imap_msgpart_open_normal(struct mail *mail, struct imap_msgpart *msgpart,
 int imap_msgpart_open(struct mail *mail, struct imap_msgpart *msgpart,
 		      struct imap_msgpart_open_result *result_r)
 {
-	struct message_part *part;
+	struct message_part *part, part_buf;
 	uoff_t virtual_size;
-	bool include_hdr, binary, use_partial_cache, have_crlfs;
+	bool include_hdr, binary, binary_fetch, use_partial_cache, have_crlfs;
 	struct mail_binary_properties bprops;
 	int ret;
 
 	i_zero(result_r);
 
-	if ((ret = imap_msgpart_find_part(mail, msgpart, &part)) < 0)
+	/* binary fetching needs the full parts tree, but otherwise only the
+	   wanted part's position and sizes are needed */
+	binary_fetch = msgpart->decode_cte_to_binary &&
+		(msgpart->fetch_type == FETCH_FULL ||
+		 msgpart->fetch_type == FETCH_BODY ||
+		 msgpart->fetch_type == FETCH_MIME_BODY);
+	if ((ret = imap_msgpart_find_part(mail, msgpart,
+					  binary_fetch ? NULL : &part_buf,
+					  &part)) < 0)
 		return -1;
 	if (ret == 0) {
 		/* MIME part not found. return an empty part. */
@@ -689,10 +796,7 @@ int imap_msgpart_open(struct mail *mail, struct imap_msgpart *msgpart,
 		return 0;
 	}
 
-	if (msgpart->decode_cte_to_binary &&
-	    (msgpart->fetch_type == FETCH_FULL ||
-	     msgpart->fetch_type == FETCH_BODY ||
-	     msgpart->fetch_type == FETCH_MIME_BODY)) {
+	if (binary_fetch) {
 		/* binary fetch */
 		include_hdr = msgpart->fetch_type == FETCH_FULL;
 		if (part == NULL) {
@@ -744,7 +848,7 @@ int imap_msgpart_size(struct mail *mail, struct imap_msgpart *msgpart,
 	}
 
 	/* binary-optimized implementation: */
-	if ((ret = imap_msgpart_find_part(mail, msgpart, &part)) < 0)
+	if ((ret = imap_msgpart_find_part(mail, msgpart, NULL, &part)) < 0)
 		return -1;
 	if (ret == 0) {
 		/* MIME part not found. return an empty part. */
@@ -828,7 +932,7 @@ int imap_msgpart_bodypartstructure(struct mail *mail,
 	   BODYSTRUCTURE */
 	mail_add_temp_wanted_fields(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE, NULL);
 
-	if ((ret = imap_msgpart_find_part(mail, msgpart, &part)) < 0)
+	if ((ret = imap_msgpart_find_part(mail, msgpart, NULL, &part)) < 0)
 		return -1;
 	if (ret == 0) {
 		/* MIME part not found. */
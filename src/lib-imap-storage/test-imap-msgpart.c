@@ -2,7 +2,13 @@
 
 #include "lib.h"
 #include "test-common.h"
+#include "test-dir.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "master-service.h"
 #include "mail-storage.h"
+#include "test-mail-storage-common.h"
 #include "imap-msgpart.h"
 
 static void test_imap_msgpart_parse(void)
@@ -53,11 +59,206 @@ static void test_imap_msgpart_parse(void)
 	test_end();
 }
 
-int main(void)
+static const char test_msgpart_msg[] =
+"From: <sender@example.com>\n"
+"Subject: test\n"
+"MIME-Version: 1.0\n"
+"Content-Type: multipart/mixed; boundary=\"a\"\n"
+"\n"
+"prologue\n"
+"--a\n"
+"Content-Type: text/plain\n"
+"\n"
+"part 1\n"
+"--a\n"
+"Content-Type: message/rfc822\n"
+"\n"
+"From: <inner@example.com>\n"
+"Subject: inner\n"
+"Content-Type: multipart/alternative; boundary=\"b\"\n"
+"\n"
+"--b\n"
+"Content-Type: text/plain\n"
+"\n"
+"part 2.1\n"
+"--b\n"
+"Content-Type: text/html\n"
+"\n"
+"<p>part 2.2</p>\n"
+"--b--\n"
+"--a\n"
+"Content-Type: multipart/mixed; boundary=\"c\"\n"
+"\n"
+"--c\n"
+"Content-Type: application/octet-stream\n"
+"\n"
+"part 3.1 with \0 NUL\n"
+"--c\n"
+"Content-Type: message/rfc822\n"
+"\n"
+"Subject: inner 3.2\n"
+"\n"
+"part 3.2\n"
+"--c--\n"
+"--a--\n";
+
+static void test_msgpart_save(struct mailbox *box)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct message_part *parts;
+	struct istream *input;
+	struct mail *mail;
+	int ret;
+
+	input = i_stream_create_from_data(test_msgpart_msg,
+					  sizeof(test_msgpart_msg)-1);
+	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL,
+					  __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+	do {
+		test_assert(mailbox_save_continue(save_ctx) == 0);
+	} while ((ret = i_stream_read(input)) > 0);
+	test_assert(ret == -1);
+	test_assert(mailbox_save_finish(&save_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	i_stream_unref(&input);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	/* parse the mail to get mime.parts cached */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	test_assert(mail_get_parts(mail, &parts) == 0);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+static void
+test_msgpart_fetch(struct mailbox_transaction_context *trans,
+		   const char *section, bool cached_parts, string_t *dest)
+{
+	struct imap_msgpart *msgpart;
+	struct imap_msgpart_open_result result;
+	struct message_part *parts;
+	struct mail *mail;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	/* a new mail, so the parts aren't already in memory */
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	if (!cached_parts) {
+		/* with the parts tree in memory the section is looked up
+		   from it instead of the cached mime.parts */
+		test_assert(mail_get_parts(mail, &parts) == 0);
+	}
+	test_assert(imap_msgpart_parse(section, &msgpart) == 0);
+	test_assert(imap_msgpart_open(mail, msgpart, &result) == 0);
+	while ((ret = i_stream_read_more(result.input, &data, &size)) > 0) {
+		str_append_data(dest, data, size);
+		i_stream_skip(result.input, size);
+	}
+	test_assert(ret == -1 && result.input->stream_errno == 0);
+	test_assert(str_len(dest) == result.size);
+	if (cached_parts) {
+		/* the NULs are known from the cached mime.parts */
+		test_assert(mail->has_nuls && !mail->has_no_nuls);
+	}
+	i_stream_unref(&result.input);
+	imap_msgpart_free(&msgpart);
+	mail_free(&mail);
+}
+
+static void test_imap_msgpart_cached_parts(void)
+{
+	static const char *const sections[] = {
+		"1", "1.MIME", "1.HEADER", "1.TEXT", "1.1", "1.2",
+		"2", "2.MIME", "2.HEADER", "2.TEXT", "2.1", "2.2", "2.3",
+		"2.1.MIME", "2.2.MIME", "2.1.1", "2.1.HEADER",
+		"3", "3.MIME", "3.HEADER", "3.TEXT", "3.1", "3.1.MIME", "3.2",
+		"3.2.MIME", "3.2.HEADER", "3.2.TEXT", "3.2.1", "3.2.1.MIME",
+		"3.2.2", "3.3", "4", "4.1",
+	};
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mail_always_cache_fields=mime.parts",
+			NULL
+		},
+	};
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+	struct mail *mail;
+	buffer_t *parts_buf;
+	string_t *cached_str, *parsed_str;
+	unsigned int i;
+
+	test_begin("imap_msgpart_open() with cached mime.parts");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_msgpart_save(box);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	mail_set_seq(mail, 1);
+	parts_buf = buffer_create_dynamic(default_pool, 128);
+	test_assert(mail_get_serialized_parts(mail, parts_buf) == 1);
+	buffer_free(&parts_buf);
+	mail_free(&mail);
+
+	cached_str = str_new(default_pool, 256);
+	parsed_str = str_new(default_pool, 256);
+	for (i = 0; i < N_ELEMENTS(sections); i++) {
+		str_truncate(cached_str, 0);
+		str_truncate(parsed_str, 0);
+		test_msgpart_fetch(trans, sections[i], TRUE, cached_str);
+		test_msgpart_fetch(trans, sections[i], FALSE, parsed_str);
+		test_assert_strcmp_idx(str_c(cached_str), str_c(parsed_str), i);
+	}
+	/* check a few of them explicitly */
+	str_truncate(cached_str, 0);
+	test_msgpart_fetch(trans, "2.1", TRUE, cached_str);
+	test_assert_strcmp(str_c(cached_str), "part 2.1");
+	str_truncate(cached_str, 0);
+	test_msgpart_fetch(trans, "3.2.HEADER", TRUE, cached_str);
+	test_assert_strcmp(str_c(cached_str), "Subject: inner 3.2\r\n\r\n");
+	str_truncate(cached_str, 0);
+	test_msgpart_fetch(trans, "3.1", TRUE, cached_str);
+	test_assert_strcmp(str_c(cached_str), "part 3.1 with \x80 NUL");
+
+	str_free(&cached_str);
+	str_free(&parsed_str);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+int main(int argc, char **argv)
 {
 	void (*const test_functions[])(void) = {
 		test_imap_msgpart_parse,
+		test_imap_msgpart_cached_parts,
 		NULL
 	};
-	return test_run(test_functions);
+	int ret;
+
+	master_service = master_service_init("test-imap-msgpart",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	test_dir_init("test-imap-msgpart");
+	ret = test_run(test_functions);
+	master_service_deinit(&master_service);
+	return ret;
 }
@@ -0,0 +1,268 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "str.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+#include "mail-transaction-log-private.h"
+#include "mail-cache.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/**
+ * Creates a synthetic index with a configurable number of messages and
+ * cached data, and measures the operations that dominate rebuilding a
+ * mailbox's indexes (e.g. doveadm force-resync):
+ *
+ *  - map read: opening the index and reading dovecot.index into memory
+ *  - fsck: checking and fixing the index map
+ *  - sync: applying a flag change to each message via index syncing
+ *  - cache purge: rewriting dovecot.index.cache
+ */
+
+#define BENCH_DIR ".bench-mail-index-fsck"
+#define BENCH_PREFIX "bench.dovecot.index"
+/* Number of messages changed in one transaction */
+#define BENCH_SYNC_TRANSACTION_COUNT 1000
+
+static const struct mail_cache_field bench_cache_fields[] = {
+	{ .name = "bench-hdr", .type = MAIL_CACHE_FIELD_STRING,
+	  .decision = MAIL_CACHE_DECISION_YES },
+	{ .name = "bench-size", .type = MAIL_CACHE_FIELD_FIXED_SIZE,
+	  .field_size = sizeof(uint64_t), .decision = MAIL_CACHE_DECISION_YES },
+};
+
+static unsigned int bench_cache_field_idx[N_ELEMENTS(bench_cache_fields)];
+
+static const struct mail_index_optimization_settings bench_optimization_set = {
+	.index = {
+		/* never rewrite the index automatically */
+		.rewrite_min_log_bytes = (uoff_t)-1,
+		.rewrite_max_log_bytes = (uoff_t)-1,
+	},
+	.log = {
+		/* never rotate the log */
+		.min_size = (uoff_t)-1,
+		.max_size = (uoff_t)-1,
+		.min_age_secs = UINT_MAX,
+	},
+};
+
+static struct mail_index *bench_index_open(void)
+{
+	struct mail_cache_field fields[N_ELEMENTS(bench_cache_fields)];
+	struct mail_index *index;
+	unsigned int i;
+
+	index = mail_index_alloc(NULL, BENCH_DIR, BENCH_PREFIX);
+	mail_index_set_optimization_settings(index, &bench_optimization_set);
+	mail_index_set_fsync_mode(index, FSYNC_MODE_NEVER, 0);
+	/* read the index into memory instead of mmap()ing it, so opening
+	   actually reads the whole file */
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE |
+				      MAIL_INDEX_OPEN_FLAG_MMAP_DISABLE) < 0)
+		i_fatal("mail_index_open_or_create() failed");
+
+	memcpy(fields, bench_cache_fields, sizeof(fields));
+	mail_cache_register_fields(index->cache, fields, N_ELEMENTS(fields),
+				   MAIL_CACHE_TRUNCATE_NAME_FAIL);
+	for (i = 0; i < N_ELEMENTS(fields); i++)
+		bench_cache_field_idx[i] = fields[i].idx;
+	return index;
+}
+
+static void bench_index_write(struct mail_index *index)
+{
+	uint32_t file_seq;
+	uoff_t file_offset;
+
+	if (mail_transaction_log_sync_lock(index->log, "bench",
+					   &file_seq, &file_offset) < 0)
+		i_fatal("mail_transaction_log_sync_lock() failed");
+	mail_index_write(index, FALSE, "bench");
+	mail_transaction_log_sync_unlock(index->log, "bench");
+}
+
+static void bench_index_create(unsigned int message_count, size_t cache_size)
+{
+	struct mail_index *index;
+	struct mail_index_view *view, *updated_view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	string_t *value;
+	uint64_t size;
+	uint32_t seq, uid_validity = 1234;
+	unsigned int i;
+
+	index = bench_index_open();
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	updated_view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(index->cache, updated_view);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	value = str_new(default_pool, cache_size);
+	for (i = 0; i < message_count; i++) {
+		mail_index_append(trans, i + 1, &seq);
+		if (i % 3 == 0) {
+			mail_index_update_flags(trans, seq, MODIFY_REPLACE,
+						MAIL_SEEN);
+		}
+
+		str_truncate(value, 0);
+		str_printfa(value, "%u", i);
+		while (str_len(value) < cache_size)
+			str_append_c(value, 'x' + str_len(value) % 3);
+		mail_cache_add(cache_trans, seq, bench_cache_field_idx[0],
+			       str_data(value), str_len(value));
+		size = i * 100;
+		mail_cache_add(cache_trans, seq, bench_cache_field_idx[1],
+			       &size, sizeof(size));
+	}
+	str_free(&value);
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&updated_view);
+	mail_index_view_close(&view);
+
+	bench_index_write(index);
+	mail_index_close(index);
+	mail_index_free(&index);
+}
+
+static void bench_index_change_flags(struct mail_index *index)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans = NULL;
+	uint32_t seq, count;
+
+	view = mail_index_view_open(index);
+	count = mail_index_view_get_messages_count(view);
+	for (seq = 1; seq <= count; seq++) {
+		if (trans == NULL) {
+			trans = mail_index_transaction_begin(view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+		}
+		mail_index_update_flags(trans, seq, MODIFY_ADD, MAIL_FLAGGED);
+		if (seq % BENCH_SYNC_TRANSACTION_COUNT == 0 || seq == count) {
+			if (mail_index_transaction_commit(&trans) < 0)
+				i_fatal("mail_index_transaction_commit() failed");
+		}
+	}
+	mail_index_view_close(&view);
+}
+
+static void bench_index_sync(struct mail_index *index)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_index_sync_rec sync_rec;
+
+	if (mail_index_sync_begin(index, &sync_ctx, &view, &trans, 0) < 0)
+		i_fatal("mail_index_sync_begin() failed");
+	while (mail_index_sync_next(sync_ctx, &sync_rec)) ;
+	if (mail_index_sync_commit(&sync_ctx) < 0)
+		i_fatal("mail_index_sync_commit() failed");
+}
+
+static void
+bench_print(const char *name, uint64_t ts_0, uint64_t ts_1,
+	    unsigned int message_count)
+{
+	printf("%-12s %10.02lf ms, %8.02lf ns/message\n", name,
+	       (double)(ts_1 - ts_0) / 1000000,
+	       (double)(ts_1 - ts_0) / message_count);
+}
+
+static void bench_index_fsck(unsigned int message_count, size_t cache_size)
+{
+	struct mail_index *index, *index2;
+	struct stat st;
+	uint64_t ts_0, ts_1;
+	const char *error;
+
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(BENCH_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR);
+
+	bench_index_create(message_count, cache_size);
+	if (stat(BENCH_DIR"/"BENCH_PREFIX, &st) < 0)
+		i_fatal("stat(%s) failed: %m", BENCH_DIR"/"BENCH_PREFIX);
+	printf("Input data is %u messages, %"PRIuUOFF_T" bytes of index, ",
+	       message_count, (uoff_t)st.st_size);
+	if (stat(BENCH_DIR"/"BENCH_PREFIX".cache", &st) < 0)
+		i_fatal("stat(%s) failed: %m", BENCH_DIR"/"BENCH_PREFIX".cache");
+	printf("%"PRIuUOFF_T" bytes of cache\n\n", (uoff_t)st.st_size);
+
+	ts_0 = i_nanoseconds();
+	index = bench_index_open();
+	ts_1 = i_nanoseconds();
+	i_assert(index->map->hdr.messages_count == message_count);
+	bench_print("map read:", ts_0, ts_1, message_count);
+
+	ts_0 = i_nanoseconds();
+	if (mail_index_fsck(index) < 0)
+		i_fatal("mail_index_fsck() failed");
+	ts_1 = i_nanoseconds();
+	bench_print("fsck:", ts_0, ts_1, message_count);
+
+	index2 = bench_index_open();
+	bench_index_change_flags(index2);
+	mail_index_close(index2);
+	mail_index_free(&index2);
+	ts_0 = i_nanoseconds();
+	bench_index_sync(index);
+	ts_1 = i_nanoseconds();
+	bench_print("sync:", ts_0, ts_1, message_count);
+
+	ts_0 = i_nanoseconds();
+	if (mail_cache_purge(index->cache, (uint32_t)-1, "bench") < 0)
+		i_fatal("mail_cache_purge() failed");
+	ts_1 = i_nanoseconds();
+	bench_print("cache purge:", ts_0, ts_1, message_count);
+
+	mail_index_close(index);
+	mail_index_free(&index);
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<message_count> [<cache_bytes>]]\n", prog);
+	fprintf(stderr, "Runs with 100000 messages and 100 bytes of cached "
+		"data per message if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct ioloop *ioloop;
+	unsigned int message_count = 100000, cache_size = 100;
+
+	lib_init();
+
+	if ((argc >= 2 && str_to_uint(argv[1], &message_count) < 0) ||
+	    (argc >= 3 && str_to_uint(argv[2], &cache_size) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 3 || message_count == 0)
+		print_usage(argv[0]);
+
+	ioloop = io_loop_create();
+	bench_index_fsck(message_count, cache_size);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,209 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "unlink-directory.h"
+#include "mail-index-private.h"
+#include "mail-transaction-log-private.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/**
+ * Writes a large dovecot.index.log that hasn't been applied to the
+ * dovecot.index yet and measures how long it takes to open the index, i.e.
+ * to replay the log into the map. The log looks like what a busy mailbox
+ * produces: messages are expunged from the beginning one transaction at a
+ * time, new messages are appended and flags are changed in between.
+ */
+
+#define BENCH_DIR ".bench-mail-index-sync"
+#define BENCH_PREFIX "bench.dovecot.index"
+/* Number of transactions of each type in one round */
+#define BENCH_ROUND_COUNT 32
+
+static const struct mail_index_optimization_settings bench_optimization_set = {
+	.index = {
+		/* never rewrite the index automatically */
+		.rewrite_min_log_bytes = (uoff_t)-1,
+		.rewrite_max_log_bytes = (uoff_t)-1,
+	},
+	.log = {
+		/* never rotate the log */
+		.min_size = (uoff_t)-1,
+		.max_size = (uoff_t)-1,
+		.min_age_secs = UINT_MAX,
+	},
+};
+
+static struct mail_index *bench_index_open(void)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(NULL, BENCH_DIR, BENCH_PREFIX);
+	mail_index_set_optimization_settings(index, &bench_optimization_set);
+	mail_index_set_fsync_mode(index, FSYNC_MODE_NEVER, 0);
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) < 0)
+		i_fatal("mail_index_open_or_create() failed");
+	return index;
+}
+
+static void bench_index_create(unsigned int message_count)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, file_seq, uid_validity = 1234;
+	uoff_t file_offset;
+	unsigned int i;
+
+	index = bench_index_open();
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (i = 0; i < message_count; i++)
+		mail_index_append(trans, i + 1, &seq);
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+	mail_index_view_close(&view);
+
+	if (mail_transaction_log_sync_lock(index->log, "bench",
+					   &file_seq, &file_offset) < 0)
+		i_fatal("mail_transaction_log_sync_lock() failed");
+	mail_index_write(index, FALSE, "bench");
+	mail_transaction_log_sync_unlock(index->log, "bench");
+
+	mail_index_close(index);
+	mail_index_free(&index);
+}
+
+static void
+bench_log_append(struct mail_index *index, enum mail_transaction_type type,
+		 const void *data, size_t size)
+{
+	struct mail_transaction_log_append_ctx *ctx;
+
+	if (mail_transaction_log_append_begin(index,
+			MAIL_TRANSACTION_EXTERNAL, &ctx) < 0)
+		i_fatal("mail_transaction_log_append_begin() failed");
+	mail_transaction_log_append_add(ctx, type, data, size);
+	if (mail_transaction_log_append_commit(&ctx) < 0)
+		i_fatal("mail_transaction_log_append_commit() failed");
+}
+
+static unsigned int
+bench_log_write(unsigned int message_count, uoff_t log_size)
+{
+	struct mail_index *index;
+	struct mail_index_record rec;
+	struct mail_transaction_expunge expunge;
+	struct mail_transaction_flag_update flag_update;
+	uint32_t file_seq, first_uid = 1, next_uid = message_count + 1;
+	uoff_t file_offset;
+	unsigned int i, transaction_count = 0;
+
+	index = bench_index_open();
+	if (mail_transaction_log_sync_lock(index->log, "bench",
+					   &file_seq, &file_offset) < 0)
+		i_fatal("mail_transaction_log_sync_lock() failed");
+	while (index->log->head->sync_offset < log_size) {
+		for (i = 0; i < BENCH_ROUND_COUNT; i++) {
+			i_zero(&expunge);
+			expunge.uid1 = expunge.uid2 = first_uid++;
+			bench_log_append(index, MAIL_TRANSACTION_EXPUNGE,
+					 &expunge, sizeof(expunge));
+		}
+		for (i = 0; i < BENCH_ROUND_COUNT; i++) {
+			i_zero(&rec);
+			rec.uid = next_uid++;
+			bench_log_append(index, MAIL_TRANSACTION_APPEND,
+					 &rec, sizeof(rec));
+		}
+		for (i = 0; i < BENCH_ROUND_COUNT; i++) {
+			i_zero(&flag_update);
+			flag_update.uid1 = flag_update.uid2 =
+				first_uid + i_rand_limit(message_count);
+			flag_update.add_flags = MAIL_SEEN;
+			bench_log_append(index, MAIL_TRANSACTION_FLAG_UPDATE,
+					 &flag_update, sizeof(flag_update));
+		}
+		transaction_count += BENCH_ROUND_COUNT * 3;
+	}
+	mail_transaction_log_sync_unlock(index->log, "bench");
+
+	mail_index_close(index);
+	mail_index_free(&index);
+	return transaction_count;
+}
+
+static void bench_index_sync(unsigned int message_count, uoff_t log_size)
+{
+	struct mail_index *index;
+	struct stat st;
+	unsigned int transaction_count;
+	uint64_t ts_0, ts_1;
+	const char *error;
+
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+	if (mkdir(BENCH_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR);
+
+	bench_index_create(message_count);
+	transaction_count = bench_log_write(message_count, log_size);
+	if (stat(BENCH_DIR"/"BENCH_PREFIX".log", &st) < 0)
+		i_fatal("stat(%s) failed: %m", BENCH_DIR"/"BENCH_PREFIX".log");
+	printf("Input data is %u messages, %u transactions, "
+	       "%"PRIuUOFF_T" bytes of log\n\n",
+	       message_count, transaction_count, (uoff_t)st.st_size);
+
+	ts_0 = i_nanoseconds();
+	index = bench_index_open();
+	ts_1 = i_nanoseconds();
+	i_assert(index->map->hdr.messages_count == message_count);
+
+	printf("replay: %0.02lf ms, %0.02lf ns/transaction, %0.02lf MB/s\n",
+	       (double)(ts_1 - ts_0) / 1000000,
+	       (double)(ts_1 - ts_0) / transaction_count,
+	       ((double)st.st_size / (1024*1024)) /
+	       ((double)(ts_1 - ts_0) / 1000000000));
+
+	mail_index_close(index);
+	mail_index_free(&index);
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<log_mb> [<message_count>]]\n", prog);
+	fprintf(stderr, "Runs with 100 MB of log and 100000 messages "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct ioloop *ioloop;
+	unsigned int log_mb = 100, message_count = 100000;
+
+	lib_init();
+
+	if ((argc >= 2 && str_to_uint(argv[1], &log_mb) < 0) ||
+	    (argc >= 3 && str_to_uint(argv[2], &message_count) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 3 || log_mb == 0 || message_count == 0)
+		print_usage(argv[0]);
+
+	ioloop = io_loop_create();
+	bench_index_sync(message_count, (uoff_t)log_mb * 1024 * 1024);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,83 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "mail-cache-private.h"
+
+#include <zlib.h>
+
+/* deflate can't compress better than this. Used for checking that the
+   uncompressed size isn't corrupted before allocating memory for it. */
+#define MAIL_CACHE_COMPRESS_MAX_RATIO 1032
+
+bool mail_cache_field_compress(struct mail_cache *cache, const void *data,
+			       size_t size, buffer_t *dest)
+{
+	unsigned int min_size =
+		cache->index->optimization_set.cache.compress_min_size;
+	uint32_t size32 = (uint32_t)size;
+	unsigned char *dest_data;
+	uLongf dest_size;
+
+	if (min_size == 0 || size < min_size || size <= sizeof(size32) + 1)
+		return FALSE;
+
+	buffer_set_used_size(dest, 0);
+	buffer_append(dest, &size32, sizeof(size32));
+	/* there's no point in using the compressed data unless it's smaller.
+	   compress2() fails with Z_BUF_ERROR if it doesn't fit. */
+	dest_size = size - sizeof(size32) - 1;
+	dest_data = buffer_append_space_unsafe(dest, dest_size);
+	if (compress2(dest_data, &dest_size, data, size,
+		      Z_DEFAULT_COMPRESSION) != Z_OK)
+		return FALSE;
+	buffer_set_used_size(dest, sizeof(size32) + dest_size);
+	return TRUE;
+}
+
+int mail_cache_field_get_data(struct mail_cache *cache,
+			      const struct mail_cache_iterate_field *field,
+			      buffer_t *dest)
+{
+	uint32_t size32;
+	unsigned char *dest_data;
+	uLongf dest_size;
+	size_t pos = dest->used;
+	int ret;
+
+	if (!field->compressed) {
+		buffer_append(dest, field->data, field->size);
+		return 0;
+	}
+
+	if (field->size <= sizeof(size32)) {
+		mail_cache_set_corrupted(cache,
+			"compressed field %s is too small (%u)",
+			cache->fields[field->field_idx].field.name,
+			field->size);
+		return -1;
+	}
+	memcpy(&size32, field->data, sizeof(size32));
+	if (size32 / MAIL_CACHE_COMPRESS_MAX_RATIO > field->size) {
+		mail_cache_set_corrupted(cache,
+			"compressed field %s has invalid size (%u > %u)",
+			cache->fields[field->field_idx].field.name,
+			size32, field->size);
+		return -1;
+	}
+
+	dest_size = size32;
+	dest_data = buffer_append_space_unsafe(dest, size32);
+	ret = uncompress(dest_data, &dest_size,
+			 CONST_PTR_OFFSET(field->data, sizeof(size32)),
+			 field->size - sizeof(size32));
+	if (ret != Z_OK || dest_size != size32) {
+		buffer_set_used_size(dest, pos);
+		mail_cache_set_corrupted(cache,
+			"compressed field %s is broken: %s",
+			cache->fields[field->field_idx].field.name,
+			ret != Z_OK ? zError(ret) : "size mismatch");
+		return -1;
+	}
+	return 0;
+}
@@ -299,6 +299,7 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 		return -1;
 	ctx->pos += sizeof(uint32_t);
 
+	field_r->compressed = FALSE;
 	data_size = cache->fields[field_idx].field.field_size;
 	if (data_size == UINT_MAX &&
 	    ctx->pos + sizeof(uint32_t) <= ctx->rec->size) {
@@ -306,6 +307,10 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 		data_size = *((const uint32_t *)
 			      CONST_PTR_OFFSET(ctx->rec, ctx->pos));
 		ctx->pos += sizeof(uint32_t);
+		if ((data_size & MAIL_CACHE_FIELD_SIZE_FLAG_COMPRESSED) != 0) {
+			data_size &= ~MAIL_CACHE_FIELD_SIZE_FLAG_COMPRESSED;
+			field_r->compressed = TRUE;
+		}
 	}
 
 	if (ctx->rec->size - ctx->pos < data_size) {
@@ -324,24 +329,59 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	return 1;
 }
 
+static void
+mail_cache_seq_add_location(struct mail_cache_view *view,
+			    const struct mail_cache_lookup_iterate_ctx *iter,
+			    const struct mail_cache_iterate_field *field)
+{
+	struct mail_cache_field_location *loc;
+
+	if (iter->inmemory_field_idx) {
+		/* not in the cache file */
+		return;
+	}
+	if (view->cache->fields[field->field_idx].field.type ==
+	    MAIL_CACHE_FIELD_BITMASK) {
+		/* all the records need to be merged */
+		return;
+	}
+	loc = array_idx_get_space(&view->cached_locations, field->field_idx);
+	loc->value = view->cached_exists_value;
+	loc->size = field->size;
+	loc->offset = field->offset;
+	loc->compressed = field->compressed;
+}
+
 static int mail_cache_seq(struct mail_cache_view *view, uint32_t seq)
 {
 	struct mail_cache_lookup_iterate_ctx iter;
 	struct mail_cache_iterate_field field;
+	const uint8_t *exists;
 	int ret;
 
 	view->cached_exists_value = (view->cached_exists_value + 1) & UINT8_MAX;
 	if (view->cached_exists_value == 0) {
-		/* wrapped, we'll have to clear the buffer */
+		/* wrapped, we'll have to clear the buffers */
 		buffer_set_used_size(view->cached_exists_buf, 0);
+		array_clear(&view->cached_locations);
 		view->cached_exists_value++;
 	}
 	view->cached_exists_seq = seq;
 
 	mail_cache_lookup_iter_init(view, seq, &iter);
+	view->cached_exists_offset = iter.offset;
+	view->cached_exists_reset_id = MAIL_CACHE_IS_UNUSABLE(view->cache) ?
+		0 : view->cache->hdr->file_seq;
 	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
+		exists = view->cached_exists_buf->data;
+		if (field.field_idx < view->cached_exists_buf->used &&
+		    exists[field.field_idx] == view->cached_exists_value) {
+			/* duplicate - the first one is returned by lookups */
+			continue;
+		}
 		buffer_write(view->cached_exists_buf, field.field_idx,
 			     &view->cached_exists_value, 1);
+		mail_cache_seq_add_location(view, &iter, &field);
 	}
 	return ret;
 }
@@ -412,6 +452,48 @@ mail_cache_lookup_bitmask(struct mail_cache_lookup_iterate_ctx *iter,
 	return ret < 0 ? -1 : (found ? 1 : 0);
 }
 
+/* Returns 1 if the field was found using cached_locations, 0 if the
+   locations can't be used, -1 if the field is corrupted. */
+static int
+mail_cache_lookup_field_location(struct mail_cache_view *view,
+				 buffer_t *dest_buf, uint32_t seq,
+				 unsigned int field_idx)
+{
+	const struct mail_cache_field_location *loc;
+	struct mail_cache_iterate_field field;
+	uint32_t reset_id;
+
+	if (view->cached_exists_seq != seq ||
+	    field_idx >= array_count(&view->cached_locations))
+		return 0;
+	loc = array_idx(&view->cached_locations, field_idx);
+	if (loc->value != view->cached_exists_value)
+		return 0;
+
+	/* make sure the message's cache records haven't changed since the
+	   locations were looked up */
+	if (MAIL_CACHE_IS_UNUSABLE(view->cache) ||
+	    view->cache->hdr->file_seq != view->cached_exists_reset_id ||
+	    mail_cache_lookup_cur_offset(view->view, seq, &reset_id) !=
+	    view->cached_exists_offset ||
+	    reset_id != view->cached_exists_reset_id)
+		return 0;
+
+	if (loc->size == 0)
+		return 1;
+
+	i_zero(&field);
+	field.field_idx = field_idx;
+	field.size = loc->size;
+	field.offset = loc->offset;
+	field.compressed = loc->compressed;
+	if (mail_cache_map(view->cache, loc->offset, loc->size,
+			   &field.data) <= 0)
+		return 0;
+	return mail_cache_field_get_data(view->cache, &field, dest_buf) < 0 ?
+		-1 : 1;
+}
+
 int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 			    uint32_t seq, unsigned int field_idx)
 {
@@ -425,6 +507,9 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 		return ret;
 
 	/* the field should exist */
+	if ((ret = mail_cache_lookup_field_location(view, dest_buf, seq,
+						    field_idx)) != 0)
+		return ret;
 	mail_cache_lookup_iter_init(view, seq, &iter);
 	if (view->cache->fields[field_idx].field.type == MAIL_CACHE_FIELD_BITMASK) {
 		ret = mail_cache_lookup_bitmask(&iter, field_idx,
@@ -435,7 +520,9 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 		   they're all identical. */
 		while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
 			if (field.field_idx == field_idx) {
-				buffer_append(dest_buf, field.data, field.size);
+				if (mail_cache_field_get_data(view->cache,
+						&field, dest_buf) < 0)
+					ret = -1;
 				break;
 			}
 		}
@@ -467,8 +554,8 @@ enum {
 	HDR_FIELD_STATE_SEEN
 };
 
-static void header_lines_save(struct header_lookup_context *ctx,
-			      const struct mail_cache_iterate_field *field)
+static int header_lines_save(struct header_lookup_context *ctx,
+			     const struct mail_cache_iterate_field *field)
 {
 	const uint32_t *lines = field->data;
 	uint32_t data_size = field->size;
@@ -477,6 +564,15 @@ static void header_lines_save(struct header_lookup_context *ctx,
 	void *data_dup;
 	unsigned int i, lines_count, pos;
 
+	if (field->compressed) {
+		buffer_t *buf = t_buffer_create(field->size * 4);
+
+		if (mail_cache_field_get_data(ctx->view->cache, field, buf) < 0)
+			return -1;
+		lines = buf->data;
+		data_size = buf->used;
+	}
+
 	/* data = { line_nums[], 0, "headers" } */
 	for (i = 0; data_size >= sizeof(uint32_t); i++) {
 		data_size -= sizeof(uint32_t);
@@ -491,7 +587,7 @@ static void header_lines_save(struct header_lookup_context *ctx,
 	if (data_size > 0) {
 		hdr_data->data = data_dup =
 			p_malloc(ctx->pool, data_size);
-		memcpy(data_dup, CONST_PTR_OFFSET(field->data, pos), data_size);
+		memcpy(data_dup, CONST_PTR_OFFSET(lines, pos), data_size);
 	}
 
 	for (i = 0; i < lines_count; i++) {
@@ -499,6 +595,7 @@ static void header_lines_save(struct header_lookup_context *ctx,
 		hdr_line.data = hdr_data;
 		array_push_back(&ctx->lines, &hdr_line);
 	}
+	return 0;
 }
 
 static int header_lookup_line_cmp(const struct header_lookup_line *l1,
@@ -557,7 +654,8 @@ mail_cache_lookup_headers_real(struct mail_cache_view *view, string_t *dest,
 			/* a) don't want it, b) duplicate */
 		} else {
 			field_state[field.field_idx] = HDR_FIELD_STATE_SEEN;
-			header_lines_save(&ctx, &field);
+			if (header_lines_save(&ctx, &field) < 0)
+				return -1;
 		}
 
 	}
@@ -13,6 +13,12 @@
 
 #define MAIL_CACHE_MAX_WRITE_BUFFER (1024*256)
 
+/* Locked by the process that is purging the cache incrementally */
+#define MAIL_CACHE_PURGE_OWNER_SUFFIX ".purge"
+/* If the owner hasn't done a purging step in this many seconds, other
+   processes stop waiting for it and purge the whole cache at once. */
+#define MAIL_CACHE_PURGE_OWNER_STALE_SECS (5*60)
+
 #define MAIL_CACHE_IS_UNUSABLE(cache) \
 	((cache)->hdr == NULL)
 
@@ -104,6 +110,11 @@ struct mail_cache_record {
 	/* array of { uint32_t field; [ uint32_t size; ] { .. } } */
 };
 
+/* If this bit is set in the size of a variable sized field, the data is
+   compressed: { uint32_t uncompressed_size; zlib stream }. Older versions
+   treat these records as corrupted. */
+#define MAIL_CACHE_FIELD_SIZE_FLAG_COMPRESSED 0x80000000U
+
 struct mail_cache_field_private {
 	struct mail_cache_field field;
 
@@ -195,6 +206,9 @@ struct mail_cache {
 	uint32_t need_purge_file_seq;
 	/* Human-readable reason for purging. Used for debugging and events. */
 	char *need_purge_reason;
+	/* Incremental purging in progress, see
+	   mail_cache_purge_incremental() */
+	struct mail_cache_copy_context *purge_ctx;
 
 	/* Cache has been opened (or it doesn't exist). */
 	bool opened:1;
@@ -238,6 +252,17 @@ struct mail_cache_missing_reason_cache {
 	uoff_t log_file_head_offset;
 };
 
+struct mail_cache_field_location {
+	/* The location is valid if value == mail_cache_view.cached_exists_value */
+	uint8_t value;
+	/* Size of the field's data */
+	uint32_t size;
+	/* Offset to the field's data in cache file */
+	uint32_t offset;
+	/* The data is compressed */
+	bool compressed;
+};
+
 struct mail_cache_view {
 	struct mail_cache *cache;
 	struct mail_cache_view *prev, *next;
@@ -265,6 +290,14 @@ struct mail_cache_view {
 	buffer_t *cached_exists_buf;
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
+	/* cached_exists_seq's first cache record offset and the cache
+	   file_seq when cached_exists_buf was filled. If they no longer match
+	   the index, cached_locations can't be used. */
+	uint32_t cached_exists_offset, cached_exists_reset_id;
+	/* Where each field of cached_exists_seq is in the cache file.
+	   This allows mail_cache_lookup_field() to find the field without
+	   iterating through all the cache records. */
+	ARRAY(struct mail_cache_field_location) cached_locations;
 
 	/* mail_cache_view_update_cache_decisions() has been used to disable
 	   updating cache decisions. */
@@ -281,6 +314,9 @@ struct mail_cache_iterate_field {
 	const void *data;
 	/* Offset to data in cache file */
 	uoff_t offset;
+	/* The data is compressed. Use mail_cache_field_get_data() to
+	   access it. */
+	bool compressed;
 };
 
 struct mail_cache_lookup_iterate_ctx {
@@ -399,6 +435,17 @@ mail_cache_decision_changed_event(struct mail_cache *cache, struct event *event,
 
 bool mail_cache_headers_check_capped(struct mail_cache *cache);
 
+/* Compress the variable sized field data into dest, if cache.compress_min_size
+   is set and the data is large enough. Returns FALSE if the data should be
+   written uncompressed. */
+bool mail_cache_field_compress(struct mail_cache *cache, const void *data,
+			       size_t size, buffer_t *dest);
+/* Append the field's data to dest, uncompressing it if needed. Returns 0 if
+   ok, -1 if the compressed data is corrupted. */
+int mail_cache_field_get_data(struct mail_cache *cache,
+			      const struct mail_cache_iterate_field *field,
+			      buffer_t *dest);
+
 struct mail_cache_purge_drop_ctx {
 	struct mail_cache *cache;
 	time_t max_yes_downgrade_time;
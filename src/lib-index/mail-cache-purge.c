@@ -1,11 +1,15 @@
 /* Copyright (c) Dovecot authors, see top-level COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "array.h"
+#include "hostpid.h"
 #include "ostream.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
+#include "write-full.h"
 #include "file-dotlock.h"
+#include "file-lock.h"
 #include "file-cache.h"
 #include "file-set-size.h"
 #include "mail-cache-private.h"
@@ -13,6 +17,14 @@
 #include <stdio.h>
 #include <sys/stat.h>
 
+struct mail_cache_copy_record {
+	uint32_t uid;
+	/* Record's offset in the old cache file when it was copied */
+	uint32_t old_offset;
+	/* Record's offset in the new cache file, 0 if nothing was copied */
+	uint32_t new_offset;
+};
+
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
 	struct event *event;
@@ -20,10 +32,39 @@ struct mail_cache_copy_context {
 
 	buffer_t *buffer, *field_seen;
 	ARRAY(unsigned int) bitmask_pos;
+	/* cache->fields[] index -> new file's field index. Fields registered
+	   after the purging started aren't in the map. */
 	uint32_t *field_file_map;
+	/* Caching decisions that are set once the purging is finished */
+	enum mail_cache_decision_type *field_decisions;
+	unsigned int orig_fields_count, used_fields_count;
+
+	/* The new cache file */
+	int fd;
+	char *temp_path;
+	struct ostream *output;
+	struct mail_cache_header hdr;
+	/* Incremental purging: the locked <cache>.purge file, which contains
+	   the name of our temp file. */
+	int owner_fd;
+	struct file_lock *owner_lock;
+	/* The cache file being purged */
+	uint32_t prev_file_seq;
+	uoff_t prev_file_size;
+
+	/* Messages copied by mail_cache_copy_step() in UID order. Only the
+	   messages that had something cached are included. */
+	ARRAY(struct mail_cache_copy_record) records;
+	/* Number of records with new_offset != 0 */
+	unsigned int records_copied;
+	/* The next UID that mail_cache_copy_step() copies */
+	uint32_t next_uid;
+	unsigned int step_count;
 
 	uint8_t field_seen_value;
 	bool new_msg;
+	/* Creating the initial cache file. All the fields are kept. */
+	bool initial;
 };
 
 static void
@@ -53,6 +94,10 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 	uint32_t file_field_idx, size32;
 	uint8_t *field_seen;
 
+	if (field->field_idx >= ctx->orig_fields_count) {
+		/* field was registered after the purging started */
+		return;
+	}
 	file_field_idx = ctx->field_file_map[field->field_idx];
 	if (file_field_idx == (uint32_t)-1)
 		return;
@@ -69,7 +114,8 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 	}
 	*field_seen = ctx->field_seen_value;
 
-	dec = cache_field->decision & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED);
+	dec = ctx->field_decisions[field->field_idx] &
+		ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED);
 	if (ctx->new_msg) {
 		if (dec == MAIL_CACHE_DECISION_NO)
 			return;
@@ -82,6 +128,8 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 
 	if (cache_field->field_size == UINT_MAX) {
 		size32 = (uint32_t)field->size;
+		if (field->compressed)
+			size32 |= MAIL_CACHE_FIELD_SIZE_FLAG_COMPRESSED;
 		buffer_append(ctx->buffer, &size32, sizeof(size32));
 	}
 
@@ -118,33 +166,35 @@ static uint32_t get_next_file_seq(struct mail_cache *cache)
 }
 
 static void
-mail_cache_purge_get_fields(struct mail_cache_copy_context *ctx,
-			    unsigned int used_fields_count)
+mail_cache_purge_get_fields(struct mail_cache_copy_context *ctx)
 {
 	struct mail_cache *cache = ctx->cache;
 	unsigned int i, j, idx;
 
 	/* Make mail_cache_header_fields_get() return the fields in
-	   the same order as we saved them. */
+	   the same order as we saved them. The fields registered after
+	   the purging started aren't in the new file. */
 	memcpy(cache->field_file_map, ctx->field_file_map,
-	       sizeof(uint32_t) * cache->fields_count);
+	       sizeof(uint32_t) * ctx->orig_fields_count);
+	for (i = ctx->orig_fields_count; i < cache->fields_count; i++)
+		cache->field_file_map[i] = (uint32_t)-1;
 
 	/* reverse mapping */
-	cache->file_fields_count = used_fields_count;
+	cache->file_fields_count = ctx->used_fields_count;
 	i_free(cache->file_field_map);
-	cache->file_field_map = used_fields_count == 0 ? NULL :
-		i_new(unsigned int, used_fields_count);
+	cache->file_field_map = ctx->used_fields_count == 0 ? NULL :
+		i_new(unsigned int, ctx->used_fields_count);
 	for (i = j = 0; i < cache->fields_count; i++) {
 		idx = cache->field_file_map[i];
 		if (idx != (uint32_t)-1) {
-			i_assert(idx < used_fields_count &&
+			i_assert(idx < ctx->used_fields_count &&
 				 cache->file_field_map != NULL &&
 				 cache->file_field_map[idx] == 0);
 			cache->file_field_map[idx] = i;
 			j++;
 		}
 	}
-	i_assert(j == used_fields_count);
+	i_assert(j == ctx->used_fields_count);
 
 	buffer_set_used_size(ctx->buffer, 0);
 	mail_cache_header_fields_get(cache, ctx->buffer);
@@ -188,88 +238,316 @@ mail_cache_purge_check_field(struct mail_cache_copy_context *ctx,
 		break;
 	}
 	}
-	priv->field.decision = dec;
+	ctx->field_decisions[field] = dec;
 
 	/* drop all fields we don't want */
-	if ((dec & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) == MAIL_CACHE_DECISION_NO) {
-		priv->used = FALSE;
-		priv->field.last_used = 0;
-	}
+	if ((dec & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) == MAIL_CACHE_DECISION_NO)
+		return FALSE;
 	return priv->used;
 }
 
+static void
+mail_cache_purge_update_decisions(struct mail_cache_copy_context *ctx)
+{
+	struct mail_cache_field_private *priv;
+	unsigned int i;
+
+	if (ctx->initial)
+		return;
+
+	for (i = 0; i < ctx->orig_fields_count; i++) {
+		priv = &ctx->cache->fields[i];
+		priv->field.decision = ctx->field_decisions[i];
+		if ((priv->field.decision &
+		     ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) ==
+		    MAIL_CACHE_DECISION_NO) {
+			priv->used = FALSE;
+			priv->field.last_used = 0;
+		}
+	}
+}
+
 static int
-mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
-		struct event *event, int fd, const char *reason,
-		uint32_t *file_seq_r, uoff_t *file_size_r, uint32_t *max_uid_r,
-		uint32_t *ext_first_seq_r, ARRAY_TYPE(uint32_t) *ext_offsets)
+mail_cache_copy_init(struct mail_cache *cache, struct mail_index_view *view,
+		     const char *temp_path_prefix, const char *reason,
+		     struct mail_cache_copy_context **ctx_r)
 {
-        struct mail_cache_copy_context ctx;
-	struct mail_cache_lookup_iterate_ctx iter;
-	struct mail_cache_iterate_field field;
-	struct mail_index_view *view;
-	struct mail_cache_view *cache_view;
+	struct mail_cache_copy_context *ctx;
 	const struct mail_index_header *idx_hdr;
-	struct mail_cache_header hdr;
-	struct mail_cache_record cache_rec;
-	struct ostream *output;
-	uint32_t message_count, seq, first_new_seq, ext_offset;
-	unsigned int i, used_fields_count, orig_fields_count, record_count;
+	const char *temp_path;
+	unsigned int i;
+	int fd;
 
 	i_assert(reason != NULL);
 
-	*max_uid_r = 0;
-	*ext_first_seq_r = 0;
-
 	/* get the latest info on fields */
 	if (mail_cache_header_fields_read(cache) < 0)
 		return -1;
 
-	view = mail_index_transaction_open_updated_view(trans);
-	cache_view = mail_cache_view_open(cache, view);
-	output = o_stream_create_fd_file(fd, 0, FALSE);
-
-	i_zero(&hdr);
-	hdr.major_version = MAIL_CACHE_MAJOR_VERSION;
-	hdr.minor_version = MAIL_CACHE_MINOR_VERSION;
-	hdr.compat_sizeof_uoff_t = sizeof(uoff_t);
-	hdr.indexid = cache->index->indexid;
-	hdr.file_seq = get_next_file_seq(cache);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	event_add_str(event, "reason", reason);
-	event_add_int(event, "file_seq", hdr.file_seq);
-	event_set_name(event, "mail_cache_purge_started");
-	e_debug(event, "Purging (new file_seq=%u): %s", hdr.file_seq, reason);
-
-	i_zero(&ctx);
-	ctx.cache = cache;
-	ctx.event = event;
-	ctx.buffer = buffer_create_dynamic(default_pool, 4096);
-	ctx.field_seen = buffer_create_dynamic(default_pool, 64);
-	ctx.field_seen_value = 0;
-	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
-	t_array_init(&ctx.bitmask_pos, 32);
+	/* we want to recreate the cache. write it first to a temporary file */
+	fd = mail_index_create_tmp_file(cache->index, temp_path_prefix,
+					&temp_path);
+	if (fd == -1)
+		return -1;
+
+	ctx = i_new(struct mail_cache_copy_context, 1);
+	ctx->cache = cache;
+	ctx->fd = fd;
+	ctx->owner_fd = -1;
+	ctx->temp_path = i_strdup(temp_path);
+	ctx->output = o_stream_create_fd_file(fd, 0, FALSE);
+	ctx->buffer = buffer_create_dynamic(default_pool, 4096);
+	ctx->field_seen = buffer_create_dynamic(default_pool, 64);
+	ctx->field_seen_value = 0;
+	i_array_init(&ctx->bitmask_pos, 32);
+	i_array_init(&ctx->records, 128);
+	ctx->next_uid = 1;
+
+	if (cache->hdr != NULL) {
+		ctx->prev_file_seq = cache->hdr->file_seq;
+		ctx->prev_file_size = cache->last_stat_size;
+	}
+	ctx->event = event_create(cache->event);
+	event_add_int(ctx->event, "prev_file_seq", ctx->prev_file_seq);
+	event_add_int(ctx->event, "prev_file_size", ctx->prev_file_size);
+	event_add_int(ctx->event, "prev_deleted_records",
+		      cache->hdr == NULL ? 0 : cache->hdr->deleted_record_count);
+
+	ctx->hdr.major_version = MAIL_CACHE_MAJOR_VERSION;
+	ctx->hdr.minor_version = MAIL_CACHE_MINOR_VERSION;
+	ctx->hdr.compat_sizeof_uoff_t = sizeof(uoff_t);
+	ctx->hdr.indexid = cache->index->indexid;
+	ctx->hdr.file_seq = get_next_file_seq(cache);
+	o_stream_nsend(ctx->output, &ctx->hdr, sizeof(ctx->hdr));
+
+	event_add_str(ctx->event, "reason", reason);
+	event_add_int(ctx->event, "file_seq", ctx->hdr.file_seq);
+	event_set_name(ctx->event, "mail_cache_purge_started");
+	e_debug(ctx->event, "Purging (new file_seq=%u): %s",
+		ctx->hdr.file_seq, reason);
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
 	   used fields */
 	idx_hdr = mail_index_get_header(view);
-	mail_cache_purge_drop_init(cache, idx_hdr, &ctx.drop_ctx);
+	mail_cache_purge_drop_init(cache, idx_hdr, &ctx->drop_ctx);
 
-	orig_fields_count = cache->fields_count;
+	ctx->orig_fields_count = cache->fields_count;
+	ctx->field_file_map = i_new(uint32_t, ctx->orig_fields_count + 1);
+	ctx->field_decisions = i_new(enum mail_cache_decision_type,
+				     ctx->orig_fields_count + 1);
 	if (cache->file_fields_count == 0) {
 		/* creating the initial cache file. add all fields. */
-		for (i = 0; i < orig_fields_count; i++)
-			ctx.field_file_map[i] = i;
-		used_fields_count = i;
+		ctx->initial = TRUE;
+		for (i = 0; i < ctx->orig_fields_count; i++) {
+			ctx->field_file_map[i] = i;
+			ctx->field_decisions[i] =
+				cache->fields[i].field.decision;
+		}
+		ctx->used_fields_count = i;
 	} else {
-		for (i = used_fields_count = 0; i < orig_fields_count; i++) {
-			if (!mail_cache_purge_check_field(&ctx, i))
-				ctx.field_file_map[i] = (uint32_t)-1;
+		for (i = 0; i < ctx->orig_fields_count; i++) {
+			if (!mail_cache_purge_check_field(ctx, i))
+				ctx->field_file_map[i] = (uint32_t)-1;
 			else
-				ctx.field_file_map[i] = used_fields_count++;
+				ctx->field_file_map[i] = ctx->used_fields_count++;
+		}
+	}
+	*ctx_r = ctx;
+	return 0;
+}
+
+static bool mail_cache_copy_temp_file_is_ours(struct mail_cache_copy_context *ctx)
+{
+	struct stat st1, st2;
+
+	/* mail_index_create_tmp_file() in another process unlinks the temp
+	   file if it already exists */
+	if (fstat(ctx->fd, &st1) < 0 || stat(ctx->temp_path, &st2) < 0)
+		return FALSE;
+	return st1.st_ino == st2.st_ino && CMP_DEV_T(st1.st_dev, st2.st_dev);
+}
+
+static void mail_cache_copy_deinit(struct mail_cache_copy_context **_ctx)
+{
+	struct mail_cache_copy_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	if (ctx->output != NULL) {
+		o_stream_abort(ctx->output);
+		o_stream_destroy(&ctx->output);
+	}
+	if (ctx->fd != -1) {
+		if (mail_cache_copy_temp_file_is_ours(ctx))
+			i_unlink(ctx->temp_path);
+		i_close_fd(&ctx->fd);
+	}
+	if (ctx->owner_lock != NULL) {
+		/* the temp file is gone now */
+		if (ftruncate(ctx->owner_fd, 0) < 0) {
+			mail_index_file_set_syscall_error(ctx->cache->index,
+				file_lock_get_path(ctx->owner_lock),
+				"ftruncate()");
 		}
+		file_lock_free(&ctx->owner_lock);
+	}
+	i_close_fd(&ctx->owner_fd);
+	array_free(&ctx->records);
+	array_free(&ctx->bitmask_pos);
+	buffer_free(&ctx->buffer);
+	buffer_free(&ctx->field_seen);
+	event_unref(&ctx->event);
+	i_free(ctx->field_decisions);
+	i_free(ctx->field_file_map);
+	i_free(ctx->temp_path);
+	i_free(ctx);
+}
+
+/* Copy the message's cache fields to the new file. Returns the offset of the
+   new record or 0 if nothing was copied. */
+static uint32_t
+mail_cache_copy_message(struct mail_cache_copy_context *ctx,
+			struct mail_cache_view *cache_view, uint32_t seq)
+{
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_record cache_rec;
+	uint32_t ext_offset;
+
+	buffer_set_used_size(ctx->buffer, 0);
+
+	ctx->field_seen_value = (ctx->field_seen_value + 1) & UINT8_MAX;
+	if (ctx->field_seen_value == 0) {
+		memset(buffer_get_modifiable_data(ctx->field_seen, NULL),
+		       0, buffer_get_size(ctx->field_seen));
+		ctx->field_seen_value++;
+	}
+	array_clear(&ctx->bitmask_pos);
+
+	i_zero(&cache_rec);
+	buffer_append(ctx->buffer, &cache_rec, sizeof(cache_rec));
+
+	mail_cache_lookup_iter_init(cache_view, seq, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0)
+		mail_cache_purge_field(ctx, &field);
+
+	if (ctx->buffer->used == sizeof(cache_rec) ||
+	    ctx->buffer->used > ctx->cache->index->optimization_set.cache.record_max_size) {
+		/* nothing cached */
+		return 0;
+	}
+
+	cache_rec.size = ctx->buffer->used;
+	ext_offset = ctx->output->offset;
+	buffer_write(ctx->buffer, 0, &cache_rec, sizeof(cache_rec));
+	o_stream_nsend(ctx->output, ctx->buffer->data, cache_rec.size);
+	return ext_offset;
+}
+
+/* Copy messages starting from ctx->next_uid until max_size bytes have been
+   written to the new file. Returns TRUE if all messages have been copied. */
+static bool
+mail_cache_copy_step(struct mail_cache_copy_context *ctx,
+		     struct mail_index_view *view, uoff_t max_size)
+{
+	struct mail_cache_view *cache_view;
+	struct mail_cache_copy_record *rec;
+	uoff_t start_offset = ctx->output->offset;
+	uint32_t seq, seq2, first_new_seq, uid, old_offset, reset_id;
+
+	if (!mail_index_lookup_seq_range(view, ctx->next_uid, (uint32_t)-1,
+					 &seq, &seq2))
+		return TRUE;
+
+	first_new_seq = mail_cache_get_first_new_seq(view);
+	cache_view = mail_cache_view_open(ctx->cache, view);
+	for (; seq <= seq2; seq++) {
+		if (ctx->output->offset - start_offset >= max_size)
+			break;
+		mail_index_lookup_uid(view, seq, &uid);
+		ctx->next_uid = uid + 1;
+
+		old_offset = mail_cache_lookup_cur_offset(view, seq, &reset_id);
+		if (old_offset == 0 || reset_id != ctx->prev_file_seq)
+			continue;
+
+		ctx->new_msg = seq >= first_new_seq;
+		rec = array_append_space(&ctx->records);
+		rec->uid = uid;
+		rec->old_offset = old_offset;
+		rec->new_offset = mail_cache_copy_message(ctx, cache_view, seq);
+		if (rec->new_offset != 0)
+			ctx->records_copied++;
 	}
+	mail_cache_view_close(&cache_view);
+	ctx->step_count++;
+
+	struct event_passthrough *e =
+		event_create_passthrough(ctx->event)->
+		set_name("mail_cache_purge_progress")->
+		add_int("step", ctx->step_count)->
+		add_int("next_uid", ctx->next_uid)->
+		add_int("records_copied", ctx->records_copied)->
+		add_int("file_size", ctx->output->offset);
+	e_debug(e->event(), "Purging in progress (step %u): "
+		"copied %u records up to UID %u, size=%"PRIuUOFF_T,
+		ctx->step_count, ctx->records_copied, ctx->next_uid - 1,
+		ctx->output->offset);
+	return seq > seq2;
+}
+
+static int
+mail_cache_copy_record_cmp(const uint32_t *uid,
+			   const struct mail_cache_copy_record *rec)
+{
+	if (*uid < rec->uid)
+		return -1;
+	if (*uid > rec->uid)
+		return 1;
+	return 0;
+}
+
+/* Returns the message's offset in the new file. The message is copied unless
+   it was already copied by mail_cache_copy_step() and hasn't changed since. */
+static uint32_t
+mail_cache_copy_finish_message(struct mail_cache_copy_context *ctx,
+			       struct mail_cache_view *cache_view,
+			       uint32_t seq, uint32_t uid,
+			       unsigned int *reused_count)
+{
+	const struct mail_cache_copy_record *rec;
+	uint32_t reset_id;
+
+	rec = array_bsearch(&ctx->records, &uid, mail_cache_copy_record_cmp);
+	if (rec != NULL &&
+	    rec->old_offset == mail_cache_lookup_cur_offset(cache_view->view,
+							    seq, &reset_id) &&
+	    reset_id == ctx->prev_file_seq) {
+		if (rec->new_offset != 0)
+			(*reused_count)++;
+		return rec->new_offset;
+	}
+	return mail_cache_copy_message(ctx, cache_view, seq);
+}
+
+static int
+mail_cache_copy_finish(struct mail_cache_copy_context *ctx,
+		       struct mail_index_transaction *trans,
+		       uoff_t *file_size_r, uint32_t *max_uid_r,
+		       uint32_t *ext_first_seq_r,
+		       ARRAY_TYPE(uint32_t) *ext_offsets)
+{
+	struct mail_cache *cache = ctx->cache;
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	struct ostream *output = ctx->output;
+	uint32_t message_count, seq, first_new_seq, uid, ext_offset;
+	unsigned int record_count = 0, reused_count = 0;
+
+	*max_uid_r = 0;
+	*ext_first_seq_r = 0;
+
+	view = mail_index_transaction_open_updated_view(trans);
+	cache_view = mail_cache_view_open(cache, view);
 
 	/* get sequence of first message which doesn't need its temp fields
 	   removed. */
@@ -283,65 +561,45 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	}
 
 	*ext_first_seq_r = seq;
-	i_array_init(ext_offsets, message_count); record_count = 0;
+	i_array_init(ext_offsets, message_count);
 	for (; seq <= message_count; seq++) {
 		if (mail_index_transaction_is_expunged(trans, seq)) {
 			array_append_zero(ext_offsets);
 			continue;
 		}
 
-		ctx.new_msg = seq >= first_new_seq;
-		buffer_set_used_size(ctx.buffer, 0);
-
-		ctx.field_seen_value = (ctx.field_seen_value + 1) & UINT8_MAX;
-		if (ctx.field_seen_value == 0) {
-			memset(buffer_get_modifiable_data(ctx.field_seen, NULL),
-			       0, buffer_get_size(ctx.field_seen));
-			ctx.field_seen_value++;
-		}
-		array_clear(&ctx.bitmask_pos);
-
-		i_zero(&cache_rec);
-		buffer_append(ctx.buffer, &cache_rec, sizeof(cache_rec));
-
-		mail_cache_lookup_iter_init(cache_view, seq, &iter);
-		while (mail_cache_lookup_iter_next(&iter, &field) > 0)
-			mail_cache_purge_field(&ctx, &field);
-
-		if (ctx.buffer->used == sizeof(cache_rec) ||
-		    ctx.buffer->used > cache->index->optimization_set.cache.record_max_size) {
-			/* nothing cached */
-			ext_offset = 0;
-		} else {
-			mail_index_lookup_uid(view, seq, max_uid_r);
-			cache_rec.size = ctx.buffer->used;
-			ext_offset = output->offset;
-			buffer_write(ctx.buffer, 0, &cache_rec,
-				     sizeof(cache_rec));
-			o_stream_nsend(output, ctx.buffer->data, cache_rec.size);
+		ctx->new_msg = seq >= first_new_seq;
+		mail_index_lookup_uid(view, seq, &uid);
+		ext_offset = mail_cache_copy_finish_message(ctx, cache_view,
+							    seq, uid,
+							    &reused_count);
+		if (ext_offset != 0) {
+			*max_uid_r = uid;
 			record_count++;
 		}
-
 		array_push_back(ext_offsets, &ext_offset);
 	}
-	i_assert(orig_fields_count == cache->fields_count);
+	i_assert(ctx->orig_fields_count <= cache->fields_count);
 
 	bool file_too_large =
 		output->offset > cache->index->optimization_set.cache.max_size;
 	if (!file_too_large) {
-		hdr.record_count = record_count;
-		hdr.field_header_offset = mail_index_uint32_to_offset(output->offset);
-		mail_cache_purge_get_fields(&ctx, used_fields_count);
-		o_stream_nsend(output, ctx.buffer->data, ctx.buffer->used);
+		ctx->hdr.record_count = record_count;
+		/* records copied by the earlier steps that were expunged or
+		   copied again afterwards */
+		ctx->hdr.deleted_record_count =
+			ctx->records_copied - reused_count;
+		ctx->hdr.field_header_offset =
+			mail_index_uint32_to_offset(output->offset);
+		mail_cache_purge_update_decisions(ctx);
+		mail_cache_purge_get_fields(ctx);
+		o_stream_nsend(output, ctx->buffer->data, ctx->buffer->used);
 	}
 
-	hdr.backwards_compat_used_file_size = output->offset;
-	buffer_free(&ctx.buffer);
-	buffer_free(&ctx.field_seen);
-
+	ctx->hdr.backwards_compat_used_file_size = output->offset;
 	*file_size_r = output->offset;
 	(void)o_stream_seek(output, 0);
-	o_stream_nsend(output, &hdr, sizeof(hdr));
+	o_stream_nsend(output, &ctx->hdr, sizeof(ctx->hdr));
 
 	mail_cache_view_close(&cache_view);
 	mail_index_view_close(&view);
@@ -358,83 +616,61 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 				cache->filepath);
 			i_unlink(cache->filepath);
 		}
-		o_stream_destroy(&output);
+		o_stream_destroy(&ctx->output);
 		array_free(ext_offsets);
 		return -1;
 	}
-	o_stream_destroy(&output);
+	o_stream_destroy(&ctx->output);
 
 	if (cache->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(fd) < 0) {
+		if (fdatasync(ctx->fd) < 0) {
 			mail_cache_set_syscall_error(cache, "fdatasync()");
 			array_free(ext_offsets);
 			return -1;
 		}
 	}
-
-	*file_seq_r = hdr.file_seq;
 	return 0;
 }
 
 static int
 mail_cache_purge_write(struct mail_cache *cache,
 		       struct mail_index_transaction *trans,
-		       int fd, const char *temp_path, const char *
-		       reason, bool *unlock)
+		       struct mail_cache_copy_context *ctx, bool *unlock)
 {
-	struct event *event;
 	struct stat st;
-	uint32_t prev_file_seq, file_seq, old_offset, max_uid, ext_first_seq;
+	uint32_t old_offset, max_uid, ext_first_seq;
 	ARRAY_TYPE(uint32_t) ext_offsets;
 	const uint32_t *offsets;
-	uoff_t prev_file_size, file_size;
-	unsigned int i, count, prev_deleted_records;
+	uoff_t file_size;
+	unsigned int i, count;
 
-	if (cache->hdr == NULL) {
-		prev_file_seq = 0;
-		prev_file_size = 0;
-		prev_deleted_records = 0;
-	} else {
-		prev_file_seq = cache->hdr->file_seq;
-		prev_file_size = cache->last_stat_size;
-		prev_deleted_records = cache->hdr->deleted_record_count;
-	}
-	event = event_create(cache->event);
-	event_add_int(event, "prev_file_seq", prev_file_seq);
-	event_add_int(event, "prev_file_size", prev_file_size);
-	event_add_int(event, "prev_deleted_records", prev_deleted_records);
-
-	if (mail_cache_copy(cache, trans, event, fd, reason,
-			    &file_seq, &file_size, &max_uid,
-			    &ext_first_seq, &ext_offsets) < 0) {
-		event_unref(&event);
+	if (mail_cache_copy_finish(ctx, trans, &file_size, &max_uid,
+				   &ext_first_seq, &ext_offsets) < 0)
 		return -1;
-	}
 
-	if (fstat(fd, &st) < 0) {
+	if (fstat(ctx->fd, &st) < 0) {
 		mail_cache_set_syscall_error(cache, "fstat()");
 		array_free(&ext_offsets);
-		event_unref(&event);
 		return -1;
 	}
-	if (rename(temp_path, cache->filepath) < 0) {
+	if (rename(ctx->temp_path, cache->filepath) < 0) {
 		mail_cache_set_syscall_error(cache, "rename()");
 		array_free(&ext_offsets);
-		event_unref(&event);
 		return -1;
 	}
 
-	event_add_int(event, "file_size", file_size);
-	event_add_int(event, "max_uid", max_uid);
-	event_set_name(event, "mail_cache_purge_finished");
-	e_debug(event, "Purging finished, file_seq changed %u -> %u, "
-		"size=%"PRIuUOFF_T" -> %"PRIuUOFF_T", max_uid=%u",
-		prev_file_seq, file_seq, prev_file_size, file_size, max_uid);
-	event_unref(&event);
+	event_add_int(ctx->event, "file_size", file_size);
+	event_add_int(ctx->event, "max_uid", max_uid);
+	event_add_int(ctx->event, "steps", ctx->step_count);
+	event_set_name(ctx->event, "mail_cache_purge_finished");
+	e_debug(ctx->event, "Purging finished, file_seq changed %u -> %u, "
+		"size=%"PRIuUOFF_T" -> %"PRIuUOFF_T", max_uid=%u, steps=%u",
+		ctx->prev_file_seq, ctx->hdr.file_seq, ctx->prev_file_size,
+		file_size, max_uid, ctx->step_count);
 
 	/* once we're sure that the purging was successful,
 	   update the offsets */
-	mail_index_ext_reset(trans, cache->ext_id, file_seq, TRUE);
+	mail_index_ext_reset(trans, cache->ext_id, ctx->hdr.file_seq, TRUE);
 	offsets = array_get(&ext_offsets, &count);
 	for (i = 0; i < count; i++) {
 		if (offsets[i] != 0) {
@@ -452,10 +688,11 @@ mail_cache_purge_write(struct mail_cache *cache,
 
 	mail_cache_file_close(cache);
 	cache->opened = TRUE;
-	cache->fd = fd;
+	cache->fd = ctx->fd;
 	cache->st_ino = st.st_ino;
 	cache->st_dev = st.st_dev;
 	cache->field_header_write_pending = FALSE;
+	ctx->fd = -1;
 	return 0;
 }
 
@@ -496,13 +733,29 @@ mail_cache_purge_has_file_changed(struct mail_cache *cache,
 	}
 }
 
+/* Returns TRUE if the incremental purging can be continued. */
+static bool mail_cache_copy_is_valid(struct mail_cache_copy_context *ctx)
+{
+	if (mail_cache_purge_has_file_changed(ctx->cache,
+					      ctx->prev_file_seq) != 0 ||
+	    !mail_cache_copy_temp_file_is_ours(ctx)) {
+		e_debug(event_create_passthrough(ctx->event)->
+			set_name("mail_cache_purge_aborted")->event(),
+			"Purging aborted: Cache file was changed by "
+			"another process");
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static int mail_cache_purge_locked(struct mail_cache *cache,
 				   uint32_t purge_file_seq,
 				   struct mail_index_transaction *trans,
 				   const char *reason, bool *unlock)
 {
-	const char *temp_path;
-	int fd, ret;
+	struct mail_cache_copy_context *ctx;
+	struct mail_index_view *view;
+	int ret;
 
 	/* we've locked the cache purging now. if somebody else had just
 	   recreated the cache, reopen the cache and return success. */
@@ -527,15 +780,25 @@ static int mail_cache_purge_locked(struct mail_cache *cache,
 			return -1;
 	}
 
-	/* we want to recreate the cache. write it first to a temporary file */
-	fd = mail_index_create_tmp_file(cache->index, cache->filepath, &temp_path);
-	if (fd == -1)
-		return -1;
-	if (mail_cache_purge_write(cache, trans, fd, temp_path, reason, unlock) < 0) {
-		i_close_fd(&fd);
-		i_unlink(temp_path);
-		return -1;
+	/* Finish the incremental purging if it's in progress. The messages
+	   that have changed since they were copied are copied again. */
+	if (cache->purge_ctx != NULL &&
+	    (trans->reset || !mail_cache_copy_is_valid(cache->purge_ctx)))
+		mail_cache_copy_deinit(&cache->purge_ctx);
+	if (cache->purge_ctx == NULL) {
+		view = mail_index_transaction_open_updated_view(trans);
+		ret = mail_cache_copy_init(cache, view, cache->filepath,
+					   reason, &cache->purge_ctx);
+		mail_index_view_close(&view);
+		if (ret < 0)
+			return -1;
 	}
+	ctx = cache->purge_ctx;
+	cache->purge_ctx = NULL;
+	ret = mail_cache_purge_write(cache, trans, ctx, unlock);
+	mail_cache_copy_deinit(&ctx);
+	if (ret < 0)
+		return -1;
 	if (cache->file_cache != NULL)
 		file_cache_set_fd(cache->file_cache, cache->fd);
 
@@ -649,6 +912,197 @@ int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 	return ret;
 }
 
+bool mail_cache_purge_is_incremental(struct mail_cache *cache)
+{
+	struct mail_index *index = cache->index;
+
+	/* The ownership lock is kept over multiple syncs, which doesn't
+	   work well with dotlocks. */
+	return index->optimization_set.cache.purge_chunk_size != 0 &&
+		!MAIL_INDEX_IS_IN_MEMORY(index) && !index->readonly &&
+		index->set.lock_method != FILE_LOCK_METHOD_DOTLOCK;
+}
+
+/* Try to lock <cache>.purge to become the only process that is purging the
+   cache incrementally. Returns 1 if locked, 0 if another process has it
+   locked, -1 on error. */
+static int
+mail_cache_purge_owner_lock(struct mail_cache *cache, int *fd_r,
+			    struct file_lock **lock_r, time_t *owner_mtime_r)
+{
+	struct mail_index *index = cache->index;
+	struct file_lock_settings lock_set = {
+		.lock_method = index->set.lock_method,
+	};
+	const char *path, *error;
+	struct stat st;
+	mode_t old_mask;
+	int fd, ret;
+
+	path = t_strconcat(cache->filepath, MAIL_CACHE_PURGE_OWNER_SUFFIX,
+			   NULL);
+	old_mask = umask(0);
+	fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, index->set.mode);
+	umask(old_mask);
+	if (fd == -1) {
+		mail_index_file_set_syscall_error(index, path, "open()");
+		return -1;
+	}
+	mail_index_fchown(index, fd, path);
+
+	ret = file_try_lock(fd, path, F_WRLCK, &lock_set, lock_r, &error);
+	if (ret < 0)
+		e_error(cache->event, "%s", error);
+	else if (ret == 0) {
+		/* the owner writes to the file after each step */
+		if (fstat(fd, &st) < 0) {
+			mail_index_file_set_syscall_error(index, path,
+							  "fstat()");
+			ret = -1;
+		} else {
+			*owner_mtime_r = st.st_mtime;
+		}
+	}
+	if (ret <= 0) {
+		i_close_fd(&fd);
+		return ret;
+	}
+	*fd_r = fd;
+	return 1;
+}
+
+/* Write our temp file's name to <cache>.purge. This also shows the other
+   processes that the purging is still progressing. */
+static int mail_cache_purge_owner_write(struct mail_cache_copy_context *ctx)
+{
+	const char *path = file_lock_get_path(ctx->owner_lock);
+	const char *temp_fname = strrchr(ctx->temp_path, '/');
+
+	temp_fname = temp_fname == NULL ? ctx->temp_path : temp_fname + 1;
+	if (ftruncate(ctx->owner_fd, 0) < 0) {
+		mail_index_file_set_syscall_error(ctx->cache->index, path,
+						  "ftruncate()");
+		return -1;
+	}
+	if (pwrite_full(ctx->owner_fd, temp_fname, strlen(temp_fname), 0) < 0) {
+		mail_index_file_set_syscall_error(ctx->cache->index, path,
+						  "write()");
+		return -1;
+	}
+	return 0;
+}
+
+/* If the previous owner died in the middle of purging, <cache>.purge still
+   contains the name of its temp file. Delete it. */
+static void
+mail_cache_purge_owner_unlink_stale(struct mail_cache *cache, int owner_fd)
+{
+	char fname[NAME_MAX + 1];
+	const char *dir, *cache_fname, *p;
+	ssize_t ret;
+
+	ret = pread(owner_fd, fname, sizeof(fname) - 1, 0);
+	if (ret < 0) {
+		mail_index_file_set_syscall_error(cache->index,
+			t_strconcat(cache->filepath,
+				    MAIL_CACHE_PURGE_OWNER_SUFFIX, NULL),
+			"read()");
+		return;
+	}
+	fname[ret] = '\0';
+
+	p = strrchr(cache->filepath, '/');
+	if (p == NULL) {
+		dir = ".";
+		cache_fname = cache->filepath;
+	} else {
+		dir = t_strdup_until(cache->filepath, p);
+		cache_fname = p + 1;
+	}
+	/* don't trust the contents too much */
+	if (ret == 0 || strchr(fname, '/') != NULL ||
+	    !str_begins_with(fname, cache_fname) ||
+	    !str_ends_with(fname, ".tmp"))
+		return;
+	i_unlink_if_exists(t_strdup_printf("%s/%s", dir, fname));
+}
+
+int mail_cache_purge_incremental(struct mail_cache *cache,
+				 uint32_t purge_file_seq, const char *reason)
+{
+	uoff_t chunk_size = cache->index->optimization_set.cache.purge_chunk_size;
+	struct mail_index_view *view;
+	struct file_lock *owner_lock;
+	const char *temp_path_prefix;
+	time_t owner_mtime;
+	int owner_fd, ret;
+	bool finished;
+
+	i_assert(!cache->index->log_sync_locked);
+
+	if (!mail_cache_purge_is_incremental(cache))
+		return mail_cache_purge(cache, purge_file_seq, reason);
+
+	if (cache->purge_ctx != NULL &&
+	    !mail_cache_copy_is_valid(cache->purge_ctx))
+		mail_cache_copy_deinit(&cache->purge_ctx);
+	if (cache->purge_ctx == NULL) {
+		if (MAIL_CACHE_IS_UNUSABLE(cache) ||
+		    cache->hdr->file_seq != purge_file_seq ||
+		    mail_cache_purge_has_file_changed(cache,
+						      purge_file_seq) != 0) {
+			/* there's nothing to copy incrementally or the file
+			   was just purged. */
+			return mail_cache_purge(cache, purge_file_seq, reason);
+		}
+		ret = mail_cache_purge_owner_lock(cache, &owner_fd,
+						  &owner_lock, &owner_mtime);
+		if (ret < 0)
+			return -1;
+		if (ret == 0) {
+			if (owner_mtime + MAIL_CACHE_PURGE_OWNER_STALE_SECS >
+			    ioloop_time) {
+				/* another process is purging the cache */
+				return 0;
+			}
+			/* The owner hasn't made progress in a while. Purge
+			   everything at once - this aborts its purging. */
+			return mail_cache_purge(cache, purge_file_seq, reason);
+		}
+		mail_cache_purge_owner_unlink_stale(cache, owner_fd);
+
+		temp_path_prefix = t_strdup_printf("%s.%s.%s", cache->filepath,
+						   my_hostname, my_pid);
+		view = mail_index_view_open(cache->index);
+		ret = mail_cache_copy_init(cache, view, temp_path_prefix,
+					   reason, &cache->purge_ctx);
+		mail_index_view_close(&view);
+		if (ret < 0) {
+			file_lock_free(&owner_lock);
+			i_close_fd(&owner_fd);
+			return -1;
+		}
+		cache->purge_ctx->owner_fd = owner_fd;
+		cache->purge_ctx->owner_lock = owner_lock;
+	}
+
+	view = mail_index_view_open(cache->index);
+	cache->purging = TRUE;
+	finished = mail_cache_copy_step(cache->purge_ctx, view, chunk_size);
+	cache->purging = FALSE;
+	mail_index_view_close(&view);
+	if (mail_cache_purge_owner_write(cache->purge_ctx) < 0) {
+		mail_cache_copy_deinit(&cache->purge_ctx);
+		return -1;
+	}
+	if (!finished)
+		return 0;
+
+	/* Everything is copied. Finish with the .log and the cache file
+	   locked. */
+	return mail_cache_purge(cache, purge_file_seq, reason);
+}
+
 bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
 {
 	if (cache->need_purge_file_seq == 0)
@@ -688,6 +1142,8 @@ void mail_cache_purge_later_reset(struct mail_cache *cache)
 {
 	cache->need_purge_file_seq = 0;
 	i_free(cache->need_purge_reason);
+	if (cache->purge_ctx != NULL)
+		mail_cache_copy_deinit(&cache->purge_ctx);
 }
 
 void mail_cache_purge_drop_init(struct mail_cache *cache,
@@ -38,6 +38,8 @@ struct mail_cache_transaction_ctx {
 	uint32_t first_new_seq;
 
 	buffer_t *cache_data;
+	/* Temporary buffer for compressing the added field */
+	buffer_t *compress_buf;
 	ARRAY(uint8_t) cache_field_idx_used;
 	ARRAY(struct mail_cache_transaction_rec) cache_data_seq;
 	ARRAY_TYPE(seq_range) cache_data_wanted_seqs;
@@ -180,6 +182,7 @@ void mail_cache_transaction_rollback(struct mail_cache_transaction_ctx **_ctx)
 
 	mail_index_view_close(&ctx->view->trans_view);
 	buffer_free(&ctx->cache_data);
+	buffer_free(&ctx->compress_buf);
 	if (array_is_created(&ctx->cache_data_seq))
 		array_free(&ctx->cache_data_seq);
 	if (array_is_created(&ctx->cache_data_wanted_seqs))
@@ -473,6 +476,7 @@ mail_cache_transaction_update_fields(struct mail_cache_transaction_ctx *ctx)
 		data_size = ctx->cache->fields[field_idx].field.field_size;
 		if (data_size == UINT_MAX) {
 			memcpy(&data_size, p, sizeof(data_size));
+			data_size &= ~MAIL_CACHE_FIELD_SIZE_FLAG_COMPRESSED;
 			p += sizeof(data_size);
 		}
 		/* data & 32bit padding */
@@ -780,6 +784,7 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 	uint32_t data_size32;
 	unsigned int fixed_size;
 	size_t full_size, record_size;
+	bool compressed = FALSE;
 
 	i_assert(field_idx < ctx->cache->fields_count);
 	i_assert(data_size < (uint32_t)-1);
@@ -804,6 +809,19 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 	fixed_size = ctx->cache->fields[field_idx].field.field_size;
 	i_assert(fixed_size == UINT_MAX || fixed_size == data_size);
 
+	if (fixed_size == UINT_MAX) {
+		if (ctx->compress_buf == NULL) {
+			ctx->compress_buf =
+				buffer_create_dynamic(default_pool, 1024);
+		}
+		if (mail_cache_field_compress(ctx->cache, data, data_size,
+					      ctx->compress_buf)) {
+			data = ctx->compress_buf->data;
+			data_size = ctx->compress_buf->used;
+			compressed = TRUE;
+		}
+	}
+
 	data_size32 = (uint32_t)data_size;
 	full_size = sizeof(field_idx) + ((data_size + 3) & ~3U);
 	if (fixed_size == UINT_MAX)
@@ -872,6 +890,8 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 
 	buffer_append(ctx->cache_data, &field_idx, sizeof(field_idx));
 	if (fixed_size == UINT_MAX) {
+		if (compressed)
+			data_size32 |= MAIL_CACHE_FIELD_SIZE_FLAG_COMPRESSED;
 		buffer_append(ctx->cache_data, &data_size32,
 			      sizeof(data_size32));
 	}
@@ -635,7 +635,7 @@ void mail_cache_free(struct mail_cache **_cache)
 	hash_table_destroy(&cache->field_name_hash);
 	pool_unref(&cache->field_pool);
 	event_unref(&cache->event);
-	i_free(cache->need_purge_reason);
+	mail_cache_purge_later_reset(cache);
 	i_free(cache->field_file_map);
 	i_free(cache->file_field_map);
 	i_free(cache->fields);
@@ -970,6 +970,7 @@ mail_cache_view_open(struct mail_cache *cache, struct mail_index_view *iview)
 	view->cached_exists_buf =
 		buffer_create_dynamic(default_pool,
 				      cache->file_fields_count + 10);
+	i_array_init(&view->cached_locations, cache->file_fields_count + 10);
 	DLLIST_PREPEND(&cache->views, view);
 	return view;
 }
@@ -987,6 +988,7 @@ void mail_cache_view_close(struct mail_cache_view **_view)
 
 	DLLIST_REMOVE(&view->cache->views, view);
 	buffer_free(&view->cached_exists_buf);
+	array_free(&view->cached_locations);
 	i_free(view);
 }
 
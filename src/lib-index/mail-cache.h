@@ -111,6 +111,22 @@ int mail_cache_purge_with_trans(struct mail_cache *cache,
 				uint32_t purge_file_seq, const char *reason);
 int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 		     const char *reason);
+/* Returns TRUE if mail_cache_purge_incremental() copies the cache in
+   multiple steps. */
+bool mail_cache_purge_is_incremental(struct mail_cache *cache);
+/* Like mail_cache_purge(), but if cache.purge_chunk_size is set, copy only
+   that many bytes of records to the new cache file per call. The new file
+   replaces the old one only once everything is copied, so readers keep using
+   the old file until then. The messages whose cache records change in the
+   middle are copied again at the end. Returns 0 also when the purging isn't
+   finished yet - it's continued on the next call.
+
+   Only one process purges incrementally at a time. It keeps <cache>.purge
+   locked, and the other processes return 0 without doing anything unless the
+   owner has stopped progressing. The copying is done without locking, so the
+   transaction log must not be locked by the caller. */
+int mail_cache_purge_incremental(struct mail_cache *cache,
+				 uint32_t purge_file_seq, const char *reason);
 /* Returns TRUE if there is at least something in the cache. */
 bool mail_cache_exists(struct mail_cache *cache);
 /* Open and read cache header. Returns 1 if ok, 0 if cache doesn't exist or it
@@ -339,6 +339,8 @@ mail_index_fsck_records(struct mail_index *index, struct mail_index_map *map,
 	hdr->first_unseen_uid_lowwater = 0;
 	hdr->first_deleted_uid_lowwater = 0;
 
+	/* records may be dropped below */
+	mail_index_record_map_truncate_columns(map->rec_map, 0);
 	rec = map->rec_map->records; last_uid = 0;
 	for (i = 0; i < map->rec_map->records_count; ) {
 		next_rec = PTR_OFFSET(rec, hdr->record_size);
@@ -277,6 +277,7 @@ static void mail_index_map_clear_recent_flags(struct mail_index_map *map)
 		rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
 		rec->flags &= ENUM_NEGATE(MAIL_RECENT);
 	}
+	mail_index_map_update_columns_flags(map, 1, map->hdr.messages_count);
 }
 
 int mail_index_map_check_header(struct mail_index_map *map,
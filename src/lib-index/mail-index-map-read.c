@@ -101,6 +101,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	buffer_append(map->hdr_copy_buf, rec_map->mmap_base, hdr->header_size);
 
 	rec_map->records = PTR_OFFSET(rec_map->mmap_base, map->hdr.header_size);
+	mail_index_record_map_truncate_columns(rec_map, 0);
 	return 1;
 }
 
@@ -246,6 +247,7 @@ mail_index_try_read_map(struct mail_index_map *map,
 	map->rec_map->records =
 		buffer_get_modifiable_data(map->rec_map->buffer, NULL);
 	map->rec_map->records_count = records_count;
+	mail_index_record_map_truncate_columns(map->rec_map, 0);
 
 	mail_index_map_copy_hdr(map, hdr);
 	i_assert(map->hdr_copy_buf->used == map->hdr.header_size);
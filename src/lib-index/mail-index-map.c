@@ -278,6 +278,10 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
+	if (array_is_created(&rec_map->uid_column)) {
+		array_free(&rec_map->uid_column);
+		array_free(&rec_map->flags_column);
+	}
 	array_free(&rec_map->maps);
 	i_free(rec_map);
 }
@@ -328,6 +332,13 @@ static void mail_index_map_copy_records(struct mail_index_record_map *dest,
 
 	dest->records = buffer_get_modifiable_data(dest->buffer, NULL);
 	dest->records_count = src->records_count;
+
+	if (dest != src && array_is_created(&src->uid_column)) {
+		i_array_init(&dest->uid_column, dest->records_count + 16);
+		i_array_init(&dest->flags_column, dest->records_count + 16);
+		array_append_array(&dest->uid_column, &src->uid_column);
+		array_append_array(&dest->flags_column, &src->flags_column);
+	}
 }
 
 static void mail_index_map_copy_header(struct mail_index_map *dest,
@@ -439,6 +450,8 @@ void mail_index_record_map_move_to_private(struct mail_index_map *map)
 		   so truncate them away. */
 		i_assert(new_map->records_count > map->hdr.messages_count);
 		new_map->records_count = map->hdr.messages_count;
+		mail_index_record_map_truncate_columns(new_map,
+						       new_map->records_count);
 		if (new_map->records_count == 0)
 			new_map->last_appended_uid = 0;
 		else {
@@ -496,17 +509,94 @@ bool mail_index_map_get_ext_idx(struct mail_index_map *map,
 	return *idx_r != (uint32_t)-1;
 }
 
+void mail_index_map_update_columns(struct mail_index_map *map)
+{
+	struct mail_index_record_map *rec_map = map->rec_map;
+	const struct mail_index_record *rec;
+	uint32_t *uids;
+	uint8_t *flags;
+	unsigned int i, count;
+
+	if (!array_is_created(&rec_map->uid_column)) {
+		i_array_init(&rec_map->uid_column, rec_map->records_count + 16);
+		i_array_init(&rec_map->flags_column,
+			     rec_map->records_count + 16);
+	}
+	count = array_count(&rec_map->uid_column);
+	i_assert(count <= rec_map->records_count);
+	if (count == rec_map->records_count)
+		return;
+
+	(void)array_idx_get_space(&rec_map->uid_column,
+				  rec_map->records_count - 1);
+	(void)array_idx_get_space(&rec_map->flags_column,
+				  rec_map->records_count - 1);
+	uids = array_front_modifiable(&rec_map->uid_column);
+	flags = array_front_modifiable(&rec_map->flags_column);
+
+	rec = MAIL_INDEX_MAP_IDX(map, count);
+	for (i = count; i < rec_map->records_count; i++) {
+		uids[i] = rec->uid;
+		flags[i] = rec->flags;
+		rec = CONST_PTR_OFFSET(rec, map->hdr.record_size);
+	}
+}
+
+void mail_index_record_map_truncate_columns(struct mail_index_record_map *rec_map,
+					    unsigned int count)
+{
+	unsigned int old_count;
+
+	if (!array_is_created(&rec_map->uid_column))
+		return;
+
+	old_count = array_count(&rec_map->uid_column);
+	if (old_count > count) {
+		array_delete(&rec_map->uid_column, count, old_count - count);
+		array_delete(&rec_map->flags_column, count, old_count - count);
+	}
+}
+
+void mail_index_map_update_columns_flags(struct mail_index_map *map,
+					 uint32_t seq1, uint32_t seq2)
+{
+	uint8_t *flags;
+	unsigned int count;
+	uint32_t seq;
+
+	if (!array_is_created(&map->rec_map->flags_column))
+		return;
+
+	flags = array_get_modifiable(&map->rec_map->flags_column, &count);
+	if (seq2 > count)
+		seq2 = count;
+	for (seq = seq1; seq <= seq2; seq++)
+		flags[seq-1] = MAIL_INDEX_REC_AT_SEQ(map, seq)->flags;
+}
+
+static inline uint32_t
+mail_index_bsearch_uid_at(struct mail_index_map *map, const uint32_t *uids,
+			  uint32_t idx)
+{
+	if (uids != NULL)
+		return uids[idx];
+	return MAIL_INDEX_MAP_IDX(map, idx)->uid;
+}
+
 static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 				       uint32_t uid, uint32_t left_idx,
 				       int nearest_side)
 {
-	const struct mail_index_record *rec_base, *rec;
-	uint32_t idx, right_idx, record_size;
+	const uint32_t *uids = NULL;
+	uint32_t idx, right_idx, rec_uid;
 
 	i_assert(map->hdr.messages_count <= map->rec_map->records_count);
 
-	rec_base = map->rec_map->records;
-	record_size = map->hdr.record_size;
+	/* Use the dense UID column if it's already built. It has many more
+	   UIDs per cache line than the records. */
+	if (array_is_created(&map->rec_map->uid_column) &&
+	    array_count(&map->rec_map->uid_column) >= map->hdr.messages_count)
+		uids = array_front(&map->rec_map->uid_column);
 
 	idx = left_idx;
 	right_idx = I_MIN(map->hdr.messages_count, uid);
@@ -515,25 +605,25 @@ static uint32_t mail_index_bsearch_uid(struct mail_index_map *map,
 	while (left_idx < right_idx) {
 		idx = (left_idx + right_idx) / 2;
 
-                rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
-		if (rec->uid < uid)
+		rec_uid = mail_index_bsearch_uid_at(map, uids, idx);
+		if (rec_uid < uid)
 			left_idx = idx+1;
-		else if (rec->uid > uid)
+		else if (rec_uid > uid)
 			right_idx = idx;
 		else
 			break;
 	}
 	i_assert(idx < map->hdr.messages_count);
 
-	rec = CONST_PTR_OFFSET(rec_base, idx * record_size);
-	if (rec->uid != uid) {
+	rec_uid = mail_index_bsearch_uid_at(map, uids, idx);
+	if (rec_uid != uid) {
 		if (nearest_side > 0) {
 			/* we want uid or larger */
-			return rec->uid > uid ? idx+1 :
+			return rec_uid > uid ? idx+1 :
 				(idx == map->hdr.messages_count-1 ? 0 : idx+2);
 		} else {
 			/* we want uid or smaller */
-			return rec->uid < uid ? idx + 1 : idx;
+			return rec_uid < uid ? idx + 1 : idx;
 		}
 	}
 
@@ -132,6 +132,14 @@ struct mail_index_record_map {
 	void *records; /* struct mail_index_record[] */
 	unsigned int records_count;
 
+	/* Dense copies of the first records' UIDs and flags. Scanning these
+	   doesn't need to stride through the extension data in the records.
+	   They're built on demand by mail_index_map_update_columns() and
+	   truncated whenever the records before their end change. Both
+	   arrays always have the same number of elements. */
+	ARRAY(uint32_t) uid_column;
+	ARRAY(uint8_t) flags_column;
+
 	uint32_t last_appended_uid;
 };
 
@@ -390,6 +398,16 @@ void mail_index_map_lookup_seq_range(struct mail_index_map *map,
 				     uint32_t *first_seq_r,
 				     uint32_t *last_seq_r);
 
+/* Add the rest of the rec_map's records to the UID and flags columns. */
+void mail_index_map_update_columns(struct mail_index_map *map);
+/* Drop the columns' elements after the first count records. This must be
+   called whenever records' UIDs are changed or records are removed. */
+void mail_index_record_map_truncate_columns(struct mail_index_record_map *rec_map,
+					    unsigned int count);
+/* Update the flags column after the records' flags were changed. */
+void mail_index_map_update_columns_flags(struct mail_index_map *map,
+					 uint32_t seq1, uint32_t seq2);
+
 /* Returns TRUE if indexid is ok, FALSE if it has either unexpectedly changed,
    or it couldn't be determined easily whether it has changed permanently or
    temporarily. If FALSE is returned, the mailbox should be reopened. */
@@ -257,6 +257,9 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 		}
 	}
 
+	/* the records are moved starting from the first expunged one */
+	mail_index_record_map_truncate_columns(map->rec_map, range[0].seq1 - 1);
+
 	prev_seq2 = 0;
 	dest_seq1 = 1;
 	orig_rec_count = map->rec_map->records_count;
@@ -297,6 +300,35 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	}
 }
 
+static void
+sync_expunge_get_seqs(struct mail_index_sync_map_ctx *ctx,
+		      const struct mail_transaction_header *hdr,
+		      const void *data, ARRAY_TYPE(seq_range) *seqs)
+{
+	uint32_t seq1, seq2;
+
+	if ((hdr->type & MAIL_TRANSACTION_EXPUNGE_GUID) == 0) {
+		const struct mail_transaction_expunge *rec = data, *end;
+
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (; rec != end; rec++) {
+			if (mail_index_lookup_seq_range(ctx->view,
+					rec->uid1, rec->uid2, &seq1, &seq2))
+				seq_range_array_add_range(seqs, seq1, seq2);
+		}
+	} else {
+		const struct mail_transaction_expunge_guid *rec = data, *end;
+
+		end = CONST_PTR_OFFSET(data, hdr->size);
+		for (; rec != end; rec++) {
+			i_assert(rec->uid != 0);
+
+			if (mail_index_lookup_seq(ctx->view, rec->uid, &seq1))
+				seq_range_array_add(seqs, seq1);
+		}
+	}
+}
+
 static void *sync_append_record(struct mail_index_map *map)
 {
 	size_t append_pos;
@@ -468,6 +500,7 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 								 rec->flags);
 		}
 	}
+	mail_index_map_update_columns_flags(view->map, seq1, seq2);
 	return 1;
 }
 
@@ -532,44 +565,17 @@ mail_index_sync_record_real(struct mail_index_sync_map_ctx *ctx,
 		break;
 	}
 	case MAIL_TRANSACTION_EXPUNGE:
-	case MAIL_TRANSACTION_EXPUNGE|MAIL_TRANSACTION_EXPUNGE_PROT: {
-		const struct mail_transaction_expunge *rec = data, *end;
-		ARRAY_TYPE(seq_range) seqs;
-		uint32_t seq1, seq2;
-
-		if ((hdr->type & MAIL_TRANSACTION_EXTERNAL) == 0) {
-			/* this is simply a request for expunge */
-			break;
-		}
-		t_array_init(&seqs, 64);
-		end = CONST_PTR_OFFSET(data, hdr->size);
-		for (; rec != end; rec++) {
-			if (mail_index_lookup_seq_range(ctx->view,
-					rec->uid1, rec->uid2, &seq1, &seq2))
-				seq_range_array_add_range(&seqs, seq1, seq2);
-		}
-		sync_expunge_range(ctx, &seqs);
-		break;
-	}
+	case MAIL_TRANSACTION_EXPUNGE|MAIL_TRANSACTION_EXPUNGE_PROT:
 	case MAIL_TRANSACTION_EXPUNGE_GUID:
 	case MAIL_TRANSACTION_EXPUNGE_GUID|MAIL_TRANSACTION_EXPUNGE_PROT: {
-		const struct mail_transaction_expunge_guid *rec = data, *end;
 		ARRAY_TYPE(seq_range) seqs;
-		uint32_t seq;
 
 		if ((hdr->type & MAIL_TRANSACTION_EXTERNAL) == 0) {
 			/* this is simply a request for expunge */
 			break;
 		}
 		t_array_init(&seqs, 64);
-		end = CONST_PTR_OFFSET(data, hdr->size);
-		for (; rec != end; rec++) {
-			i_assert(rec->uid != 0);
-
-			if (mail_index_lookup_seq(ctx->view, rec->uid, &seq))
-				seq_range_array_add(&seqs, seq);
-		}
-
+		sync_expunge_get_seqs(ctx, hdr, data, &seqs);
 		sync_expunge_range(ctx, &seqs);
 		break;
 	}
@@ -925,6 +931,36 @@ bool mail_index_sync_map_want_index_reopen(struct mail_index_map *map,
 	return FALSE;
 }
 
+static bool
+mail_index_sync_record_is_expunge(const struct mail_transaction_header *hdr)
+{
+	if ((hdr->type & MAIL_TRANSACTION_EXTERNAL) == 0)
+		return FALSE;
+
+	switch (hdr->type & MAIL_TRANSACTION_TYPE_MASK) {
+	case MAIL_TRANSACTION_EXPUNGE:
+	case MAIL_TRANSACTION_EXPUNGE|MAIL_TRANSACTION_EXPUNGE_PROT:
+	case MAIL_TRANSACTION_EXPUNGE_GUID:
+	case MAIL_TRANSACTION_EXPUNGE_GUID|MAIL_TRANSACTION_EXPUNGE_PROT:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void
+mail_index_sync_flush_expunges(struct mail_index_sync_map_ctx *ctx,
+			       ARRAY_TYPE(seq_range) *seqs)
+{
+	if (array_count(seqs) == 0)
+		return;
+
+	T_BEGIN {
+		sync_expunge_range(ctx, seqs);
+	} T_END;
+	array_clear(seqs);
+}
+
 int mail_index_sync_map(struct mail_index_map **_map,
 			enum mail_index_sync_handler_type type,
 			const char **reason_r)
@@ -935,6 +971,7 @@ int mail_index_sync_map(struct mail_index_map **_map,
 	struct mail_index_sync_map_ctx sync_map_ctx;
 	const struct mail_transaction_header *thdr;
 	const void *tdata;
+	ARRAY_TYPE(seq_range) expunge_seqs;
 	uint32_t prev_seq;
 	uoff_t start_offset, prev_offset;
 	const char *reason, *error;
@@ -1002,6 +1039,13 @@ int mail_index_sync_map(struct mail_index_map **_map,
 	}
 	map = NULL;
 
+	/* Consecutive expunge records are applied at once. Each expunge
+	   moves all the following records in the map, so applying them one
+	   by one is slow with large mailboxes. The pending expunges don't
+	   change the map, so their sequences stay valid until they're
+	   applied. */
+	i_array_init(&expunge_seqs, 64);
+
 	/* mail_transaction_log_view_next() returns -1 on corruption.
 	   Since the log file content before the corruption was found can be
 	   useful and important, we don't fail this sync entirely. Instead,
@@ -1019,9 +1063,20 @@ int mail_index_sync_map(struct mail_index_map **_map,
 			continue;
 		}
 
+		if (mail_index_sync_record_is_expunge(thdr)) {
+			T_BEGIN {
+				sync_expunge_get_seqs(&sync_map_ctx, thdr,
+						      tdata, &expunge_seqs);
+			} T_END;
+			continue;
+		}
+		mail_index_sync_flush_expunges(&sync_map_ctx, &expunge_seqs);
+
 		/* we'll just skip over broken entries */
 		(void)mail_index_sync_record(&sync_map_ctx, thdr, tdata);
 	}
+	mail_index_sync_flush_expunges(&sync_map_ctx, &expunge_seqs);
+	array_free(&expunge_seqs);
 	map = view->map;
 
 	if (had_dirty)
@@ -898,6 +898,7 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 	const char *reason = NULL;
 	uint32_t next_uid;
 	bool want_rotate, index_undeleted, delete_index;
+	bool purge_incremental = FALSE;
 	int ret = 0, ret2;
 
 	index_undeleted = ctx->ext_trans->index_undeleted;
@@ -964,7 +965,12 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 	   record_count and deleted_record_count. That also has a side effect
 	   of updating whether cache needs to be purged. */
 	if (ret == 0 && mail_cache_need_purge(index->cache, &reason) &&
-	    !mail_cache_transactions_have_changes(index->cache)) {
+	    !mail_cache_transactions_have_changes(index->cache) &&
+	    mail_cache_purge_is_incremental(index->cache)) {
+		/* the records are copied after the .log is unlocked */
+		purge_incremental = TRUE;
+	} else if (ret == 0 && mail_cache_need_purge(index->cache, &reason) &&
+		   !mail_cache_transactions_have_changes(index->cache)) {
 		if (mail_cache_purge(index->cache,
 				     index->cache->need_purge_file_seq,
 				     reason) < 0) {
@@ -996,6 +1002,15 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 		mail_index_write(index, want_rotate, reason);
 	}
 	mail_index_sync_end(_ctx);
+
+	if (purge_incremental && mail_cache_need_purge(index->cache, &reason) &&
+	    !mail_cache_transactions_have_changes(index->cache)) {
+		if (mail_cache_purge_incremental(index->cache,
+				index->cache->need_purge_file_seq,
+				reason) < 0) {
+			/* can't really do anything if it fails */
+		}
+	}
 	return ret;
 }
 
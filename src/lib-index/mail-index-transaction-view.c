@@ -234,21 +234,37 @@ static void tview_lookup_first(struct mail_index_view *view,
 {
 	struct mail_index_view_transaction *tview =
 		(struct mail_index_view_transaction *)view;
+	struct mail_index_transaction *t = tview->t;
 	const struct mail_index_record *rec;
 	unsigned int append_count;
 	uint32_t seq, message_count;
 
-	if (!tview->t->reset) {
+	if (!t->reset) {
 		tview->super->lookup_first(view, flags, flags_mask, seq_r);
+		if (t->min_flagupdate_seq != 0 &&
+		    (*seq_r == 0 || *seq_r >= t->min_flagupdate_seq)) {
+			/* the transaction's flag updates may change the
+			   result. check the updated messages one by one. */
+			message_count = t->first_new_seq - 1;
+			for (seq = t->min_flagupdate_seq;
+			     seq <= message_count; seq++) {
+				rec = mail_index_lookup(view, seq);
+				if ((rec->flags & flags_mask) == (uint8_t)flags)
+					break;
+			}
+			*seq_r = seq <= message_count ? seq : 0;
+		}
 		if (*seq_r != 0)
 			return;
 	} else {
 		*seq_r = 0;
 	}
 
-	rec = array_get(&tview->t->appends, &append_count);
-	seq = tview->t->first_new_seq;
-	message_count = tview->t->last_new_seq;
+	if (!array_is_created(&t->appends))
+		return;
+	rec = array_get(&t->appends, &append_count);
+	seq = t->first_new_seq;
+	message_count = t->last_new_seq;
 	i_assert(append_count == message_count - seq + 1);
 
 	for (; seq <= message_count; seq++, rec++) {
@@ -259,6 +275,22 @@ static void tview_lookup_first(struct mail_index_view *view,
 	}
 }
 
+static unsigned int
+tview_lookup_columns(struct mail_index_view *view, uint32_t seq1, uint32_t seq2,
+		     const uint32_t **uids_r, const uint8_t **flags_r)
+{
+	struct mail_index_view_transaction *tview =
+		(struct mail_index_view_transaction *)view;
+
+	if (tview->t->min_flagupdate_seq != 0 || tview->t->reset) {
+		/* the columns don't have the updated flags */
+		return 0;
+	}
+	/* appended messages aren't in the columns. super limits the range to
+	   the map's messages. */
+	return tview->super->lookup_columns(view, seq1, seq2, uids_r, flags_r);
+}
+
 static void keyword_index_add(ARRAY_TYPE(keyword_indexes) *keywords,
 			      unsigned int idx)
 {
@@ -504,6 +536,7 @@ static struct mail_index_view_vfuncs trans_view_vfuncs = {
 	tview_lookup_uid,
 	tview_lookup_seq_range,
 	tview_lookup_first,
+	tview_lookup_columns,
 	tview_lookup_keywords,
 	tview_lookup_ext_full,
 	tview_get_header_ext,
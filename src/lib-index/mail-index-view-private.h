@@ -26,6 +26,10 @@ struct mail_index_view_vfuncs {
 	void (*lookup_first)(struct mail_index_view *view,
 			     enum mail_flags flags, uint8_t flags_mask,
 			     uint32_t *seq_r);
+	unsigned int (*lookup_columns)(struct mail_index_view *view,
+				       uint32_t seq1, uint32_t seq2,
+				       const uint32_t **uids_r,
+				       const uint8_t **flags_r);
 	void (*lookup_keywords)(struct mail_index_view *view, uint32_t seq,
 				ARRAY_TYPE(keyword_indexes) *keyword_idx);
 	void (*lookup_ext_full)(struct mail_index_view *view, uint32_t seq,
@@ -255,7 +255,8 @@ static void view_lookup_first(struct mail_index_view *view,
 #define LOW_UPDATE(x) \
 	STMT_START { if ((x) > low_uid) low_uid = x; } STMT_END
 	const struct mail_index_header *hdr = &view->map->hdr;
-	const struct mail_index_record *rec;
+	const uint8_t *flags_column;
+	unsigned int count;
 	uint32_t seq, seq2, low_uid = 1;
 
 	*seq_r = 0;
@@ -274,15 +275,42 @@ static void view_lookup_first(struct mail_index_view *view,
 	}
 
 	i_assert(hdr->messages_count <= view->map->rec_map->records_count);
+	/* scan the dense flags column instead of the records */
+	mail_index_map_update_columns(view->map);
+	flags_column = array_get(&view->map->rec_map->flags_column, &count);
+	i_assert(count >= hdr->messages_count);
 	for (; seq <= hdr->messages_count; seq++) {
-		rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
-		if ((rec->flags & flags_mask) == (uint8_t)flags) {
+		if ((flags_column[seq-1] & flags_mask) == (uint8_t)flags) {
 			*seq_r = seq;
 			break;
 		}
 	}
 }
 
+static unsigned int
+view_lookup_columns(struct mail_index_view *view, uint32_t seq1, uint32_t seq2,
+		    const uint32_t **uids_r, const uint8_t **flags_r)
+{
+	struct mail_index_map *map = view->map;
+
+	i_assert(seq1 > 0 && seq1 <= seq2);
+
+	if (map != view->index->map) {
+		/* mail_index_lookup() would return the flags from the head
+		   map, which may have changed */
+		return 0;
+	}
+	if (seq2 > map->hdr.messages_count)
+		seq2 = map->hdr.messages_count;
+	if (seq1 > seq2)
+		return 0;
+
+	mail_index_map_update_columns(map);
+	*uids_r = array_idx(&map->rec_map->uid_column, seq1 - 1);
+	*flags_r = array_idx(&map->rec_map->flags_column, seq1 - 1);
+	return seq2 - seq1 + 1;
+}
+
 static void
 mail_index_data_lookup_keywords(struct mail_index_map *map,
 				const unsigned char *data,
@@ -527,6 +555,14 @@ void mail_index_lookup_first(struct mail_index_view *view,
 	view->v.lookup_first(view, flags, flags_mask, seq_r);
 }
 
+unsigned int mail_index_lookup_columns(struct mail_index_view *view,
+				       uint32_t seq1, uint32_t seq2,
+				       const uint32_t **uids_r,
+				       const uint8_t **flags_r)
+{
+	return view->v.lookup_columns(view, seq1, seq2, uids_r, flags_r);
+}
+
 void mail_index_lookup_ext(struct mail_index_view *view, uint32_t seq,
 			   uint32_t ext_id, const void **data_r,
 			   bool *expunged_r)
@@ -594,6 +630,7 @@ static struct mail_index_view_vfuncs view_vfuncs = {
 	view_lookup_uid,
 	view_lookup_seq_range,
 	view_lookup_first,
+	view_lookup_columns,
 	view_lookup_keywords,
 	view_lookup_ext_full,
 	view_get_header_ext,
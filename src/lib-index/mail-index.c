@@ -205,6 +205,8 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->log.min_age_secs = set->log.min_age_secs;
 	if (set->log.log2_max_age_secs != 0)
 		dest->log.log2_max_age_secs = set->log.log2_max_age_secs;
+	if (set->log.prealloc_size != 0)
+		dest->log.prealloc_size = set->log.prealloc_size;
 
 	/* cache */
 	if (set->cache.unaccessed_field_drop_secs != 0)
@@ -223,8 +225,12 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 	if (set->cache.purge_header_continue_count != 0)
 		dest->cache.purge_header_continue_count =
 			set->cache.purge_header_continue_count;
+	if (set->cache.purge_chunk_size != 0)
+		dest->cache.purge_chunk_size = set->cache.purge_chunk_size;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
+	if (set->cache.compress_min_size != 0)
+		dest->cache.compress_min_size = set->cache.compress_min_size;
 
 	dest->cache.max_header_name_length = set->cache.max_header_name_length;
 	dest->cache.max_headers_count = set->cache.max_headers_count;
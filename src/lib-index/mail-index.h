@@ -334,6 +334,11 @@ struct mail_index_log_optimization_settings {
 	/* Delete .log.2 when it's older than log2_stale_secs. Don't be too
 	   eager, because older files are useful for QRESYNC and dsync. */
 	unsigned int log2_max_age_secs;
+
+	/* If non-zero, preallocate disk space for the log in extents of this
+	   size and mmap() the log with this much room to grow, so appends
+	   don't need to re-mmap it. */
+	uoff_t prealloc_size;
 };
 
 struct mail_index_cache_optimization_settings {
@@ -360,6 +365,12 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+	/* If non-zero, purge the file incrementally: each index sync copies
+	   about this many bytes to the new file. */
+	uoff_t purge_chunk_size;
+	/* If non-zero, compress variable sized fields that are at least this
+	   large. */
+	unsigned int compress_min_size;
 };
 
 struct mail_index_optimization_settings {
@@ -634,6 +645,16 @@ bool mail_index_lookup_seq(struct mail_index_view *view,
 void mail_index_lookup_first(struct mail_index_view *view,
 			     enum mail_flags flags, uint8_t flags_mask,
 			     uint32_t *seq_r);
+/* Return the UIDs and flags of messages seq1..seq2 as dense arrays, which
+   are faster to scan than looking up each message separately. Returns the
+   number of messages in the arrays, which may be less than requested.
+   Returns 0 if the view can't provide the arrays, e.g. because the
+   transaction has flag updates or the view's map isn't the latest one. The
+   arrays are valid until the view or the transaction is changed. */
+unsigned int mail_index_lookup_columns(struct mail_index_view *view,
+				       uint32_t seq1, uint32_t seq2,
+				       const uint32_t **uids_r,
+				       const uint8_t **flags_r);
 
 /* Append a new record to index. */
 void mail_index_append(struct mail_index_transaction *t, uint32_t uid,
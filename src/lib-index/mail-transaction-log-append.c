@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "write-full.h"
+#include "file-set-size.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
 
@@ -78,6 +79,31 @@ log_buffer_keep_written(struct mail_transaction_log_append_ctx *ctx,
 	return 0;
 }
 
+static void log_buffer_preallocate(struct mail_transaction_log_append_ctx *ctx)
+{
+	struct mail_transaction_log_file *file = ctx->log->head;
+	uoff_t prealloc_size =
+		ctx->log->index->optimization_set.log.prealloc_size;
+	int ret;
+
+	if (prealloc_size == 0 || file->prealloc_unsupported ||
+	    file->sync_offset + ctx->output->used <= file->prealloc_offset)
+		return;
+
+	/* Allocate the space for the following appends at once, so the
+	   filesystem doesn't have to allocate blocks for each small write. */
+	file->prealloc_offset = file->sync_offset + ctx->output->used +
+		prealloc_size;
+	ret = file_preallocate(file->fd, file->prealloc_offset);
+	if (ret == 0 || (ret < 0 && errno == EOPNOTSUPP))
+		file->prealloc_unsupported = TRUE;
+	else if (ret < 0 && !ENOSPACE(errno)) {
+		mail_index_file_set_syscall_error(ctx->log->index,
+						  file->filepath,
+						  "file_preallocate()");
+	}
+}
+
 static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx,
 			    size_t trans_size)
 {
@@ -97,6 +123,7 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx,
 		return 0;
 	}
 
+	log_buffer_preallocate(ctx);
 	if (write_full_count(file->fd, ctx->output->data, ctx->output->used,
 			     &written) < 0) {
 		/* write failure, fallback to in-memory indexes. */
@@ -1549,7 +1549,10 @@ mail_transaction_log_file_mmap(struct mail_transaction_log_file *file,
 	/* we may have switched to mmaping */
 	buffer_free(&file->buffer);
 
-	file->mmap_size = file->last_size;
+	/* leave room for the log to grow. the pages past EOF are never
+	   accessed. */
+	file->mmap_size = file->last_size +
+		file->log->index->optimization_set.log.prealloc_size;
 	file->mmap_base = mmap(NULL, file->mmap_size, PROT_READ, MAP_SHARED,
 			       file->fd, 0);
 	if (file->mmap_base == MAP_FAILED) {
@@ -1573,7 +1576,7 @@ mail_transaction_log_file_mmap(struct mail_transaction_log_file *file,
 	}
 
 	buffer_create_from_const_data(&file->mmap_buffer,
-				      file->mmap_base, file->mmap_size);
+				      file->mmap_base, file->last_size);
 	file->buffer = &file->mmap_buffer;
 	file->buffer_offset = 0;
 	return 0;
@@ -1631,17 +1634,25 @@ mail_transaction_log_file_map_mmap(struct mail_transaction_log_file *file,
 	}
 
 	do {
-		mail_transaction_log_file_munmap(file);
+		if (file->mmap_base != NULL &&
+		    file->last_size >= file->buffer->used &&
+		    file->last_size <= file->mmap_size) {
+			/* the file grew, but it still fits into the mmaped
+			   area */
+			buffer_create_from_const_data(&file->mmap_buffer,
+				file->mmap_base, file->last_size);
+		} else {
+			mail_transaction_log_file_munmap(file);
 
-		if (file->last_size - start_offset < mmap_get_page_size()) {
-			/* just reading the file is probably faster */
-			return mail_transaction_log_file_read(file,
-							      start_offset,
-							      FALSE, reason_r);
-		}
+			if (file->last_size - start_offset < mmap_get_page_size()) {
+				/* just reading the file is probably faster */
+				return mail_transaction_log_file_read(file,
+					start_offset, FALSE, reason_r);
+			}
 
-		if (mail_transaction_log_file_mmap(file, reason_r) < 0)
-			return -1;
+			if (mail_transaction_log_file_mmap(file, reason_r) < 0)
+				return -1;
+		}
 		ret = mail_transaction_log_file_sync(file, &retry, reason_r);
 	} while (retry);
 
@@ -1740,8 +1751,8 @@ int mail_transaction_log_file_move_to_memory(struct mail_transaction_log_file *f
 		/* just copy to memory */
 		i_assert(file->buffer_offset == 0);
 
-		buf = buffer_create_dynamic(default_pool, file->mmap_size);
-		buffer_append(buf, file->mmap_base, file->mmap_size);
+		buf = buffer_create_dynamic(default_pool, file->buffer->used);
+		buffer_append_buf(buf, file->buffer, 0, SIZE_MAX);
 		buffer_free(&file->buffer);
 		file->buffer = buf;
 
@@ -55,9 +55,13 @@ struct mail_transaction_log_file {
 	buffer_t *buffer;
 	/* Offset to log where the buffer starts from. 0 with mmaped log. */
 	uoff_t buffer_offset;
-	/* If non-NULL, mmap()ed log file */
+	/* If non-NULL, mmap()ed log file. The mapping may be larger than the
+	   file, in which case the file can grow up to mmap_size without
+	   having to re-mmap it. */
 	void *mmap_base;
 	size_t mmap_size;
+	/* Disk space has been preallocated for the log up to this offset */
+	uoff_t prealloc_offset;
 
 	/* Offset to log file how far it's been read. Usually it's the same
 	   as the log file size. However, if the last multi-record transaction
@@ -109,6 +113,8 @@ struct mail_transaction_log_file {
 	   transaction. The log must be rotated before it can be written to
 	   again. */
 	bool garbage_at_eof:1;
+	/* Preallocating space isn't supported by the filesystem */
+	bool prealloc_unsupported:1;
 };
 
 struct mail_transaction_log {
@@ -354,6 +354,14 @@ int mail_transaction_log_rotate(struct mail_transaction_log *log, bool reset)
 			return -1;
 		}
 		i_assert(file->locked);
+
+		/* the old log isn't appended to anymore. release the space
+		   that was preallocated past its EOF. */
+		if (log->head->prealloc_offset > (uoff_t)st.st_size &&
+		    ftruncate(log->head->fd, st.st_size) < 0) {
+			mail_index_file_set_syscall_error(log->index,
+				log->head->filepath, "ftruncate()");
+		}
 	}
 
 	old_head = log->head;
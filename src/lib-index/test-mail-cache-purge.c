@@ -1044,6 +1044,252 @@ static void test_mail_cache_update_need_purge_deleted_records2(void)
 	test_end();
 }
 
+static void test_mail_cache_purge_incremental(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_chunk_size = 1,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	unsigned int i;
+
+	test_begin("mail cache purge incremental");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo4");
+
+	/* the first sync copies only the first message */
+	mail_cache_purge_later(ctx.cache, "test");
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx != NULL);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+
+	/* change the already copied message and expunge a message that
+	   hasn't been copied yet */
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	struct mail_index_transaction *trans =
+		mail_index_transaction_begin(ctx.view, 0);
+	mail_index_expunge(trans, 3);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+
+	for (i = 0; i < 10 && ctx.cache->purge_ctx != NULL; i++)
+		test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx == NULL);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(ctx.cache->need_purge_file_seq == 0);
+	test_assert(ctx.cache->hdr->record_count == 3);
+
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field.idx, "foo1"));
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field2.idx, "bar1"));
+	test_assert(cache_equals(cache_view, 2, ctx.cache_field.idx, "foo2"));
+	test_assert(cache_equals(cache_view, 3, ctx.cache_field.idx, "foo4"));
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_purge_incremental_aborted(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_chunk_size = 1,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+
+	test_begin("mail cache purge incremental aborted");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+
+	mail_cache_purge_later(ctx.cache, "test");
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx != NULL);
+
+	/* another process purges the cache in the middle */
+	test_mail_cache_purge();
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx == NULL);
+	test_assert(ctx.cache->need_purge_file_seq == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field.idx, "foo1"));
+	test_assert(cache_equals(cache_view, 2, ctx.cache_field.idx, "foo2"));
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void
+test_mail_cache_purge_incremental_init(struct test_mail_cache_ctx *ctx,
+				       struct mail_index *index)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_chunk_size = 1,
+		},
+	};
+
+	/* flock() locks conflict also within the same process */
+	mail_index_set_lock_method(index, FILE_LOCK_METHOD_FLOCK, UINT_MAX);
+	test_mail_cache_init(index, ctx);
+	mail_index_set_optimization_settings(ctx->index, &optimization_set);
+}
+
+static void test_mail_cache_purge_incremental_interleaved(void)
+{
+	struct test_mail_cache_ctx ctx, ctx2;
+	struct mail_cache_view *cache_view;
+	unsigned int i, seq;
+
+	test_begin("mail cache purge incremental interleaved");
+	test_mail_cache_purge_incremental_init(&ctx,
+					       test_mail_index_init(TRUE));
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo3");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo4");
+
+	/* two sessions both want to purge the cache */
+	test_mail_cache_purge_incremental_init(&ctx2,
+					       test_mail_index_open(FALSE));
+	test_assert(mail_cache_open_and_verify(ctx2.cache) == 1);
+	mail_cache_purge_later(ctx.cache, "test");
+	mail_cache_purge_later(ctx2.cache, "test");
+
+	/* The first one becomes the owner and the second one leaves it
+	   alone, but keeps adding to the cache in the middle. */
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx != NULL);
+	for (i = 0; i < 10 && ctx.cache->purge_ctx != NULL; i++) {
+		test_mail_cache_index_sync(&ctx2);
+		test_assert_idx(ctx2.cache->purge_ctx == NULL, i);
+		if (i < 4) {
+			test_mail_cache_add_field(&ctx2, i + 1,
+				ctx2.cache_field2.idx,
+				t_strdup_printf("bar%u", i + 1));
+		}
+		test_mail_cache_index_sync(&ctx);
+	}
+	test_assert(ctx.cache->purge_ctx == NULL);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(ctx.cache->need_purge_file_seq == 0);
+
+	/* the second one notices that the purging is done */
+	test_mail_cache_index_sync(&ctx2);
+	test_assert(ctx2.cache->purge_ctx == NULL);
+	test_assert(ctx2.cache->need_purge_file_seq == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx2) == 1);
+
+	test_mail_cache_view_sync(&ctx2);
+	cache_view = mail_cache_view_open(ctx2.cache, ctx2.view);
+	for (seq = 1; seq <= 4; seq++) {
+		test_assert_idx(cache_equals(cache_view, seq,
+			ctx2.cache_field.idx,
+			t_strdup_printf("foo%u", seq)), seq);
+		test_assert_idx(cache_equals(cache_view, seq,
+			ctx2.cache_field2.idx, seq > i ? NULL :
+			t_strdup_printf("bar%u", seq)), seq);
+	}
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx2);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static const char *
+test_mail_cache_purge_owner_temp_path(struct test_mail_cache_ctx *ctx)
+{
+	const char *path = t_strconcat(ctx->cache->filepath,
+				       MAIL_CACHE_PURGE_OWNER_SUFFIX, NULL);
+	char fname[NAME_MAX + 1];
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	ret = read(fd, fname, sizeof(fname) - 1);
+	i_close_fd(&fd);
+	if (ret <= 0)
+		return NULL;
+	fname[ret] = '\0';
+	return t_strdup_printf("%s/%s", test_mail_index_get_dir(), fname);
+}
+
+static void test_mail_cache_purge_incremental_owner_stale(void)
+{
+	struct test_mail_cache_ctx ctx, ctx2;
+	struct mail_cache_view *cache_view;
+	const char *temp_path;
+	struct stat st;
+
+	test_begin("mail cache purge incremental owner stale");
+	test_mail_cache_purge_incremental_init(&ctx,
+					       test_mail_index_init(TRUE));
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+
+	test_mail_cache_purge_incremental_init(&ctx2,
+					       test_mail_index_open(FALSE));
+	test_assert(mail_cache_open_and_verify(ctx2.cache) == 1);
+	mail_cache_purge_later(ctx.cache, "test");
+	mail_cache_purge_later(ctx2.cache, "test");
+
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx != NULL);
+	/* <cache>.purge contains the owner's temp file name */
+	temp_path = test_mail_cache_purge_owner_temp_path(&ctx);
+	test_assert(temp_path != NULL && stat(temp_path, &st) == 0);
+
+	/* the owner doesn't continue, so the other session purges the whole
+	   cache once it has waited long enough */
+	test_mail_cache_index_sync(&ctx2);
+	test_assert(ctx2.cache->need_purge_file_seq != 0);
+	ioloop_time = time(NULL) + MAIL_CACHE_PURGE_OWNER_STALE_SECS + 1;
+	test_mail_cache_index_sync(&ctx2);
+	test_assert(ctx2.cache->need_purge_file_seq == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx2) == 1);
+
+	/* the owner notices that its purging was aborted */
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->purge_ctx == NULL);
+	test_assert(ctx.cache->need_purge_file_seq == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(stat(temp_path, &st) < 0 && errno == ENOENT);
+
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field.idx, "foo1"));
+	test_assert(cache_equals(cache_view, 2, ctx.cache_field.idx, "foo2"));
+	mail_cache_view_close(&cache_view);
+
+	ioloop_time = 1;
+	test_mail_cache_deinit(&ctx2);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 static void test_mail_cache_purge_deadlines(void)
 {
 	static const uint32_t BASE_TIME = 1000;
@@ -1104,6 +1350,10 @@ int main(void)
 		test_mail_cache_purge_field_changes4,
 		test_mail_cache_purge_already_done,
 		test_mail_cache_purge_bitmask,
+		test_mail_cache_purge_incremental,
+		test_mail_cache_purge_incremental_aborted,
+		test_mail_cache_purge_incremental_interleaved,
+		test_mail_cache_purge_incremental_owner_stale,
 		test_mail_cache_update_need_purge_continued_records,
 		test_mail_cache_update_need_purge_continued_records2,
 		test_mail_cache_update_need_purge_deleted_records,
@@ -1,6 +1,7 @@
 /* Copyright (c) Dovecot authors, see top-level COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "write-full.h"
 #include "test-common.h"
@@ -806,6 +807,134 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static bool
+test_mail_cache_lookup_equals(struct mail_cache_view *cache_view, uint32_t seq,
+			      unsigned int field_idx, const char *value)
+{
+	string_t *str = t_str_new(16);
+
+	return mail_cache_lookup_field(cache_view, str, seq, field_idx) == 1 &&
+		strcmp(str_c(str), value) == 0;
+}
+
+static void test_mail_cache_lookup_locations(void)
+{
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	const struct mail_cache_field_location *loc;
+
+	test_begin("mail cache lookup locations");
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo1");
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo2");
+	/* the 1st mail has two records */
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+	test_mail_cache_view_sync(&ctx);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(test_mail_cache_lookup_equals(cache_view, 1,
+		ctx.cache_field.idx, "foo1"));
+	/* both fields' locations were found while iterating the records */
+	loc = array_idx(&cache_view->cached_locations, ctx.cache_field.idx);
+	test_assert(loc->value == cache_view->cached_exists_value);
+	loc = array_idx(&cache_view->cached_locations, ctx.cache_field2.idx);
+	test_assert(loc->value == cache_view->cached_exists_value);
+	test_assert(test_mail_cache_lookup_equals(cache_view, 1,
+		ctx.cache_field2.idx, "bar1"));
+	test_assert(test_mail_cache_lookup_equals(cache_view, 2,
+		ctx.cache_field.idx, "foo2"));
+
+	/* the locations can't be used after the cache file is purged */
+	test_mail_cache_purge();
+	test_mail_cache_view_sync(&ctx);
+	test_assert(test_mail_cache_lookup_equals(cache_view, 2,
+		ctx.cache_field.idx, "foo2"));
+	test_assert(test_mail_cache_lookup_equals(cache_view, 1,
+		ctx.cache_field2.idx, "bar1"));
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void
+test_mail_cache_compressed_fields_check(struct test_mail_cache_ctx *ctx,
+					const char *long_value)
+{
+	struct mail_cache_view *cache_view;
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	unsigned int count = 0;
+	int ret;
+
+	cache_view = mail_cache_view_open(ctx->cache, ctx->view);
+	mail_cache_lookup_iter_init(cache_view, 1, &iter);
+	while ((ret = mail_cache_lookup_iter_next(&iter, &field)) > 0) {
+		if (field.field_idx == ctx->cache_field.idx) {
+			test_assert(field.compressed);
+			test_assert(field.size < strlen(long_value));
+		} else {
+			test_assert(!field.compressed);
+		}
+		count++;
+	}
+	test_assert(ret == 0);
+	test_assert(count == 2);
+
+	test_assert(test_mail_cache_lookup_equals(cache_view, 1,
+		ctx->cache_field.idx, long_value));
+	test_assert(test_mail_cache_lookup_equals(cache_view, 1,
+		ctx->cache_field2.idx, "short"));
+	mail_cache_view_close(&cache_view);
+}
+
+static void test_mail_cache_compressed_fields(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.compress_min_size = 64,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_iterate_field field;
+	string_t *long_value = t_str_new(1024);
+	buffer_t *buf = t_buffer_create(64);
+	unsigned int i;
+
+	test_begin("mail cache compressed fields");
+	for (i = 0; i < 100; i++)
+		str_printfa(long_value, "Header-%u: value\n", i);
+
+	test_mail_cache_init(test_mail_index_init(TRUE), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+				 str_c(long_value));
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "short");
+	test_mail_cache_view_sync(&ctx);
+	test_mail_cache_compressed_fields_check(&ctx, str_c(long_value));
+
+	/* purging copies the compressed data as-is */
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_assert(mail_cache_reopen(ctx.cache) == 1);
+	test_mail_cache_compressed_fields_check(&ctx, str_c(long_value));
+
+	/* broken compressed data */
+	i_zero(&field);
+	field.field_idx = ctx.cache_field.idx;
+	field.data = "\x10\0\0\0broken";
+	field.size = 10;
+	field.compressed = TRUE;
+	test_expect_error_string("compressed field foo is broken");
+	test_assert(mail_cache_field_get_data(ctx.cache, &field, buf) < 0);
+	test_expect_no_more_errors();
+	test_assert(buf->used == 0);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +949,8 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_lookup_locations,
+		test_mail_cache_compressed_fields,
 		NULL
 	};
 	test_dir_init("mail-cache");
@@ -7,7 +7,8 @@
 #include "mail-index-modseq.h"
 #include "mail-index-transaction-private.h"
 
-static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count)
+static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count,
+							bool columns)
 {
 	struct mail_index_record_map rec_map;
 	struct mail_index_map map;
@@ -25,6 +26,8 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 		MAIL_INDEX_REC_AT_SEQ(&map, seq)->uid = seq*2;
 	max_uid = (seq-1)*2;
 	map.hdr.next_uid = max_uid + 1;
+	if (columns)
+		mail_index_map_update_columns(&map);
 
 	for (first_uid = 2; first_uid <= max_uid; first_uid++) {
 		for (last_uid = first_uid; last_uid <= max_uid; last_uid++) {
@@ -34,6 +37,10 @@ static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_cou
 			test_assert((first_uid+1)/2 == first_seq && last_uid/2 == last_seq);
 		}
 	}
+	if (columns) {
+		array_free(&rec_map.uid_column);
+		array_free(&rec_map.flags_column);
+	}
 	i_free(rec_map.records);
 }
 
@@ -42,8 +49,72 @@ static void test_mail_index_map_lookup_seq_range(void)
 	unsigned int i;
 
 	test_begin("mail index map lookup seq range");
-	for (i = 1; i < 20; i++)
-		test_mail_index_map_lookup_seq_range_count(i);
+	for (i = 1; i < 20; i++) {
+		test_mail_index_map_lookup_seq_range_count(i, FALSE);
+		test_mail_index_map_lookup_seq_range_count(i, TRUE);
+	}
+	test_end();
+}
+
+static void test_mail_index_map_columns(void)
+{
+	struct mail_index_record_map rec_map;
+	struct mail_index_map map;
+	const uint32_t *uids;
+	const uint8_t *flags;
+	unsigned int count;
+	uint32_t seq;
+
+	test_begin("mail index map columns");
+	i_zero(&map);
+	i_zero(&rec_map);
+	map.rec_map = &rec_map;
+	map.hdr.messages_count = 10;
+	map.hdr.record_size = sizeof(struct mail_index_record) + 8;
+	rec_map.records_count = map.hdr.messages_count;
+	rec_map.records = i_malloc(map.hdr.record_size * 20);
+	for (seq = 1; seq <= 20; seq++) {
+		MAIL_INDEX_REC_AT_SEQ(&map, seq)->uid = seq*3;
+		MAIL_INDEX_REC_AT_SEQ(&map, seq)->flags = seq % 4;
+	}
+
+	mail_index_map_update_columns(&map);
+	uids = array_get(&rec_map.uid_column, &count);
+	flags = array_front(&rec_map.flags_column);
+	test_assert(count == 10);
+	test_assert(array_count(&rec_map.flags_column) == 10);
+	for (seq = 1; seq <= count; seq++) {
+		test_assert_idx(uids[seq-1] == seq*3, seq);
+		test_assert_idx(flags[seq-1] == seq % 4, seq);
+	}
+
+	/* flag changes are copied to the column */
+	MAIL_INDEX_REC_AT_SEQ(&map, 2)->flags = MAIL_FLAGGED;
+	MAIL_INDEX_REC_AT_SEQ(&map, 3)->flags = MAIL_DRAFT;
+	mail_index_map_update_columns_flags(&map, 2, 3);
+	flags = array_front(&rec_map.flags_column);
+	test_assert(flags[0] == 1 && flags[1] == MAIL_FLAGGED &&
+		    flags[2] == MAIL_DRAFT && flags[3] == 0);
+
+	/* appended records are added incrementally */
+	rec_map.records_count = 15;
+	mail_index_map_update_columns(&map);
+	uids = array_get(&rec_map.uid_column, &count);
+	test_assert(count == 15);
+	test_assert(uids[1] == 6 && uids[14] == 45);
+
+	/* truncating drops the rest, and they're rebuilt */
+	mail_index_record_map_truncate_columns(&rec_map, 4);
+	test_assert(array_count(&rec_map.uid_column) == 4);
+	test_assert(array_count(&rec_map.flags_column) == 4);
+	MAIL_INDEX_REC_AT_SEQ(&map, 5)->uid = 100;
+	mail_index_map_update_columns(&map);
+	uids = array_get(&rec_map.uid_column, &count);
+	test_assert(count == 15 && uids[4] == 100 && uids[5] == 18);
+
+	array_free(&rec_map.uid_column);
+	array_free(&rec_map.flags_column);
+	i_free(rec_map.records);
 	test_end();
 }
 
@@ -89,6 +160,7 @@ int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_columns,
 		test_mail_index_map_parse_keywords_empty_name_area,
 		NULL
 	};
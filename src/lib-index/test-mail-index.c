@@ -529,6 +529,213 @@ static void test_mail_index_map_fsck_fail_restores_map(void)
 	test_end();
 }
 
+static void test_mail_index_lookup_columns(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view, *tview;
+	struct mail_index_transaction *trans;
+	const uint32_t *uids;
+	const uint8_t *flags;
+	unsigned int i, count;
+	uint32_t seq, uid_validity = 1234;
+
+	test_begin("mail index lookup columns");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (i = 1; i <= 100; i++) {
+		mail_index_append(trans, i*2, &seq);
+		if (i % 3 == 0) {
+			mail_index_update_flags(trans, seq, MODIFY_REPLACE,
+						MAIL_FLAGGED);
+		}
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_lookup_columns(view, 1, 200, &uids,
+					      &flags) == 100);
+	count = mail_index_lookup_columns(view, 11, 20, &uids, &flags);
+	test_assert(count == 10);
+	for (i = 0; i < count; i++) {
+		test_assert_idx(uids[i] == (11 + i) * 2, i);
+		test_assert_idx(flags[i] == ((11 + i) % 3 == 0 ?
+					     MAIL_FLAGGED : 0), i);
+	}
+	mail_index_lookup_first(view, MAIL_FLAGGED, MAIL_FLAGGED, &seq);
+	test_assert(seq == 3);
+	mail_index_lookup_first(view, 0, MAIL_SEEN, &seq);
+	test_assert(seq == 1);
+
+	/* the columns can't be used with flag updates in the transaction */
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags(trans, 2, MODIFY_ADD, MAIL_FLAGGED);
+	tview = mail_index_transaction_open_updated_view(trans);
+	test_assert(mail_index_lookup_columns(tview, 1, 100, &uids,
+					      &flags) == 0);
+	mail_index_lookup_first(tview, MAIL_FLAGGED, MAIL_FLAGGED, &seq);
+	test_assert(seq == 2);
+	mail_index_update_flags(trans, 2, MODIFY_REMOVE, MAIL_FLAGGED);
+	mail_index_update_flags(trans, 3, MODIFY_REMOVE, MAIL_FLAGGED);
+	mail_index_lookup_first(tview, MAIL_FLAGGED, MAIL_FLAGGED, &seq);
+	test_assert(seq == 6);
+	mail_index_update_flags(trans, 1, MODIFY_ADD, MAIL_SEEN);
+	mail_index_lookup_first(tview, 0, MAIL_SEEN, &seq);
+	test_assert(seq == 2);
+	mail_index_view_close(&tview);
+	mail_index_transaction_rollback(&trans);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_sync_expunges(void)
+{
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const struct mail_index_record *rec;
+	static const uint32_t expunge_uids[] = { 2, 3, 4, 9, 5, 1 };
+	static const uint32_t result_uids[] = { 6, 7, 8, 10 };
+	uint32_t seq, file_seq, uid_validity = 1234;
+	uoff_t file_offset;
+	unsigned int i;
+
+	test_begin("mail index sync expunges");
+	index = test_mail_index_init(TRUE);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (i = 1; i <= 10; i++)
+		mail_index_append(trans, i, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_transaction_log_sync_lock(index->log, "test",
+		&file_seq, &file_offset) == 0);
+	mail_index_write(index, FALSE, "test");
+	mail_transaction_log_sync_unlock(index->log, "test");
+
+	/* Expunge the messages in separate transactions, so they're
+	   applied together when the log is replayed. The flag update in the
+	   middle must see the sequences after the earlier expunges. */
+	for (i = 0; i < N_ELEMENTS(expunge_uids); i++) {
+		view = mail_index_view_open(index);
+		trans = mail_index_transaction_begin(view,
+				MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+		test_assert(mail_index_lookup_seq(view, expunge_uids[i], &seq));
+		mail_index_expunge(trans, seq);
+		if (i == 3) {
+			test_assert(mail_index_lookup_seq(view, 7, &seq));
+			mail_index_update_flags(trans, seq, MODIFY_ADD,
+						MAIL_FLAGGED);
+		}
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+		mail_index_view_close(&view);
+	}
+
+	index2 = test_mail_index_open(FALSE);
+	view = mail_index_view_open(index2);
+	test_assert(mail_index_view_get_messages_count(view) ==
+		    N_ELEMENTS(result_uids));
+	for (i = 0; i < N_ELEMENTS(result_uids); i++) {
+		rec = mail_index_lookup(view, i + 1);
+		test_assert_idx(rec->uid == result_uids[i], i);
+		test_assert_idx(rec->flags ==
+				(rec->uid == 7 ? MAIL_FLAGGED : 0), i);
+	}
+	mail_index_view_close(&view);
+	test_mail_index_close(&index2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void
+test_mail_index_log_prealloc_append(struct mail_index *index, uint32_t uid)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+}
+
+static void test_mail_index_log_prealloc(void)
+{
+	const struct mail_index_optimization_settings set = {
+		.log = { .prealloc_size = 64 * 1024 },
+	};
+	struct mail_index *index, *index2;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_transaction_log_file *file, *file2;
+	struct stat st;
+	const void *mmap_base;
+	uint32_t seq, uid_validity = 1234;
+	unsigned int i;
+
+	test_begin("mail index log prealloc");
+	index = test_mail_index_init(TRUE);
+	mail_index_set_optimization_settings(index, &set);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (i = 1; i <= 1000; i++)
+		mail_index_append(trans, i, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	/* preallocating doesn't change the file size */
+	file = index->log->head;
+	if (fstat(file->fd, &st) < 0)
+		i_fatal("fstat(%s) failed: %m", file->filepath);
+	test_assert_ucmp(st.st_size, ==, file->sync_offset);
+	test_assert(file->prealloc_unsupported ||
+		    file->prealloc_offset == file->sync_offset + set.log.prealloc_size);
+
+	/* the log is large enough to get mmaped */
+	index2 = test_mail_index_open(FALSE);
+	mail_index_set_optimization_settings(index2, &set);
+	test_mail_index_log_prealloc_append(index, 1001);
+	test_assert(mail_index_refresh(index2) == 0);
+	file2 = index2->log->head;
+	test_assert(file2->mmap_base != NULL);
+	test_assert_ucmp(file2->mmap_size, ==,
+			 file->sync_offset + set.log.prealloc_size);
+	mmap_base = file2->mmap_base;
+
+	/* the appends fit into the mmaped area without re-mmaping */
+	for (i = 0; i < 10; i++) {
+		test_mail_index_log_prealloc_append(index, 1002 + i);
+		test_assert(mail_index_refresh(index2) == 0);
+	}
+	test_assert(file2->mmap_base == mmap_base);
+	test_assert_ucmp(file2->buffer->used, ==, file->sync_offset);
+	test_assert_ucmp(file2->sync_offset, ==, file->sync_offset);
+	test_assert_ucmp(index2->map->hdr.messages_count, ==, 1011);
+
+	test_mail_index_close(&index2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -540,6 +747,9 @@ int main(void)
 		test_mail_index_log_garbage_at_eof,
 		test_mail_index_log_rotate_at_close,
 		test_mail_index_map_fsck_fail_restores_map,
+		test_mail_index_lookup_columns,
+		test_mail_index_sync_expunges,
+		test_mail_index_log_prealloc,
 		NULL
 	};
 	test_dir_init("mail-index");
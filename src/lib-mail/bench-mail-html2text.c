@@ -0,0 +1,166 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "mail-html2text.h"
+
+#include <stdio.h>
+
+/**
+ * Generates newsletter-like HTML documents and measures the throughput of
+ * converting them to text with mail_html2text_more(). The documents have a
+ * large <style> block, table based layout with long inline style
+ * attributes, comments, entities and tracking links, so most of the input
+ * is markup that gets skipped. The input is fed in blocks of the given
+ * size, similar to how message-decoder feeds FTS and snippet generation.
+ */
+
+static void bench_append_text(string_t *dest, size_t size)
+{
+	static const char *const words[] = {
+		"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+		"adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+		"&amp;", "&nbsp;", "&rsquo;", "&#8212;", "&euro;",
+	};
+	size_t start = str_len(dest);
+
+	while (str_len(dest) - start < size) {
+		str_append(dest, words[i_rand_limit(N_ELEMENTS(words))]);
+		str_append_c(dest, ' ');
+	}
+}
+
+static void bench_append_document(string_t *dest, size_t size)
+{
+	unsigned int i = 0;
+
+	str_append(dest,
+		   "<!DOCTYPE html>\r\n<html><head>\r\n"
+		   "<meta http-equiv=\"Content-Type\" "
+		   "content=\"text/html; charset=utf-8\">\r\n"
+		   "<style type=\"text/css\">\r\n");
+	for (i = 0; i < 50; i++) {
+		str_printfa(dest, ".c%u { font-family: Arial, sans-serif; "
+			    "font-size: 14px; line-height: 20px; color: "
+			    "#333333; padding: 0 10px 0 10px; }\r\n", i);
+	}
+	str_append(dest, "</style></head>\r\n<body style=\"margin:0; "
+		   "padding:0;\">\r\n<!-- preheader text -->\r\n"
+		   "<table role=\"presentation\" width=\"100%\" border=\"0\" "
+		   "cellpadding=\"0\" cellspacing=\"0\">\r\n");
+	while (str_len(dest) < size) {
+		str_printfa(dest, "<tr><td class=\"c%u\" align=\"left\" "
+			    "valign=\"top\" style=\"padding: 20px 30px; "
+			    "font-family: Arial, sans-serif; font-size: 16px; "
+			    "color: #222222;\">\r\n<p style=\"margin: 0 0 10px "
+			    "0;\">", i++ % 50);
+		bench_append_text(dest, 200);
+		str_printfa(dest, "</p>\r\n<a href=\"https://click.example.org"
+			    "/track?u=0123456789abcdef&amp;id=%u&amp;e=user%%40"
+			    "example.org\" target=\"_blank\" style=\"color: "
+			    "#1a73e8; text-decoration: underline;\">Read "
+			    "more&nbsp;&raquo;</a>\r\n"
+			    "<img src=\"https://img.example.org/%u.png\" "
+			    "width=\"600\" alt=\"\" style=\"display: block; "
+			    "border: 0;\">\r\n</td></tr>\r\n", i, i);
+	}
+	str_append(dest, "</table>\r\n<script type=\"text/javascript\">"
+		   "var x = 1 < 2 && 3 > 2;</script>\r\n</body></html>\r\n");
+}
+
+static size_t bench_convert(const string_t *doc, size_t block_size,
+			    buffer_t *output)
+{
+	struct mail_html2text *ht;
+	const unsigned char *data = str_data(doc);
+	size_t size = str_len(doc), len, total_size = 0;
+
+	ht = mail_html2text_init(0);
+	while (size > 0) {
+		len = I_MIN(size, block_size);
+		buffer_set_used_size(output, 0);
+		mail_html2text_more(ht, data, len, output);
+		total_size += output->used;
+		data += len;
+		size -= len;
+	}
+	mail_html2text_deinit(&ht);
+	return total_size;
+}
+
+static void
+bench_mail_html2text(unsigned int doc_count, size_t doc_size,
+		     size_t block_size, unsigned int rounds)
+{
+	string_t **docs;
+	buffer_t *output;
+	uoff_t total_size = 0, output_size = 0;
+	uint64_t ts_0, ts_1;
+	unsigned int i, round;
+
+	docs = i_new(string_t *, doc_count);
+	for (i = 0; i < doc_count; i++) {
+		docs[i] = str_new(default_pool, doc_size + 4096);
+		bench_append_document(docs[i], doc_size);
+		total_size += str_len(docs[i]);
+	}
+	printf("Input data is %u documents, %"PRIuUOFF_T" bytes\n\n",
+	       doc_count, total_size);
+
+	output = buffer_create_dynamic(default_pool, block_size);
+	ts_0 = i_nanoseconds();
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < doc_count; i++) {
+			output_size += bench_convert(docs[i], block_size,
+						     output);
+		}
+	}
+	ts_1 = i_nanoseconds();
+
+	printf("html2text: %0.02lf ms, %0.02lf MB/s, "
+	       "%"PRIuUOFF_T" bytes of text\n",
+	       (double)(ts_1 - ts_0) / 1000000,
+	       ((double)total_size * rounds / (1024*1024)) /
+	       ((double)(ts_1 - ts_0) / 1000000000),
+	       output_size / rounds);
+
+	buffer_free(&output);
+	for (i = 0; i < doc_count; i++)
+		str_free(&docs[i]);
+	i_free(docs);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<doc_count> [<doc_kb> [<block_size> "
+		"[<rounds>]]]]\n", prog);
+	fprintf(stderr, "Runs 10 rounds over 100 documents of 256 kB "
+		"in 8192 byte blocks if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int doc_count = 100, doc_kb = 256, block_size = 8192;
+	unsigned int rounds = 10;
+
+	lib_init();
+
+	if ((argc >= 2 && str_to_uint(argv[1], &doc_count) < 0) ||
+	    (argc >= 3 && str_to_uint(argv[2], &doc_kb) < 0) ||
+	    (argc >= 4 && str_to_uint(argv[3], &block_size) < 0) ||
+	    (argc >= 5 && str_to_uint(argv[4], &rounds) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 5 || doc_count == 0 || doc_kb == 0 || block_size == 0 ||
+	    rounds == 0)
+		print_usage(argv[0]);
+
+	bench_mail_html2text(doc_count, (size_t)doc_kb * 1024, block_size,
+			     rounds);
+	lib_deinit();
+	return 0;
+}
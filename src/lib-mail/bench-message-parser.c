@@ -0,0 +1,241 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "base64.h"
+#include "randgen.h"
+#include "istream.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "message-parser.h"
+
+#include <stdio.h>
+
+/**
+ * Generates a corpus of large multipart messages and measures the
+ * throughput of parsing them with message_parser_parse_next_block(). Each
+ * message is multipart/mixed with a nested multipart/alternative text part,
+ * base64 encoded attachments and a message/rfc822 part, so the parser needs
+ * to look for several boundaries at once. The text parts contain lines
+ * beginning with "--" that aren't boundaries.
+ */
+
+#define BENCH_BOUNDARY_MIXED "=_bench-mixed-0123456789abcdef"
+#define BENCH_BOUNDARY_ALT "=_bench-alt-fedcba9876543210"
+#define BENCH_BOUNDARY_INNER "=_bench-inner-00112233445566"
+
+static void bench_append_text(string_t *dest, size_t size)
+{
+	static const char *const words[] = {
+		"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+		"adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+	};
+	size_t start = str_len(dest), line_start = start;
+	unsigned int line = 0;
+
+	while (str_len(dest) - start < size) {
+		str_append(dest, words[i_rand_limit(N_ELEMENTS(words))]);
+		if (str_len(dest) - line_start < 72) {
+			str_append_c(dest, ' ');
+			continue;
+		}
+		str_append(dest, "\r\n");
+		line_start = str_len(dest);
+		if (++line % 20 == 0) {
+			/* signature separators and similar lines */
+			str_append(dest, line % 40 == 0 ? "-- \r\n" :
+				   "-----------------------------\r\n");
+			line_start = str_len(dest);
+		}
+	}
+	str_append(dest, "\r\n");
+}
+
+static void bench_append_base64(string_t *dest, size_t size)
+{
+	unsigned char *data = i_malloc(size);
+
+	random_fill(data, size);
+	base64_encode(data, size, dest);
+	i_free(data);
+}
+
+static void bench_append_attachment(string_t *dest, size_t size)
+{
+	string_t *encoded = t_str_new(MAX_BASE64_ENCODED_SIZE(size));
+	const char *p, *end;
+
+	str_append(dest, "--"BENCH_BOUNDARY_MIXED"\r\n"
+		   "Content-Type: application/octet-stream; name=\"data.bin\"\r\n"
+		   "Content-Transfer-Encoding: base64\r\n"
+		   "Content-Disposition: attachment; filename=\"data.bin\"\r\n"
+		   "\r\n");
+	bench_append_base64(encoded, size);
+	p = str_c(encoded);
+	end = p + str_len(encoded);
+	while (p < end) {
+		size_t len = I_MIN(76, (size_t)(end - p));
+
+		str_append_data(dest, p, len);
+		str_append(dest, "\r\n");
+		p += len;
+	}
+}
+
+static void bench_append_message(string_t *dest, size_t size)
+{
+	size_t text_size = size / 8;
+
+	str_append(dest,
+		   "From: Sender <sender@example.org>\r\n"
+		   "To: Recipient <recipient@example.org>\r\n"
+		   "Subject: benchmark message\r\n"
+		   "Date: Thu, 01 Jan 2026 00:00:00 +0000\r\n"
+		   "Message-ID: <bench@example.org>\r\n"
+		   "MIME-Version: 1.0\r\n"
+		   "Content-Type: multipart/mixed;\r\n"
+		   "\tboundary=\""BENCH_BOUNDARY_MIXED"\"\r\n"
+		   "\r\n"
+		   "This is a multi-part message in MIME format.\r\n"
+		   "\r\n"
+		   "--"BENCH_BOUNDARY_MIXED"\r\n"
+		   "Content-Type: multipart/alternative;\r\n"
+		   "\tboundary=\""BENCH_BOUNDARY_ALT"\"\r\n"
+		   "\r\n"
+		   "--"BENCH_BOUNDARY_ALT"\r\n"
+		   "Content-Type: text/plain; charset=utf-8\r\n"
+		   "\r\n");
+	bench_append_text(dest, text_size);
+	str_append(dest, "--"BENCH_BOUNDARY_ALT"\r\n"
+		   "Content-Type: text/html; charset=utf-8\r\n"
+		   "\r\n");
+	bench_append_text(dest, text_size);
+	str_append(dest, "--"BENCH_BOUNDARY_ALT"--\r\n\r\n");
+
+	bench_append_attachment(dest, size / 4);
+	bench_append_attachment(dest, size / 4);
+
+	str_append(dest, "--"BENCH_BOUNDARY_MIXED"\r\n"
+		   "Content-Type: message/rfc822\r\n"
+		   "\r\n"
+		   "From: Forwarded <forwarded@example.org>\r\n"
+		   "Subject: forwarded message\r\n"
+		   "MIME-Version: 1.0\r\n"
+		   "Content-Type: multipart/mixed;\r\n"
+		   "\tboundary=\""BENCH_BOUNDARY_INNER"\"\r\n"
+		   "\r\n"
+		   "--"BENCH_BOUNDARY_INNER"\r\n"
+		   "Content-Type: text/plain\r\n"
+		   "\r\n");
+	bench_append_text(dest, text_size);
+	str_append(dest, "--"BENCH_BOUNDARY_INNER"\r\n"
+		   "Content-Type: application/octet-stream\r\n"
+		   "Content-Transfer-Encoding: base64\r\n"
+		   "\r\n");
+	bench_append_base64(dest, size / 8);
+	str_append(dest, "\r\n--"BENCH_BOUNDARY_INNER"--\r\n"
+		   "\r\n--"BENCH_BOUNDARY_MIXED"--\r\n");
+}
+
+static unsigned int bench_parse(const string_t *msg)
+{
+	const struct message_parser_settings set = {
+		.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
+	};
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct message_part *parts, *part;
+	struct istream *input;
+	unsigned int part_count = 0;
+	pool_t pool;
+	int ret;
+
+	pool = pool_alloconly_create("message parser bench", 10240);
+	input = i_stream_create_from_data(str_data(msg), str_len(msg));
+	parser = message_parser_init(pool, input, &set);
+	while ((ret = message_parser_parse_next_block(parser, &block)) > 0) ;
+	i_assert(ret < 0);
+	message_parser_deinit(&parser, &parts);
+	i_assert(input->stream_errno == 0);
+
+	for (part = parts; part != NULL; ) {
+		part_count++;
+		if (part->children != NULL)
+			part = part->children;
+		else {
+			while (part->next == NULL && part->parent != NULL)
+				part = part->parent;
+			part = part->next;
+		}
+	}
+	i_stream_unref(&input);
+	pool_unref(&pool);
+	return part_count;
+}
+
+static void
+bench_message_parser(unsigned int message_count, size_t message_size,
+		     unsigned int rounds)
+{
+	string_t **msgs;
+	uoff_t total_size = 0;
+	uint64_t ts_0, ts_1;
+	unsigned int i, round, part_count = 0;
+
+	msgs = i_new(string_t *, message_count);
+	for (i = 0; i < message_count; i++) {
+		msgs[i] = str_new(default_pool, message_size + 4096);
+		T_BEGIN {
+			bench_append_message(msgs[i], message_size);
+		} T_END;
+		total_size += str_len(msgs[i]);
+	}
+	printf("Input data is %u messages, %"PRIuUOFF_T" bytes\n\n",
+	       message_count, total_size);
+
+	ts_0 = i_nanoseconds();
+	for (round = 0; round < rounds; round++) {
+		for (i = 0; i < message_count; i++)
+			part_count += bench_parse(msgs[i]);
+	}
+	ts_1 = i_nanoseconds();
+	i_assert(part_count == rounds * message_count * 10);
+
+	printf("parse: %0.02lf ms, %0.02lf MB/s\n",
+	       (double)(ts_1 - ts_0) / 1000000,
+	       ((double)total_size * rounds / (1024*1024)) /
+	       ((double)(ts_1 - ts_0) / 1000000000));
+
+	for (i = 0; i < message_count; i++)
+		str_free(&msgs[i]);
+	i_free(msgs);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<message_count> [<message_kb> [<rounds>]]]\n",
+		prog);
+	fprintf(stderr, "Runs 10 rounds over 100 messages of 1024 kB "
+		"if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int message_count = 100, message_kb = 1024, rounds = 10;
+
+	lib_init();
+
+	if ((argc >= 2 && str_to_uint(argv[1], &message_count) < 0) ||
+	    (argc >= 3 && str_to_uint(argv[2], &message_kb) < 0) ||
+	    (argc >= 4 && str_to_uint(argv[3], &rounds) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 4 || message_count == 0 || message_kb == 0 || rounds == 0)
+		print_usage(argv[0]);
+
+	bench_message_parser(message_count, (size_t)message_kb * 1024, rounds);
+	lib_deinit();
+	return 0;
+}
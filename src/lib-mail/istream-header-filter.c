@@ -210,8 +210,8 @@ static ssize_t read_header(struct header_filter_istream *mstream)
 
 	if (mstream->hdr_ctx == NULL) {
 		mstream->hdr_ctx =
-			message_parse_header_init(mstream->istream.parent,
-						  NULL, 0);
+			message_parse_header_init(mstream->istream.parent, NULL,
+				MESSAGE_HEADER_PARSER_FLAG_NO_VALUE_COPY);
 	}
 
 	/* remove skipped data from hdr_buf */
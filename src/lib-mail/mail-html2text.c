@@ -6,6 +6,10 @@
 #include "message-parser.h"
 #include "mail-html2text.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /* Zero-width space (&#x200B;) apparently also belongs here, but that gets a
    bit tricky to handle.. is it actually used anywhere? */
 #define HTML_WHITESPACE(c) \
@@ -51,11 +55,94 @@ static struct {
 #include "html-entities.h"
 };
 
+/* The entity names are looked up with a perfect hash: the multiplier was
+   chosen so that none of the names in html-entities.h collide. If adding a
+   new entity causes a collision, html_entities_hash_init() asserts and
+   another multiplier needs to be found. */
+#define HTML_ENTITY_HASH_BITS 12
+#define HTML_ENTITY_HASH_MULTIPLIER 2471
+/* Entity names are at most this long */
+#define HTML_ENTITY_MAX_LEN 9
+
+/* html_entities[] index+1 for each hash, or 0 if unused */
+static uint8_t html_entities_hash[1 << HTML_ENTITY_HASH_BITS];
+static bool html_entities_hash_initialized = FALSE;
+
+static unsigned int html_entity_hash(const unsigned char *name, size_t len)
+{
+	uint32_t hash = 0;
+
+	for (size_t i = 0; i < len; i++)
+		hash = hash * HTML_ENTITY_HASH_MULTIPLIER + name[i];
+	return (uint32_t)(hash * 2654435761U) >> (32 - HTML_ENTITY_HASH_BITS);
+}
+
+static void html_entities_hash_init(void)
+{
+	unsigned int hash;
+
+	if (html_entities_hash_initialized)
+		return;
+
+	i_assert(N_ELEMENTS(html_entities) < UINT8_MAX);
+	for (unsigned int i = 0; i < N_ELEMENTS(html_entities); i++) {
+		hash = html_entity_hash(
+			(const unsigned char *)html_entities[i].name,
+			strlen(html_entities[i].name));
+		i_assert(html_entities_hash[hash] == 0);
+		html_entities_hash[hash] = i + 1;
+	}
+	html_entities_hash_initialized = TRUE;
+}
+
+/* Returns the offset of the first c1, c2 or c3 in data, or size if none of
+   them were found. */
+static size_t
+html_find_chr3(const unsigned char *data, size_t size,
+	       unsigned char c1, unsigned char c2, unsigned char c3)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i v1 = _mm_set1_epi8((char)c1);
+	const __m128i v2 = _mm_set1_epi8((char)c2);
+	const __m128i v3 = _mm_set1_epi8((char)c3);
+
+	for (; size - i >= 16; i += 16) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+		__m128i eq = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, v1),
+				     _mm_cmpeq_epi8(v, v2)),
+			_mm_cmpeq_epi8(v, v3));
+		unsigned int mask = _mm_movemask_epi8(eq);
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < size; i++) {
+		if (data[i] == c1 || data[i] == c2 || data[i] == c3)
+			break;
+	}
+	return i;
+}
+
+/* Returns the offset of the first c in data, or size if it wasn't found. */
+static size_t html_find_chr(const unsigned char *data, size_t size,
+			    unsigned char c)
+{
+	const unsigned char *p = memchr(data, c, size);
+
+	return p == NULL ? size : (size_t)(p - data);
+}
+
 struct mail_html2text *
 mail_html2text_init(enum mail_html2text_flags flags)
 {
 	struct mail_html2text *ht;
 
+	html_entities_hash_init();
+
 	ht = i_new(struct mail_html2text, 1);
 	ht->flags = flags;
 	ht->input = buffer_create_dynamic(default_pool, 512);
@@ -115,13 +202,23 @@ parse_tag_name(struct mail_html2text *ht,
 	return 1;
 }
 
-static bool html_entity_get_unichar(const char *name, unichar_t *chr_r)
+static bool
+html_entity_get_unichar(const unsigned char *name, size_t len,
+			unichar_t *chr_r)
 {
+	const char *entity_name;
+	char numeric[HTML_ENTITY_MAX_LEN + 1];
+	unsigned int idx;
 	unichar_t chr;
 
-	for (size_t i = 0; i < N_ELEMENTS(html_entities); i++) {
-		if (strcmp(html_entities[i].name, name) == 0) {
-			*chr_r = html_entities[i].chr;
+	i_assert(len <= HTML_ENTITY_MAX_LEN);
+
+	idx = html_entities_hash[html_entity_hash(name, len)];
+	if (idx != 0) {
+		entity_name = html_entities[idx-1].name;
+		if (strlen(entity_name) == len &&
+		    memcmp(entity_name, name, len) == 0) {
+			*chr_r = html_entities[idx-1].chr;
 			return TRUE;
 		}
 	}
@@ -129,10 +226,12 @@ static bool html_entity_get_unichar(const char *name, unichar_t *chr_r)
 	/* maybe it's just encoded binary byte
 	   it can be &#nnn; or &#xnnn;
 	*/
-	if (name[0] == '#' &&
-	    ((name[1] == 'x' &&
-	      str_to_uint32_hex(name+2, &chr) == 0) ||
-	     str_to_uint32(name+1, &chr) == 0) &&
+	if (len == 0 || name[0] != '#')
+		return FALSE;
+	memcpy(numeric, name, len); numeric[len] = '\0';
+	if (((numeric[1] == 'x' &&
+	      str_to_uint32_hex(numeric+2, &chr) == 0) ||
+	     str_to_uint32(numeric+1, &chr) == 0) &&
 	     uni_is_valid_ucs4(chr)) {
 		*chr_r = chr;
 		return TRUE;
@@ -144,12 +243,11 @@ static bool html_entity_get_unichar(const char *name, unichar_t *chr_r)
 static size_t parse_entity(const unsigned char *data, size_t size,
 			   buffer_t *output)
 {
-	char entity[10];
 	unichar_t chr;
 	size_t i;
 
 	for (i = 0; i < size; i++) {
-		if (HTML_WHITESPACE(data[i]) || i >= sizeof(entity)) {
+		if (HTML_WHITESPACE(data[i]) || i > HTML_ENTITY_MAX_LEN) {
 			/* broken entity */
 			return 1;
 		}
@@ -159,10 +257,7 @@ static size_t parse_entity(const unsigned char *data, size_t size,
 	if (i == size)
 		return 0;
 
-	i_assert(i < sizeof(entity));
-	memcpy(entity, data, i); entity[i] = '\0';
-
-	if (html_entity_get_unichar(entity, &chr))
+	if (html_entity_get_unichar(data, i, &chr))
 		uni_ucs4_to_utf8_c(chr, output);
 	return i + 1 + 1;
 }
@@ -176,40 +271,54 @@ static void mail_html2text_add_space(buffer_t *output)
 		buffer_append_c(output, ' ');
 }
 
+static bool mail_html2text_skipping(struct mail_html2text *ht)
+{
+	return ht->quote_level > 0 &&
+		(ht->flags & MAIL_HTML2TEXT_FLAG_SKIP_QUOTED) != 0;
+}
+
 static size_t
 parse_data(struct mail_html2text *ht,
 	   const unsigned char *data, size_t size, buffer_t *output)
 {
-	size_t i, ret;
-
-	for (i = 0; i < size; i++) {
-		unsigned char c = data[i];
+	size_t i = 0, n, ret;
+	unsigned int max_len;
 
+	/* Each state skips (or copies) everything it doesn't care about
+	   at once, so the output is appended in blocks instead of one
+	   character at a time. */
+	while (i < size) {
 		switch (ht->state) {
 		case HTML_STATE_TEXT:
-			if (c == '<') {
+			if (mail_html2text_skipping(ht)) {
+				/* skip until the next tag */
+				i += html_find_chr(data + i, size - i, '<');
+			} else {
+				n = html_find_chr3(data + i, size - i,
+						   '<', '&', '&');
+				buffer_append(output, data + i, n);
+				i += n;
+			}
+			if (i == size)
+				break;
+			if (data[i] == '<') {
 				ret = parse_tag_name(ht, data+i+1, size-i-1);
-				if (ret == 0)
-					return i;
-				i += ret - 1;
-			} else if (ht->quote_level > 0 &&
-				   (ht->flags & MAIL_HTML2TEXT_FLAG_SKIP_QUOTED) != 0) {
-					break;
-			} else if (c == '&') {
-				ret = parse_entity(data+i+1, size-i-1, output);
-				if (ret == 0)
-					return i;
-				i += ret - 1;
 			} else {
-				buffer_append_c(output, c);
+				ret = parse_entity(data+i+1, size-i-1, output);
 			}
+			if (ret == 0)
+				return i;
+			i += ret;
 			break;
 		case HTML_STATE_TAG:
-			if (c == '"')
+			i += html_find_chr3(data + i, size - i, '"', '\'', '>');
+			if (i == size)
+				break;
+			if (data[i] == '"')
 				ht->state = HTML_STATE_TAG_DQUOTED;
-			else if (c == '\'')
+			else if (data[i] == '\'')
 				ht->state = HTML_STATE_TAG_SQUOTED;
-			else if (c == '>') {
+			else {
 				ht->state = HTML_STATE_TEXT;
 				if (ht->quote_level > 0 &&
 				    (ht->flags & MAIL_HTML2TEXT_FLAG_SKIP_QUOTED) == 0) {
@@ -220,82 +329,103 @@ parse_data(struct mail_html2text *ht,
 				ht->add_newline = FALSE;
 				mail_html2text_add_space(output);
 			}
+			i++;
 			break;
 		case HTML_STATE_TAG_DQUOTED:
-			if (c == '"')
+			i += html_find_chr3(data + i, size - i,
+					    '"', '\\', '\\');
+			if (i == size)
+				break;
+			if (data[i] == '"')
 				ht->state = HTML_STATE_TAG;
-			else if (c == '\\')
+			else
 				ht->state = HTML_STATE_TAG_DQUOTED_ESCAPE;
+			i++;
 			break;
 		case HTML_STATE_TAG_DQUOTED_ESCAPE:
 			ht->state = HTML_STATE_TAG_DQUOTED;
+			i++;
 			break;
 		case HTML_STATE_TAG_SQUOTED:
-			if (c == '\'')
+			i += html_find_chr3(data + i, size - i,
+					    '\'', '\\', '\\');
+			if (i == size)
+				break;
+			if (data[i] == '\'')
 				ht->state = HTML_STATE_TAG;
-			else if (c == '\\')
+			else
 				ht->state = HTML_STATE_TAG_SQUOTED_ESCAPE;
+			i++;
 			break;
 		case HTML_STATE_TAG_SQUOTED_ESCAPE:
 			ht->state = HTML_STATE_TAG_SQUOTED;
+			i++;
 			break;
 		case HTML_STATE_COMMENT:
-			if (c == '-') {
-				if (i+1 == size)
-					return i;
-				if (data[i+1] == '-') {
-					ht->state = HTML_STATE_COMMENT_END;
-					i++;
-				}
+			i += html_find_chr(data + i, size - i, '-');
+			if (i == size)
+				break;
+			if (i+1 == size)
+				return i;
+			if (data[i+1] == '-') {
+				ht->state = HTML_STATE_COMMENT_END;
+				i++;
 			}
+			i++;
 			break;
 		case HTML_STATE_COMMENT_END:
-			if (c == '>')
+			if (data[i] == '>')
 				ht->state = HTML_STATE_TEXT;
-			else if (!HTML_WHITESPACE(c))
+			else if (!HTML_WHITESPACE(data[i]))
 				ht->state = HTML_STATE_COMMENT;
+			i++;
 			break;
 		case HTML_STATE_SCRIPT:
-			if (c == '<') {
-				unsigned int max_len = I_MIN(size-i, 9);
-
-				if (i_memcasecmp(data+i, "</script>", max_len) == 0) {
-					if (max_len < 9)
-						return i;
-					mail_html2text_add_space(output);
-					ht->state = HTML_STATE_TEXT;
-					i += 8;
-				}
+			i += html_find_chr(data + i, size - i, '<');
+			if (i == size)
+				break;
+			max_len = I_MIN(size-i, 9);
+			if (i_memcasecmp(data+i, "</script>", max_len) == 0) {
+				if (max_len < 9)
+					return i;
+				mail_html2text_add_space(output);
+				ht->state = HTML_STATE_TEXT;
+				i += 8;
 			}
+			i++;
 			break;
 		case HTML_STATE_STYLE:
-			if (c == '<') {
-				unsigned int max_len = I_MIN(size-i, 8);
-
-				if (i_memcasecmp(data+i, "</style>", max_len) == 0) {
-					if (max_len < 8)
-						return i;
-					mail_html2text_add_space(output);
-					ht->state = HTML_STATE_TEXT;
-					i += 7;
-				}
+			i += html_find_chr(data + i, size - i, '<');
+			if (i == size)
+				break;
+			max_len = I_MIN(size-i, 8);
+			if (i_memcasecmp(data+i, "</style>", max_len) == 0) {
+				if (max_len < 8)
+					return i;
+				mail_html2text_add_space(output);
+				ht->state = HTML_STATE_TEXT;
+				i += 7;
 			}
+			i++;
 			break;
 		case HTML_STATE_CDATA:
-			if (c == ']') {
-				unsigned int max_len = I_MIN(size-i, 3);
-
-				if (i_memcasecmp(data+i, "]]>", max_len) == 0) {
-					if (max_len < 3)
-						return i;
-					ht->state = HTML_STATE_TEXT;
-					i += 2;
-					break;
-				}
+			n = html_find_chr(data + i, size - i, ']');
+			if (!mail_html2text_skipping(ht))
+				buffer_append(output, data + i, n);
+			i += n;
+			if (i == size)
+				break;
+			max_len = I_MIN(size-i, 3);
+			if (i_memcasecmp(data+i, "]]>", max_len) == 0) {
+				if (max_len < 3)
+					return i;
+				ht->state = HTML_STATE_TEXT;
+				i += 3;
+				break;
 			}
-			if (ht->quote_level == 0 ||
-			    (ht->flags & MAIL_HTML2TEXT_FLAG_SKIP_QUOTED) == 0)
-				buffer_append_c(output, c);
+			if (!mail_html2text_skipping(ht))
+				buffer_append_c(output, ']');
+			i++;
 			break;
 		}
 	}
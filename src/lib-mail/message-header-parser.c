@@ -369,7 +369,14 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 				ctx->header_block_max_size - header_total_used;
 	line_value_size = I_MIN(line_value_size, line_available);
 
-	if (!line->continued) {
+	if (!line->continued && !line->continues && !line->eoh &&
+	    (ctx->flags & MESSAGE_HEADER_PARSER_FLAG_NO_VALUE_COPY) != 0) {
+		/* the whole header is in this line, and the caller promised
+		   not to use it after reading the input stream again. */
+		ctx->header_block_total_size += line_value_size;
+		line->full_value = line->value;
+		line->full_value_len = line->value_len = line_value_size;
+	} else if (!line->continued) {
 		/* first header line. make a copy of the line since we can't
 		   really trust input stream not to lose it. */
 		buffer_append(ctx->value_buf, line->value, line_value_size);
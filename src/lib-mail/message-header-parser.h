@@ -16,7 +16,12 @@ enum message_header_parser_flags {
 	/* Don't add CRs to full_value even if input had them */
 	MESSAGE_HEADER_PARSER_FLAG_DROP_CR		= 0x02,
 	/* Convert [CR+]LF+LWSP to a space character in full_value */
-	MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE	= 0x04
+	MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE	= 0x04,
+	/* Don't copy the value of headers that fit into a single line.
+	   value and full_value then point directly to the input stream's
+	   buffer, and they are valid only until the stream is read again.
+	   Multiline headers are still copied. */
+	MESSAGE_HEADER_PARSER_FLAG_NO_VALUE_COPY	= 0x08
 };
 
 struct message_header_line {
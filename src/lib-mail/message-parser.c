@@ -8,6 +8,10 @@
 #include "rfc2231-parser.h"
 #include "message-parser-private.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 message_part_header_callback_t *null_message_part_header_callback = NULL;
 
 static int parse_next_header_init(struct message_parser_ctx *ctx,
@@ -53,37 +57,64 @@ boundary_find(struct message_boundary *boundaries,
 static void parse_body_add_block(struct message_parser_ctx *ctx,
 				 struct message_block *block)
 {
-	unsigned int missing_cr_count = 0;
-	const unsigned char *cur, *next, *data = block->data;
+	unsigned int lines = 0, missing_cr_count = 0;
+	const unsigned char *data = block->data;
+	size_t i = 1, size = block->size;
+	bool has_nuls;
 
 	i_assert(block->size > 0);
 
 	block->hdr = NULL;
 
-	/* check if we have NULs */
-	if (memchr(data, '\0', block->size) != NULL)
-		ctx->part->flags |= MESSAGE_PART_FLAG_HAS_NULS;
-
-	/* count number of lines and missing CRs */
+	/* count number of lines and missing CRs, and check if we have NULs */
+	has_nuls = *data == '\0';
 	if (*data == '\n') {
-		ctx->part->body_size.lines++;
+		lines++;
 		if (ctx->last_chr != '\r')
 			missing_cr_count++;
 	}
 
-	cur = data + 1;
-	while ((next = memchr(cur, '\n', block->size - (cur - data))) != NULL) {
-		ctx->part->body_size.lines++;
-		if (next[-1] != '\r')
+#ifdef __SSE2__
+	unsigned int nul_mask = 0;
+	for (; size - i >= 16; i += 16) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+		__m128i prev = _mm_loadu_si128((const void *)(data + i - 1));
+		unsigned int lf_mask = _mm_movemask_epi8(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+
+		nul_mask |= _mm_movemask_epi8(
+			_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		if (lf_mask == 0)
+			continue;
+
+		/* lines are usually long, so there are only a few LFs */
+		unsigned int lf_no_cr_mask = lf_mask & ~_mm_movemask_epi8(
+			_mm_cmpeq_epi8(prev, _mm_set1_epi8('\r')));
+		for (; lf_mask != 0; lf_mask &= lf_mask - 1)
+			lines++;
+		for (; lf_no_cr_mask != 0; lf_no_cr_mask &= lf_no_cr_mask - 1)
 			missing_cr_count++;
-
-		cur = next + 1;
 	}
-	ctx->last_chr = data[block->size - 1];
-	ctx->skip += block->size;
+	if (nul_mask != 0)
+		has_nuls = TRUE;
+#endif
+	for (; i < size; i++) {
+		if (data[i] == '\n') {
+			lines++;
+			if (data[i-1] != '\r')
+				missing_cr_count++;
+		} else if (data[i] == '\0') {
+			has_nuls = TRUE;
+		}
+	}
+	if (has_nuls)
+		ctx->part->flags |= MESSAGE_PART_FLAG_HAS_NULS;
+	ctx->part->body_size.lines += lines;
+	ctx->last_chr = data[size - 1];
+	ctx->skip += size;
 
-	ctx->part->body_size.physical_size += block->size;
-	ctx->part->body_size.virtual_size += block->size + missing_cr_count;
+	ctx->part->body_size.physical_size += size;
+	ctx->part->body_size.virtual_size += size + missing_cr_count;
 }
 
 int message_parser_read_more(struct message_parser_ctx *ctx,
@@ -229,6 +260,44 @@ static int parse_next_body_message_rfc822_init(struct message_parser_ctx *ctx,
 	return parse_next_header_init(ctx, block_r);
 }
 
+/* Find the next LF that may begin a boundary line, i.e. it's followed by
+   "--" or there isn't enough data after it to know yet. Other lines can't
+   contain a boundary, so they don't need to be looked at. */
+static const unsigned char *
+boundary_candidate_find(const unsigned char *data, const unsigned char *end)
+{
+	size_t i = 0, size = end - data;
+
+#ifdef __SSE2__
+	/* Compare each position and the two following ones at once, so the
+	   last two bytes are left for the scalar loop. */
+	while (size - i >= 16 + 2) {
+		__m128i lf = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const void *)(data + i)),
+			_mm_set1_epi8('\n'));
+		__m128i dash1 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const void *)(data + i + 1)),
+			_mm_set1_epi8('-'));
+		__m128i dash2 = _mm_cmpeq_epi8(
+			_mm_loadu_si128((const void *)(data + i + 2)),
+			_mm_set1_epi8('-'));
+		unsigned int mask = _mm_movemask_epi8(
+			_mm_and_si128(lf, _mm_and_si128(dash1, dash2)));
+
+		if (mask != 0)
+			return data + i + __builtin_ctz(mask);
+		i += 16;
+	}
+#endif
+	for (; i < size; i++) {
+		if (data[i] != '\n')
+			continue;
+		if (size - i < 3 || (data[i+1] == '-' && data[i+2] == '-'))
+			return data + i;
+	}
+	return NULL;
+}
+
 static int
 boundary_line_find(struct message_parser_ctx *ctx,
 		   const unsigned char *data, size_t size, bool full,
@@ -418,10 +487,10 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	i_assert(block_r->size > 0);
 	boundary_start = 0;
 
-	/* skip to beginning of the next line. the first line was
-	   handled already. */
+	/* skip to beginning of the next line that may be a boundary. the
+	   first line was handled already. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	while ((next = boundary_candidate_find(cur, end)) != NULL) {
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -443,6 +512,17 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 		}
 	}
 
+	if (next == NULL) {
+		/* leave the last line to buffer. it may be the beginning of
+		   a boundary line. */
+		for (cur = end; cur > data && cur[-1] != '\n'; cur--) ;
+		if (cur > data) {
+			boundary_start = cur - 1 - data;
+			if (boundary_start > 0 && data[boundary_start-1] == '\r')
+				boundary_start--;
+		}
+	}
+
 	if (next != NULL) {
 		/* found / need more data */
 		i_assert(ret >= 0);
@@ -135,6 +135,71 @@ static bool read_next(struct deserialize_context *ctx,
 	return TRUE;
 }
 
+static bool
+message_part_deserialize_fields(struct deserialize_context *ctx,
+				struct message_part *part, bool root,
+				unsigned int *children_count_r)
+{
+	if (!read_next(ctx, &part->flags, sizeof(part->flags)))
+		return FALSE;
+
+	if (!root) {
+		if (!read_next(ctx, &part->physical_pos,
+			       sizeof(part->physical_pos)))
+			return FALSE;
+	}
+
+	if (part->physical_pos < ctx->pos) {
+		ctx->error = "physical_pos less than expected";
+		return FALSE;
+	}
+
+	if (!read_next(ctx, &part->header_size.physical_size,
+		       sizeof(part->header_size.physical_size)))
+		return FALSE;
+
+	if (!read_next(ctx, &part->header_size.virtual_size,
+		       sizeof(part->header_size.virtual_size)))
+		return FALSE;
+
+	if (part->header_size.virtual_size <
+	    part->header_size.physical_size) {
+		ctx->error = "header_size.virtual_size too small";
+		return FALSE;
+	}
+
+	if (!read_next(ctx, &part->body_size.physical_size,
+		       sizeof(part->body_size.physical_size)))
+		return FALSE;
+
+	if (!read_next(ctx, &part->body_size.virtual_size,
+		       sizeof(part->body_size.virtual_size)))
+		return FALSE;
+
+	if ((part->flags & (MESSAGE_PART_FLAG_TEXT |
+			    MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
+		if (!read_next(ctx, &part->body_size.lines,
+			       sizeof(part->body_size.lines)))
+			return FALSE;
+	}
+
+	if (part->body_size.virtual_size <
+	    part->body_size.physical_size) {
+		ctx->error = "body_size.virtual_size too small";
+		return FALSE;
+	}
+
+	if ((part->flags & (MESSAGE_PART_FLAG_MULTIPART |
+			    MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
+		if (!read_next(ctx, children_count_r,
+			       sizeof(*children_count_r)))
+			return FALSE;
+	} else {
+		*children_count_r = 0;
+	}
+	return TRUE;
+}
+
 static bool ATTR_NULL(2)
 message_part_deserialize_part(struct deserialize_context *ctx,
 			      struct message_part *parent,
@@ -156,65 +221,10 @@ message_part_deserialize_part(struct deserialize_context *ctx,
 		for (p = parent; p != NULL; p = p->parent)
 			p->children_count++;
 
-		if (!read_next(ctx, &part->flags, sizeof(part->flags)))
+		if (!message_part_deserialize_fields(ctx, part, root,
+						     &children_count))
 			return FALSE;
-
-		if (root)
-			root = FALSE;
-		else {
-			if (!read_next(ctx, &part->physical_pos,
-				       sizeof(part->physical_pos)))
-				return FALSE;
-		}
-
-		if (part->physical_pos < ctx->pos) {
-			ctx->error = "physical_pos less than expected";
-			return FALSE;
-		}
-
-		if (!read_next(ctx, &part->header_size.physical_size,
-			       sizeof(part->header_size.physical_size)))
-			return FALSE;
-
-		if (!read_next(ctx, &part->header_size.virtual_size,
-			       sizeof(part->header_size.virtual_size)))
-			return FALSE;
-
-		if (part->header_size.virtual_size <
-		    part->header_size.physical_size) {
-			ctx->error = "header_size.virtual_size too small";
-			return FALSE;
-		}
-
-		if (!read_next(ctx, &part->body_size.physical_size,
-			       sizeof(part->body_size.physical_size)))
-			return FALSE;
-
-		if (!read_next(ctx, &part->body_size.virtual_size,
-			       sizeof(part->body_size.virtual_size)))
-			return FALSE;
-
-		if ((part->flags & (MESSAGE_PART_FLAG_TEXT |
-				    MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
-			if (!read_next(ctx, &part->body_size.lines,
-				       sizeof(part->body_size.lines)))
-				return FALSE;
-		}
-
-		if (part->body_size.virtual_size <
-		    part->body_size.physical_size) {
-			ctx->error = "body_size.virtual_size too small";
-			return FALSE;
-		}
-
-		if ((part->flags & (MESSAGE_PART_FLAG_MULTIPART |
-				    MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
-			if (!read_next(ctx, &children_count,
-				       sizeof(children_count)))
-				return FALSE;
-		} else {
-                        children_count = 0;
-		}
+		root = FALSE;
 
 		if ((part->flags & MESSAGE_PART_FLAG_MESSAGE_RFC822) != 0) {
 			/* Only one child is possible */
@@ -293,3 +303,149 @@ message_part_deserialize(pool_t pool, const void *data, size_t size,
 
 	return part;
 }
+
+bool message_part_deserialize_root(const void *data, size_t size,
+				   struct message_part *part_r,
+				   const char **error_r)
+{
+	struct message_part_deserialize_cursor cursor;
+
+	if (!message_part_deserialize_cursor_init(&cursor, data, size,
+						  error_r))
+		return FALSE;
+	*part_r = cursor.part;
+	return TRUE;
+}
+
+bool message_part_deserialize_cursor_init(
+	struct message_part_deserialize_cursor *cursor,
+	const void *data, size_t size, const char **error_r)
+{
+	struct deserialize_context ctx;
+
+	i_zero(&ctx);
+	ctx.data = data;
+	ctx.end = ctx.data + size;
+
+	i_zero(cursor);
+	if (!message_part_deserialize_fields(&ctx, &cursor->part, TRUE,
+					     &cursor->children_count)) {
+		*error_r = ctx.error;
+		return FALSE;
+	}
+	if (cursor->children_count == 0 && ctx.data != ctx.end) {
+		*error_r = "Too much data";
+		return FALSE;
+	}
+	cursor->data = ctx.data;
+	cursor->end = ctx.end;
+	return TRUE;
+}
+
+static bool
+message_part_deserialize_skip(struct deserialize_context *ctx,
+			      unsigned int count, enum message_part_flags *flags)
+{
+	struct message_part part;
+	unsigned int children_count;
+
+	/* Skip the parts and all of their children. This is done iteratively
+	   by counting the parts still left to skip, so corrupted data can't
+	   cause a deep recursion. */
+	while (count > 0) {
+		i_zero(&part);
+		ctx->pos = 0;
+		if (!message_part_deserialize_fields(ctx, &part, FALSE,
+						     &children_count))
+			return FALSE;
+		*flags |= part.flags;
+		count--;
+		if (children_count > UINT_MAX - count) {
+			ctx->error = "Too many children";
+			return FALSE;
+		}
+		count += children_count;
+	}
+	return TRUE;
+}
+
+bool message_part_deserialize_all_flags(const void *data, size_t size,
+					enum message_part_flags *flags_r,
+					const char **error_r)
+{
+	struct message_part_deserialize_cursor cursor;
+	struct deserialize_context ctx;
+
+	if (!message_part_deserialize_cursor_init(&cursor, data, size,
+						  error_r))
+		return FALSE;
+
+	i_zero(&ctx);
+	ctx.data = cursor.data;
+	ctx.end = cursor.end;
+	*flags_r = cursor.part.flags;
+	if (!message_part_deserialize_skip(&ctx, cursor.children_count,
+					   flags_r)) {
+		*error_r = ctx.error;
+		return FALSE;
+	}
+	if (ctx.data != ctx.end) {
+		*error_r = "Too much data";
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int message_part_deserialize_cursor_child(
+	struct message_part_deserialize_cursor *cursor, unsigned int idx,
+	const char **error_r)
+{
+	const struct message_part *parent = &cursor->part;
+	struct deserialize_context ctx;
+	struct message_part part;
+	enum message_part_flags flags = 0;
+	unsigned int children_count;
+	uoff_t body_end, part_size;
+
+	if (idx >= cursor->children_count)
+		return 0;
+
+	i_zero(&ctx);
+	ctx.data = cursor->data;
+	ctx.end = cursor->end;
+	if (!message_part_deserialize_skip(&ctx, idx, &flags)) {
+		*error_r = ctx.error;
+		return -1;
+	}
+
+	/* the child must be within the parent's body */
+	ctx.pos = parent->physical_pos + parent->header_size.physical_size;
+	body_end = ctx.pos + parent->body_size.physical_size;
+
+	i_zero(&part);
+	if (!message_part_deserialize_fields(&ctx, &part, FALSE,
+					     &children_count)) {
+		*error_r = ctx.error;
+		return -1;
+	}
+	part_size = part.header_size.physical_size +
+		part.body_size.physical_size;
+	if (part.physical_pos > body_end ||
+	    part_size < part.header_size.physical_size ||
+	    part_size > body_end - part.physical_pos) {
+		*error_r = "child part location exceeds our size";
+		return -1;
+	}
+	if ((part.flags & MESSAGE_PART_FLAG_MESSAGE_RFC822) != 0 &&
+	    children_count != 1) {
+		*error_r = children_count == 0 ?
+			"message/rfc822 part has no children" :
+			"message/rfc822 part has multiple children";
+		return -1;
+	}
+
+	cursor->data = ctx.data;
+	cursor->part = part;
+	cursor->children_count = children_count;
+	return 1;
+}
@@ -12,5 +12,45 @@ void message_part_serialize(struct message_part *part, buffer_t *dest);
 struct message_part *
 message_part_deserialize(pool_t pool, const void *data, size_t size,
 			 const char **error_r);
+/* Deserialize only the root part without building the rest of the tree.
+   The returned part has no parent, children or siblings. The children's
+   data isn't validated. Returns FALSE and sets error if any problems are
+   detected in the root part. */
+bool message_part_deserialize_root(const void *data, size_t size,
+				   struct message_part *part_r,
+				   const char **error_r);
+
+/* Get the flags of all the parts ORed together without building the tree.
+   This can be used e.g. to find out if the message has NULs. Returns FALSE
+   and sets error if any problems are detected. */
+bool message_part_deserialize_all_flags(const void *data, size_t size,
+					enum message_part_flags *flags_r,
+					const char **error_r);
+
+/* Cursor for looking up individual parts directly from the serialized data
+   without deserializing the whole tree. Skipping over parts only reads their
+   fixed size fields, so finding e.g. the part for BODY[2.1] costs neither
+   memory allocations nor validating unrelated subtrees. */
+struct message_part_deserialize_cursor {
+	const unsigned char *data, *end;
+
+	/* The current part. Its parent, children and next pointers are
+	   always NULL and children_count is 0. */
+	struct message_part part;
+	/* Number of the current part's direct children */
+	unsigned int children_count;
+};
+
+/* Initialize the cursor to point to the root part. Returns FALSE and sets
+   error if the root part is broken. */
+bool message_part_deserialize_cursor_init(
+	struct message_part_deserialize_cursor *cursor,
+	const void *data, size_t size, const char **error_r);
+/* Move the cursor to the current part's child with the given 0-based index.
+   Returns 1 if found, 0 if there is no such child (cursor is unchanged),
+   -1 and error if the data is broken. */
+int message_part_deserialize_cursor_child(
+	struct message_part_deserialize_cursor *cursor, unsigned int idx,
+	const char **error_r);
 
 #endif
@@ -5,6 +5,10 @@
 #include "hex-binary.h"
 #include "qp-decoder.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /* quoted-printable lines can be max 76 characters. if we've seen more than
    that much whitespace, it means there really shouldn't be anything else left
    in the line except trailing whitespace. */
@@ -48,22 +52,100 @@ void qp_decoder_deinit(struct qp_decoder **_qp)
 	i_free(qp);
 }
 
+/* Returns the position of the first character in src that may need special
+   handling in text state, or src_size if there are none. */
+static size_t qp_decoder_find_special(const unsigned char *src, size_t src_size)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	/* Whitespace followed by another character than whitespace or
+	   newline can't be trailing whitespace, so it's plain text. This
+	   looks at the next character, so the last byte is left for the
+	   scalar loop. */
+	while (src_size - i > 16) {
+		__m128i v = _mm_loadu_si128((const void *)(src + i));
+		__m128i next = _mm_loadu_si128((const void *)(src + i + 1));
+		__m128i ws = _mm_or_si128(
+			_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+			_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+		__m128i next_ws = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(next, _mm_set1_epi8(' ')),
+				     _mm_cmpeq_epi8(next, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(next, _mm_set1_epi8('\r')),
+				     _mm_cmpeq_epi8(next, _mm_set1_epi8('\n'))));
+		__m128i special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('=')),
+				     _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+				     _mm_and_si128(ws, next_ws)));
+		unsigned int mask = _mm_movemask_epi8(special);
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+		i += 16;
+	}
+#endif
+	for (; i < src_size; i++) {
+		if (src[i] > '=')
+			continue;
+		switch (src[i]) {
+		case '=':
+		case '\r':
+		case '\n':
+		case ' ':
+		case '\t':
+			return i;
+		}
+	}
+	return src_size;
+}
+
+static inline int qp_hex_digit(unsigned char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	/* lowercase hex isn't strictly valid, but allow */
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
 static size_t
 qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		     size_t src_size)
 {
 	size_t i, start = 0, ret = src_size;
+	int hi, lo;
 
 	for (i = 0; i < src_size; i++) {
-		if (src[i] > '=') {
-			/* fast path */
-			continue;
-		}
+		i += qp_decoder_find_special(src + i, src_size - i);
+		if (i == src_size)
+			break;
+
 		switch (src[i]) {
 		case '=':
+			if (src_size - i >= 3 &&
+			    (hi = qp_hex_digit(src[i+1])) >= 0 &&
+			    (lo = qp_hex_digit(src[i+2])) >= 0) {
+				/* fast path: the whole =<hex><hex> is
+				   available */
+				buffer_append(qp->dest, src+start, i-start);
+				buffer_append_c(qp->dest, (hi << 4) | lo);
+				i += 2;
+				start = i+1;
+				continue;
+			}
 			qp->state = STATE_EQUALS;
 			break;
 		case '\r':
+			if (i+1 < src_size && src[i+1] == '\n') {
+				/* CRLF is copied as-is */
+				i++;
+				continue;
+			}
 			qp->state = STATE_CR;
 			break;
 		case '\n':
@@ -74,6 +156,12 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 			continue;
 		case ' ':
 		case '\t':
+			if (i+1 < src_size &&
+			    !QP_IS_TRAILING_WHITESPACE(src[i+1]) &&
+			    src[i+1] != '\r' && src[i+1] != '\n') {
+				/* not trailing whitespace */
+				continue;
+			}
 			i_assert(qp->whitespace->used == 0);
 			qp->state = STATE_WHITESPACE;
 			buffer_append_c(qp->whitespace, src[i]);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "istream.h"
+#include "unichar.h"
 #include "mail-html2text.h"
 #include "test-common.h"
 
@@ -42,6 +43,21 @@ static const struct {
 	{ "a&#xe4;", "a\xC3\xA4" },
 	{ "&#8364;", "\xE2\x82\xAC" },
 	{ "&#deee;", "" }, // invalid codepoint
+	{ "&amq;&Amp;&ampamp;", "" },
+
+	/* longer inputs to exercise skipping large blocks at once */
+	{ "<table width=\"100%\" cellpadding='0' style=\"a:b\\\"c>\">"
+	  "<tr><td class='x\\'y>z'>some longer text in a table cell</td>"
+	  "</tr></table>",
+	  "some longer text in a table cell " },
+	{ "<style type=\"text/css\">body { color: red; } a < b </stylex> "
+	  "p { margin: 0 }</STYLE>text&nbsp;after style",
+	  "text\xC2\xA0""after style" },
+	{ "<!-- a long comment - with -dashes- and <tags> inside -- >"
+	  "visible",
+	  "visible" },
+	{ "<![CDATA[a long CDATA section ] with ]] brackets]]>after",
+	  "a long CDATA section ] with ]] brackets" "after" },
 };
 
 static const char *test_blockquote_input[] = {
@@ -72,6 +88,13 @@ static void test_mail_html2text(void)
 		test_assert_idx(strcmp(str_c(str), tests[i].output) == 0, i);
 		mail_html2text_deinit(&ht);
 		str_truncate(str, 0);
+
+		ht = mail_html2text_init(MAIL_HTML2TEXT_FLAG_SKIP_QUOTED);
+		mail_html2text_more(ht, (const void *)tests[i].input,
+				    strlen(tests[i].input), str);
+		test_assert_idx(strcmp(str_c(str), tests[i].output) == 0, i);
+		mail_html2text_deinit(&ht);
+		str_truncate(str, 0);
 	}
 
 	/* test without skipping quoted */
@@ -87,6 +110,35 @@ static void test_mail_html2text(void)
 	test_end();
 }
 
+static void test_mail_html2text_entities(void)
+{
+	static const struct {
+		const char *name;
+		unichar_t chr;
+	} entities[] = {
+#include "html-entities.h"
+	};
+	string_t *str = t_str_new(128), *expected = t_str_new(128);
+	struct mail_html2text *ht;
+	const char *input;
+
+	test_begin("mail_html2text() entities");
+	for (unsigned int i = 0; i < N_ELEMENTS(entities); i++) {
+		str_truncate(str, 0);
+		str_truncate(expected, 0);
+		uni_ucs4_to_utf8_c(entities[i].chr, expected);
+		str_append(expected, "x");
+
+		input = t_strdup_printf("&%s;x", entities[i].name);
+		ht = mail_html2text_init(0);
+		mail_html2text_more(ht, (const void *)input, strlen(input),
+				    str);
+		test_assert_idx(str_equals(str, expected), i);
+		mail_html2text_deinit(&ht);
+	}
+	test_end();
+}
+
 static void test_mail_html2text_random(void)
 {
 	string_t *str = t_str_new(128);
@@ -113,6 +165,7 @@ int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_html2text,
+		test_mail_html2text_entities,
 		test_mail_html2text_random,
 		NULL
 	};
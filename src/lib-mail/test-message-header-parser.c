@@ -140,7 +140,8 @@ static void test_message_header_parser(void)
 	static enum message_header_parser_flags max_hdr_flags =
 		MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
 		MESSAGE_HEADER_PARSER_FLAG_DROP_CR |
-		MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE;
+		MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE |
+		MESSAGE_HEADER_PARSER_FLAG_NO_VALUE_COPY;
 	enum message_header_parser_flags hdr_flags;
 	struct message_header_parser_ctx *parser;
 	struct message_size hdr_size, hdr_size2;
@@ -528,6 +529,54 @@ static void test_message_header_truncation_flag0(void)
 	test_end();
 }
 
+static void test_message_header_parser_no_value_copy(void)
+{
+	static const char *input_str =
+		"h1: v1\n"
+		"h2: v2\n"
+		" w2\n"
+		"h3: v3\n"
+		"\n";
+	struct message_header_parser_ctx *parser;
+	struct message_header_line *hdr;
+	struct istream *input;
+
+	test_begin("message header parser no value copy");
+	input = i_stream_create_from_data(input_str, strlen(input_str));
+	parser = message_parse_header_init(input, NULL,
+		MESSAGE_HEADER_PARSER_FLAG_NO_VALUE_COPY);
+
+	/* single line headers point to the input buffer */
+	test_assert(message_parse_header_next(parser, &hdr) > 0);
+	test_assert(strcmp(hdr->name, "h1") == 0);
+	test_assert(hdr->value == (const unsigned char *)input_str + 4 &&
+		    hdr->value_len == 2);
+	test_assert(hdr->full_value == hdr->value && hdr->full_value_len == 2);
+
+	/* multiline headers are copied */
+	test_assert(message_parse_header_next(parser, &hdr) > 0);
+	test_assert(strcmp(hdr->name, "h2") == 0 && hdr->continues);
+	test_assert(hdr->value != (const unsigned char *)input_str + 11 &&
+		    hdr->value_len == 2 && memcmp(hdr->value, "v2", 2) == 0);
+	hdr->use_full_value = TRUE;
+	test_assert(message_parse_header_next(parser, &hdr) > 0);
+	test_assert(hdr->continued && !hdr->continues);
+	test_assert(hdr->full_value_len == 6 &&
+		    memcmp(hdr->full_value, "v2\n w2", 6) == 0);
+
+	test_assert(message_parse_header_next(parser, &hdr) > 0);
+	test_assert(strcmp(hdr->name, "h3") == 0);
+	test_assert(hdr->value == (const unsigned char *)input_str + 22 &&
+		    hdr->value_len == 2);
+
+	test_assert(message_parse_header_next(parser, &hdr) > 0 && hdr->eoh);
+	test_assert(message_parse_header_next(parser, &hdr) < 0);
+
+	message_parse_header_deinit(&parser);
+	i_stream_unref(&input);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -540,6 +589,7 @@ int main(void)
 		test_message_header_parser_extra_crlf_in_name,
 		test_message_header_truncation_flag0,
 		test_message_header_truncation_clean_oneline,
+		test_message_header_parser_no_value_copy,
 		NULL
 	};
 	return test_run(test_functions);
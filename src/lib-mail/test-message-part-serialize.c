@@ -139,6 +139,18 @@ static struct test_case {
 			test_parsed_parts(is, parts);
 		else
 			i_error("message_part_deserialize: %s", error);
+
+		struct message_part root;
+		test_assert(message_part_deserialize_root(dest->data, dest->used,
+							  &root, &error));
+		if (parts != NULL) {
+			test_assert(root.flags == parts->flags);
+			test_assert(memcmp(&root.header_size, &parts->header_size,
+					   sizeof(root.header_size)) == 0);
+			test_assert(memcmp(&root.body_size, &parts->body_size,
+					   sizeof(root.body_size)) == 0);
+			test_assert(root.children == NULL);
+		}
 		i_stream_unref(&is);
 		pool_unref(&pool);
 	}
@@ -254,6 +266,227 @@ static void test_message_deserialize_errors(void)
 	TEST_CASE(dest->data, dest->used, "physical_pos less than expected");
 	buffer_set_used_size(dest, 0);
 
+	/* root part errors */
+	test_assert(!message_part_deserialize_root("\x08\x00\x00", 3,
+						   &part, &error));
+	test_assert_strcmp(error, "Not enough data");
+	i_zero(&part);
+	part.flags = MESSAGE_PART_FLAG_TEXT;
+	message_part_serialize(&part, dest);
+	buffer_append_c(dest, 0);
+	test_assert(!message_part_deserialize_root(dest->data, dest->used,
+						   &part, &error));
+	test_assert_strcmp(error, "Too much data");
+	buffer_set_used_size(dest, 0);
+
+	test_end();
+}
+
+static void
+test_serialize_part_fields(buffer_t *dest, const struct message_part *part,
+			   bool root, unsigned int children_count)
+{
+	/* the same format as message_part_serialize(), but without its
+	   consistency checks */
+	buffer_append(dest, &part->flags, sizeof(part->flags));
+	if (!root) {
+		buffer_append(dest, &part->physical_pos,
+			      sizeof(part->physical_pos));
+	}
+	buffer_append(dest, &part->header_size.physical_size,
+		      sizeof(part->header_size.physical_size));
+	buffer_append(dest, &part->header_size.virtual_size,
+		      sizeof(part->header_size.virtual_size));
+	buffer_append(dest, &part->body_size.physical_size,
+		      sizeof(part->body_size.physical_size));
+	buffer_append(dest, &part->body_size.virtual_size,
+		      sizeof(part->body_size.virtual_size));
+	if ((part->flags & (MESSAGE_PART_FLAG_TEXT |
+			    MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
+		buffer_append(dest, &part->body_size.lines,
+			      sizeof(part->body_size.lines));
+	}
+	if ((part->flags & (MESSAGE_PART_FLAG_MULTIPART |
+			    MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0)
+		buffer_append(dest, &children_count, sizeof(children_count));
+}
+
+static enum message_part_flags
+test_message_parts_flags(const struct message_part *part)
+{
+	enum message_part_flags flags = 0;
+
+	for (; part != NULL; part = part->next)
+		flags |= part->flags | test_message_parts_flags(part->children);
+	return flags;
+}
+
+static void
+test_message_deserialize_cursor_children(
+	const struct message_part_deserialize_cursor *cursor,
+	const struct message_part *parent)
+{
+	struct message_part_deserialize_cursor child_cursor;
+	const struct message_part *part, *child;
+	unsigned int idx = 0, children_count;
+	const char *error;
+
+	for (part = parent->children; part != NULL; part = part->next, idx++) {
+		child_cursor = *cursor;
+		test_assert_idx(message_part_deserialize_cursor_child(
+			&child_cursor, idx, &error) == 1, idx);
+		test_assert_idx(child_cursor.part.flags == part->flags, idx);
+		test_assert_idx(child_cursor.part.physical_pos ==
+				part->physical_pos, idx);
+		/* header lines aren't serialized */
+		test_assert_idx(child_cursor.part.header_size.physical_size ==
+				part->header_size.physical_size, idx);
+		test_assert_idx(child_cursor.part.header_size.virtual_size ==
+				part->header_size.virtual_size, idx);
+		test_assert_idx(child_cursor.part.body_size.physical_size ==
+				part->body_size.physical_size, idx);
+		test_assert_idx(child_cursor.part.body_size.virtual_size ==
+				part->body_size.virtual_size, idx);
+		children_count = 0;
+		for (child = part->children; child != NULL; child = child->next)
+			children_count++;
+		test_assert_idx(child_cursor.children_count == children_count,
+				idx);
+		test_message_deserialize_cursor_children(&child_cursor, part);
+	}
+	child_cursor = *cursor;
+	test_assert(message_part_deserialize_cursor_child(
+		&child_cursor, idx, &error) == 0);
+	test_assert(child_cursor.part.physical_pos == parent->physical_pos);
+}
+
+static void test_message_deserialize_cursor(void)
+{
+	static const char input_msg[] =
+"Content-Type: multipart/mixed; boundary=1\n"
+"\n--1\n"
+"Content-Type: multipart/alternative; boundary=2\n"
+"\n--2\n"
+"Content-Type: text/plain\n"
+"\n"
+"plain\n"
+"--2\n"
+"Content-Type: text/html\n"
+"\n"
+"<p>html</p>\n"
+"--2--\n"
+"\n--1\n"
+"Content-Type: message/rfc822\n"
+"\n"
+"Content-Type: multipart/mixed; boundary=3\n"
+"\n--3\n"
+"\n"
+"inner 1\n"
+"--3\n"
+"\n"
+"inner 2\n"
+"--3--\n"
+"\n--1\n"
+"Content-Type: text/plain\n"
+"\n"
+"last\n"
+"--1--\n";
+	struct message_part_deserialize_cursor cursor;
+	struct message_part *parts, *part2_1_2, part, child1;
+	enum message_part_flags flags;
+	const char *error;
+	pool_t pool;
+	buffer_t *dest;
+	struct istream *input;
+
+	test_begin("message part deserialize cursor");
+	pool = pool_alloconly_create("message parser", 10240);
+	input = test_istream_create_data(input_msg, sizeof(input_msg)-1);
+	test_assert(message_parse_stream(pool, input, &set_empty, &parts) == -1);
+	dest = buffer_create_dynamic(pool, 256);
+	message_part_serialize(parts, dest);
+
+	test_assert(message_part_deserialize_cursor_init(&cursor, dest->data,
+							 dest->used, &error));
+	test_assert(cursor.part.flags == parts->flags);
+	test_assert(cursor.children_count == 3);
+	test_message_deserialize_cursor_children(&cursor, parts);
+
+	/* 2.1.2 - the 2nd part inside message/rfc822 */
+	test_assert(message_part_deserialize_cursor_child(&cursor, 1, &error) == 1);
+	test_assert((cursor.part.flags & MESSAGE_PART_FLAG_MESSAGE_RFC822) != 0);
+	test_assert(message_part_deserialize_cursor_child(&cursor, 0, &error) == 1);
+	test_assert(message_part_deserialize_cursor_child(&cursor, 1, &error) == 1);
+	test_assert(cursor.part.physical_pos ==
+		    parts->children->next->children->children->next->physical_pos);
+	test_assert(message_part_deserialize_cursor_child(&cursor, 0, &error) == 0);
+
+	/* truncated data must fail without crashing */
+	for (size_t i = 0; i < dest->used; i++) {
+		if (!message_part_deserialize_cursor_init(&cursor, dest->data,
+							  i, &error))
+			continue;
+		test_assert_idx(message_part_deserialize_cursor_child(
+			&cursor, 2, &error) == -1, i);
+	}
+
+	/* all the flags, including the ones only in the nested parts */
+	test_assert(message_part_deserialize_all_flags(dest->data, dest->used,
+						       &flags, &error));
+	test_assert(flags == test_message_parts_flags(parts));
+	test_assert((flags & MESSAGE_PART_FLAG_HAS_NULS) == 0);
+	part2_1_2 = parts->children->next->children->children->next;
+	part2_1_2->flags |= MESSAGE_PART_FLAG_HAS_NULS;
+	buffer_set_used_size(dest, 0);
+	message_part_serialize(parts, dest);
+	test_assert(message_part_deserialize_all_flags(dest->data, dest->used,
+						       &flags, &error));
+	test_assert((flags & MESSAGE_PART_FLAG_HAS_NULS) != 0);
+	test_assert((parts->flags & MESSAGE_PART_FLAG_HAS_NULS) == 0);
+	for (size_t i = 0; i < dest->used; i++) {
+		test_assert_idx(!message_part_deserialize_all_flags(
+			dest->data, i, &flags, &error), i);
+	}
+	buffer_append_c(dest, '\x00');
+	test_assert(!message_part_deserialize_all_flags(dest->data, dest->used,
+							&flags, &error));
+	test_assert_strcmp(error, "Too much data");
+	i_stream_unref(&input);
+	buffer_set_used_size(dest, 0);
+
+	/* broken message/rfc822 child */
+	i_zero(&part);
+	i_zero(&child1);
+	part.flags = MESSAGE_PART_FLAG_MULTIPART|MESSAGE_PART_FLAG_IS_MIME;
+	part.children_count = 1;
+	child1.flags = MESSAGE_PART_FLAG_MESSAGE_RFC822;
+	child1.parent = &part;
+	part.children = &child1;
+	message_part_serialize(&part, dest);
+	test_assert(message_part_deserialize_cursor_init(&cursor, dest->data,
+							 dest->used, &error));
+	test_assert(message_part_deserialize_cursor_child(&cursor, 0, &error) == -1);
+	test_assert_strcmp(error, "message/rfc822 part has no children");
+	buffer_set_used_size(dest, 0);
+
+	/* child outside the parent's body: the child at [110, 120) doesn't
+	   fit into the parent's body at [10, 110) */
+	i_zero(&part);
+	i_zero(&child1);
+	part.flags = MESSAGE_PART_FLAG_MULTIPART|MESSAGE_PART_FLAG_IS_MIME;
+	part.header_size.physical_size = part.header_size.virtual_size = 10;
+	part.body_size.physical_size = part.body_size.virtual_size = 100;
+	child1.flags = MESSAGE_PART_FLAG_TEXT;
+	child1.physical_pos = 110;
+	child1.body_size.physical_size = child1.body_size.virtual_size = 10;
+	test_serialize_part_fields(dest, &part, TRUE, 1);
+	test_serialize_part_fields(dest, &child1, FALSE, 0);
+	test_assert(message_part_deserialize_cursor_init(&cursor, dest->data,
+							 dest->used, &error));
+	test_assert(message_part_deserialize_cursor_child(&cursor, 0, &error) == -1);
+	test_assert_strcmp(error, "child part location exceeds our size");
+
+	pool_unref(&pool);
 	test_end();
 }
 
@@ -329,6 +562,7 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_message_serialize_deserialize,
 		test_message_deserialize_errors,
+		test_message_deserialize_cursor,
 		NULL
 	};
 	static enum fatal_test_state (*const fatal_functions[])(unsigned int) = {
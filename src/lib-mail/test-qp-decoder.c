@@ -178,10 +178,57 @@ static void test_qp_decoder(void)
 	test_end();
 }
 
+static void test_qp_decoder_random(void)
+{
+	static const char chars[] = "aZ09=\r\n \tF\x80";
+	unsigned char input[200];
+	string_t *str1, *str2;
+	unsigned int i, j, input_len;
+	size_t error_pos;
+	const char *error;
+	int ret1, ret2;
+
+	test_begin("qp-decoder random");
+	str1 = t_str_new(256);
+	str2 = t_str_new(256);
+	for (i = 0; i < 10000; i++) {
+		struct qp_decoder *qp1 = qp_decoder_init(str1);
+		struct qp_decoder *qp2 = qp_decoder_init(str2);
+
+		input_len = i_rand_limit(sizeof(input));
+		for (j = 0; j < input_len; j++)
+			input[j] = chars[i_rand_limit(sizeof(chars) - 1)];
+
+		/* all at once uses the fast paths, while one byte at a
+		   time goes through the state machine */
+		ret1 = qp_decoder_more(qp1, input, input_len,
+				       &error_pos, &error);
+		if (qp_decoder_finish(qp1, &error) < 0)
+			ret1 = -1;
+		ret2 = 0;
+		for (j = 0; j < input_len; j++) {
+			if (qp_decoder_more(qp2, input + j, 1,
+					    &error_pos, &error) < 0)
+				ret2 = -1;
+		}
+		if (qp_decoder_finish(qp2, &error) < 0)
+			ret2 = -1;
+		test_assert_idx(ret1 == ret2, i);
+		test_assert_idx(str_equals(str1, str2), i);
+
+		qp_decoder_deinit(&qp1);
+		qp_decoder_deinit(&qp2);
+		str_truncate(str1, 0);
+		str_truncate(str2, 0);
+	}
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_qp_decoder,
+		test_qp_decoder_random,
 		NULL
 	};
 	return test_run(test_functions);
@@ -854,6 +854,12 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 		}
 	}
 
+	if (set->ktls) {
+		ctx->ktls = TRUE;
+		SSL_CTX_set_keylog_callback(ctx->ssl_ctx,
+					    openssl_iostream_ktls_keylog_callback);
+	}
+
 	if (ssl_proxy_ctx_set_crypto_params(ctx->ssl_ctx, set, error_r) < 0)
 		return -1;
 
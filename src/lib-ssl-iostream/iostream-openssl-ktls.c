@@ -0,0 +1,524 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "hex-binary.h"
+#include "safe-memset.h"
+#include "ostream-private.h"
+#include "iostream-openssl.h"
+
+#include <openssl/kdf.h>
+
+#ifdef HAVE_LINUX_TLS_H
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <linux/tls.h>
+#  ifndef SOL_TLS
+#    define SOL_TLS 282
+#  endif
+#endif
+
+/* OpenSSL only does the handshake. After that the kernel encrypts the sent
+   data, which allows sendfile() and splice() to be used for the connection.
+   The bio pair hides the socket from OpenSSL, so its own kTLS support can't
+   be used. Instead the TLSv1.3 application traffic secret is captured from
+   the keylog callback, the key and IV are derived from it and given to the
+   kernel along with the number of records OpenSSL has already sent with
+   them. Receiving is still done by OpenSSL.
+
+   OpenSSL may still want to send TLS messages afterwards, e.g. a KeyUpdate
+   when the peer requests one. The message callback captures the plaintext
+   messages, the records OpenSSL encrypted are dropped and the messages are
+   sent via the kernel as control messages. After sending a KeyUpdate the
+   kernel is given the next key derived from the traffic secret. */
+
+#define TLS_RECORD_HEADER_SIZE 5
+#define TLS_RECORD_TYPE_ALERT 21
+#define TLS_MSG_HEADER_SIZE 3
+
+void openssl_iostream_ktls_keylog_callback(const SSL *ssl, const char *line)
+{
+	struct ssl_iostream *ssl_io;
+	const char *label, *p;
+	buffer_t buf;
+
+	ssl_io = SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	if (ssl_io == NULL || ssl_io->ktls_tx || ssl_io->ktls_tx_failed)
+		return;
+
+	/* <label> <client random> <secret> */
+	label = ssl_io->ctx->client_ctx ?
+		"CLIENT_TRAFFIC_SECRET_0 " : "SERVER_TRAFFIC_SECRET_0 ";
+	if (!str_begins(line, label, &line))
+		return;
+	if ((p = strchr(line, ' ')) == NULL)
+		return;
+	p++;
+
+	buffer_create_from_data(&buf, ssl_io->ktls_tx_secret,
+				sizeof(ssl_io->ktls_tx_secret));
+	if (strlen(p) > sizeof(ssl_io->ktls_tx_secret) * 2 ||
+	    hex_to_binary(p, &buf) < 0) {
+		ssl_io->ktls_tx_failed = TRUE;
+		return;
+	}
+	ssl_io->ktls_tx_secret_size = buf.used;
+	/* OpenSSL writes all the records using the previous key to bio_int
+	   before switching to the new key. */
+	ssl_io->ktls_tx_key_offset =
+		BIO_number_written(SSL_get_wbio(ssl_io->ssl));
+	ssl_io->ktls_tx_seq = 0;
+	ssl_io->ktls_tx_hdr_pos = 0;
+	ssl_io->ktls_tx_record_left = 0;
+}
+
+static void
+openssl_iostream_ktls_queue_msg(struct ssl_iostream *ssl_io, int content_type,
+				const unsigned char *data, size_t size)
+{
+	unsigned char hdr[TLS_MSG_HEADER_SIZE];
+
+	/* the post-handshake messages OpenSSL sends are small */
+	i_assert(size <= 0xffff);
+	if (ssl_io->ktls_tx_msgs == NULL)
+		ssl_io->ktls_tx_msgs = buffer_create_dynamic(default_pool, 64);
+	hdr[0] = content_type;
+	hdr[1] = size >> 8;
+	hdr[2] = size & 0xff;
+	buffer_append(ssl_io->ktls_tx_msgs, hdr, sizeof(hdr));
+	buffer_append(ssl_io->ktls_tx_msgs, data, size);
+}
+
+void openssl_iostream_ktls_msg_callback(int write_p, int version ATTR_UNUSED,
+					int content_type, const void *buf,
+					size_t len, SSL *ssl,
+					void *context ATTR_UNUSED)
+{
+	struct ssl_iostream *ssl_io;
+	const unsigned char *data = buf;
+
+	if (write_p == 0)
+		return;
+	ssl_io = SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	if (ssl_io == NULL)
+		return;
+
+	if (ssl_io->ktls_tx) {
+		/* OpenSSL encrypts this with its own record sequence number,
+		   which the kernel has already used. Send the plaintext via
+		   the kernel instead. */
+		if (content_type == SSL3_RT_HANDSHAKE ||
+		    content_type == SSL3_RT_ALERT)
+			openssl_iostream_ktls_queue_msg(ssl_io, content_type,
+							data, len);
+		return;
+	}
+	if (content_type == SSL3_RT_HANDSHAKE && len > 0 &&
+	    data[0] == SSL3_MT_KEY_UPDATE) {
+		/* Sending a KeyUpdate before the kernel has taken over
+		   switches to a new secret, which the keylog callback doesn't
+		   tell. */
+		ssl_io->ktls_tx_failed = TRUE;
+	}
+}
+
+void openssl_iostream_ktls_count_records(struct ssl_iostream *ssl_io,
+					 uint64_t offset,
+					 const unsigned char *data,
+					 size_t size)
+{
+	size_t n;
+
+	if (ssl_io->ktls_tx_secret_size == 0 || ssl_io->ktls_tx_failed)
+		return;
+
+	/* skip the records sent with the handshake keys */
+	if (offset + size <= ssl_io->ktls_tx_key_offset)
+		return;
+	if (offset < ssl_io->ktls_tx_key_offset) {
+		n = ssl_io->ktls_tx_key_offset - offset;
+		data += n;
+		size -= n;
+	}
+
+	while (size > 0) {
+		if (ssl_io->ktls_tx_record_left > 0) {
+			n = I_MIN(size, ssl_io->ktls_tx_record_left);
+			ssl_io->ktls_tx_record_left -= n;
+			data += n;
+			size -= n;
+			continue;
+		}
+		ssl_io->ktls_tx_hdr[ssl_io->ktls_tx_hdr_pos++] = *data++;
+		size--;
+		if (ssl_io->ktls_tx_hdr_pos == TLS_RECORD_HEADER_SIZE) {
+			ssl_io->ktls_tx_record_left =
+				((size_t)ssl_io->ktls_tx_hdr[3] << 8) |
+				ssl_io->ktls_tx_hdr[4];
+			ssl_io->ktls_tx_hdr_pos = 0;
+			ssl_io->ktls_tx_seq++;
+		}
+	}
+}
+
+#ifdef HAVE_LINUX_TLS_H
+static int
+openssl_iostream_ktls_expand_label(const EVP_MD *md,
+				   const unsigned char *secret,
+				   size_t secret_size, const char *label,
+				   unsigned char *out, size_t out_size)
+{
+	/* RFC 8446 HKDF-Expand-Label() with empty context */
+	static const char prefix[] = "tls13 ";
+	unsigned char info[2 + 1 + 255 + 1];
+	size_t label_len = strlen(label), info_size = 0;
+	EVP_PKEY_CTX *pctx;
+	int ret = -1;
+
+	i_assert(sizeof(prefix)-1 + label_len <= 255);
+	info[info_size++] = out_size >> 8;
+	info[info_size++] = out_size & 0xff;
+	info[info_size++] = sizeof(prefix)-1 + label_len;
+	memcpy(info + info_size, prefix, sizeof(prefix)-1);
+	info_size += sizeof(prefix)-1;
+	memcpy(info + info_size, label, label_len);
+	info_size += label_len;
+	info[info_size++] = 0;
+
+	pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+	if (pctx == NULL)
+		return -1;
+	if (EVP_PKEY_derive_init(pctx) > 0 &&
+	    EVP_PKEY_CTX_set_hkdf_mode(pctx,
+				       EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+	    EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0 &&
+	    EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secret_size) > 0 &&
+	    EVP_PKEY_CTX_add1_hkdf_info(pctx, info, info_size) > 0 &&
+	    EVP_PKEY_derive(pctx, out, &out_size) > 0)
+		ret = 0;
+	EVP_PKEY_CTX_free(pctx);
+	return ret;
+}
+
+static void
+ktls_set_rec_seq(unsigned char rec_seq[8], uint64_t seq)
+{
+	for (unsigned int i = 8; i > 0; i--) {
+		rec_seq[i-1] = seq & 0xff;
+		seq >>= 8;
+	}
+}
+
+static int
+openssl_iostream_ktls_set_tx(struct ssl_iostream *ssl_io, bool rekey,
+			     const char **error_r)
+{
+	const SSL_CIPHER *cipher = SSL_get_current_cipher(ssl_io->ssl);
+	const EVP_MD *md;
+	union {
+		struct tls_crypto_info info;
+		struct tls12_crypto_info_aes_gcm_128 aes_gcm_128;
+		struct tls12_crypto_info_aes_gcm_256 aes_gcm_256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+		struct tls12_crypto_info_chacha20_poly1305 chacha20_poly1305;
+#endif
+	} ci;
+	unsigned char key[32], iv[12];
+	size_t key_size, ci_size;
+	int fd, ret = -1;
+
+	i_zero(&ci);
+	ci.info.version = TLS_1_3_VERSION;
+	switch (SSL_CIPHER_get_id(cipher)) {
+	case TLS1_3_CK_AES_128_GCM_SHA256:
+		ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		key_size = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+		ci_size = sizeof(ci.aes_gcm_128);
+		break;
+	case TLS1_3_CK_AES_256_GCM_SHA384:
+		ci.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		key_size = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+		ci_size = sizeof(ci.aes_gcm_256);
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS1_3_CK_CHACHA20_POLY1305_SHA256:
+		ci.info.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+		key_size = TLS_CIPHER_CHACHA20_POLY1305_KEY_SIZE;
+		ci_size = sizeof(ci.chacha20_poly1305);
+		break;
+#endif
+	default:
+		*error_r = t_strdup_printf("Unsupported cipher %s",
+					   SSL_CIPHER_get_name(cipher));
+		return -1;
+	}
+
+	md = SSL_CIPHER_get_handshake_digest(cipher);
+	if (md == NULL ||
+	    openssl_iostream_ktls_expand_label(md, ssl_io->ktls_tx_secret,
+		ssl_io->ktls_tx_secret_size, "key", key, key_size) < 0 ||
+	    openssl_iostream_ktls_expand_label(md, ssl_io->ktls_tx_secret,
+		ssl_io->ktls_tx_secret_size, "iv", iv, sizeof(iv)) < 0) {
+		*error_r = t_strdup_printf("Key derivation failed: %s",
+					   openssl_iostream_error());
+		safe_memset(key, 0, sizeof(key));
+		return -1;
+	}
+
+	/* The kernel uses the TLSv1.2 naming: the first 4 bytes of the IV
+	   are the salt. */
+	switch (ci.info.cipher_type) {
+	case TLS_CIPHER_AES_GCM_128:
+		memcpy(ci.aes_gcm_128.key, key, key_size);
+		memcpy(ci.aes_gcm_128.salt, iv, 4);
+		memcpy(ci.aes_gcm_128.iv, iv + 4, 8);
+		ktls_set_rec_seq(ci.aes_gcm_128.rec_seq, ssl_io->ktls_tx_seq);
+		break;
+	case TLS_CIPHER_AES_GCM_256:
+		memcpy(ci.aes_gcm_256.key, key, key_size);
+		memcpy(ci.aes_gcm_256.salt, iv, 4);
+		memcpy(ci.aes_gcm_256.iv, iv + 4, 8);
+		ktls_set_rec_seq(ci.aes_gcm_256.rec_seq, ssl_io->ktls_tx_seq);
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		memcpy(ci.chacha20_poly1305.key, key, key_size);
+		memcpy(ci.chacha20_poly1305.iv, iv, sizeof(iv));
+		ktls_set_rec_seq(ci.chacha20_poly1305.rec_seq,
+				 ssl_io->ktls_tx_seq);
+		break;
+#endif
+	}
+
+	fd = o_stream_get_fd(ssl_io->plain_output);
+	if (!rekey &&
+	    setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0)
+		*error_r = t_strdup_printf("setsockopt(TCP_ULP) failed: %m");
+	else if (setsockopt(fd, SOL_TLS, TLS_TX, &ci, ci_size) < 0)
+		*error_r = t_strdup_printf("setsockopt(TLS_TX) failed: %m");
+	else
+		ret = 0;
+	safe_memset(key, 0, sizeof(key));
+	safe_memset(iv, 0, sizeof(iv));
+	safe_memset(&ci, 0, sizeof(ci));
+	return ret;
+}
+#endif
+
+bool openssl_iostream_ktls_try_enable(struct ssl_iostream *ssl_io)
+{
+	const char *error = NULL;
+
+	if (!ssl_io->ctx->ktls || ssl_io->ktls_tx || ssl_io->ktls_tx_failed ||
+	    !ssl_io->handshaked || ssl_io->closed)
+		return FALSE;
+
+	/* Everything OpenSSL has encrypted must be sent before the kernel
+	   can continue. The plain ostream may still be buffering the end of
+	   the handshake, e.g. because it's corked. */
+	if (BIO_ctrl_pending(ssl_io->bio_ext) > 0)
+		return FALSE;
+	if (o_stream_get_buffer_used_size(ssl_io->plain_output) > 0 &&
+	    o_stream_flush(ssl_io->plain_output) <= 0)
+		return FALSE;
+	i_assert(ssl_io->ktls_tx_hdr_pos == 0 &&
+		 ssl_io->ktls_tx_record_left == 0);
+
+#ifndef HAVE_LINUX_TLS_H
+	error = "Not supported by the OS";
+#else
+	if (SSL_version(ssl_io->ssl) != TLS1_3_VERSION)
+		error = "Only TLSv1.3 is supported";
+	else if (ssl_io->ktls_tx_secret_size == 0)
+		error = "Traffic secret not available";
+	else if (!ssl_io->plain_output->writable_fd ||
+		 o_stream_get_fd(ssl_io->plain_output) == -1)
+		error = "Not a socket stream";
+	else
+		(void)openssl_iostream_ktls_set_tx(ssl_io, FALSE, &error);
+#endif
+
+	if (error != NULL) {
+		e_debug(ssl_io->event, "Kernel TLS not used: %s", error);
+		safe_memset(ssl_io->ktls_tx_secret, 0,
+			    sizeof(ssl_io->ktls_tx_secret));
+		ssl_io->ktls_tx_secret_size = 0;
+		ssl_io->ktls_tx_failed = TRUE;
+		return FALSE;
+	}
+	e_debug(ssl_io->event, "Using kernel TLS for sending "
+		"(continuing from record %"PRIu64")", ssl_io->ktls_tx_seq);
+	ssl_io->ktls_tx = TRUE;
+	return TRUE;
+}
+
+#ifdef HAVE_LINUX_TLS_H
+/* Send a record with the given type via kernel TLS */
+static ssize_t
+openssl_iostream_ktls_send_record(struct ssl_iostream *ssl_io,
+				  unsigned char record_type,
+				  const void *data, size_t size)
+{
+	char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+
+	i_assert(ssl_io->ktls_tx);
+
+	i_zero(&msg);
+	memset(cbuf, 0, sizeof(cbuf));
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cmsg) = record_type;
+
+	return sendmsg(o_stream_get_fd(ssl_io->plain_output), &msg, 0);
+}
+
+/* A KeyUpdate was sent. Switch the kernel to the next traffic secret. */
+static int
+openssl_iostream_ktls_key_update(struct ssl_iostream *ssl_io,
+				 const char **error_r)
+{
+	const EVP_MD *md =
+		SSL_CIPHER_get_handshake_digest(SSL_get_current_cipher(ssl_io->ssl));
+	unsigned char secret[EVP_MAX_MD_SIZE];
+
+	/* RFC 8446 7.2: application_traffic_secret_N+1 =
+	   HKDF-Expand-Label(application_traffic_secret_N, "traffic upd", "",
+			     Hash.length) */
+	i_assert(ssl_io->ktls_tx_secret_size <= sizeof(secret));
+	if (md == NULL ||
+	    openssl_iostream_ktls_expand_label(md, ssl_io->ktls_tx_secret,
+		ssl_io->ktls_tx_secret_size, "traffic upd",
+		secret, ssl_io->ktls_tx_secret_size) < 0) {
+		*error_r = t_strdup_printf("Key derivation failed: %s",
+					   openssl_iostream_error());
+		return -1;
+	}
+	memcpy(ssl_io->ktls_tx_secret, secret, ssl_io->ktls_tx_secret_size);
+	safe_memset(secret, 0, sizeof(secret));
+	ssl_io->ktls_tx_seq = 0;
+	/* Older kernels fail this with EBUSY */
+	return openssl_iostream_ktls_set_tx(ssl_io, TRUE, error_r);
+}
+#endif
+
+int openssl_iostream_ktls_send_msgs(struct ssl_iostream *ssl_io)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	size_t pending;
+	int ret;
+
+	i_assert(ssl_io->ktls_tx);
+
+	/* these were encrypted by OpenSSL with a wrong record sequence */
+	while ((pending = BIO_ctrl_pending(ssl_io->bio_ext)) > 0) {
+		ret = BIO_read(ssl_io->bio_ext, buf, I_MIN(pending, sizeof(buf)));
+		i_assert(ret > 0);
+	}
+	if (ssl_io->ktls_tx_msgs == NULL || ssl_io->ktls_tx_msgs->used == 0)
+		return 1;
+
+#ifdef HAVE_LINUX_TLS_H
+	const unsigned char *msg;
+	const char *error;
+	size_t msg_size;
+	ssize_t sent;
+
+	/* the data written before the messages must be sent first */
+	if ((ret = o_stream_flush(ssl_io->plain_output)) <= 0) {
+		if (ret < 0) {
+			i_free(ssl_io->plain_stream_errstr);
+			ssl_io->plain_stream_errstr = i_strdup(
+				o_stream_get_error(ssl_io->plain_output));
+			ssl_io->plain_stream_errno =
+				ssl_io->plain_output->stream_errno;
+			ssl_io->closed = TRUE;
+			return -1;
+		}
+		return 0;
+	}
+
+	while (ssl_io->ktls_tx_msgs->used > 0) {
+		msg = ssl_io->ktls_tx_msgs->data;
+		msg_size = ((size_t)msg[1] << 8) | msg[2];
+		i_assert(ssl_io->ktls_tx_msg_pos < msg_size);
+
+		sent = openssl_iostream_ktls_send_record(ssl_io, msg[0],
+			msg + TLS_MSG_HEADER_SIZE + ssl_io->ktls_tx_msg_pos,
+			msg_size - ssl_io->ktls_tx_msg_pos);
+		if (sent < 0) {
+			if (errno == EAGAIN) {
+				o_stream_set_flush_pending(ssl_io->plain_output,
+							   TRUE);
+				return 0;
+			}
+			i_free(ssl_io->plain_stream_errstr);
+			ssl_io->plain_stream_errstr =
+				i_strdup_printf("sendmsg() failed: %m");
+			ssl_io->plain_stream_errno = errno;
+			ssl_io->closed = TRUE;
+			return -1;
+		}
+		ssl_io->ktls_tx_msg_pos += sent;
+		if (ssl_io->ktls_tx_msg_pos < msg_size)
+			continue;
+
+		if (msg[0] == SSL3_RT_HANDSHAKE &&
+		    msg[TLS_MSG_HEADER_SIZE] == SSL3_MT_KEY_UPDATE &&
+		    openssl_iostream_ktls_key_update(ssl_io, &error) < 0) {
+			i_free(ssl_io->plain_stream_errstr);
+			ssl_io->plain_stream_errstr = i_strdup_printf(
+				"Kernel TLS key update failed: %s", error);
+			ssl_io->plain_stream_errno = EPROTO;
+			ssl_io->closed = TRUE;
+			return -1;
+		}
+		if (msg[0] == SSL3_RT_ALERT) {
+			/* e.g. close_notify from SSL_shutdown() */
+			SSL_set_shutdown(ssl_io->ssl, SSL_get_shutdown(ssl_io->ssl) |
+					 SSL_SENT_SHUTDOWN);
+		}
+		buffer_delete(ssl_io->ktls_tx_msgs, 0,
+			      TLS_MSG_HEADER_SIZE + msg_size);
+		ssl_io->ktls_tx_msg_pos = 0;
+	}
+	return 1;
+#else
+	i_unreached();
+#endif
+}
+
+int openssl_iostream_ktls_send_close_notify(struct ssl_iostream *ssl_io)
+{
+#ifdef HAVE_LINUX_TLS_H
+	static const unsigned char alert[] = {
+		1, /* warning */
+		0, /* close_notify */
+	};
+
+	if (openssl_iostream_ktls_send_record(ssl_io, TLS_RECORD_TYPE_ALERT,
+					      alert, sizeof(alert)) < 0) {
+		if (errno == EAGAIN)
+			return 0;
+		return -1;
+	}
+	/* Keep the session resumable, as it would be after SSL_shutdown() */
+	SSL_set_shutdown(ssl_io->ssl,
+			 SSL_get_shutdown(ssl_io->ssl) | SSL_SENT_SHUTDOWN);
+	return 1;
+#else
+	i_unreached();
+#endif
+}
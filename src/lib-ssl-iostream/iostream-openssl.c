@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "buffer.h"
 #include "hex-binary.h"
+#include "safe-memset.h"
 #include "istream-private.h"
 #include "ostream-private.h"
 #include "iostream-openssl.h"
@@ -126,6 +127,10 @@ openssl_iostream_set(struct ssl_iostream *ssl_io)
 	int verify_flags;
 
 	SSL_set_info_callback(ssl_io->ssl, openssl_info_callback);
+	if (ssl_io->ctx->ktls) {
+		SSL_set_msg_callback(ssl_io->ssl,
+				     openssl_iostream_ktls_msg_callback);
+	}
 
 	if (ssl_io->ctx->verify_remote_cert) {
 		if (ssl_io->ctx->client_ctx)
@@ -234,6 +239,8 @@ static void openssl_iostream_free(struct ssl_iostream *ssl_io)
 	i_free(ssl_io->last_error);
 	i_free(ssl_io->connected_host);
 	i_free(ssl_io->sni_host);
+	safe_memset(ssl_io->ktls_tx_secret, 0, sizeof(ssl_io->ktls_tx_secret));
+	buffer_free(&ssl_io->ktls_tx_msgs);
 	event_unref(&ssl_io->event);
 	i_free(ssl_io);
 }
@@ -259,8 +266,17 @@ void openssl_iostream_shutdown(struct ssl_iostream *ssl_io)
 	ssl_io->destroyed = TRUE;
 	(void)o_stream_flush(ssl_io->plain_output);
 
-	if (!ssl_io->closed && !ssl_io->handshake_failed &&
-	    (ssl_io->handshaked || ssl_io->do_shutdown)) {
+	if (ssl_io->ktls_tx) {
+		/* OpenSSL can't send anything anymore */
+		if (!ssl_io->closed &&
+		    (SSL_get_shutdown(ssl_io->ssl) & SSL_SENT_SHUTDOWN) == 0 &&
+		    o_stream_get_buffer_used_size(ssl_io->plain_output) == 0 &&
+		    openssl_iostream_ktls_send_close_notify(ssl_io) < 0) {
+			e_debug(ssl_io->event,
+				"sendmsg(close_notify) failed: %m");
+		}
+	} else if (!ssl_io->closed && !ssl_io->handshake_failed &&
+		   (ssl_io->handshaked || ssl_io->do_shutdown)) {
 		/* Try shutting down connection. If it does not succeed at once,
 		   try once more. */
 		for (int i = 0; i < 2; i++) {
@@ -312,6 +328,7 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 	size_t bytes, max_bytes = 0;
 	ssize_t sent;
 	unsigned char buffer[IO_BLOCK_SIZE];
+	uint64_t offset;
 	int result = 0;
 	int ret;
 
@@ -332,8 +349,13 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 
 		/* BIO_read() is guaranteed to return all the bytes that
 		   BIO_ctrl_pending() returned */
+		offset = BIO_number_read(ssl_io->bio_ext);
 		ret = BIO_read(ssl_io->bio_ext, buffer, bytes);
 		i_assert(ret == (int)bytes);
+		if (ssl_io->ctx->ktls) {
+			openssl_iostream_ktls_count_records(ssl_io, offset,
+							    buffer, bytes);
+		}
 
 		/* we limited number of read bytes to plain_output's
 		   available size. this send() is guaranteed to either
@@ -358,8 +380,18 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 
 static int openssl_iostream_bio_output(struct ssl_iostream *ssl_io)
 {
+	bool pending;
 	int ret;
 
+	if (ssl_io->ktls_tx) {
+		/* OpenSSL tried to send a message (e.g. a KeyUpdate reply),
+		   but the kernel has already taken over the connection's
+		   sending side. Send it via the kernel instead. */
+		pending = BIO_ctrl_pending(ssl_io->bio_ext) > 0;
+		if (openssl_iostream_ktls_send_msgs(ssl_io) < 0)
+			return -1;
+		return pending ? 1 : 0;
+	}
 	ret = openssl_iostream_bio_output_real(ssl_io);
 	if (ret < 0) {
 		i_assert(ssl_io->plain_output->stream_errno != 0);
@@ -668,6 +700,8 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 	const char *alpn_proto = ssl_iostream_get_application_protocol(ssl_io);
 	if (alpn_proto != NULL && *alpn_proto != '\0')
 		e_debug(ssl_io->event, "SSL: Chosen application protocol %s", alpn_proto);
+	/* Flushing also enables kernel TLS, so the ostream's writable_fd is
+	   already set when the caller e.g. decides whether to use splice(). */
 	if (ssl_io->ssl_output != NULL)
 		(void)o_stream_flush(ssl_io->ssl_output);
 	return 1;
@@ -34,6 +34,7 @@ struct ssl_iostream_context {
 	bool client_ctx:1;
 	bool verify_remote_cert:1;
 	bool allow_invalid_cert:1;
+	bool ktls:1;
 };
 
 struct ssl_iostream {
@@ -67,6 +68,28 @@ struct ssl_iostream {
 	ssl_iostream_sni_callback_t *sni_callback;
 	void *sni_context;
 
+	/* Kernel TLS: The application traffic secret used for sending, and
+	   the bio_int offset where OpenSSL started using it. The secret is
+	   kept after the kernel has taken over sending, because the next
+	   secret is derived from it when a KeyUpdate is sent. */
+	unsigned char ktls_tx_secret[EVP_MAX_MD_SIZE];
+	size_t ktls_tx_secret_size;
+	uint64_t ktls_tx_key_offset;
+	/* Number of TLS records OpenSSL has sent with the secret. The kernel
+	   continues from this sequence number. */
+	uint64_t ktls_tx_seq;
+	/* Record header parsing state for counting the sent records */
+	unsigned char ktls_tx_hdr[5];
+	unsigned int ktls_tx_hdr_pos;
+	size_t ktls_tx_record_left;
+	/* TLS messages OpenSSL wanted to send after the kernel took over
+	   sending, e.g. a KeyUpdate reply. Each is stored as the record type,
+	   16bit message length and the message. They're sent via the kernel
+	   instead of the records OpenSSL encrypted. */
+	buffer_t *ktls_tx_msgs;
+	/* Bytes of the first message in ktls_tx_msgs that are already sent */
+	size_t ktls_tx_msg_pos;
+
 	bool do_shutdown:1;
 	bool allow_invalid_cert:1;
 	bool handshaked:1;
@@ -80,6 +103,10 @@ struct ssl_iostream {
 	bool ostream_flush_waiting_input:1;
 	bool closed:1;
 	bool destroyed:1;
+	/* Kernel encrypts the sent data. OpenSSL can't send anything. */
+	bool ktls_tx:1;
+	/* Kernel TLS can't be used for this connection */
+	bool ktls_tx_failed:1;
 };
 
 extern int dovecot_ssl_extdata_index;
@@ -130,6 +157,32 @@ int openssl_iostream_handle_error(struct ssl_iostream *ssl_io, int ret,
 /* Perform clean shutdown for the connection. */
 void openssl_iostream_shutdown(struct ssl_iostream *ssl_io);
 
+/* SSL_CTX keylog callback, which captures the traffic secret needed for
+   kernel TLS. */
+void openssl_iostream_ktls_keylog_callback(const SSL *ssl, const char *line);
+/* SSL message callback, which notices if the traffic secret changes. */
+void openssl_iostream_ktls_msg_callback(int write_p, int version,
+					int content_type, const void *buf,
+					size_t len, SSL *ssl, void *context);
+/* Keep track of the TLS records read from bio_ext. offset is the bio_ext
+   read offset before the data. */
+void openssl_iostream_ktls_count_records(struct ssl_iostream *ssl_io,
+					 uint64_t offset,
+					 const unsigned char *data,
+					 size_t size);
+/* Try to hand over sending to kernel TLS. This can be done only after all
+   the data written by OpenSSL has been sent to the kernel. Returns TRUE if
+   kernel TLS was enabled now. */
+bool openssl_iostream_ktls_try_enable(struct ssl_iostream *ssl_io);
+/* Send close_notify alert via kernel TLS. Returns 1 if sent, 0 if the
+   socket buffer is full, -1 on error (errno is set). */
+int openssl_iostream_ktls_send_close_notify(struct ssl_iostream *ssl_io);
+/* Drop the records OpenSSL encrypted after the kernel took over sending and
+   send their messages via kernel TLS instead. Returns 1 if there's nothing
+   left to send, 0 if the rest is sent once the socket is writable, -1 on
+   error (plain_stream_errno and plain_stream_errstr are set). */
+int openssl_iostream_ktls_send_msgs(struct ssl_iostream *ssl_io);
+
 void openssl_iostream_set_error(struct ssl_iostream *ssl_io, const char *str);
 const char *openssl_iostream_error(void);
 const char *openssl_iostream_key_load_error(void);
@@ -108,6 +108,10 @@ struct ssl_iostream_settings {
 	bool compression;
 	/* If FALSE, set SSL_OP_NO_TICKET. See OpenSSL documentation. */
 	bool tickets;
+	/* Hand over the encryption of sent data to the kernel (kTLS) after
+	   the handshake if possible. Falls back to OpenSSL if the kernel or
+	   the negotiated cipher doesn't support it. */
+	bool ktls;
 };
 
 /* Load SSL module */
@@ -127,6 +127,72 @@ static int o_stream_ssl_flush_buffer(struct ssl_ostream *sstream)
 	return ret <= 0 ? ret : 1;
 }
 
+static void o_stream_ssl_ktls_try_enable(struct ssl_ostream *sstream)
+{
+	if (sstream->buffer != NULL && sstream->buffer->used > 0)
+		return;
+	if (!openssl_iostream_ktls_try_enable(sstream->ssl_io))
+		return;
+
+	/* From now on the data is written as plaintext directly to the
+	   socket, so it can also be spliced there. */
+	sstream->ostream.ostream.writable_fd = TRUE;
+	if (sstream->ostream.corked)
+		o_stream_cork(sstream->ssl_io->plain_output);
+}
+
+static void o_stream_ssl_copy_plain_error(struct ssl_ostream *sstream)
+{
+	struct ostream *plain_output = sstream->ssl_io->plain_output;
+
+	io_stream_set_error(&sstream->ostream.iostream, "%s",
+			    o_stream_get_error(plain_output));
+	sstream->ostream.ostream.stream_errno = plain_output->stream_errno;
+}
+
+static int o_stream_ssl_ktls_send_msgs(struct ssl_ostream *sstream)
+{
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	int ret;
+
+	if ((ret = openssl_iostream_ktls_send_msgs(ssl_io)) < 0) {
+		i_assert(ssl_io->plain_stream_errno != 0 &&
+			 ssl_io->plain_stream_errstr != NULL);
+		io_stream_set_error(&sstream->ostream.iostream,
+				    "%s", ssl_io->plain_stream_errstr);
+		sstream->ostream.ostream.stream_errno =
+			ssl_io->plain_stream_errno;
+	}
+	return ret;
+}
+
+static int o_stream_ssl_ktls_flush(struct ssl_ostream *sstream)
+{
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	int ret;
+
+	if ((ret = o_stream_ssl_ktls_send_msgs(sstream)) <= 0)
+		return ret;
+	if ((ret = o_stream_flush(ssl_io->plain_output)) < 0) {
+		o_stream_ssl_copy_plain_error(sstream);
+		return -1;
+	}
+	if (ret > 0 && sstream->ostream.finished && !sstream->shutdown) {
+		ret = openssl_iostream_ktls_send_close_notify(ssl_io);
+		if (ret < 0) {
+			io_stream_set_error(&sstream->ostream.iostream,
+				"sendmsg(close_notify) failed: %m");
+			sstream->ostream.ostream.stream_errno = errno;
+			return -1;
+		}
+		if (ret == 0)
+			o_stream_set_flush_pending(ssl_io->plain_output, TRUE);
+		else
+			sstream->shutdown = TRUE;
+	}
+	return ret;
+}
+
 static int o_stream_ssl_flush(struct ostream_private *stream)
 {
 	struct ssl_ostream *sstream = (struct ssl_ostream *)stream;
@@ -159,6 +225,10 @@ static int o_stream_ssl_flush(struct ostream_private *stream)
 		/* we can try to send some of our buffered data */
 		ret = o_stream_ssl_flush_buffer(sstream);
 	}
+	if (ret > 0)
+		o_stream_ssl_ktls_try_enable(sstream);
+	if (ssl_io->ktls_tx)
+		return o_stream_ssl_ktls_flush(sstream);
 
 	/* Stream is finished; shutdown the SSL write direction once our buffer
 	   is empty. */
@@ -195,9 +265,29 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 		   const struct const_iovec *iov, unsigned int iov_count)
 {
 	struct ssl_ostream *sstream = (struct ssl_ostream *)stream;
+	struct ssl_iostream *ssl_io = sstream->ssl_io;
+	ssize_t ret;
 
 	i_assert(!sstream->shutdown);
 
+	if (ssl_io->handshaked)
+		o_stream_ssl_ktls_try_enable(sstream);
+	if (ssl_io->ktls_tx) {
+		/* Send any pending TLS messages (e.g. a KeyUpdate reply)
+		   before the data. If the socket is full, they're sent when
+		   it's flushed. */
+		if (o_stream_ssl_ktls_send_msgs(sstream) < 0)
+			return -1;
+		/* the kernel encrypts the data */
+		ret = o_stream_sendv(ssl_io->plain_output, iov, iov_count);
+		if (ret < 0) {
+			o_stream_ssl_copy_plain_error(sstream);
+			return -1;
+		}
+		stream->ostream.offset += ret;
+		return ret;
+	}
+
 	size_t bytes_sent = o_stream_ssl_buffer(sstream, iov, iov_count);
 	if (sstream->ssl_io->handshaked &&
 	    sstream->buffer->used == bytes_sent) {
@@ -209,6 +299,46 @@ o_stream_ssl_sendv(struct ostream_private *stream,
 	return bytes_sent;
 }
 
+static void o_stream_ssl_cork(struct ostream_private *stream, bool set)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)stream;
+	struct ostream *plain_output = sstream->ssl_io->plain_output;
+
+	stream->corked = set;
+	if (set) {
+		if (sstream->ssl_io->ktls_tx)
+			o_stream_cork(plain_output);
+	} else {
+		if (o_stream_is_corked(plain_output) &&
+		    sstream->ssl_io->ktls_tx)
+			o_stream_uncork(plain_output);
+		(void)o_stream_flush(&stream->ostream);
+		stream->last_errors_not_checked = TRUE;
+	}
+}
+
+static enum ostream_send_istream_result
+o_stream_ssl_send_istream(struct ostream_private *outstream,
+			  struct istream *instream)
+{
+	struct ssl_ostream *sstream = (struct ssl_ostream *)outstream;
+	struct ostream *plain_output = sstream->ssl_io->plain_output;
+	enum ostream_send_istream_result res;
+	uoff_t old_offset;
+
+	if (!sstream->ssl_io->ktls_tx)
+		return io_stream_copy(&outstream->ostream, instream);
+
+	/* the kernel encrypts the data, so the plain ostream can use
+	   sendfile() */
+	old_offset = plain_output->offset;
+	res = o_stream_send_istream(plain_output, instream);
+	outstream->ostream.offset += plain_output->offset - old_offset;
+	if (res == OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT)
+		o_stream_ssl_copy_plain_error(sstream);
+	return res;
+}
+
 static void o_stream_ssl_switch_ioloop_to(struct ostream_private *stream,
 					  struct ioloop *ioloop)
 {
@@ -236,6 +366,8 @@ o_stream_ssl_get_buffer_avail_size(const struct ostream_private *stream)
 {
 	const struct ssl_ostream *sstream = (const struct ssl_ostream *)stream;
 
+	if (sstream->ssl_io->ktls_tx)
+		return o_stream_get_buffer_avail_size(sstream->ssl_io->plain_output);
 	return get_buffer_avail_size(sstream);
 }
 
@@ -277,6 +409,8 @@ struct ostream *openssl_o_stream_create_ssl(struct ssl_iostream *ssl_io)
 	sstream->ostream.iostream.destroy = o_stream_ssl_destroy;
 	sstream->ostream.sendv = o_stream_ssl_sendv;
 	sstream->ostream.flush = o_stream_ssl_flush;
+	sstream->ostream.cork = o_stream_ssl_cork;
+	sstream->ostream.send_istream = o_stream_ssl_send_istream;
 	sstream->ostream.switch_ioloop_to = o_stream_ssl_switch_ioloop_to;
 
 	sstream->ostream.get_buffer_used_size =
@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "buffer.h"
+#include "net.h"
 #include "randgen.h"
 #include "istream.h"
 #include "ostream.h"
@@ -10,6 +11,10 @@
 #include "iostream-ssl-test.h"
 
 #include <sys/socket.h>
+#ifdef HAVE_LINUX_TLS_H
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#endif
 
 #define MAX_SENT_BYTES 10000
 
@@ -551,12 +556,326 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+#define KTLS_DATA_SIZE (256*1024)
+
+struct ktls_test_ctx {
+	struct test_endpoint *server, *client;
+	const unsigned char *data;
+	size_t data_sent;
+	struct istream *data_input;
+	buffer_t *received;
+	bool data_finished;
+
+	/* The client requests a KeyUpdate after receiving the first data.
+	   The server sends the rest only after it has received the request,
+	   so its KeyUpdate reply is sent while it's still sending. */
+	bool key_update;
+	bool key_update_sent;
+	bool key_update_received;
+	unsigned int client_key_updates;
+};
+
+static int ktls_output_callback(struct ktls_test_ctx *ctx)
+{
+	struct ostream *output = ctx->server->output;
+	ssize_t ret;
+
+	if (ctx->data_finished)
+		return flush_output(ctx->server, TRUE);
+
+	/* first half with small writes, the rest via o_stream_send_istream() */
+	while (ctx->data_sent < KTLS_DATA_SIZE / 2) {
+		size_t size = i_rand_minmax(1, 1000);
+
+		size = I_MIN(size, KTLS_DATA_SIZE / 2 - ctx->data_sent);
+		ret = o_stream_send(output, ctx->data + ctx->data_sent, size);
+		test_assert(ret >= 0);
+		if (ret <= 0)
+			return ret;
+		ctx->data_sent += ret;
+	}
+	if (ctx->key_update && !ctx->key_update_received)
+		return 1;
+
+	switch (o_stream_send_istream(output, ctx->data_input)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		ctx->data_finished = TRUE;
+		break;
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+		i_unreached();
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		return 1;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		test_assert(FALSE);
+		io_loop_stop(current_ioloop);
+		return -1;
+	}
+	return flush_output(ctx->server, TRUE);
+}
+
+static void ktls_input_callback(struct ktls_test_ctx *ctx)
+{
+	struct istream *input = ctx->client->input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		buffer_append(ctx->received, data, size);
+		i_stream_skip(input, size);
+	}
+	if (ret < 0) {
+		test_assert(input->stream_errno == 0);
+		io_loop_stop(current_ioloop);
+		return;
+	}
+	if (ctx->key_update && !ctx->key_update_sent &&
+	    ctx->received->used > 0) {
+		/* the KeyUpdate is sent along with the next write */
+		ctx->key_update_sent = TRUE;
+		test_assert(SSL_key_update(ctx->client->iostream->ssl,
+					   SSL_KEY_UPDATE_REQUESTED) == 1);
+		o_stream_nsend_str(ctx->client->output, "x");
+		test_assert(o_stream_flush(ctx->client->output) >= 0);
+	}
+}
+
+static void ktls_server_input_callback(struct ktls_test_ctx *ctx)
+{
+	struct istream *input = ctx->server->input;
+	const unsigned char *data;
+	size_t size;
+
+	/* OpenSSL sends the KeyUpdate reply while reading the request */
+	if (i_stream_read_more(input, &data, &size) > 0) {
+		i_stream_skip(input, size);
+		ctx->key_update_received = TRUE;
+		o_stream_set_flush_pending(ctx->server->output, TRUE);
+	}
+	test_assert(input->stream_errno == 0);
+}
+
+static void
+ktls_client_msg_callback(int write_p, int version ATTR_UNUSED,
+			 int content_type, const void *buf, size_t len,
+			 SSL *ssl ATTR_UNUSED, void *context)
+{
+	struct ktls_test_ctx *ctx = context;
+	const unsigned char *data = buf;
+
+	if (write_p == 0 && content_type == SSL3_RT_HANDSHAKE && len > 0 &&
+	    data[0] == SSL3_MT_KEY_UPDATE)
+		ctx->client_key_updates++;
+}
+
+static void test_tcp_connection_create(int fd[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int fd_listen;
+
+	test_assert(net_addr2ip("127.0.0.1", &ip) == 0);
+	fd_listen = net_listen(&ip, &port, 1);
+	if (fd_listen < 0)
+		i_fatal("net_listen() failed: %m");
+	fd[1] = net_connect_ip_blocking(&ip, port, NULL);
+	if (fd[1] < 0)
+		i_fatal("net_connect_ip_blocking() failed: %m");
+	fd[0] = net_accept(fd_listen, NULL, NULL);
+	if (fd[0] < 0)
+		i_fatal("net_accept() failed: %m");
+	i_close_fd(&fd_listen);
+}
+
+static bool test_ktls_is_available(const char **reason_r)
+{
+#if defined(HAVE_LINUX_TLS_H) && defined(TCP_ULP)
+	int fd[2];
+	bool ret = TRUE;
+
+	test_tcp_connection_create(fd);
+	if (setsockopt(fd[0], IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+		*reason_r = t_strdup_printf(
+			"setsockopt(TCP_ULP) failed: %m");
+		ret = FALSE;
+	}
+	i_close_fd(&fd[0]);
+	i_close_fd(&fd[1]);
+	return ret;
+#else
+	*reason_r = "Not supported by the OS";
+	return FALSE;
+#endif
+}
+
+static void
+test_iostream_ssl_ktls_transfer(bool ktls, bool ktls_available,
+				bool key_update, const unsigned char *data,
+				buffer_t *received)
+{
+	struct ssl_iostream_settings set;
+	struct ktls_test_ctx ctx;
+	int fd[2];
+	const char *error;
+	bool kernel_tls = ktls && ktls_available;
+
+	/* use a TCP connection so kernel TLS can be used if available */
+	test_tcp_connection_create(fd);
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+
+	i_zero(&ctx);
+	ssl_iostream_test_settings_server(&set);
+	set.ktls = ktls;
+	ctx.server = create_test_endpoint(fd[0], &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	ctx.client = create_test_endpoint(fd[1], &set);
+	ctx.client->client = TRUE;
+	ctx.client->other = ctx.server;
+	ctx.server->other = ctx.client;
+
+	test_assert(ssl_iostream_context_init_server(ctx.server->set,
+		    &ctx.server->ctx, &error) == 0);
+	test_assert(ssl_iostream_context_init_client(ctx.client->set,
+		    &ctx.client->ctx, &error) == 0);
+	test_assert(io_stream_create_ssl_server(ctx.server->ctx, NULL,
+		    &ctx.server->input, &ctx.server->output,
+		    &ctx.server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(ctx.client->ctx, "localhost",
+		    NULL, 0, &ctx.client->input, &ctx.client->output,
+		    &ctx.client->iostream, &error) == 0);
+
+	ctx.server->io = io_add_istream(ctx.server->input,
+					handshake_input_callback, ctx.server);
+	ctx.client->io = io_add_istream(ctx.client->input,
+					handshake_input_callback, ctx.client);
+	test_assert(ssl_iostream_handshake(ctx.client->iostream) == 0);
+	io_loop_run(current_ioloop);
+	test_assert(ssl_iostream_is_handshaked(ctx.server->iostream));
+	test_assert(ssl_iostream_is_handshaked(ctx.client->iostream));
+	io_remove(&ctx.server->io);
+	io_remove(&ctx.client->io);
+	/* kernel TLS is enabled as soon as the handshake is finished, so
+	   e.g. iostream-pump can already use splice() */
+	test_assert(ctx.server->output->writable_fd == kernel_tls);
+
+	ctx.data = data;
+	ctx.data_input = i_stream_create_from_data(data + KTLS_DATA_SIZE / 2,
+						   KTLS_DATA_SIZE / 2);
+	ctx.received = received;
+	ctx.key_update = key_update;
+	o_stream_set_flush_callback(ctx.server->output,
+				    ktls_output_callback, &ctx);
+	o_stream_set_flush_pending(ctx.server->output, TRUE);
+	if (key_update) {
+		SSL_set_msg_callback(ctx.client->iostream->ssl,
+				     ktls_client_msg_callback);
+		SSL_set_msg_callback_arg(ctx.client->iostream->ssl, &ctx);
+		ctx.server->io = io_add_istream(ctx.server->input,
+						ktls_server_input_callback,
+						&ctx);
+	} else {
+		ctx.server->io = io_add_istream(ctx.server->input,
+						bufsize_discard_callback,
+						ctx.server);
+	}
+	ctx.client->io = io_add_istream(ctx.client->input,
+					ktls_input_callback, &ctx);
+
+	struct timeout *to = timeout_add(10000, io_loop_stop, current_ioloop);
+	io_loop_run(current_ioloop);
+	timeout_remove(&to);
+
+	test_assert(ctx.server->finished);
+	if (key_update) {
+		/* the server replied to the KeyUpdate request */
+		test_assert(ctx.key_update_received);
+		test_assert(ctx.client_key_updates == 1);
+	}
+	/* the ostream can be written directly only with kernel TLS */
+	test_assert(ctx.server->output->writable_fd == kernel_tls);
+	test_assert(ctx.server->iostream->ktls_tx == kernel_tls);
+	/* With kernel TLS OpenSSL encrypted only the handshake, and the data
+	   was written directly to the fd. */
+	if (kernel_tls)
+		test_assert(BIO_number_read(ctx.server->iostream->bio_ext) <
+			    KTLS_DATA_SIZE);
+	else
+		test_assert(BIO_number_read(ctx.server->iostream->bio_ext) >
+			    KTLS_DATA_SIZE);
+
+	i_stream_unref(&ctx.data_input);
+	i_stream_unref(&ctx.server->input);
+	o_stream_unref(&ctx.server->output);
+	i_stream_unref(&ctx.client->input);
+	o_stream_unref(&ctx.client->output);
+	destroy_test_endpoint(&ctx.client);
+	destroy_test_endpoint(&ctx.server);
+}
+
+static void test_iostream_ssl_ktls(void)
+{
+	struct ioloop *ioloop;
+	unsigned char *data;
+	buffer_t *received_plain, *received_ktls, *received_key_update;
+	const char *reason;
+	bool ktls_available;
+
+	test_begin("ssl: kernel TLS");
+
+	ioloop = io_loop_create();
+	data = i_malloc(KTLS_DATA_SIZE);
+	random_fill(data, KTLS_DATA_SIZE);
+	received_plain = buffer_create_dynamic(default_pool, KTLS_DATA_SIZE);
+	received_ktls = buffer_create_dynamic(default_pool, KTLS_DATA_SIZE);
+	received_key_update =
+		buffer_create_dynamic(default_pool, KTLS_DATA_SIZE);
+
+	/* If the kernel doesn't support kTLS, only the fallback is tested.
+	   Either way the output must be byte-identical. */
+	ktls_available = test_ktls_is_available(&reason);
+	if (!ktls_available) {
+		i_info("Kernel TLS not available, "
+		       "skipping kernel TLS tests: %s", reason);
+	}
+	test_iostream_ssl_ktls_transfer(FALSE, FALSE, FALSE, data,
+					received_plain);
+	test_iostream_ssl_ktls_transfer(TRUE, ktls_available, FALSE, data,
+					received_ktls);
+
+	test_assert(received_plain->used == KTLS_DATA_SIZE);
+	test_assert(memcmp(received_plain->data, data, KTLS_DATA_SIZE) == 0);
+	test_assert(buffer_cmp(received_plain, received_ktls));
+
+	/* The peer requests a KeyUpdate in the middle of the transfer. The
+	   reply must be sent via the kernel after it has taken over. */
+	test_iostream_ssl_ktls_transfer(FALSE, FALSE, TRUE, data,
+					received_key_update);
+	test_assert(buffer_cmp(received_plain, received_key_update));
+	buffer_set_used_size(received_key_update, 0);
+	test_iostream_ssl_ktls_transfer(TRUE, ktls_available, TRUE, data,
+					received_key_update);
+	test_assert(buffer_cmp(received_plain, received_key_update));
+
+	buffer_free(&received_plain);
+	buffer_free(&received_ktls);
+	buffer_free(&received_key_update);
+	i_free(data);
+	io_loop_destroy(&ioloop);
+	ssl_iostream_context_cache_free();
+
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+		test_iostream_ssl_ktls,
 		NULL
 	};
 	ssl_iostream_openssl_init();
@@ -0,0 +1,220 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "test-dir.h"
+#include "master-service.h"
+#include "test-mail-storage-common.h"
+
+#include <stdio.h>
+
+/**
+ * Saves messages into a mailbox so that their BODYSTRUCTURE and ENVELOPE
+ * related fields are cached, and measures how fast FETCH (ENVELOPE
+ * BODYSTRUCTURE) can be answered for the whole mailbox from the cache. Half
+ * of the messages are plain 7bit text, which have only the mime.parts and
+ * a flag cached instead of imap.bodystructure, and the other half are
+ * multipart messages.
+ */
+
+#define BENCH_CACHE_FIELDS \
+	"flags hdr.date hdr.subject hdr.from hdr.sender hdr.reply-to " \
+	"hdr.to hdr.cc hdr.bcc hdr.in-reply-to hdr.message-id " \
+	"imap.bodystructure mime.parts"
+
+static const char *bench_plain_msg =
+	"From: Sender Name <sender@example.org>\n"
+	"To: Recipient <recipient@example.org>, other@example.org\n"
+	"Subject: plain message %u\n"
+	"Date: Thu, 01 Jan 2026 00:00:00 +0000\n"
+	"Message-ID: <plain-%u@example.org>\n"
+	"\n"
+	"plain text body\n";
+
+static const char *bench_multipart_msg =
+	"From: Sender Name <sender@example.org>\n"
+	"To: Recipient <recipient@example.org>\n"
+	"Cc: Carbon Copy <cc@example.org>\n"
+	"Subject: =?utf-8?q?multipart_message?= %u\n"
+	"Date: Thu, 01 Jan 2026 00:00:00 +0000\n"
+	"Message-ID: <multipart-%u@example.org>\n"
+	"MIME-Version: 1.0\n"
+	"Content-Type: multipart/mixed; boundary=\"bound\"\n"
+	"\n"
+	"--bound\n"
+	"Content-Type: text/plain; charset=utf-8\n"
+	"\n"
+	"text part\n"
+	"--bound\n"
+	"Content-Type: application/pdf; name=\"file.pdf\"\n"
+	"Content-Disposition: attachment; filename=\"file.pdf\"\n"
+	"Content-Transfer-Encoding: base64\n"
+	"\n"
+	"YXR0YWNobWVudA==\n"
+	"--bound--\n";
+
+static void bench_save(struct mailbox *box, unsigned int message_count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	const char *msg;
+	unsigned int i;
+	int ret;
+
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = 0; i < message_count; i++) T_BEGIN {
+		msg = t_strdup_printf(i % 2 == 0 ? bench_plain_msg :
+				      bench_multipart_msg, i, i);
+		input = i_stream_create_from_data(msg, strlen(msg));
+		save_ctx = mailbox_save_alloc(trans);
+		if (mailbox_save_begin(&save_ctx, input) < 0)
+			i_fatal("mailbox_save_begin() failed");
+		do {
+			if (mailbox_save_continue(save_ctx) < 0)
+				i_fatal("mailbox_save_continue() failed");
+		} while ((ret = i_stream_read(input)) > 0);
+		i_assert(ret == -1);
+		if (mailbox_save_finish(&save_ctx) < 0) {
+			i_fatal("Failed to save mail: %s",
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		i_stream_unref(&input);
+	} T_END;
+	if (mailbox_transaction_commit(&trans) < 0) {
+		i_fatal("Failed to commit: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+}
+
+static uoff_t bench_fetch(struct mailbox *box, struct ostream *output,
+			  buffer_t *buf)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	const char *bodystructure, *envelope;
+	uint32_t seq, count;
+	uoff_t total_size = 0;
+
+	count = mail_index_view_get_messages_count(box->view);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, MAIL_FETCH_IMAP_BODYSTRUCTURE |
+			  MAIL_FETCH_IMAP_ENVELOPE, NULL);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	for (seq = 1; seq <= count; seq++) T_BEGIN {
+		mail_set_seq(mail, seq);
+		if (mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE,
+				     &envelope) < 0 ||
+		    mail_get_special(mail, MAIL_FETCH_IMAP_BODYSTRUCTURE,
+				     &bodystructure) < 0) {
+			i_fatal("Failed to fetch seq=%u from cache: %s", seq,
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		o_stream_nsend_str(output, "ENVELOPE (");
+		o_stream_nsend_str(output, envelope);
+		o_stream_nsend_str(output, ") BODYSTRUCTURE (");
+		o_stream_nsend_str(output, bodystructure);
+		o_stream_nsend_str(output, ")\r\n");
+		total_size += buf->used;
+		buffer_set_used_size(buf, 0);
+	} T_END;
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+	return total_size;
+}
+
+static void bench_mail_fetch_cached(unsigned int message_count,
+				    unsigned int rounds)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mail_cache_fields="BENCH_CACHE_FIELDS,
+			"mail_always_cache_fields="BENCH_CACHE_FIELDS,
+			"mail_attachment_detection_options=",
+			NULL
+		},
+	};
+	struct mailbox *box;
+	struct ostream *output;
+	buffer_t *buf;
+	uint64_t ts_0, ts_1, ts_2;
+	uoff_t total_size = 0;
+	unsigned int round;
+
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0)
+		i_fatal("mailbox_open() failed");
+
+	ts_0 = i_nanoseconds();
+	bench_save(box, message_count);
+	if (mailbox_sync(box, 0) < 0)
+		i_fatal("mailbox_sync() failed");
+	ts_1 = i_nanoseconds();
+	printf("save %u messages: %0.02lf ms\n", message_count,
+	       (double)(ts_1 - ts_0) / 1000000);
+
+	buf = buffer_create_dynamic(default_pool, 4096);
+	output = o_stream_create_buffer(buf);
+	o_stream_set_no_error_handling(output, TRUE);
+
+	ts_1 = i_nanoseconds();
+	for (round = 0; round < rounds; round++)
+		total_size += bench_fetch(box, output, buf);
+	ts_2 = i_nanoseconds();
+
+	printf("fetch (ENVELOPE BODYSTRUCTURE): %0.02lf ms, %0.02lf us/message, "
+	       "%"PRIuUOFF_T" bytes\n",
+	       (double)(ts_2 - ts_1) / 1000000,
+	       (double)(ts_2 - ts_1) / 1000 / ((uint64_t)message_count * rounds),
+	       total_size / rounds);
+
+	o_stream_destroy(&output);
+	buffer_free(&buf);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<message_count> [<rounds>]]\n", prog);
+	fprintf(stderr, "Runs 10 rounds over 100000 messages "
+		"if nothing given\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int message_count = 100000, rounds = 10;
+	const char *prog = argv[0];
+
+	master_service = master_service_init("bench-mail-fetch-cached",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_CONFIG_BUILTIN |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	if ((argc >= 2 && str_to_uint(argv[1], &message_count) < 0) ||
+	    (argc >= 3 && str_to_uint(argv[2], &rounds) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(prog);
+	}
+	if (argc > 3 || message_count == 0 || rounds == 0)
+		print_usage(prog);
+
+	test_dir_init("bench-mail-fetch-cached");
+	bench_mail_fetch_cached(message_count, rounds);
+	master_service_deinit(&master_service);
+	return 0;
+}
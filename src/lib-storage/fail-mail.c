@@ -246,6 +246,7 @@ struct mail_vfuncs fail_mail_vfuncs = {
 	fail_mail_get_modseq,
 	fail_mail_get_modseq,
 	fail_mail_get_parts,
+	NULL,
 	fail_mail_get_date,
 	fail_mail_get_received_date,
 	fail_mail_get_save_date,
@@ -10,6 +10,7 @@
 #include "ostream.h"
 #include "file-lock.h"
 #include "file-dotlock.h"
+#include "fsync-group.h"
 #include "mkdir-parents.h"
 #include "eacces-error.h"
 #include "str.h"
@@ -571,7 +572,17 @@ int dbox_file_append_flush(struct dbox_file_append_context *ctx)
 		}
 	}
 
-	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER) {
+	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER &&
+	    ctx->fsync_group != NULL) {
+		/* the file may get closed before the group is flushed */
+		int fd = dup(ctx->file->fd);
+
+		if (fd == -1) {
+			dbox_file_set_syscall_error(ctx->file, "dup()");
+			return -1;
+		}
+		fsync_group_add_fd(ctx->fsync_group, fd, ctx->file->cur_path);
+	} else if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER) {
 		if (fdatasync(ctx->file->fd) < 0) {
 			dbox_file_set_syscall_error(ctx->file, "fdatasync()");
 			return -1;
@@ -130,6 +130,9 @@ struct dbox_file_append_context {
 
 	uoff_t first_append_offset, last_checkpoint_offset, last_flush_offset;
 	struct ostream *output;
+	/* If set, the fdatasync() is delayed by adding the file to the group
+	   instead. The caller is responsible for flushing the group. */
+	struct fsync_group *fsync_group;
 };
 
 #define dbox_file_is_open(file) ((file)->fd != -1)
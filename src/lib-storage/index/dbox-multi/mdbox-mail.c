@@ -254,6 +254,7 @@ struct mail_vfuncs mdbox_mail_vfuncs = {
 	index_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	index_mail_get_parts,
+	index_mail_get_serialized_parts,
 	index_mail_get_date,
 	dbox_mail_get_received_date,
 	mdbox_mail_get_save_date,
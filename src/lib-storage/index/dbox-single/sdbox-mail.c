@@ -162,6 +162,7 @@ struct mail_vfuncs sdbox_mail_vfuncs = {
 	index_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	index_mail_get_parts,
+	index_mail_get_serialized_parts,
 	index_mail_get_date,
 	dbox_mail_get_received_date,
 	dbox_mail_get_save_date,
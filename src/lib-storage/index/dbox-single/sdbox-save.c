@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "fdatasync-path.h"
+#include "fsync-group.h"
 #include "hex-binary.h"
 #include "hex-dec.h"
 #include "str.h"
@@ -28,6 +29,8 @@ struct sdbox_save_context {
 
 	struct dbox_file *cur_file;
 	struct dbox_file_append_context *append_ctx;
+	/* The saved files are fsynced all at once when committing */
+	struct fsync_group *fsync_group;
 
 	uint32_t first_saved_seq;
 	ARRAY(struct dbox_file *) files;
@@ -106,6 +109,13 @@ int sdbox_save_begin(struct mail_save_context *_ctx, struct istream *input)
 
 	file = sdbox_file_create(ctx->mbox);
 	ctx->append_ctx = dbox_file_append_init(file);
+	if (ctx->mbox->box.storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER) {
+		if (ctx->fsync_group == NULL) {
+			ctx->fsync_group =
+				fsync_group_init(INDEX_STORAGE_FSYNC_MAX_THREADS);
+		}
+		ctx->append_ctx->fsync_group = ctx->fsync_group;
+	}
 	ret = dbox_file_get_append_stream(ctx->append_ctx,
 					  &ctx->ctx.dbox_output);
 	if (ret <= 0) {
@@ -283,6 +293,7 @@ int sdbox_transaction_save_commit_pre(struct mail_save_context *_ctx)
 	struct sdbox_save_context *ctx = SDBOX_SAVECTX(_ctx);
 	struct mailbox_transaction_context *_t = _ctx->transaction;
 	const struct mail_index_header *hdr;
+	const char *error;
 
 	i_assert(ctx->ctx.finished);
 
@@ -291,6 +302,14 @@ int sdbox_transaction_save_commit_pre(struct mail_save_context *_ctx)
 		return 0;
 	}
 
+	if (ctx->fsync_group != NULL &&
+	    fsync_group_flush(ctx->fsync_group, &error) < 0) {
+		if (!mail_storage_set_error_from_errno(_t->box->storage))
+			mailbox_set_critical(_t->box, "%s", error);
+		sdbox_transaction_save_rollback(_ctx);
+		return -1;
+	}
+
 	if (sdbox_sync_begin(ctx->mbox, SDBOX_SYNC_FLAG_FORCE |
 			     SDBOX_SYNC_FLAG_FSYNC, &ctx->sync_ctx) < 0) {
 		sdbox_transaction_save_rollback(_ctx);
@@ -343,6 +362,7 @@ void sdbox_transaction_save_commit_post(struct mail_save_context *_ctx,
 	}
 	i_assert(ctx->ctx.finished);
 	dbox_save_unref_files(ctx);
+	fsync_group_deinit(&ctx->fsync_group);
 	i_free(ctx);
 }
 
@@ -357,5 +377,6 @@ void sdbox_transaction_save_rollback(struct mail_save_context *_ctx)
 
 	if (ctx->sync_ctx != NULL)
 		(void)sdbox_sync_finish(&ctx->sync_ctx, FALSE);
+	fsync_group_deinit(&ctx->fsync_group);
 	i_free(ctx);
 }
@@ -656,6 +656,7 @@ struct mail_vfuncs imapc_mail_vfuncs = {
 	imapc_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	index_mail_get_parts,
+	index_mail_get_serialized_parts,
 	index_mail_get_date,
 	imapc_mail_get_received_date,
 	imapc_mail_get_save_date,
@@ -18,7 +18,8 @@
 
 static const struct message_parser_settings msg_parser_set = {
 	.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
-		MESSAGE_HEADER_PARSER_FLAG_DROP_CR,
+		MESSAGE_HEADER_PARSER_FLAG_DROP_CR |
+		MESSAGE_HEADER_PARSER_FLAG_NO_VALUE_COPY,
 	.flags = MESSAGE_PARSER_FLAG_SKIP_BODY_BLOCK,
 };
 
@@ -283,17 +284,20 @@ void index_mail_parse_header_init(struct index_mail *mail,
 	}
 }
 
-static void index_mail_parse_finish_imap_envelope(struct index_mail *mail)
+static void
+index_mail_set_imap_envelope(struct index_mail *mail,
+			     struct message_part_envelope *envelope,
+			     size_t size_hint)
 {
 	struct mail *_mail = &mail->mail.mail;
 	const unsigned int cache_field_envelope =
 		mail->ibox->cache_fields[MAIL_CACHE_IMAP_ENVELOPE].idx;
 	string_t *str;
 
-	str = str_new(mail->mail.data_pool, 256);
+	str = str_new(mail->mail.data_pool, size_hint);
 	/* FIXME: Implement UTF-8 support for quoted strings in generated
 	          ENVELOPE element. */
-	imap_envelope_write(mail->data.envelope_data, str, 0);
+	imap_envelope_write(envelope, str, 0);
 	mail->data.envelope = str_c(str);
 	mail->data.save_envelope = FALSE;
 
@@ -304,6 +308,11 @@ static void index_mail_parse_finish_imap_envelope(struct index_mail *mail)
 	}
 }
 
+static void index_mail_parse_finish_imap_envelope(struct index_mail *mail)
+{
+	index_mail_set_imap_envelope(mail, mail->data.envelope_data, 256);
+}
+
 void index_mail_parse_header(struct message_part *part,
 			     struct message_header_line *hdr,
 			     struct index_mail *mail)
@@ -528,6 +537,51 @@ imap_envelope_parse_callback(struct message_header_line *hdr,
 		index_mail_parse_finish_imap_envelope(mail);
 }
 
+static int
+index_mail_headers_get_envelope_cached(struct index_mail *mail,
+				       struct mailbox_header_lookup_ctx *headers)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct message_part_envelope *envelope = NULL;
+	struct message_header_parser_ctx *parser;
+	struct message_header_line *hdr;
+	struct istream *input;
+	string_t *hdr_str;
+	pool_t pool;
+	int ret;
+
+	/* The headers and the parsed envelope are needed only until the
+	   ENVELOPE string is written, so keep them in data stack instead of
+	   the mail's data pool. message_parse_header() can't be used, because
+	   it frees the data stack after each callback. */
+	T_BEGIN {
+		hdr_str = t_str_new(1024);
+		ret = mail_cache_lookup_headers(_mail->transaction->cache_view,
+						hdr_str, _mail->seq,
+						headers->idx, headers->count);
+		if (ret > 0) {
+			_mail->transaction->stats.cache_hit_count++;
+			pool = pool_datastack_create();
+			input = i_stream_create_from_data(str_data(hdr_str),
+							  str_len(hdr_str));
+			parser = message_parse_header_init(input, NULL,
+						msg_parser_set.hdr_flags);
+			while (message_parse_header_next(parser, &hdr) > 0) {
+				message_part_envelope_parse_from_header(pool,
+					&envelope, hdr);
+			}
+			message_parse_header_deinit(&parser);
+			i_stream_unref(&input);
+			message_part_envelope_parse_from_header(pool,
+				&envelope, NULL);
+			/* the ENVELOPE is roughly as long as the headers */
+			index_mail_set_imap_envelope(mail, envelope,
+						     str_len(hdr_str) + 128);
+		}
+	} T_END;
+	return ret;
+}
+
 int index_mail_headers_get_envelope(struct index_mail *mail)
 {
 	const unsigned int cache_field_envelope =
@@ -545,6 +599,15 @@ int index_mail_headers_get_envelope(struct index_mail *mail)
 	}
 	str_free(&str);
 
+	header_ctx = mailbox_header_lookup_init(mail->mail.mail.box,
+						message_part_envelope_headers);
+	if (!mail->data.save_bodystructure_header &&
+	    index_mail_headers_get_envelope_cached(mail, header_ctx) > 0) {
+		/* written directly from the cached header fields */
+		mailbox_header_lookup_unref(&header_ctx);
+		return 0;
+	}
+
 	old_offset = mail->data.stream == NULL ? 0 :
 		mail->data.stream->v_offset;
 
@@ -552,8 +615,6 @@ int index_mail_headers_get_envelope(struct index_mail *mail)
 	   Otherwise two callbacks are doing it and mixing up results. */
 	mail->data.save_envelope = FALSE;
 
-	header_ctx = mailbox_header_lookup_init(mail->mail.mail.box,
-						message_part_envelope_headers);
 	if (mail_get_header_stream(&mail->mail.mail, header_ctx, &stream) < 0) {
 		mailbox_header_lookup_unref(&header_ctx);
 		return -1;
@@ -386,6 +386,43 @@ int index_mail_get_parts(struct mail *_mail, struct message_part **parts_r)
 	return 0;
 }
 
+int index_mail_get_serialized_parts(struct mail *_mail, buffer_t *parts_buf)
+{
+	struct index_mail *mail = INDEX_MAIL(_mail);
+	struct index_mail_data *data = &mail->data;
+	const unsigned int field_idx =
+		mail->ibox->cache_fields[MAIL_CACHE_MESSAGE_PARTS].idx;
+	enum message_part_flags flags;
+	const char *error;
+
+	if (data->parts != NULL || data->parser_ctx != NULL) {
+		/* parts are already in memory or will be after parsing */
+		return 0;
+	}
+	if (index_mail_want_attachment_keywords_on_fetch(mail)) {
+		/* mail_get_parts() sets the attachment keywords */
+		return 0;
+	}
+
+	data->cache_fetch_fields |= MAIL_FETCH_MESSAGE_PARTS;
+	if (index_mail_cache_lookup_field(mail, parts_buf, field_idx) <= 0)
+		return 0;
+
+	/* we know the NULs now, update them */
+	if (!message_part_deserialize_all_flags(parts_buf->data,
+						parts_buf->used, &flags,
+						&error)) {
+		mail_set_mail_cache_corrupted(_mail,
+			"Corrupted cached mime.parts data: %s (parts=%s)",
+			error, binary_to_hex(parts_buf->data, parts_buf->used));
+		buffer_set_used_size(parts_buf, 0);
+		return 0;
+	}
+	_mail->has_nuls = (flags & MESSAGE_PART_FLAG_HAS_NULS) != 0;
+	_mail->has_no_nuls = !_mail->has_nuls;
+	return 1;
+}
+
 int index_mail_get_received_date(struct mail *_mail, time_t *date_r)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
@@ -1604,13 +1641,64 @@ static int index_mail_parse_bodystructure(struct index_mail *mail,
 	return 0;
 }
 
+static bool
+get_cached_plain_body_size(struct index_mail *mail,
+			   struct message_size *body_size_r)
+{
+	struct message_part root;
+	buffer_t *part_buf;
+	const char *error;
+	bool ret;
+
+	if (mail->data.parts != NULL ||
+	    index_mail_want_attachment_keywords_on_fetch(mail)) {
+		/* attachment keywords need the whole tree */
+		if (!get_cached_parts(mail))
+			return FALSE;
+		*body_size_r = mail->data.parts->body_size;
+		return TRUE;
+	}
+	if (mail->data.parser_ctx != NULL)
+		return FALSE;
+
+	/* text/plain message has only the root part. There's no need to
+	   deserialize it into the data pool just for its size. */
+	T_BEGIN {
+		ret = TRUE;
+		if (get_serialized_parts(mail, &part_buf) <= 0)
+			ret = FALSE;
+		else if (!message_part_deserialize_root(part_buf->data,
+							part_buf->used, &root,
+							&error)) {
+			mail_set_mail_cache_corrupted(&mail->mail.mail,
+				"Corrupted cached mime.parts data: %s (parts=%s)",
+				error, binary_to_hex(part_buf->data,
+						     part_buf->used));
+			ret = FALSE;
+		} else if ((root.flags & (MESSAGE_PART_FLAG_MULTIPART |
+					  MESSAGE_PART_FLAG_MESSAGE_RFC822)) != 0) {
+			/* not a single part message after all - do it the
+			   slow way */
+			ret = get_cached_parts(mail);
+			if (ret)
+				root = *mail->data.parts;
+		} else {
+			mail->mail.mail.has_nuls =
+				(root.flags & MESSAGE_PART_FLAG_HAS_NULS) != 0;
+			mail->mail.mail.has_no_nuls = !mail->mail.mail.has_nuls;
+		}
+	} T_END;
+	if (ret)
+		*body_size_r = root.body_size;
+	return ret;
+}
+
 static void
-index_mail_get_plain_bodystructure(struct index_mail *mail, string_t *str,
-				   bool extended)
+index_mail_get_plain_bodystructure(const struct message_size *body_size,
+				   string_t *str, bool extended)
 {
 	str_printfa(str, IMAP_BODY_PLAIN_7BIT_ASCII" %"PRIuUOFF_T" %u",
-		    mail->data.parts->body_size.virtual_size,
-		    mail->data.parts->body_size.lines);
+		    body_size->virtual_size, body_size->lines);
 	if (extended)
 		str_append(str, " NIL NIL NIL NIL");
 }
@@ -1653,6 +1741,7 @@ bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 	const unsigned int bodystructure_cache_field =
 		cache_fields[MAIL_CACHE_IMAP_BODYSTRUCTURE].idx;
 	struct index_mail_data *data = &mail->data;
+	struct message_size body_size;
 	string_t *str;
 	const char *error;
 
@@ -1663,8 +1752,8 @@ bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r)
 
 	str = str_new(mail->mail.data_pool, 128);
 	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0 &&
-	    get_cached_parts(mail)) {
-		index_mail_get_plain_bodystructure(mail, str, FALSE);
+	    get_cached_plain_body_size(mail, &body_size)) {
+		index_mail_get_plain_bodystructure(&body_size, str, FALSE);
 		*value_r = data->body = str_c(str);
 		return TRUE;
 	}
@@ -1704,6 +1793,7 @@ bool index_mail_get_cached_bodystructure(struct index_mail *mail,
 	const unsigned int bodystructure_cache_field =
 		cache_fields[MAIL_CACHE_IMAP_BODYSTRUCTURE].idx;
 	struct index_mail_data *data = &mail->data;
+	struct message_size body_size;
 	string_t *str;
 
 	if (data->bodystructure != NULL) {
@@ -1713,8 +1803,8 @@ bool index_mail_get_cached_bodystructure(struct index_mail *mail,
 
 	str = str_new(mail->mail.data_pool, 128);
 	if ((data->cache_flags & MAIL_CACHE_FLAG_TEXT_PLAIN_7BIT_ASCII) != 0 &&
-	    get_cached_parts(mail))
-		index_mail_get_plain_bodystructure(mail, str, TRUE);
+	    get_cached_plain_body_size(mail, &body_size))
+		index_mail_get_plain_bodystructure(&body_size, str, TRUE);
 	else if (index_mail_cache_lookup_field(mail, str,
 			bodystructure_cache_field) <= 0) {
 		str_free(&str);
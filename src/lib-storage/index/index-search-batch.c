@@ -0,0 +1,236 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "bits.h"
+#include "seq-range-array.h"
+#include "mail-search.h"
+#include "index-storage.h"
+#include "index-search-private.h"
+
+/* Number of messages evaluated at once. Each message is one bit in the
+   block's mask. */
+#define SEARCH_BATCH_BLOCK_SIZE 64
+
+struct index_search_batch {
+	struct index_search_context *ctx;
+	enum mail_flags pvt_flags_mask;
+
+	/* The current block */
+	uint32_t seq1;
+	unsigned int count;
+	const uint32_t *uids;
+	const uint8_t *flags;
+	/* Messages in the current block that may match */
+	uint64_t mask;
+
+	/* The columns couldn't be looked up. Don't try again. */
+	bool disabled;
+};
+
+bool index_search_batch_disabled = FALSE;
+
+static uint64_t
+search_batch_args(struct index_search_batch *batch,
+		  struct mail_search_arg *args, bool match_all, bool *exact_r);
+
+static uint64_t search_batch_all_mask(struct index_search_batch *batch)
+{
+	return batch->count == 64 ? (uint64_t)-1 :
+		((uint64_t)1 << batch->count) - 1;
+}
+
+static uint64_t
+search_batch_flags(struct index_search_batch *batch, uint8_t flags)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	/* A simple loop without branches, which compilers can vectorize. */
+	for (i = 0; i < batch->count; i++)
+		mask |= (uint64_t)((batch->flags[i] & flags) == flags) << i;
+	return mask;
+}
+
+static uint64_t
+search_batch_seqset(struct index_search_batch *batch,
+		    const ARRAY_TYPE(seq_range) *seqset, bool uids)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+	uint32_t value;
+
+	for (i = 0; i < batch->count; i++) {
+		value = uids ? batch->uids[i] : batch->seq1 + i;
+		if (seq_range_exists(seqset, value))
+			mask |= (uint64_t)1 << i;
+	}
+	return mask;
+}
+
+/* Returns the messages that may match the arg. exact_r is set to FALSE
+   if some of them may still not match. */
+static uint64_t
+search_batch_arg(struct index_search_batch *batch,
+		 struct mail_search_arg *arg, bool *exact_r)
+{
+	uint64_t mask;
+
+	*exact_r = TRUE;
+	if (arg->match_always)
+		return search_batch_all_mask(batch);
+	if (arg->nonmatch_always)
+		return 0;
+
+	switch (arg->type) {
+	case SEARCH_OR:
+		mask = search_batch_args(batch, arg->value.subargs, FALSE,
+					 exact_r);
+		break;
+	case SEARCH_SUB:
+		mask = search_batch_args(batch, arg->value.subargs, TRUE,
+					 exact_r);
+		break;
+	case SEARCH_ALL:
+		mask = search_batch_all_mask(batch);
+		break;
+	case SEARCH_SEQSET:
+		mask = search_batch_seqset(batch, &arg->value.seqset, FALSE);
+		break;
+	case SEARCH_UIDSET:
+	case SEARCH_INTHREAD:
+		mask = search_batch_seqset(batch, &arg->value.seqset, TRUE);
+		break;
+	case SEARCH_FLAGS:
+		if ((arg->value.flags &
+		     (batch->pvt_flags_mask | MAIL_RECENT)) == 0) {
+			mask = search_batch_flags(batch, arg->value.flags);
+			break;
+		}
+		/* fall through */
+	default:
+		/* anything may match */
+		*exact_r = FALSE;
+		return search_batch_all_mask(batch);
+	}
+
+	if (!arg->match_not)
+		return mask;
+	if (!*exact_r) {
+		/* NOT of an inexact result - anything may match */
+		return search_batch_all_mask(batch);
+	}
+	return ~mask & search_batch_all_mask(batch);
+}
+
+static uint64_t
+search_batch_args(struct index_search_batch *batch,
+		  struct mail_search_arg *args, bool match_all, bool *exact_r)
+{
+	uint64_t mask, arg_mask;
+	bool arg_exact;
+
+	mask = match_all ? search_batch_all_mask(batch) : 0;
+	*exact_r = TRUE;
+	for (; args != NULL; args = args->next) {
+		arg_mask = search_batch_arg(batch, args, &arg_exact);
+		if (match_all)
+			mask &= arg_mask;
+		else
+			mask |= arg_mask;
+		if (!arg_exact)
+			*exact_r = FALSE;
+	}
+	return mask;
+}
+
+static bool
+search_batch_fill(struct index_search_batch *batch, uint32_t seq,
+		  uint32_t seq2)
+{
+	bool exact;
+
+	if (seq2 - seq >= SEARCH_BATCH_BLOCK_SIZE)
+		seq2 = seq + SEARCH_BATCH_BLOCK_SIZE - 1;
+	batch->count = mail_index_lookup_columns(batch->ctx->view, seq, seq2,
+						 &batch->uids, &batch->flags);
+	if (batch->count == 0)
+		return FALSE;
+
+	batch->seq1 = seq;
+	batch->mask = search_batch_args(batch, batch->ctx->mail_ctx.args->args,
+					TRUE, &exact);
+	return TRUE;
+}
+
+static bool search_batch_arg_is_useful(struct mail_search_arg *arg)
+{
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			if (search_batch_arg_is_useful(arg->value.subargs))
+				return TRUE;
+			break;
+		case SEARCH_SEQSET:
+		case SEARCH_UIDSET:
+		case SEARCH_INTHREAD:
+		case SEARCH_FLAGS:
+			return TRUE;
+		default:
+			break;
+		}
+	}
+	return FALSE;
+}
+
+struct index_search_batch *
+index_search_batch_init(struct index_search_context *ctx)
+{
+	struct index_search_batch *batch;
+
+	if (index_search_batch_disabled ||
+	    !search_batch_arg_is_useful(ctx->mail_ctx.args->args))
+		return NULL;
+
+	batch = i_new(struct index_search_batch, 1);
+	batch->ctx = ctx;
+	batch->pvt_flags_mask = ctx->box->view_pvt == NULL ? 0 :
+		mailbox_get_private_flags_mask(ctx->box);
+	return batch;
+}
+
+void index_search_batch_deinit(struct index_search_batch **_batch)
+{
+	struct index_search_batch *batch = *_batch;
+
+	*_batch = NULL;
+	i_free(batch);
+}
+
+bool index_search_batch_next(struct index_search_batch *batch,
+			     uint32_t *seq, uint32_t seq2)
+{
+	uint64_t mask;
+
+	while (*seq <= seq2) {
+		if (batch->disabled)
+			return TRUE;
+		if (*seq < batch->seq1 || *seq - batch->seq1 >= batch->count) {
+			if (!search_batch_fill(batch, *seq, seq2)) {
+				/* the rest must be checked one by one */
+				batch->disabled = TRUE;
+				return TRUE;
+			}
+		}
+
+		mask = batch->mask >> (*seq - batch->seq1);
+		if (mask != 0) {
+			/* skip to the lowest set bit */
+			*seq += bits_required64(mask & UNSIGNED_MINUS(mask)) - 1;
+			return TRUE;
+		}
+		*seq = batch->seq1 + batch->count;
+	}
+	return FALSE;
+}
@@ -22,6 +22,7 @@ struct index_search_context {
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
+	struct index_search_batch *batch;
 	pool_t temp_pool;
 
 	struct timeval last_nonblock_timeval;
@@ -38,6 +39,21 @@ struct index_search_context {
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
 
+/* For unit tests: Don't evaluate the search args in batches, so the results
+   can be compared with evaluating each message separately. */
+extern bool index_search_batch_disabled;
+
+/* Evaluate the flag and message set search args for blocks of messages
+   using the index's dense UID and flags columns. Returns NULL if the args
+   have nothing that can be evaluated this way. */
+struct index_search_batch *
+index_search_batch_init(struct index_search_context *ctx);
+void index_search_batch_deinit(struct index_search_batch **batch);
+/* Move seq forward to the next message that may match the search args.
+   Returns FALSE if none of the messages up to seq2 match. */
+bool index_search_batch_next(struct index_search_batch *batch,
+			     uint32_t *seq, uint32_t seq2);
+
 int index_search_mime_arg_match(struct mail_search_arg *args,
 	struct index_search_context *ctx);
 void index_search_mime_arg_deinit(struct mail_search_arg *arg,
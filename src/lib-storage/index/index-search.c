@@ -1040,6 +1040,30 @@ static void search_limit_lowwater(struct index_search_context *ctx,
 		*first_seq = seq1;
 }
 
+static bool search_limit_by_flags(struct index_search_context *ctx,
+				  const struct mail_search_arg *arg,
+				  uint32_t *seq1, uint32_t seq2)
+{
+	enum mail_flags flags = arg->value.flags;
+	uint32_t seq;
+
+	if (arg->match_not && (flags & (flags - 1)) != 0) {
+		/* NOT with multiple flags matches a message with any of the
+		   flags missing */
+		return TRUE;
+	}
+
+	/* Skip to the first message that can match. This scans only the
+	   index's dense flags column. */
+	mail_index_lookup_first(ctx->view, arg->match_not ? 0 : flags, flags,
+				&seq);
+	if (seq == 0 || seq > seq2)
+		return FALSE;
+	if (*seq1 < seq)
+		*seq1 = seq;
+	return TRUE;
+}
+
 /* Returns TRUE if the view's header counters (e.g.
    deleted_messages_count) may be older than the flags that searching
    actually matches. */
@@ -1141,6 +1165,9 @@ static bool search_limit_by_hdr(struct index_search_context *ctx,
                                 	hdr->first_deleted_uid_lowwater, seq1);
 			}
 		}
+		if ((args->value.flags & (pvt_flags_mask | MAIL_RECENT)) == 0 &&
+		    !search_limit_by_flags(ctx, args, seq1, *seq2))
+			return FALSE;
 	}
 
 	return *seq1 <= *seq2;
@@ -1387,6 +1414,8 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
+	if (ctx->have_seqsets || ctx->have_index_args)
+		ctx->batch = index_search_batch_init(ctx);
 	return &ctx->mail_ctx;
 }
 
@@ -1426,6 +1455,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	}
 	if (ctx->thread_ctx != NULL)
 		mail_thread_deinit(&ctx->thread_ctx);
+	if (ctx->batch != NULL)
+		index_search_batch_deinit(&ctx->batch);
 	array_free(&ctx->mail_ctx.results);
 	array_free(&ctx->mail_ctx.module_contexts);
 
@@ -1958,6 +1989,12 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		/* skip over the messages whose flags and UIDs can't match */
+		if (ctx->batch != NULL &&
+		    !index_search_batch_next(ctx->batch, &_ctx->seq,
+					     ctx->seq2))
+			break;
+
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
@@ -286,6 +286,7 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.max_size = set->mail_index_log_rotate_max_size,
 			.min_age_secs = set->mail_index_log_rotate_min_age,
 			.log2_max_age_secs = set->mail_index_log2_max_age,
+			.prealloc_size = set->mail_index_log_prealloc_size,
 		},
 		.cache = {
 			.unaccessed_field_drop_secs = set->mail_cache_unaccessed_field_drop,
@@ -297,6 +298,8 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.purge_chunk_size = set->mail_cache_purge_chunk_size,
+			.compress_min_size = set->mail_cache_compress_min_size,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
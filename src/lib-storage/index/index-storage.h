@@ -7,6 +7,8 @@
 #include "mailbox-watch.h"
 
 #define MAILBOX_FULL_SYNC_INTERVAL 5
+/* Maximum number of threads used for fsyncing the saved mails */
+#define INDEX_STORAGE_FSYNC_MAX_THREADS 8
 
 enum mailbox_lock_notify_type {
 	MAILBOX_LOCK_NOTIFY_NONE,
@@ -818,6 +818,7 @@ struct mail_vfuncs maildir_mail_vfuncs = {
 	index_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	index_mail_get_parts,
+	index_mail_get_serialized_parts,
 	index_mail_get_date,
 	maildir_mail_get_received_date,
 	maildir_mail_get_save_date,
@@ -8,6 +8,7 @@
 #include "istream-crlf.h"
 #include "ostream.h"
 #include "fdatasync-path.h"
+#include "fsync-group.h"
 #include "eacces-error.h"
 #include "str.h"
 #include "index-mail.h"
@@ -57,6 +58,8 @@ struct maildir_save_context {
 	struct istream *input;
 	int fd;
 	uint32_t first_seq, seq, last_nonrecent_uid;
+	/* The saved files are fsynced all at once when committing */
+	struct fsync_group *fsync_group;
 
 	bool have_keywords:1;
 	bool have_preserved_filenames:1;
@@ -570,16 +573,6 @@ static int maildir_save_finish_real(struct mail_save_context *_ctx)
 
 	maildir_save_finish_keywords(_ctx);
 
-	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER &&
-	    !ctx->failed) {
-		if (fsync(ctx->fd) < 0) {
-			if (!mail_storage_set_error_from_errno(storage)) {
-				mail_set_critical(_ctx->dest_mail,
-						  "fsync(%s) failed: %m", path);
-			}
-			ctx->failed = TRUE;
-		}
-	}
 	real_size = lseek(ctx->fd, 0, SEEK_END);
 	if (real_size == (off_t)-1) {
 		mail_set_critical(_ctx->dest_mail, "lseek(%s) failed: %m", path);
@@ -598,7 +591,15 @@ static int maildir_save_finish_real(struct mail_save_context *_ctx)
 		   ,W=vsize */
 		ctx->file_last->dest_basename = ctx->file_last->tmp_name;
 	}
-	if (close(ctx->fd) < 0) {
+	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER &&
+	    !ctx->failed) {
+		/* fsync and close the file when committing */
+		if (ctx->fsync_group == NULL) {
+			ctx->fsync_group =
+				fsync_group_init(INDEX_STORAGE_FSYNC_MAX_THREADS);
+		}
+		fsync_group_add_fd(ctx->fsync_group, ctx->fd, path);
+	} else if (close(ctx->fd) < 0) {
 		if (!mail_storage_set_error_from_errno(storage)) {
 			mail_set_critical(_ctx->dest_mail,
 					  "close(%s) failed: %m", path);
@@ -959,6 +960,7 @@ int maildir_transaction_save_commit_pre(struct mail_save_context *_ctx)
 	struct maildir_save_context *ctx = MAILDIR_SAVECTX(_ctx);
 	struct mailbox_transaction_context *_t = _ctx->transaction;
 	enum maildir_uidlist_sync_flags sync_flags;
+	const char *error;
 	int ret;
 
 	i_assert(_ctx->data.output == NULL);
@@ -967,6 +969,14 @@ int maildir_transaction_save_commit_pre(struct mail_save_context *_ctx)
 	if (ctx->files_count == 0)
 		return 0;
 
+	if (ctx->fsync_group != NULL &&
+	    fsync_group_flush(ctx->fsync_group, &error) < 0) {
+		if (!mail_storage_set_error_from_errno(_t->box->storage))
+			mailbox_set_critical(_t->box, "%s", error);
+		maildir_transaction_save_rollback(_ctx);
+		return -1;
+	}
+
 	sync_flags = MAILDIR_UIDLIST_SYNC_PARTIAL |
 		MAILDIR_UIDLIST_SYNC_NOREFRESH;
 
@@ -1059,6 +1069,7 @@ void maildir_transaction_save_commit_post(struct mail_save_context *_ctx,
 
 	if (ctx->locked)
 		maildir_uidlist_unlock(ctx->mbox->uidlist);
+	fsync_group_deinit(&ctx->fsync_group);
 	pool_unref(&ctx->pool);
 }
 
@@ -1080,6 +1091,7 @@ void maildir_transaction_save_rollback(struct mail_save_context *_ctx)
 		maildir_sync_index_rollback(&ctx->sync_ctx);
 	if (ctx->locked)
 		maildir_uidlist_unlock(ctx->mbox->uidlist);
+	fsync_group_deinit(&ctx->fsync_group);
 
 	pool_unref(&ctx->pool);
 }
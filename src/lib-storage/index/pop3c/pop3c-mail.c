@@ -281,6 +281,7 @@ struct mail_vfuncs pop3c_mail_vfuncs = {
 	index_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	index_mail_get_parts,
+	index_mail_get_serialized_parts,
 	index_mail_get_date,
 	pop3c_mail_get_received_date,
 	pop3c_mail_get_save_date,
@@ -129,6 +129,7 @@ struct mail_vfuncs raw_mail_vfuncs = {
 	index_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	index_mail_get_parts,
+	index_mail_get_serialized_parts,
 	index_mail_get_date,
 	raw_mail_get_received_date,
 	raw_mail_get_save_date,
@@ -3,15 +3,21 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "str.h"
 #include "base64.h"
 #include "test-common.h"
 #include "test-dir.h"
 #include "master-service.h"
 #include "test-mail-storage-common.h"
 #include "mail-storage-private.h"
+#include "mail-search-build.h"
+#include "mail-search-parser.h"
 #include "index/index-storage.h"
 #include "index/index-mailbox-size.h"
 #include "index/index-attachment.h"
+#include "index/index-search-private.h"
+
+#define TEST_SEARCH_MAIL_COUNT 150
 
 static void test_mail_save(struct mailbox *box, const char *mail_input)
 {
@@ -235,12 +241,176 @@ static void test_index_attachment_base64_decoded_size(void)
 	test_end();
 }
 
+static void test_index_search_save_mails(struct mailbox *box)
+{
+	static const char *const kw1[] = { "kw1", NULL };
+	static const char *const kw2[] = { "kw2", NULL };
+	static const char *const kw12[] = { "kw1", "kw2", NULL };
+	static const char *const *const keywords[] = {
+		NULL, kw1, kw2, kw12
+	};
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct mail_keywords *kw;
+	struct mail *mail;
+	struct istream *input;
+	enum mail_flags flags;
+	unsigned int i;
+	int ret;
+
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (i = 1; i <= TEST_SEARCH_MAIL_COUNT; i++) {
+		flags = 0;
+		if (i % 2 == 0)
+			flags |= MAIL_SEEN;
+		if (i % 3 == 0)
+			flags |= MAIL_FLAGGED;
+		if (i % 5 == 0)
+			flags |= MAIL_ANSWERED;
+		if (i % 7 == 0)
+			flags |= MAIL_DELETED;
+		if (i % 11 == 0)
+			flags |= MAIL_DRAFT;
+		kw = keywords[(i / 4) % 4] == NULL ? NULL :
+			mailbox_keywords_create_valid(box,
+						      keywords[(i / 4) % 4]);
+
+		input = i_stream_create_from_data("From: foo\n\nbar\n", 15);
+		save_ctx = mailbox_save_alloc(trans);
+		mailbox_save_set_flags(save_ctx, flags, kw);
+		test_assert(mailbox_save_begin(&save_ctx, input) == 0);
+		while ((ret = i_stream_read(input)) > 0) ;
+		test_assert(ret == -1);
+		test_assert(mailbox_save_finish(&save_ctx) == 0);
+		i_stream_unref(&input);
+		if (kw != NULL)
+			mailbox_keywords_unref(&kw);
+	}
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	/* expunge some mails, so the UIDs have gaps */
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 1; i <= TEST_SEARCH_MAIL_COUNT; i += 9) {
+		mail_set_seq(mail, i);
+		mail_expunge(mail);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static const char *
+test_index_search_uids(struct mailbox_transaction_context *trans,
+		       const char *query, bool batch)
+{
+	struct mail_search_parser *parser;
+	struct mail_search_args *args;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	const char *error, *charset = "UTF-8";
+	string_t *str = t_str_new(256);
+
+	parser = mail_search_parser_init_cmdline(t_strsplit(query, " "));
+	if (mail_search_build(mail_search_register_get_imap4rev1(),
+			      parser, &charset, &args, &error) < 0)
+		i_panic("%s", error);
+	mail_search_parser_deinit(&parser);
+
+	index_search_batch_disabled = !batch;
+	search_ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	index_search_batch_disabled = FALSE;
+	test_assert_idx((((struct index_search_context *)search_ctx)->
+			 batch != NULL) == batch, batch);
+	while (mailbox_search_next(search_ctx, &mail))
+		str_printfa(str, "%u,", mail->uid);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	mail_search_args_unref(&args);
+	return str_c(str);
+}
+
+static void test_index_search_batch(void)
+{
+	static const char *const queries[] = {
+		"SEEN",
+		"NOT SEEN",
+		"SEEN FLAGGED NOT DELETED",
+		"OR FLAGGED ANSWERED",
+		"NOT ( OR FLAGGED ANSWERED )",
+		"OR NOT SEEN ( FLAGGED NOT DELETED )",
+		"OR ( NOT ( OR SEEN DRAFT ) ) ( ANSWERED NOT FLAGGED )",
+		"OR RECENT DRAFT",
+		"KEYWORD kw1 NOT DELETED",
+		"KEYWORD kw1 SEEN",
+		"NOT KEYWORD kw1 NOT ANSWERED",
+		"OR KEYWORD kw1 FLAGGED",
+		"NOT ( OR KEYWORD kw2 NOT SEEN )",
+		"NOT ( OR KEYWORD kw1 KEYWORD kw2 ) OR SEEN DELETED",
+		"OR ( KEYWORD kw1 NOT KEYWORD kw2 ) ( NOT SEEN NOT FLAGGED )",
+		"UID 3:20,40,70:100 NOT SEEN",
+		"OR UID 1:10 ( NOT UID 50:* FLAGGED )",
+		"NOT ( UID 30:90 OR SEEN KEYWORD kw2 )",
+		"1:5,60:70,130:* OR DELETED NOT KEYWORD kw1",
+		"NOT 10:120 NOT ( OR FLAGGED KEYWORD kw2 )",
+		"NOT ( OR ( UID 5:140 NOT FLAGGED ) "
+			"( NOT ( OR SEEN KEYWORD kw1 ) ) )",
+	};
+	struct test_mail_storage_ctx *ctx;
+	const struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	const struct mail_namespace *ns;
+	struct mailbox *box;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	const char *batched, *unbatched;
+	unsigned int i;
+
+	test_begin("index search batch");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	ns = mail_namespace_find_inbox(ctx->user->namespaces);
+	box = mailbox_alloc(ns->list, "search-batch-test", 0);
+	test_assert(mailbox_create(box, NULL, FALSE) == 0);
+	test_assert(mailbox_open(box) == 0);
+	test_index_search_save_mails(box);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	for (i = 0; i < N_ELEMENTS(queries); i++) T_BEGIN {
+		batched = test_index_search_uids(trans, queries[i], TRUE);
+		unbatched = test_index_search_uids(trans, queries[i], FALSE);
+		test_assert_strcmp_idx(batched, unbatched, i);
+	} T_END;
+
+	/* uncommitted flag changes in the transaction are seen by both */
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 1; i <= 40; i += 3) {
+		mail_set_seq(mail, i);
+		mail_update_flags(mail, MODIFY_ADD, MAIL_SEEN | MAIL_FLAGGED);
+	}
+	mail_free(&mail);
+	for (i = 0; i < N_ELEMENTS(queries); i++) T_BEGIN {
+		batched = test_index_search_uids(trans, queries[i], TRUE);
+		unbatched = test_index_search_uids(trans, queries[i], FALSE);
+		test_assert_strcmp_idx(batched, unbatched, i);
+	} T_END;
+	mailbox_transaction_rollback(&trans);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 int main(int argc, char *argv[])
 {
 	static void (* const test_functions[])(void) = {
 		test_vsize_hdr_corruption_fix,
 		test_vsize_hdr_msg_count_corruption_fix,
 		test_index_attachment_base64_decoded_size,
+		test_index_search_batch,
 		NULL
 	};
 
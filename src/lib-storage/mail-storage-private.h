@@ -557,6 +557,7 @@ struct mail_vfuncs {
 
 	int (*get_parts)(struct mail *mail,
 			 struct message_part **parts_r);
+	int (*get_serialized_parts)(struct mail *mail, buffer_t *parts_buf);
 	int (*get_date)(struct mail *mail, time_t *date_r, int *timezone_r);
 	int (*get_received_date)(struct mail *mail, time_t *date_r);
 	int (*get_save_date)(struct mail *mail, time_t *date_r);
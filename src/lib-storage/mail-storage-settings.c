@@ -59,12 +59,15 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(SIZE_HIDDEN, mail_cache_purge_chunk_size),
+	DEF(SIZE_HIDDEN, mail_cache_compress_min_size),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_max_size),
 	DEF(TIME_HIDDEN, mail_index_log_rotate_min_age),
 	DEF(TIME_HIDDEN, mail_index_log2_max_age),
+	DEF(SIZE_HIDDEN, mail_index_log_prealloc_size),
 	DEF(TIME_HIDDEN, mailbox_idle_check_interval),
 	DEF(UINT_HIDDEN, mail_max_keyword_length),
 	DEF(TIME, mail_max_lock_timeout),
@@ -134,12 +137,15 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_purge_chunk_size = 0,
+	.mail_cache_compress_min_size = 0,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
 	.mail_index_log_rotate_min_size = 32 * 1024,
 	.mail_index_log_rotate_max_size = 1024 * 1024,
 	.mail_index_log_rotate_min_age = 5 * 60,
 	.mail_index_log2_max_age = 3600 * 24 * 2,
+	.mail_index_log_prealloc_size = 0,
 	.mailbox_idle_check_interval = 30,
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
@@ -48,12 +48,15 @@ struct mail_storage_settings {
 	unsigned int mail_cache_purge_delete_percentage;
 	unsigned int mail_cache_purge_continued_percentage;
 	unsigned int mail_cache_purge_header_continue_count;
+	uoff_t mail_cache_purge_chunk_size;
+	uoff_t mail_cache_compress_min_size;
 	uoff_t mail_index_rewrite_min_log_bytes;
 	uoff_t mail_index_rewrite_max_log_bytes;
 	uoff_t mail_index_log_rotate_min_size;
 	uoff_t mail_index_log_rotate_max_size;
 	unsigned int mail_index_log_rotate_min_age;
 	unsigned int mail_index_log2_max_age;
+	uoff_t mail_index_log_prealloc_size;
 	unsigned int mailbox_idle_check_interval;
 	unsigned int mail_max_keyword_length;
 	unsigned int mail_max_lock_timeout;
@@ -956,6 +956,13 @@ uint64_t mail_get_pvt_modseq(struct mail *mail);
 
 /* Returns message's MIME parts */
 int mail_get_parts(struct mail *mail, struct message_part **parts_r);
+/* Append message's cached MIME parts to parts_buf in the
+   message_part_serialize() format without deserializing them. This allows
+   looking up a single part cheaply with message_part_deserialize_cursor.
+   has_nuls and has_no_nuls are updated when the parts are found.
+   Returns 1 if found, 0 if they're not cached or the backend doesn't support
+   this (use mail_get_parts() instead), -1 on error. */
+int mail_get_serialized_parts(struct mail *mail, buffer_t *parts_buf);
 
 /* Get the Date-header of the mail. Timezone is in minutes. date=0 if it
    wasn't found or it was invalid. */
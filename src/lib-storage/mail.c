@@ -208,6 +208,19 @@ int mail_get_parts(struct mail *mail, struct message_part **parts_r)
 	return ret;
 }
 
+int mail_get_serialized_parts(struct mail *mail, buffer_t *parts_buf)
+{
+	struct mail_private *p = (struct mail_private *)mail;
+	int ret;
+
+	if (p->v.get_serialized_parts == NULL)
+		return 0;
+	T_BEGIN {
+		ret = p->v.get_serialized_parts(mail, parts_buf);
+	} T_END;
+	return ret;
+}
+
 int mail_get_date(struct mail *mail, time_t *date_r, int *timezone_r)
 {
 	struct mail_private *p = (struct mail_private *)mail;
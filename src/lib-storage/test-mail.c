@@ -8,6 +8,9 @@
 #include "message-size.h"
 #include "test-mail-storage-common.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 static int
 test_mail_save_trans(struct mailbox_transaction_context *trans,
 		     struct istream *input)
@@ -331,6 +334,65 @@ static void test_mail_random_access(void)
 	test_end();
 }
 
+static int test_get_lowest_free_fd(void)
+{
+	int fd = open("/dev/null", O_RDONLY);
+
+	if (fd == -1)
+		i_fatal("open(/dev/null) failed: %m");
+	i_close_fd(&fd);
+	return fd;
+}
+
+static void test_maildir_save_rollback(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "maildir",
+		.extra_input = (const char *const[]) {
+			"mail_fsync=always",
+			NULL
+		},
+	};
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+	struct istream *input;
+	const char *mail_input =
+		"From: <test1@example.com>\n"
+		"\n"
+		"test body\n";
+	int free_fd;
+
+	test_begin("maildir save rollback");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+
+	/* the saved tmp files are kept open for fsyncing them at commit.
+	   rollback must close them all. */
+	free_fd = test_get_lowest_free_fd();
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	for (unsigned int i = 0; i < 3; i++) {
+		input = i_stream_create_from_data(mail_input,
+						  strlen(mail_input));
+		test_assert(test_mail_save_trans(trans, input) == 0);
+		i_stream_unref(&input);
+	}
+	mailbox_transaction_rollback(&trans);
+	test_assert(test_get_lowest_free_fd() == free_fd);
+
+	test_assert(mailbox_sync(box, 0) == 0);
+	test_assert(mail_index_view_get_messages_count(box->view) == 0);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 static void test_attachment_flags_during_header_fetch(void)
 {
 	struct test_mail_storage_ctx *ctx;
@@ -730,6 +792,7 @@ int main(int argc, char **argv)
 	void (*const tests[])(void) = {
 		test_mail_random_access,
 		test_attachment_flags_during_header_fetch,
+		test_maildir_save_rollback,
 		test_bodystructure_reparsing,
 		test_bodystructure_corruption_reparsing,
 		test_mail_set_critical,
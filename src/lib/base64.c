@@ -3,6 +3,370 @@
 #include "lib.h"
 #include "base64.h"
 #include "buffer.h"
+#include "cpu-features.h"
+
+#ifdef HAVE_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+/*
+ * Bulk conversion
+ */
+
+/* The bulk functions below convert only whole 3-byte groups into 4
+   characters and back, without any whitespace or padding. The streaming
+   encoder and decoder use them for the middle of the data and handle the
+   rest byte by byte. The SIMD versions only support the standard alphabet
+   with the last two characters being variable (base64 and base64url). */
+
+static size_t
+base64_encode_bulk_scalar(const char *b64enc,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+	uint32_t v;
+
+	for (; src_size - src_pos >= 3 && dst_size - dst_pos >= 4;
+	     src_pos += 3, dst_pos += 4) {
+		v = ((uint32_t)src[src_pos] << 16) |
+			((uint32_t)src[src_pos+1] << 8) | src[src_pos+2];
+		dst[dst_pos] = b64enc[v >> 18];
+		dst[dst_pos+1] = b64enc[(v >> 12) & 0x3f];
+		dst[dst_pos+2] = b64enc[(v >> 6) & 0x3f];
+		dst[dst_pos+3] = b64enc[v & 0x3f];
+	}
+	return src_pos;
+}
+
+static size_t
+base64_decode_bulk_scalar(const unsigned char *b64dec,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+	uint32_t a, b, c, d, v;
+
+	for (; src_size - src_pos >= 4 && dst_size - dst_pos >= 3;
+	     src_pos += 4, dst_pos += 3) {
+		a = b64dec[src[src_pos]];
+		b = b64dec[src[src_pos+1]];
+		c = b64dec[src[src_pos+2]];
+		d = b64dec[src[src_pos+3]];
+		/* invalid characters map to 0xff */
+		if (((a | b | c | d) & 0x80) != 0)
+			break;
+		v = (a << 18) | (b << 12) | (c << 6) | d;
+		dst[dst_pos] = v >> 16;
+		dst[dst_pos+1] = (v >> 8) & 0xff;
+		dst[dst_pos+2] = v & 0xff;
+	}
+	return src_pos;
+}
+
+#ifdef HAVE_X86_SIMD
+static bool
+base64_scheme_get_simd_chars(const struct base64_scheme *b64,
+			     char *c62_r, char *c63_r)
+{
+	if (b64 != &base64_scheme && b64 != &base64url_scheme)
+		return FALSE;
+	*c62_r = b64->encmap[62];
+	*c63_r = b64->encmap[63];
+	return TRUE;
+}
+
+/* Split each 3 bytes of the 12 first bytes into 4 6-bit values. */
+static inline __m128i __attribute__((target("sse4.1")))
+base64_sse_encode_split(__m128i in)
+{
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+					       4, 5, 3, 4, 1, 2, 0, 1));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+/* Translate 6-bit values to characters. */
+static inline __m128i __attribute__((target("sse4.1")))
+base64_sse_encode_translate(__m128i idx, char c62, char c63)
+{
+	__m128i lt26 = _mm_cmplt_epi8(idx, _mm_set1_epi8(26));
+	__m128i lt52 = _mm_cmplt_epi8(idx, _mm_set1_epi8(52));
+	__m128i lt62 = _mm_cmplt_epi8(idx, _mm_set1_epi8(62));
+	__m128i eq62 = _mm_cmpeq_epi8(idx, _mm_set1_epi8(62));
+	__m128i eq63 = _mm_cmpeq_epi8(idx, _mm_set1_epi8(63));
+	__m128i offset;
+
+	offset = _mm_and_si128(lt26, _mm_set1_epi8('A'));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		_mm_andnot_si128(lt26, lt52), _mm_set1_epi8('a' - 26)));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		_mm_andnot_si128(lt52, lt62), _mm_set1_epi8('0' - 52)));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		eq62, _mm_set1_epi8(c62 - 62)));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		eq63, _mm_set1_epi8(c63 - 63)));
+	return _mm_add_epi8(idx, offset);
+}
+
+/* Translate characters to 6-bit values. Returns FALSE if there are any
+   characters outside the alphabet. */
+static inline bool __attribute__((target("sse4.1")))
+base64_sse_decode_translate(__m128i in, char c62, char c63, __m128i *out_r)
+{
+	/* bytes >= 0x80 are negative, so they fall outside all the ranges */
+	__m128i upper = _mm_and_si128(
+		_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+		_mm_cmplt_epi8(in, _mm_set1_epi8('Z' + 1)));
+	__m128i lower = _mm_and_si128(
+		_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(in, _mm_set1_epi8('z' + 1)));
+	__m128i digit = _mm_and_si128(
+		_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+	__m128i eq62 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c62));
+	__m128i eq63 = _mm_cmpeq_epi8(in, _mm_set1_epi8(c63));
+	__m128i valid, offset;
+
+	valid = _mm_or_si128(_mm_or_si128(upper, lower),
+			     _mm_or_si128(digit, _mm_or_si128(eq62, eq63)));
+	if (_mm_movemask_epi8(valid) != 0xffff)
+		return FALSE;
+
+	offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		lower, _mm_set1_epi8(26 - 'a')));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		digit, _mm_set1_epi8(52 - '0')));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		eq62, _mm_set1_epi8(62 - c62)));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		eq63, _mm_set1_epi8(63 - c63)));
+	*out_r = _mm_add_epi8(in, offset);
+	return TRUE;
+}
+
+/* Merge each 4 6-bit values into 3 bytes, leaving them to the 12 first
+   bytes. */
+static inline __m128i __attribute__((target("sse4.1")))
+base64_sse_decode_merge(__m128i v)
+{
+	v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+	v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+						 14, 13, 12, -1, -1, -1, -1));
+}
+
+static size_t __attribute__((target("sse4.1")))
+base64_encode_bulk_sse(char c62, char c63,
+		       const unsigned char *src, size_t src_size,
+		       unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+	__m128i v;
+
+	/* reads 16 bytes, but uses only 12 of them */
+	for (; src_size - src_pos >= 16 && dst_size - dst_pos >= 16;
+	     src_pos += 12, dst_pos += 16) {
+		v = _mm_loadu_si128((const void *)(src + src_pos));
+		v = base64_sse_encode_split(v);
+		v = base64_sse_encode_translate(v, c62, c63);
+		_mm_storeu_si128((void *)(dst + dst_pos), v);
+	}
+	return src_pos;
+}
+
+static size_t __attribute__((target("sse4.1")))
+base64_decode_bulk_sse(char c62, char c63,
+		       const unsigned char *src, size_t src_size,
+		       unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+	__m128i v;
+
+	/* writes 16 bytes, but only 12 of them are output */
+	for (; src_size - src_pos >= 16 && dst_size - dst_pos >= 16;
+	     src_pos += 16, dst_pos += 12) {
+		v = _mm_loadu_si128((const void *)(src + src_pos));
+		if (!base64_sse_decode_translate(v, c62, c63, &v))
+			break;
+		_mm_storeu_si128((void *)(dst + dst_pos),
+				 base64_sse_decode_merge(v));
+	}
+	return src_pos;
+}
+
+static size_t __attribute__((target("avx2")))
+base64_encode_bulk_avx2(char c62, char c63,
+			const unsigned char *src, size_t src_size,
+			unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+	__m128i lo, hi;
+	__m256i v, t0, t1, t2, t3, lt26, lt52, lt62, offset;
+
+	/* reads 28 bytes, but uses only 24 of them */
+	for (; src_size - src_pos >= 28 && dst_size - dst_pos >= 32;
+	     src_pos += 24, dst_pos += 32) {
+		lo = _mm_loadu_si128((const void *)(src + src_pos));
+		hi = _mm_loadu_si128((const void *)(src + src_pos + 12));
+		v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_shuffle_epi8(v, _mm256_set_epi8(
+			10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+			10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+		t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+		t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		v = _mm256_or_si256(t1, t3);
+
+		lt26 = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+		lt52 = _mm256_cmpgt_epi8(_mm256_set1_epi8(52), v);
+		lt62 = _mm256_cmpgt_epi8(_mm256_set1_epi8(62), v);
+		offset = _mm256_and_si256(lt26, _mm256_set1_epi8('A'));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			_mm256_andnot_si256(lt26, lt52),
+			_mm256_set1_epi8('a' - 26)));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			_mm256_andnot_si256(lt52, lt62),
+			_mm256_set1_epi8('0' - 52)));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8(62)),
+			_mm256_set1_epi8(c62 - 62)));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			_mm256_cmpeq_epi8(v, _mm256_set1_epi8(63)),
+			_mm256_set1_epi8(c63 - 63)));
+		_mm256_storeu_si256((void *)(dst + dst_pos),
+				    _mm256_add_epi8(v, offset));
+	}
+	return src_pos;
+}
+
+static size_t __attribute__((target("avx2")))
+base64_decode_bulk_avx2(char c62, char c63,
+			const unsigned char *src, size_t src_size,
+			unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+	__m256i in, upper, lower, digit, eq62, eq63, valid, offset, v;
+
+	/* writes 32 bytes, but only 24 of them are output */
+	for (; src_size - src_pos >= 32 && dst_size - dst_pos >= 32;
+	     src_pos += 32, dst_pos += 24) {
+		in = _mm256_loadu_si256((const void *)(src + src_pos));
+		upper = _mm256_and_si256(
+			_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+		lower = _mm256_and_si256(
+			_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+		digit = _mm256_and_si256(
+			_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+			_mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+		eq62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c62));
+		eq63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(c63));
+		valid = _mm256_or_si256(
+			_mm256_or_si256(upper, lower),
+			_mm256_or_si256(digit, _mm256_or_si256(eq62, eq63)));
+		if ((uint32_t)_mm256_movemask_epi8(valid) != 0xffffffff)
+			break;
+
+		offset = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			lower, _mm256_set1_epi8(26 - 'a')));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			digit, _mm256_set1_epi8(52 - '0')));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			eq62, _mm256_set1_epi8(62 - c62)));
+		offset = _mm256_or_si256(offset, _mm256_and_si256(
+			eq63, _mm256_set1_epi8(63 - c63)));
+		v = _mm256_add_epi8(in, offset);
+
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		v = _mm256_permutevar8x32_epi32(
+			v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((void *)(dst + dst_pos), v);
+	}
+	return src_pos;
+}
+#endif
+
+/* Encode as many whole 3-byte groups as possible from src to dst. Returns
+   the number of bytes consumed from src. */
+static size_t
+base64_encode_bulk(const struct base64_scheme *b64,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0, n;
+#ifdef HAVE_X86_SIMD
+	char c62, c63;
+
+	if (base64_scheme_get_simd_chars(b64, &c62, &c63)) {
+		if (cpu_features_have(CPU_FEATURE_AVX2)) {
+			n = base64_encode_bulk_avx2(c62, c63, src, src_size,
+						    dst, dst_size);
+			src_pos += n;
+			dst_pos += n / 3 * 4;
+		}
+		if (cpu_features_have(CPU_FEATURE_SSE4_1)) {
+			n = base64_encode_bulk_sse(c62, c63, src + src_pos,
+						   src_size - src_pos,
+						   dst + dst_pos,
+						   dst_size - dst_pos);
+			src_pos += n;
+			dst_pos += n / 3 * 4;
+		}
+	}
+#endif
+	n = base64_encode_bulk_scalar(b64->encmap, src + src_pos,
+				      src_size - src_pos, dst + dst_pos,
+				      dst_size - dst_pos);
+	return src_pos + n;
+}
+
+/* Decode as many whole 4-character groups as possible from src to dst.
+   Decoding stops at the first group containing anything else than
+   characters of the alphabet (whitespace, padding, invalid characters).
+   Returns the number of characters consumed from src. */
+static size_t
+base64_decode_bulk(const struct base64_scheme *b64,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0, n;
+#ifdef HAVE_X86_SIMD
+	char c62, c63;
+
+	if (base64_scheme_get_simd_chars(b64, &c62, &c63)) {
+		if (cpu_features_have(CPU_FEATURE_AVX2)) {
+			n = base64_decode_bulk_avx2(c62, c63, src, src_size,
+						    dst, dst_size);
+			src_pos += n;
+			dst_pos += n / 4 * 3;
+		}
+		if (cpu_features_have(CPU_FEATURE_SSE4_1)) {
+			n = base64_decode_bulk_sse(c62, c63, src + src_pos,
+						   src_size - src_pos,
+						   dst + dst_pos,
+						   dst_size - dst_pos);
+			src_pos += n;
+			dst_pos += n / 4 * 3;
+		}
+	}
+#endif
+	n = base64_decode_bulk_scalar(b64->decmap, src + src_pos,
+				      src_size - src_pos, dst + dst_pos,
+				      dst_size - dst_pos);
+	return src_pos + n;
+}
 
 /*
  * Low-level Base64 encoder
@@ -223,7 +587,7 @@ base64_encode_more_data(struct base64_encoder *enc,
 	const char *b64enc = b64->encmap;
 	size_t res_size;
 	unsigned char *start, *ptr, *end;
-	size_t src_pos;
+	size_t src_pos, bulk_size;
 
 	i_assert(!enc->pending_lf);
 
@@ -307,15 +671,10 @@ base64_encode_more_data(struct base64_encoder *enc,
 	}
 
 	/* Convert the bulk */
-	for (; src_size - src_pos > 2 && &ptr[3] < end;
-	     src_pos += 3, ptr += 4) {
-		ptr[0] = b64enc[src_c[src_pos] >> 2];
-		ptr[1] = b64enc[((src_c[src_pos] & 0x03) << 4) |
-				(src_c[src_pos+1] >> 4)];
-		ptr[2] = b64enc[((src_c[src_pos+1] & 0x0f) << 2) |
-				((src_c[src_pos+2] & 0xc0) >> 6)];
-		ptr[3] = b64enc[src_c[src_pos+2] & 0x3f];
-	}
+	bulk_size = base64_encode_bulk(b64, src_c + src_pos, src_size - src_pos,
+				       ptr, end - ptr);
+	src_pos += bulk_size;
+	ptr += bulk_size / 3 * 4;
 
 	/* Convert the bytes beyond the last 3-byte boundary and update state
 	   for next call */
@@ -599,6 +958,32 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+static void
+base64_decode_more_bulk(struct base64_decoder *dec,
+			const unsigned char *src_c, size_t src_size,
+			size_t *src_pos, size_t *dst_avail, buffer_t *dest)
+{
+	/* Decode via a temporary buffer to avoid reserving (and clearing)
+	   destination buffer space for data that is possibly not decoded
+	   here. */
+	unsigned char tmp[3 * 512];
+	size_t groups, size;
+
+	i_assert(dec->sub_pos == 0);
+
+	do {
+		groups = I_MIN((src_size - *src_pos) / 4, *dst_avail / 3);
+		groups = I_MIN(groups, sizeof(tmp) / 3);
+		if (groups == 0)
+			break;
+		size = base64_decode_bulk(dec->b64, src_c + *src_pos,
+					  groups * 4, tmp, sizeof(tmp));
+		buffer_append(dest, tmp, size / 4 * 3);
+		*src_pos += size;
+		*dst_avail -= size / 4 * 3;
+	} while (size == groups * 4);
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -661,9 +1046,17 @@ int base64_decode_more(struct base64_decoder *dec,
 	}
 
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+		if (dec->sub_pos == 0 && src_size - src_pos >= 4) {
+			base64_decode_more_bulk(dec, src_c, src_size,
+						&src_pos, &dst_avail, dest);
+			if (src_pos == src_size)
+				break;
+		}
 
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 		if (dm == 0xff) {
 			if (no_whitespace) {
 				ret = -1;
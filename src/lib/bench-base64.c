@@ -0,0 +1,123 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "cpu-features.h"
+#include "base64.h"
+
+#include <stdio.h>
+
+/**
+ * Encodes and decodes random data with each base64 implementation, both as
+ * MIME-style lines and without line breaks. It measures the throughput of
+ * the binary data size.
+ */
+
+static double bench_throughput(size_t size, uint64_t nsecs)
+{
+	return ((double)size / (1024.0 * 1024.0)) /
+		((double)nsecs / 1000000000.0);
+}
+
+static void
+bench_base64(const char *name, enum cpu_feature disabled,
+	     const unsigned char *data, size_t data_size,
+	     size_t max_line_len, unsigned long count)
+{
+	enum base64_encode_flags flags = BASE64_ENCODE_FLAG_CRLF;
+	buffer_t *encoded, *decoded;
+	uint64_t ts_0, ts_1, ts_2;
+	unsigned long i;
+
+	encoded = buffer_create_dynamic(default_pool, data_size * 2);
+	decoded = buffer_create_dynamic(default_pool, data_size);
+
+	cpu_features_set_disabled(disabled);
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		buffer_set_used_size(encoded, 0);
+		base64_scheme_encode(&base64_scheme, flags, max_line_len,
+				     data, data_size, encoded);
+	}
+	ts_1 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		buffer_set_used_size(decoded, 0);
+		if (base64_decode(encoded->data, encoded->used,
+				  decoded) < 0)
+			i_fatal("base64_decode() failed");
+	}
+	ts_2 = i_nanoseconds();
+	cpu_features_set_disabled(0);
+
+	if (decoded->used != data_size ||
+	    memcmp(decoded->data, data, data_size) != 0)
+		i_fatal("%s: Decoded data differs", name);
+
+	printf("%s, %s\n", name, max_line_len == 0 ?
+	       "no line breaks" : t_strdup_printf("%zu byte lines",
+						  max_line_len));
+	printf("\tEncode: %0.02lf MB/s\n",
+	       bench_throughput(data_size * count, ts_1 - ts_0));
+	printf("\tDecode: %0.02lf MB/s\n\n",
+	       bench_throughput(data_size * count, ts_2 - ts_1));
+
+	buffer_free(&encoded);
+	buffer_free(&decoded);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<data_size> [<count>]]\n", prog);
+	fprintf(stderr, "Runs with 1000 rounds of 64k data if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	static const struct {
+		const char *name;
+		enum cpu_feature required, disabled;
+	} impls[] = {
+		{ "scalar", 0, CPU_FEATURE_ALL },
+		{ "SSE4.1", CPU_FEATURE_SSE4_1, CPU_FEATURE_AVX2 },
+		{ "AVX2", CPU_FEATURE_AVX2, 0 },
+	};
+	static const size_t line_lens[] = { 0, 76 };
+	unsigned long data_size = 65536UL;
+	unsigned long count = 1000UL;
+	unsigned char *data;
+	unsigned int i, j;
+
+	lib_init();
+
+	if (argc >= 2 && str_to_ulong(argv[1], &data_size) < 0) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc >= 3 && str_to_ulong(argv[2], &count) < 0) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 3)
+		print_usage(argv[0]);
+
+	data = i_malloc(data_size);
+	random_fill(data, data_size);
+	printf("Input data is %lu rounds of %lu bytes\n\n", count, data_size);
+
+	for (i = 0; i < N_ELEMENTS(impls); i++) {
+		if (!cpu_features_have(impls[i].required))
+			continue;
+		for (j = 0; j < N_ELEMENTS(line_lens); j++) T_BEGIN {
+			bench_base64(impls[i].name, impls[i].disabled,
+				     data, data_size, line_lens[j], count);
+		} T_END;
+	}
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
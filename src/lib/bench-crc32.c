@@ -0,0 +1,96 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "cpu-features.h"
+#include "crc32.h"
+
+#include <stdio.h>
+
+/**
+ * Calculates CRC32 of random data with each implementation using different
+ * block sizes. Small blocks mimic index records and large ones mail files.
+ */
+
+static void
+bench_crc32(const char *name, enum cpu_feature disabled,
+	    const unsigned char *data, size_t data_size, size_t block_size,
+	    unsigned long count)
+{
+	uint64_t ts_0, ts_1;
+	uint32_t crc = CRC32_INIT;
+	unsigned long i;
+	size_t pos;
+
+	cpu_features_set_disabled(disabled);
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		for (pos = 0; pos + block_size <= data_size; pos += block_size)
+			crc = crc32_data_more(crc, data + pos, block_size);
+	}
+	ts_1 = i_nanoseconds();
+	cpu_features_set_disabled(0);
+
+	printf("%s, %zu byte blocks: %0.02lf MB/s (crc %08x)\n",
+	       name, block_size,
+	       ((double)(data_size / block_size * block_size) * count /
+		(1024.0 * 1024.0)) / ((double)(ts_1 - ts_0) / 1000000000.0),
+	       crc);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<data_size> [<count>]]\n", prog);
+	fprintf(stderr, "Runs with 1000 rounds of 1M data if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	static const struct {
+		const char *name;
+		enum cpu_feature required, disabled;
+	} impls[] = {
+		{ "zlib", 0, CPU_FEATURE_ALL },
+		{ "PCLMUL", CPU_FEATURE_SSE4_1 | CPU_FEATURE_PCLMUL, 0 },
+	};
+	static const size_t block_sizes[] = { 40, 256, 4096, 65536 };
+	unsigned long data_size = 1024UL * 1024UL;
+	unsigned long count = 1000UL;
+	unsigned char *data;
+	unsigned int i, j;
+
+	lib_init();
+
+	if (argc >= 2 && str_to_ulong(argv[1], &data_size) < 0) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc >= 3 && str_to_ulong(argv[2], &count) < 0) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 3)
+		print_usage(argv[0]);
+
+	data = i_malloc(data_size);
+	random_fill(data, data_size);
+	printf("Input data is %lu rounds of %lu bytes\n\n", count, data_size);
+
+	for (i = 0; i < N_ELEMENTS(impls); i++) {
+		if (!cpu_features_have(impls[i].required))
+			continue;
+		for (j = 0; j < N_ELEMENTS(block_sizes); j++) {
+			if (block_sizes[j] > data_size)
+				continue;
+			bench_crc32(impls[i].name, impls[i].disabled, data,
+				    data_size, block_sizes[j], count);
+		}
+	}
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,126 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "hash.h"
+
+#include <stdio.h>
+
+/**
+ * Inserts, looks up, iterates and removes string keys using the chained and
+ * the open addressing hash tables. The keys look similar to the usernames
+ * used in auth cache and anvil.
+ */
+
+static void bench_print(const char *name, const char *op, unsigned int count,
+			uint64_t ts_0, uint64_t ts_1)
+{
+	printf("%s, %s: %0.02lf ns/op\n", name, op,
+	       (double)(ts_1 - ts_0) / count);
+}
+
+static void
+bench_hash(const char *name, bool open_addressing, char *const *keys,
+	   unsigned int count)
+{
+	HASH_TABLE(char *, void *) hash;
+	struct hash_iterate_context *iter;
+	uint64_t ts_0, ts_1;
+	unsigned int i, found = 0;
+	char *key;
+	void *value;
+
+	if (open_addressing)
+		hash_table_create_open(&hash, default_pool, 0, str_hash, strcmp);
+	else
+		hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_insert(hash, keys[i], POINTER_CAST(i + 1));
+	ts_1 = i_nanoseconds();
+	bench_print(name, "insert", count, ts_0, ts_1);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, keys[i]) != NULL)
+			found++;
+	}
+	ts_1 = i_nanoseconds();
+	bench_print(name, "lookup", count, ts_0, ts_1);
+	i_assert(found == count);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		if (hash_table_lookup(hash, keys[count + i]) != NULL)
+			found++;
+	}
+	ts_1 = i_nanoseconds();
+	bench_print(name, "missing lookup", count, ts_0, ts_1);
+	i_assert(found == count);
+
+	found = 0;
+	ts_0 = i_nanoseconds();
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value))
+		found++;
+	hash_table_iterate_deinit(&iter);
+	ts_1 = i_nanoseconds();
+	bench_print(name, "iterate", count, ts_0, ts_1);
+	i_assert(found == count);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++)
+		hash_table_remove(hash, keys[i]);
+	ts_1 = i_nanoseconds();
+	bench_print(name, "remove", count, ts_0, ts_1);
+
+	hash_table_destroy(&hash);
+	printf("\n");
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [<key_count>]\n", prog);
+	fprintf(stderr, "Runs with 1M keys if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, j, count = 1000000;
+	char **keys, *tmp;
+
+	lib_init();
+
+	if (argc >= 2 && str_to_uint(argv[1], &count) < 0) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+	if (argc > 2 || count == 0)
+		print_usage(argv[0]);
+
+	/* the second half of the keys is used for missing lookups */
+	keys = i_new(char *, count * 2);
+	for (i = 0; i < count * 2; i++)
+		keys[i] = i_strdup_printf("user%u@example.com", i);
+	/* access the keys in random order */
+	for (i = count * 2 - 1; i > 0; i--) {
+		j = i_rand_limit(i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+	printf("Input data is %u keys\n\n", count);
+
+	bench_hash("chained", FALSE, keys, count);
+	bench_hash("open addressing", TRUE, keys, count);
+
+	for (i = 0; i < count * 2; i++)
+		i_free(keys[i]);
+	i_free(keys);
+	lib_deinit();
+	return 0;
+}
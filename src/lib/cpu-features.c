@@ -0,0 +1,48 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "cpu-features.h"
+
+static enum cpu_feature cpu_features_supported;
+static enum cpu_feature cpu_features_disabled;
+static bool cpu_features_detected = FALSE;
+
+static void cpu_features_detect(void)
+{
+	enum cpu_feature features = 0;
+
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.1"))
+		features |= CPU_FEATURE_SSE4_1;
+	if (__builtin_cpu_supports("sse4.2"))
+		features |= CPU_FEATURE_SSE4_2;
+	if (__builtin_cpu_supports("avx2"))
+		features |= CPU_FEATURE_AVX2;
+	if (__builtin_cpu_supports("pclmul"))
+		features |= CPU_FEATURE_PCLMUL;
+#endif
+	cpu_features_supported = features;
+	cpu_features_detected = TRUE;
+}
+
+bool cpu_features_have(enum cpu_feature features)
+{
+	if (unlikely(!cpu_features_detected))
+		cpu_features_detect();
+	return (cpu_features_supported & ~cpu_features_disabled &
+		features) == features;
+}
+
+enum cpu_feature cpu_features_disable(enum cpu_feature features)
+{
+	enum cpu_feature old_disabled = cpu_features_disabled;
+
+	cpu_features_disabled |= features;
+	return old_disabled;
+}
+
+void cpu_features_set_disabled(enum cpu_feature features)
+{
+	cpu_features_disabled = features;
+}
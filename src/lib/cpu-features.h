@@ -0,0 +1,27 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* CPU features that optimized code paths can be selected for at runtime.
+   Code using these must be built only #ifdef HAVE_X86_SIMD with the
+   matching __attribute__((target(...))). */
+enum cpu_feature {
+	CPU_FEATURE_SSE4_1	= BIT(0),
+	CPU_FEATURE_SSE4_2	= BIT(1),
+	CPU_FEATURE_AVX2	= BIT(2),
+	CPU_FEATURE_PCLMUL	= BIT(3),
+};
+#define CPU_FEATURE_ALL \
+	(CPU_FEATURE_SSE4_1 | CPU_FEATURE_SSE4_2 | CPU_FEATURE_AVX2 | \
+	 CPU_FEATURE_PCLMUL)
+
+/* Returns TRUE if all the given features are supported by the CPU and they
+   haven't been disabled. */
+bool cpu_features_have(enum cpu_feature features);
+/* Stop using the given features even if the CPU supports them. This is
+   intended for testing and benchmarking the fallback code. Returns the
+   previously disabled features, which can be restored with
+   cpu_features_set_disabled(). */
+enum cpu_feature cpu_features_disable(enum cpu_feature features);
+void cpu_features_set_disabled(enum cpu_feature features);
+
+#endif
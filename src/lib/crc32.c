@@ -1,9 +1,98 @@
 /* Copyright (c) Dovecot authors, see top-level COPYING file */
 
 #include "lib.h"
+#include "cpu-features.h"
 #include "crc32.h"
 #include <zlib.h>
 
+#ifdef HAVE_X86_SIMD
+#  include <immintrin.h>
+
+/* Use PCLMULQDQ only for data large enough to amortize its setup cost */
+#define CRC32_PCLMUL_MIN_SIZE 64
+
+/* CRC32 calculation by folding with carry-less multiplication, as described
+   in Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+   Instruction" paper. The size must be at least 64 and a multiple of 16.
+   The crc is the raw (inverted) CRC state. */
+static uint32_t __attribute__((target("sse4.1,pclmul")))
+crc32_data_pclmul(uint32_t crc, const unsigned char *p, size_t size)
+{
+	/* bit-reflected constants for the CRC32 polynomial */
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	i_assert(size >= 64 && size % 16 == 0);
+
+	x1 = _mm_loadu_si128((const void *)(p + 0x00));
+	x2 = _mm_loadu_si128((const void *)(p + 0x10));
+	x3 = _mm_loadu_si128((const void *)(p + 0x20));
+	x4 = _mm_loadu_si128((const void *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	p += 64;
+	size -= 64;
+
+	/* fold 4x128 bits in parallel */
+	for (; size >= 64; p += 64, size -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const void *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+			_mm_loadu_si128((const void *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+			_mm_loadu_si128((const void *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+			_mm_loadu_si128((const void *)(p + 0x30)));
+	}
+
+	/* fold into 128 bits */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* fold the remaining 128 bit blocks */
+	for (; size >= 16; p += 16, size -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			_mm_loadu_si128((const void *)p));
+	}
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_extract_epi32(x1, 1);
+}
+#endif
+
 uint32_t crc32_data(const void *data, size_t size)
 {
 	return crc32_data_more(CRC32_INIT, data, size);
@@ -12,14 +101,18 @@ uint32_t crc32_data(const void *data, size_t size)
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
 {
 	const unsigned char *p = data;
-	uLong zcrc;
 
-	if (crc == CRC32_INIT) {
-		/* Start new CRC calculation. */
-		zcrc = crc32_z(0L, Z_NULL, 0);
-	} else {
-		zcrc = crc;
-	}
+#ifdef HAVE_X86_SIMD
+	if (size >= CRC32_PCLMUL_MIN_SIZE &&
+	    cpu_features_have(CPU_FEATURE_SSE4_1 | CPU_FEATURE_PCLMUL)) {
+		size_t bulk_size = size & ~(size_t)15;
 
-	return (uint32_t)crc32_z(zcrc, p, size);
+		crc = ~crc32_data_pclmul(~crc, p, bulk_size);
+		p += bulk_size;
+		size -= bulk_size;
+	}
+#endif
+	/* zlib's implementation is table-driven and processes multiple
+	   bytes at a time. CRC32_INIT is the same as zlib's initial value. */
+	return (uint32_t)crc32_z(crc, p, size);
 }
@@ -3,8 +3,8 @@
 
 #define CRC32_INIT 0
 
-uint32_t crc32_data(const void *data, size_t size) ATTR_PURE;
-uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
+uint32_t crc32_data(const void *data, size_t size);
+uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size);
 
 static inline uint32_t crc32_str(const char *str)
 {
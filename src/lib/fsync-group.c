@@ -0,0 +1,216 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "fsync-group.h"
+
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#  include <signal.h>
+#  include <pthread.h>
+#endif
+
+/* Don't keep more than this many fds open */
+#define FSYNC_GROUP_MAX_PENDING_FDS 128
+/* Maximum number of threads used for syncing */
+#define FSYNC_GROUP_MAX_THREADS 32
+
+struct fsync_group_file {
+	int fd;
+	/* fdatasync() errno, or 0 if it succeeded */
+	int sync_errno;
+	char *path;
+};
+
+struct fsync_group {
+	unsigned int max_threads;
+	ARRAY(struct fsync_group_file) files;
+
+	/* The first failure since the last flush */
+	char *error;
+	int error_errno;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+	/* Index of the next file in files to sync. Protected by mutex. */
+	unsigned int next_idx;
+#endif
+};
+
+struct fsync_group *fsync_group_init(unsigned int max_threads)
+{
+	struct fsync_group *group;
+
+	group = i_new(struct fsync_group, 1);
+	i_array_init(&group->files, 16);
+#ifdef HAVE_PTHREAD
+	group->max_threads = I_MIN(max_threads, FSYNC_GROUP_MAX_THREADS);
+	pthread_mutex_init(&group->mutex, NULL);
+#else
+	(void)max_threads;
+#endif
+	return group;
+}
+
+void fsync_group_deinit(struct fsync_group **_group)
+{
+	struct fsync_group *group = *_group;
+	struct fsync_group_file *file;
+
+	if (group == NULL)
+		return;
+	*_group = NULL;
+
+	array_foreach_modifiable(&group->files, file) {
+		i_close_fd_path(&file->fd, file->path);
+		i_free(file->path);
+	}
+	array_free(&group->files);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&group->mutex);
+#endif
+	i_free(group->error);
+	i_free(group);
+}
+
+static void ATTR_FORMAT(3, 4)
+fsync_group_set_error(struct fsync_group *group, int error_errno,
+		      const char *fmt, ...)
+{
+	va_list args;
+
+	if (group->error != NULL)
+		return;
+
+	va_start(args, fmt);
+	group->error = i_strdup_vprintf(fmt, args);
+	group->error_errno = error_errno;
+	va_end(args);
+}
+
+static void fsync_group_sync_sequential(struct fsync_group *group)
+{
+	struct fsync_group_file *file;
+
+	array_foreach_modifiable(&group->files, file) {
+		if (fdatasync(file->fd) < 0)
+			file->sync_errno = errno;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void *fsync_group_thread(void *context)
+{
+	struct fsync_group *group = context;
+	struct fsync_group_file *files;
+	unsigned int idx, count;
+
+	/* NOTE: This runs also in the other threads, so it must not use data
+	   stack, memory pools or logging. */
+	files = array_get_modifiable(&group->files, &count);
+	for (;;) {
+		pthread_mutex_lock(&group->mutex);
+		idx = group->next_idx++;
+		pthread_mutex_unlock(&group->mutex);
+		if (idx >= count)
+			break;
+
+		if (fdatasync(files[idx].fd) < 0)
+			files[idx].sync_errno = errno;
+	}
+	return NULL;
+}
+
+static void fsync_group_sync_threads(struct fsync_group *group)
+{
+	pthread_t threads[FSYNC_GROUP_MAX_THREADS];
+	sigset_t sigset, old_sigset;
+	unsigned int i, thread_count;
+
+	/* The calling thread syncs files as well */
+	thread_count = I_MIN(group->max_threads,
+			     array_count(&group->files) - 1);
+	group->next_idx = 0;
+
+	/* Signals are handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &old_sigset);
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&threads[i], NULL,
+				   fsync_group_thread, group) != 0) {
+			/* the already created threads and the calling thread
+			   sync the rest */
+			thread_count = i;
+			break;
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old_sigset, NULL);
+
+	(void)fsync_group_thread(group);
+	for (i = 0; i < thread_count; i++)
+		(void)pthread_join(threads[i], NULL);
+}
+#else
+static void fsync_group_sync_threads(struct fsync_group *group ATTR_UNUSED)
+{
+	i_unreached();
+}
+#endif
+
+static void fsync_group_sync(struct fsync_group *group)
+{
+	struct fsync_group_file *file;
+
+	if (array_count(&group->files) == 0)
+		return;
+
+	if (group->max_threads > 0 && array_count(&group->files) > 1)
+		fsync_group_sync_threads(group);
+	else
+		fsync_group_sync_sequential(group);
+
+	array_foreach_modifiable(&group->files, file) {
+		if (file->sync_errno != 0) {
+			fsync_group_set_error(group, file->sync_errno,
+				"fdatasync(%s) failed: %s",
+				file->path, strerror(file->sync_errno));
+		}
+		if (close(file->fd) < 0) {
+			fsync_group_set_error(group, errno,
+				"close(%s) failed: %m", file->path);
+		}
+		i_free(file->path);
+	}
+	array_clear(&group->files);
+}
+
+void fsync_group_add_fd(struct fsync_group *group, int fd, const char *path)
+{
+	struct fsync_group_file *file;
+
+	i_assert(fd != -1);
+
+	if (array_count(&group->files) >= FSYNC_GROUP_MAX_PENDING_FDS)
+		fsync_group_sync(group);
+
+	file = array_append_space(&group->files);
+	file->fd = fd;
+	file->path = i_strdup(path);
+}
+
+unsigned int fsync_group_pending_count(struct fsync_group *group)
+{
+	return array_count(&group->files);
+}
+
+int fsync_group_flush(struct fsync_group *group, const char **error_r)
+{
+	fsync_group_sync(group);
+	if (group->error == NULL)
+		return 0;
+
+	*error_r = t_strdup(group->error);
+	i_free(group->error);
+	errno = group->error_errno;
+	return -1;
+}
@@ -0,0 +1,27 @@
+#ifndef FSYNC_GROUP_H
+#define FSYNC_GROUP_H
+
+/* Collects files that need to be fdatasync()ed, so they can all be synced at
+   once later on. The fdatasync()s are done in parallel threads when
+   possible, so with network storage the latencies overlap instead of adding
+   up. */
+
+/* Sync the files using up to max_threads threads in addition to the calling
+   thread. With max_threads=0 the files are synced one by one. */
+struct fsync_group *fsync_group_init(unsigned int max_threads);
+/* Close the pending fds without syncing them. */
+void fsync_group_deinit(struct fsync_group **group);
+
+/* Add fd to be fdatasync()ed. The group takes the ownership of the fd and
+   closes it after it's synced. If there are too many pending fds, they are
+   synced immediately. The path is used only for error messages. */
+void fsync_group_add_fd(struct fsync_group *group, int fd, const char *path);
+/* Returns the number of fds waiting to be synced. */
+unsigned int fsync_group_pending_count(struct fsync_group *group);
+
+/* fdatasync() and close all the pending fds. Returns 0 if ok, -1 if syncing
+   or closing any of the files failed since the previous flush. In that case
+   errno is set to the first failure's errno. */
+int fsync_group_flush(struct fsync_group *group, const char **error_r);
+
+#endif
@@ -3,6 +3,7 @@
 /* @UNSAFE: whole file */
 
 #include "lib.h"
+#include "llist.h"
 #include "hash.h"
 #include "primes.h"
 
@@ -10,8 +11,19 @@
 
 #define HASH_TABLE_MIN_SIZE 67
 
+/* Open addressing tables have power of 2 sizes. Including the removed slots,
+   they're kept at most 3/4 full. */
+#define HASH_TABLE_OPEN_MIN_SIZE_BITS 4
+#define HASH_TABLE_OPEN_MAX_LOAD(size) ((size) / 2 + (size) / 4)
+/* Control bytes of full slots contain 7 bits of the hash. */
+#define HASH_CTRL_EMPTY 0xff
+#define HASH_CTRL_DELETED 0xfe
+#define HASH_CTRL_IS_FULL(c) ((c) < 0x80)
+
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_open
+#undef hash_table_create_direct_open
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -32,6 +44,11 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_slot {
+	void *key;
+	void *value;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
@@ -42,14 +59,33 @@ struct hash_table {
 	struct hash_node *nodes;
 	struct hash_node *free_nodes;
 
+	/* Open addressing with linear probing: ctrl[] has a control byte for
+	   each slot, so most of the probing doesn't need to access the slots
+	   at all. Removed slots are marked deleted (counted in
+	   removed_count), so existing slots never move while iterating. */
+	unsigned int size_bits;
+	struct hash_iterate_context *iterators;
+	uint8_t *ctrl;
+	struct hash_slot *slots;
+
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
+
+	bool open_addressing:1;
 };
 
 struct hash_iterate_context {
 	struct hash_table *table;
 	struct hash_node *next;
 	unsigned int pos;
+
+	/* Open addressing: If the table is resized while iterating, the
+	   iteration continues using the old slots. Nodes removed from the
+	   table are removed from the old slots as well. */
+	struct hash_iterate_context *prev_iter, *next_iter;
+	unsigned int old_size_bits;
+	uint8_t *old_ctrl;
+	struct hash_slot *old_slots;
 };
 
 enum hash_table_operation{
@@ -98,6 +134,278 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+static unsigned int hash_table_open_get_size_bits(unsigned int count)
+{
+	unsigned int bits = HASH_TABLE_OPEN_MIN_SIZE_BITS;
+
+	while (HASH_TABLE_OPEN_MAX_LOAD(1U << bits) <= count) {
+		bits++;
+		i_assert(bits < 32);
+	}
+	return bits;
+}
+
+static void
+hash_table_open_alloc(struct hash_table *table, unsigned int size_bits)
+{
+	table->size_bits = size_bits;
+	table->size = 1U << size_bits;
+	table->ctrl = i_malloc(table->size);
+	memset(table->ctrl, HASH_CTRL_EMPTY, table->size);
+	table->slots = i_new(struct hash_slot, table->size);
+	table->nodes_count = 0;
+	table->removed_count = 0;
+}
+
+void hash_table_create_open(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_table *table;
+	unsigned int size_bits;
+
+	pool_ref(node_pool);
+	table = i_new(struct hash_table, 1);
+	table->node_pool = node_pool;
+	table->open_addressing = TRUE;
+	table->hash_cb = hash_cb;
+	table->key_compare_cb = key_compare_cb;
+
+	size_bits = hash_table_open_get_size_bits(initial_size);
+	table->initial_size = 1U << size_bits;
+	hash_table_open_alloc(table, size_bits);
+	*table_r = table;
+}
+
+void hash_table_create_direct_open(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size)
+{
+	hash_table_create_open(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp);
+}
+
+static inline uint64_t
+hash_table_open_mix(const struct hash_table *table, const void *key)
+{
+	/* The hash callbacks can be weak (e.g. direct_hash() of aligned
+	   pointers), so mix the bits. The slot is taken from the highest
+	   bits and the control byte from the bits below them. */
+	return (uint64_t)table->hash_cb(key) * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline unsigned int
+hash_table_open_pos(unsigned int size_bits, uint64_t mixed)
+{
+	return mixed >> (64 - size_bits);
+}
+
+static inline uint8_t
+hash_table_open_ctrl(unsigned int size_bits, uint64_t mixed)
+{
+	return (mixed >> (64 - 7 - size_bits)) & 0x7f;
+}
+
+static struct hash_slot *
+hash_table_open_lookup_slot(const struct hash_table *table, const void *key)
+{
+	uint64_t mixed = hash_table_open_mix(table, key);
+	unsigned int mask = table->size - 1;
+	unsigned int pos = hash_table_open_pos(table->size_bits, mixed);
+	uint8_t c, ctrl = hash_table_open_ctrl(table->size_bits, mixed);
+
+	/* there's always at least one empty slot */
+	while ((c = table->ctrl[pos]) != HASH_CTRL_EMPTY) {
+		if (c == ctrl &&
+		    table->key_compare_cb(table->slots[pos].key, key) == 0)
+			return &table->slots[pos];
+		pos = (pos + 1) & mask;
+	}
+	return NULL;
+}
+
+static void
+hash_table_open_set(struct hash_table *table, unsigned int pos, uint8_t ctrl,
+		    void *key, void *value)
+{
+	if (table->ctrl[pos] == HASH_CTRL_DELETED)
+		table->removed_count--;
+	table->ctrl[pos] = ctrl;
+	table->slots[pos].key = key;
+	table->slots[pos].value = value;
+	table->nodes_count++;
+}
+
+static void
+hash_table_open_resize(struct hash_table *table, unsigned int size_bits)
+{
+	struct hash_slot *old_slots = table->slots;
+	uint8_t *old_ctrl = table->ctrl;
+	unsigned int i, pos, mask, old_size = table->size;
+	unsigned int old_size_bits = table->size_bits;
+	struct hash_iterate_context *iter;
+	bool old_taken = FALSE;
+	uint64_t mixed;
+
+	hash_table_open_alloc(table, size_bits);
+	mask = table->size - 1;
+	for (i = 0; i < old_size; i++) {
+		if (!HASH_CTRL_IS_FULL(old_ctrl[i]))
+			continue;
+		mixed = hash_table_open_mix(table, old_slots[i].key);
+		pos = hash_table_open_pos(table->size_bits, mixed);
+		while (table->ctrl[pos] != HASH_CTRL_EMPTY)
+			pos = (pos + 1) & mask;
+		hash_table_open_set(table, pos,
+				    hash_table_open_ctrl(table->size_bits, mixed),
+				    old_slots[i].key, old_slots[i].value);
+	}
+
+	/* Iterators that are still using the current slots continue with
+	   the old slots. Each of them needs its own copy. */
+	for (iter = table->iterators; iter != NULL; iter = iter->next_iter) {
+		if (iter->old_ctrl != NULL)
+			continue;
+		iter->old_size_bits = old_size_bits;
+		if (!old_taken) {
+			iter->old_ctrl = old_ctrl;
+			iter->old_slots = old_slots;
+			old_taken = TRUE;
+		} else {
+			iter->old_ctrl = i_memdup(old_ctrl, old_size);
+			iter->old_slots = i_memdup(old_slots,
+				sizeof(struct hash_slot) * old_size);
+		}
+	}
+	if (!old_taken) {
+		i_free(old_ctrl);
+		i_free(old_slots);
+	}
+}
+
+static void
+hash_table_open_iterators_remove(struct hash_table *table, void *key)
+{
+	struct hash_iterate_context *iter;
+	unsigned int pos, mask;
+	uint64_t mixed = hash_table_open_mix(table, key);
+
+	for (iter = table->iterators; iter != NULL; iter = iter->next_iter) {
+		if (iter->old_ctrl == NULL)
+			continue;
+		mask = (1U << iter->old_size_bits) - 1;
+		pos = hash_table_open_pos(iter->old_size_bits, mixed);
+		for (; iter->old_ctrl[pos] != HASH_CTRL_EMPTY;
+		     pos = (pos + 1) & mask) {
+			if (HASH_CTRL_IS_FULL(iter->old_ctrl[pos]) &&
+			    iter->old_slots[pos].key == key) {
+				iter->old_ctrl[pos] = HASH_CTRL_DELETED;
+				break;
+			}
+		}
+	}
+}
+
+/* Resize the table if it has too few empty or too many unused slots after
+   adding new_count more nodes. Returns TRUE if resized. */
+static bool
+hash_table_open_resize_if_needed(struct hash_table *table,
+				 unsigned int new_count)
+{
+	unsigned int size_bits;
+
+	if (table->nodes_count + table->removed_count + new_count >
+	    HASH_TABLE_OPEN_MAX_LOAD(table->size)) {
+		/* too full - either grow or get rid of the removed slots.
+		   Leave enough room so this isn't done again too soon. */
+		size_bits = hash_table_open_get_size_bits(
+			table->nodes_count + table->nodes_count / 2 + new_count);
+	} else if (table->nodes_count < table->size / 8 &&
+		   table->size > table->initial_size && table->frozen == 0) {
+		/* too empty - shrink, but leave room to grow */
+		size_bits = hash_table_open_get_size_bits(table->nodes_count * 2);
+		while ((1U << size_bits) < table->initial_size)
+			size_bits++;
+	} else {
+		return FALSE;
+	}
+	hash_table_open_resize(table, size_bits);
+	return TRUE;
+}
+
+static void
+hash_table_open_insert(struct hash_table *table, void *key, void *value,
+		       enum hash_table_operation opcode)
+{
+	uint64_t mixed = hash_table_open_mix(table, key);
+	unsigned int mask = table->size - 1;
+	unsigned int pos = hash_table_open_pos(table->size_bits, mixed);
+	unsigned int insert_pos = UINT_MAX;
+	uint8_t c, ctrl = hash_table_open_ctrl(table->size_bits, mixed);
+
+	i_assert(table->nodes_count < UINT_MAX);
+	i_assert(key != NULL);
+
+	while ((c = table->ctrl[pos]) != HASH_CTRL_EMPTY) {
+		if (c == HASH_CTRL_DELETED) {
+			if (insert_pos == UINT_MAX)
+				insert_pos = pos;
+		} else if (c == ctrl &&
+			   table->key_compare_cb(table->slots[pos].key,
+						 key) == 0) {
+			i_assert(opcode == HASH_TABLE_OP_UPDATE);
+			table->slots[pos].value = value;
+			return;
+		}
+		pos = (pos + 1) & mask;
+	}
+	if (insert_pos == UINT_MAX) {
+		/* using an empty slot */
+		if (hash_table_open_resize_if_needed(table, 1)) {
+			/* resized table, try again */
+			hash_table_open_insert(table, key, value,
+					       HASH_TABLE_OP_RESIZE);
+			return;
+		}
+		insert_pos = pos;
+	}
+	hash_table_open_set(table, insert_pos, ctrl, key, value);
+}
+
+static bool hash_table_open_try_remove(struct hash_table *table, const void *key)
+{
+	struct hash_slot *slot;
+	unsigned int pos, mask = table->size - 1;
+
+	slot = hash_table_open_lookup_slot(table, key);
+	if (unlikely(slot == NULL))
+		return FALSE;
+
+	pos = slot - table->slots;
+	if (table->iterators != NULL)
+		hash_table_open_iterators_remove(table, slot->key);
+	slot->key = NULL;
+	slot->value = NULL;
+	table->nodes_count--;
+	if (table->ctrl[(pos + 1) & mask] != HASH_CTRL_EMPTY) {
+		/* a probe sequence may continue past this slot */
+		table->ctrl[pos] = HASH_CTRL_DELETED;
+		table->removed_count++;
+	} else {
+		/* this is the end of the probe sequence. the preceding
+		   deleted slots can become empty as well. */
+		table->ctrl[pos] = HASH_CTRL_EMPTY;
+		for (pos = (pos - 1) & mask;
+		     table->ctrl[pos] == HASH_CTRL_DELETED;
+		     pos = (pos - 1) & mask) {
+			table->ctrl[pos] = HASH_CTRL_EMPTY;
+			table->removed_count--;
+		}
+	}
+	(void)hash_table_open_resize_if_needed(table, 0);
+	return TRUE;
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,7 +447,10 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (table->open_addressing) {
+		i_free(table->ctrl);
+		i_free(table->slots);
+	} else if (!table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
@@ -153,6 +464,14 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->open_addressing) {
+		memset(table->ctrl, HASH_CTRL_EMPTY, table->size);
+		memset(table->slots, 0, sizeof(struct hash_slot) * table->size);
+		table->nodes_count = 0;
+		table->removed_count = 0;
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +510,12 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->open_addressing) {
+		struct hash_slot *slot =
+			hash_table_open_lookup_slot(table, key);
+		return slot != NULL ? slot->value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +526,16 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->open_addressing) {
+		struct hash_slot *slot =
+			hash_table_open_lookup_slot(table, lookup_key);
+		if (slot == NULL)
+			return FALSE;
+		*orig_key = slot->key;
+		*value = slot->value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +632,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->open_addressing)
+		hash_table_open_insert(table, key, value, HASH_TABLE_OP_INSERT);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->open_addressing)
+		hash_table_open_insert(table, key, value, HASH_TABLE_OP_UPDATE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +688,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->open_addressing)
+		return hash_table_open_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -376,7 +720,10 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (table->open_addressing)
+		DLLIST_PREPEND_FULL(&table->iterators, ctx, prev_iter, next_iter);
+	else
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -401,8 +748,41 @@ hash_table_iterate_next(struct hash_iterate_context *ctx,
 bool hash_table_iterate(struct hash_iterate_context *ctx,
 			void **key_r, void **value_r)
 {
+	struct hash_table *table = ctx->table;
 	struct hash_node *node;
 
+	if (table->open_addressing && ctx->old_ctrl == NULL) {
+		/* slots don't move while iterating */
+		for (; ctx->pos < table->size; ctx->pos++) {
+			if (HASH_CTRL_IS_FULL(table->ctrl[ctx->pos])) {
+				*key_r = table->slots[ctx->pos].key;
+				*value_r = table->slots[ctx->pos].value;
+				ctx->pos++;
+				return TRUE;
+			}
+		}
+		*key_r = *value_r = NULL;
+		return FALSE;
+	}
+	if (table->open_addressing) {
+		/* table was resized - continue with the old slots, but
+		   return the current values */
+		for (; ctx->pos < (1U << ctx->old_size_bits); ctx->pos++) {
+			if (HASH_CTRL_IS_FULL(ctx->old_ctrl[ctx->pos])) {
+				struct hash_slot *slot =
+					hash_table_open_lookup_slot(table,
+						ctx->old_slots[ctx->pos].key);
+				i_assert(slot != NULL);
+				*key_r = slot->key;
+				*value_r = slot->value;
+				ctx->pos++;
+				return TRUE;
+			}
+		}
+		*key_r = *value_r = NULL;
+		return FALSE;
+	}
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -425,6 +805,12 @@ void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
 		return;
 
 	*_ctx = NULL;
+	if (ctx->table->open_addressing) {
+		DLLIST_REMOVE_FULL(&ctx->table->iterators, ctx,
+				   prev_iter, next_iter);
+		i_free(ctx->old_ctrl);
+		i_free(ctx->old_slots);
+	}
 	hash_table_thaw(ctx->table);
 	i_free(ctx);
 }
@@ -441,6 +827,10 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->open_addressing) {
+		(void)hash_table_open_resize_if_needed(table, 0);
+		return;
+	}
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
@@ -14,16 +14,7 @@ typedef unsigned int hash_callback_t(const void *p);
 /* Returns 0 if the pointers are equal. */
 typedef int hash_cmp_callback_t(const void *p1, const void *p2);
 
-/* Create a new hash table. If initial_size is 0, the default value is used.
-   table_pool is used to allocate/free large hash tables, node_pool is used
-   for smaller allocations and can also be alloconly pool. The pools must not
-   be free'd before hash_table_destroy() is called. */
-void hash_table_create(struct hash_table **table_r, pool_t node_pool,
-		       unsigned int initial_size,
-		       hash_callback_t *hash_cb,
-		       hash_cmp_callback_t *key_compare_cb);
-#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
-	TYPE_CHECKS(void, \
+#define HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb) \
 	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
 	COMPILE_ERROR_IF_TRUE( \
 		sizeof((*table)._key) != sizeof(void *) || \
@@ -37,8 +28,26 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
 			unsigned int (*)(typeof((*table)._key))) && \
 		!__builtin_types_compatible_p(typeof(&hash_cb), \
-		unsigned int (*)(typeof((*table)._const_key)))), \
-	/* NOLINTEND(bugprone-sizeof-expression) */ \
+		unsigned int (*)(typeof((*table)._const_key)))) \
+	/* NOLINTEND(bugprone-sizeof-expression) */
+#define HASH_TABLE_CREATE_DIRECT_TYPE_CHECKS(table) \
+	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
+	COMPILE_ERROR_IF_TRUE( \
+		sizeof((*table)._key) != sizeof(void *) || \
+		sizeof((*table)._value) != sizeof(void *)) \
+	/* NOLINTEND(bugprone-sizeof-expression) */
+
+/* Create a new hash table. If initial_size is 0, the default value is used.
+   table_pool is used to allocate/free large hash tables, node_pool is used
+   for smaller allocations and can also be alloconly pool. The pools must not
+   be free'd before hash_table_destroy() is called. */
+void hash_table_create(struct hash_table **table_r, pool_t node_pool,
+		       unsigned int initial_size,
+		       hash_callback_t *hash_cb,
+		       hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
 	hash_table_create(&(*table)._table, pool, size, \
 		(hash_callback_t *)hash_cb, \
 		(hash_cmp_callback_t *)key_cmp_cb))
@@ -48,13 +57,31 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			      unsigned int initial_size);
 #define hash_table_create_direct(table, pool, size) \
 	TYPE_CHECKS(void, \
-	/* NOLINTBEGIN(bugprone-sizeof-expression) */ \
-	COMPILE_ERROR_IF_TRUE( \
-		sizeof((*table)._key) != sizeof(void *) || \
-		sizeof((*table)._value) != sizeof(void *)), \
-	/* NOLINTEND(bugprone-sizeof-expression) */ \
+	HASH_TABLE_CREATE_DIRECT_TYPE_CHECKS(table), \
 	hash_table_create_direct(&(*table)._table, pool, size))
 
+/* Same as hash_table_create(), but the table uses open addressing instead of
+   collision lists. Lookups don't need to follow node pointers, which makes
+   this faster for large and frequently accessed tables. node_pool isn't used
+   for allocations. Nodes can be added and removed while iterating, but
+   hash_table_freeze() should still be used to avoid unnecessary shrinking. */
+void hash_table_create_open(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb);
+#define hash_table_create_open(table, pool, size, hash_cb, key_cmp_cb) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_TYPE_CHECKS(table, hash_cb, key_cmp_cb), \
+	hash_table_create_open(&(*table)._table, pool, size, \
+		(hash_callback_t *)hash_cb, \
+		(hash_cmp_callback_t *)key_cmp_cb))
+void hash_table_create_direct_open(struct hash_table **table_r,
+				   pool_t node_pool, unsigned int initial_size);
+#define hash_table_create_direct_open(table, pool, size) \
+	TYPE_CHECKS(void, \
+	HASH_TABLE_CREATE_DIRECT_TYPE_CHECKS(table), \
+	hash_table_create_direct_open(&(*table)._table, pool, size))
+
 #define hash_table_is_created(table) \
 	((table)._table != NULL)
 
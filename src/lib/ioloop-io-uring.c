@@ -0,0 +1,665 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* Linux io_uring based ioloop handler.
+
+   Changes done by io_add() and io_remove() are only queued to the
+   submission ring, and everything is submitted in the same io_uring_enter()
+   call that waits for the next events. So unlike with epoll, adding and
+   removing IOs doesn't cost a syscall each time. If an IO is removed and
+   added back before the ioloop runs again, nothing is submitted at all.
+
+   Multishot polls would be edge-triggered: a callback that leaves some of
+   the input unread wouldn't be called again until more data arrives. IO
+   callbacks expect level-triggered behaviour, so single-shot polls are
+   used instead. The poll is armed again after each completion, which
+   checks the fd's state immediately.
+
+   The poll request holds a reference to the file, so closing the fd
+   doesn't remove it. When the last IO of an fd is removed, the poll is
+   always cancelled and a new poll with a new generation is armed if the fd
+   is added back. The generation is stored in the request's user_data, which
+   allows ignoring completions from requests that are already cancelled.
+
+   If the kernel doesn't support (or doesn't allow) io_uring, the epoll
+   handler is used instead. */
+
+#define IO_URING_RING_ENTRIES 256
+
+/* user_data for requests whose completion isn't interesting */
+#define IO_URING_USER_DATA_IGNORE 0
+
+#define IO_URING_USER_DATA(fd, gen) \
+	(((uint64_t)(gen) << 32) | (uint32_t)(fd))
+#define IO_URING_USER_DATA_FD(user_data) \
+	((int)(uint32_t)(user_data))
+#define IO_URING_USER_DATA_GEN(user_data) \
+	((uint32_t)((user_data) >> 32))
+
+#define IO_URING_POLL_ERROR (POLLERR | POLLHUP)
+#define IO_URING_POLL_INPUT (POLLIN | POLLPRI | IO_URING_POLL_ERROR)
+#define IO_URING_POLL_OUTPUT (POLLOUT | IO_URING_POLL_ERROR)
+
+/* v5.11+ */
+#define IO_URING_REQUIRED_FEATURES \
+	(IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+struct io_uring_fd {
+	struct io_list list;
+
+	/* Generation of the currently armed poll request, 0 if none */
+	uint32_t armed_gen;
+	/* Poll events of the currently armed request */
+	uint32_t armed_events;
+	/* fd is in dirty_fds */
+	bool dirty;
+};
+
+ARRAY_DEFINE_TYPE(io_uring_cqe, struct io_uring_cqe);
+
+struct ioloop_handler_context {
+	int ring_fd;
+	/* Index of the ring fd registered with IORING_REGISTER_RING_FDS,
+	   or -1 if it couldn't be registered. */
+	int ring_fd_index;
+	unsigned int features;
+
+	void *ring_ptr;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+	unsigned int sq_tail_local;
+
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	uint32_t last_gen;
+	unsigned int armed_count;
+
+	ARRAY(struct io_uring_fd *) fd_index;
+	/* fds whose poll request may need to be changed before waiting */
+	ARRAY(int) dirty_fds;
+	ARRAY_TYPE(io_uring_cqe) events;
+	/* Completions reaped by io_uring_submit() to make room in the
+	   completion ring. They're handled by the next ioloop run. */
+	ARRAY_TYPE(io_uring_cqe) backlog;
+};
+
+static bool io_uring_unavailable = FALSE;
+static bool io_uring_fallback_forced = FALSE;
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, argsz);
+}
+
+#ifdef IORING_REGISTER_RING_FDS
+static int
+sys_io_uring_register(int fd, unsigned int opcode, const void *arg,
+		      unsigned int nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+#endif
+
+static void io_uring_ring_unmap(struct ioloop_handler_context *ctx)
+{
+	if (ctx->sqes != NULL) {
+		if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+			i_error("munmap(io_uring sqes) failed: %m");
+	}
+	if (ctx->ring_ptr != NULL) {
+		if (munmap(ctx->ring_ptr, ctx->ring_size) < 0)
+			i_error("munmap(io_uring ring) failed: %m");
+	}
+}
+
+static int io_uring_ring_init(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_params params;
+	size_t sq_size, cq_size;
+	unsigned char *ptr;
+
+	i_zero(&params);
+	params.flags = IORING_SETUP_CLAMP;
+#ifdef IORING_SETUP_COOP_TASKRUN
+	/* all completions are reaped in io_uring_enter(), so there's no
+	   need to interrupt the process when they arrive */
+	params.flags |= IORING_SETUP_COOP_TASKRUN;
+#endif
+	ctx->ring_fd = sys_io_uring_setup(IO_URING_RING_ENTRIES, &params);
+#ifdef IORING_SETUP_COOP_TASKRUN
+	if (ctx->ring_fd < 0 && errno == EINVAL) {
+		/* kernel older than v5.19 */
+		params.flags &= ~IORING_SETUP_COOP_TASKRUN;
+		ctx->ring_fd = sys_io_uring_setup(IO_URING_RING_ENTRIES,
+						  &params);
+	}
+#endif
+	if (ctx->ring_fd < 0) {
+		if (errno != ENOSYS && errno != EPERM && errno != EACCES &&
+		    errno != EINVAL)
+			i_fatal("io_uring_setup() failed: %m");
+		/* not supported by kernel, disabled by sysctl or blocked
+		   by seccomp */
+		return -1;
+	}
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+	if ((params.features & IO_URING_REQUIRED_FEATURES) !=
+	    IO_URING_REQUIRED_FEATURES)
+		return -1;
+	ctx->features = params.features;
+
+	sq_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	cq_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	ctx->ring_size = I_MAX(sq_size, cq_size);
+	ptr = mmap(NULL, ctx->ring_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+		   IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED) {
+		ctx->ring_ptr = NULL;
+		i_fatal("mmap(io_uring ring) failed: %m");
+	}
+	ctx->ring_ptr = ptr;
+
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ctx->ring_fd,
+			 IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED) {
+		ctx->sqes = NULL;
+		i_fatal("mmap(io_uring sqes) failed: %m");
+	}
+
+	ctx->sq_head = (void *)(ptr + params.sq_off.head);
+	ctx->sq_tail = (void *)(ptr + params.sq_off.tail);
+	ctx->sq_mask = (void *)(ptr + params.sq_off.ring_mask);
+	ctx->sq_entries = (void *)(ptr + params.sq_off.ring_entries);
+	ctx->sq_array = (void *)(ptr + params.sq_off.array);
+	ctx->sq_tail_local = *ctx->sq_tail;
+
+	ctx->cq_head = (void *)(ptr + params.cq_off.head);
+	ctx->cq_tail = (void *)(ptr + params.cq_off.tail);
+	ctx->cq_mask = (void *)(ptr + params.cq_off.ring_mask);
+	ctx->cqes = (void *)(ptr + params.cq_off.cqes);
+
+	ctx->ring_fd_index = -1;
+#ifdef IORING_REGISTER_RING_FDS
+	/* v5.18+: avoid looking up the ring fd on every io_uring_enter() */
+	struct io_uring_rsrc_update reg = {
+		.offset = UINT_MAX,
+		.data = ctx->ring_fd,
+	};
+	if (sys_io_uring_register(ctx->ring_fd, IORING_REGISTER_RING_FDS,
+				  &reg, 1) == 1)
+		ctx->ring_fd_index = reg.offset;
+#endif
+	return 0;
+}
+
+static int
+io_uring_enter(struct ioloop_handler_context *ctx, unsigned int to_submit,
+	       unsigned int min_complete, unsigned int flags,
+	       const void *arg, size_t argsz)
+{
+	int fd = ctx->ring_fd;
+
+#ifdef IORING_REGISTER_RING_FDS
+	if (ctx->ring_fd_index != -1) {
+		fd = ctx->ring_fd_index;
+		flags |= IORING_ENTER_REGISTERED_RING;
+	}
+#endif
+	return sys_io_uring_enter(fd, to_submit, min_complete, flags,
+				  arg, argsz);
+}
+
+static unsigned int io_uring_sq_pending(struct ioloop_handler_context *ctx)
+{
+	return ctx->sq_tail_local - __atomic_load_n(ctx->sq_head,
+						    __ATOMIC_ACQUIRE);
+}
+
+static unsigned int
+io_uring_cq_drain(struct ioloop_handler_context *ctx,
+		  ARRAY_TYPE(io_uring_cqe) *dest)
+{
+	unsigned int head, tail, count;
+
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	count = tail - head;
+	for (; head != tail; head++)
+		array_push_back(dest, &ctx->cqes[head & *ctx->cq_mask]);
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+static void io_uring_submit(struct ioloop_handler_context *ctx)
+{
+	unsigned int pending;
+
+	while ((pending = io_uring_sq_pending(ctx)) > 0) {
+		if (io_uring_enter(ctx, pending, 0, 0, NULL, 0) >= 0 ||
+		    errno == EINTR || errno == EAGAIN)
+			break;
+		/* EBUSY: The completion ring is full and the kernel has
+		   more completions waiting (kernels older than v5.19). It
+		   can happen under load when the ring is flushed between
+		   ioloop runs. Move the completions aside to make room and
+		   try again. */
+		if (errno != EBUSY ||
+		    io_uring_cq_drain(ctx, &ctx->backlog) == 0)
+			i_fatal("io_uring_enter(submit) failed: %m");
+	}
+}
+
+static struct io_uring_sqe *io_uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	while (io_uring_sq_pending(ctx) >= *ctx->sq_entries) {
+		/* submission ring is full - flush it */
+		io_uring_submit(ctx);
+	}
+
+	idx = ctx->sq_tail_local & *ctx->sq_mask;
+	sqe = &ctx->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ctx->sq_array[idx] = idx;
+	ctx->sq_tail_local++;
+	__atomic_store_n(ctx->sq_tail, ctx->sq_tail_local, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+static uint32_t io_uring_poll_mask(struct io_list *list)
+{
+	uint32_t events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_POLL_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_POLL_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_POLL_ERROR;
+	}
+	return events;
+}
+
+static void
+io_uring_poll_arm(struct ioloop_handler_context *ctx, int fd,
+		  struct io_uring_fd *state, uint32_t events)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t poll_events = events;
+
+	i_assert(state->armed_gen == 0);
+
+	if (++ctx->last_gen == 0)
+		ctx->last_gen++;
+	state->armed_gen = ctx->last_gen;
+	state->armed_events = events;
+	ctx->armed_count++;
+
+#ifdef WORDS_BIGENDIAN
+	poll_events = (poll_events << 16) | (poll_events >> 16);
+#endif
+	sqe = io_uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = poll_events;
+	sqe->user_data = IO_URING_USER_DATA(fd, state->armed_gen);
+}
+
+static void
+io_uring_poll_cancel(struct ioloop_handler_context *ctx, int fd,
+		     struct io_uring_fd *state)
+{
+	struct io_uring_sqe *sqe;
+
+	i_assert(state->armed_gen != 0);
+
+	sqe = io_uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = IO_URING_USER_DATA(fd, state->armed_gen);
+	sqe->user_data = IO_URING_USER_DATA_IGNORE;
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+	if ((ctx->features & IORING_FEAT_CQE_SKIP) != 0)
+		sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+#endif
+	/* any further completions for this generation are ignored */
+	state->armed_gen = 0;
+	state->armed_events = 0;
+	i_assert(ctx->armed_count > 0);
+	ctx->armed_count--;
+}
+
+static void
+io_uring_fd_set_dirty(struct ioloop_handler_context *ctx, int fd,
+		      struct io_uring_fd *state)
+{
+	if (!state->dirty) {
+		state->dirty = TRUE;
+		array_push_back(&ctx->dirty_fds, &fd);
+	}
+}
+
+static void io_uring_flush_dirty(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_fd *state;
+	const int *fds;
+	unsigned int i, count;
+	uint32_t events;
+	int fd;
+
+	/* Only the final state of the fd matters. If an IO was removed and
+	   added back during the same ioloop run, nothing is submitted.
+
+	   Polls on already-ready fds complete in submission order. Submit
+	   the most recently changed fds first, so the callbacks are called
+	   in the same order as with the poll handler (newest IO first). */
+	fds = array_get(&ctx->dirty_fds, &count);
+	for (i = count; i > 0; i--) {
+		fd = fds[i-1];
+		state = array_idx_elem(&ctx->fd_index, fd);
+		state->dirty = FALSE;
+
+		events = io_uring_poll_mask(&state->list);
+		if (state->armed_gen != 0 && state->armed_events == events)
+			continue;
+		if (state->armed_gen != 0)
+			io_uring_poll_cancel(ctx, fd, state);
+		if (events != 0)
+			io_uring_poll_arm(ctx, fd, state, events);
+	}
+	array_clear(&ctx->dirty_fds);
+}
+
+static void
+io_loop_io_uring_handler_init(struct ioloop *ioloop,
+			      struct ioloop_handler_context *ctx,
+			      unsigned int initial_fd_count)
+{
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->dirty_fds, initial_fd_count);
+	i_array_init(&ctx->events, IO_URING_RING_ENTRIES * 2);
+	i_array_init(&ctx->backlog, 8);
+	ioloop->handler_context = ctx;
+}
+
+static void io_loop_io_uring_handler_free(struct ioloop_handler_context *ctx)
+{
+	io_uring_ring_unmap(ctx);
+	if (ctx->ring_fd != -1) {
+		if (close(ctx->ring_fd) < 0)
+			i_error("close(io_uring) failed: %m");
+	}
+	i_free(ctx);
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+
+	ioloop->handler_epoll_fallback = FALSE;
+	if (!io_uring_unavailable && !io_uring_fallback_forced &&
+	    getenv("IOLOOP_DISABLE_IO_URING") == NULL) {
+		ctx = i_new(struct ioloop_handler_context, 1);
+		if (io_uring_ring_init(ctx) == 0) {
+			io_loop_io_uring_handler_init(ioloop, ctx,
+						      initial_fd_count);
+			return;
+		}
+		io_loop_io_uring_handler_free(ctx);
+		/* don't bother trying again in this process */
+		io_uring_unavailable = TRUE;
+	}
+	ioloop->handler_epoll_fallback = TRUE;
+	io_loop_epoll_handler_init(ioloop, initial_fd_count);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_fd *state;
+
+	if (ioloop->handler_epoll_fallback) {
+		io_loop_epoll_handler_deinit(ioloop);
+		return;
+	}
+
+	/* closing the ring cancels all the pending requests */
+	array_foreach_elem(&ctx->fd_index, state)
+		i_free(state);
+	array_free(&ctx->fd_index);
+	array_free(&ctx->dirty_fds);
+	array_free(&ctx->events);
+	array_free(&ctx->backlog);
+	io_loop_io_uring_handler_free(ctx);
+	ioloop->handler_context = NULL;
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd **state;
+
+	if (io->io.ioloop->handler_epoll_fallback) {
+		io_loop_epoll_handle_add(io);
+		return;
+	}
+
+	state = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*state == NULL)
+		*state = i_new(struct io_uring_fd, 1);
+
+	(void)ioloop_iolist_add(&(*state)->list, io);
+	io_uring_fd_set_dirty(ctx, io->fd, *state);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd *state;
+
+	if (io->io.ioloop->handler_epoll_fallback) {
+		io_loop_epoll_handle_remove(io, closed);
+		return;
+	}
+
+	state = array_idx_elem(&ctx->fd_index, io->fd);
+	if (ioloop_iolist_del(&state->list, io)) {
+		/* The poll request keeps the file open even after the fd is
+		   closed. Cancel it now, since the fd number may be reused
+		   before the ioloop runs again. */
+		if (state->armed_gen != 0)
+			io_uring_poll_cancel(ctx, io->fd, state);
+	} else {
+		io_uring_fd_set_dirty(ctx, io->fd, state);
+	}
+	i_free(io);
+}
+
+static int
+io_uring_wait(struct ioloop_handler_context *ctx, int msecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	i_zero(&arg);
+	if (msecs >= 0) {
+		ts.tv_sec = msecs / 1000;
+		ts.tv_nsec = (long long)(msecs % 1000) * 1000000;
+		arg.ts = (uintptr_t)&ts;
+	}
+	return io_uring_enter(ctx, io_uring_sq_pending(ctx), 1,
+			      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			      &arg, sizeof(arg));
+}
+
+static unsigned int io_uring_reap(struct ioloop_handler_context *ctx)
+{
+	array_clear(&ctx->events);
+	/* the backlogged completions are older than the ones in the ring */
+	array_append_array(&ctx->events, &ctx->backlog);
+	array_clear(&ctx->backlog);
+	(void)io_uring_cq_drain(ctx, &ctx->events);
+	return array_count(&ctx->events);
+}
+
+static bool
+io_uring_cqe_consume(struct ioloop_handler_context *ctx,
+		     const struct io_uring_cqe *cqe)
+{
+	struct io_uring_fd *state;
+	uint32_t gen;
+	int fd;
+
+	if (cqe->user_data == IO_URING_USER_DATA_IGNORE)
+		return FALSE;
+
+	fd = IO_URING_USER_DATA_FD(cqe->user_data);
+	gen = IO_URING_USER_DATA_GEN(cqe->user_data);
+	if ((unsigned int)fd >= array_count(&ctx->fd_index))
+		return FALSE;
+	state = array_idx_elem(&ctx->fd_index, fd);
+	if (state == NULL || state->armed_gen != gen) {
+		/* completion from an already cancelled request */
+		return FALSE;
+	}
+
+	/* the poll is done - arm it again before waiting for more events */
+	state->armed_gen = 0;
+	state->armed_events = 0;
+	i_assert(ctx->armed_count > 0);
+	ctx->armed_count--;
+	io_uring_fd_set_dirty(ctx, fd, state);
+
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+		i_panic("io_uring poll(%d) failed: %m", fd);
+	}
+	return TRUE;
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_cqe *cqe;
+	struct io_uring_fd *state;
+	struct io_file *io;
+	struct timeval tv;
+	unsigned int i, events_count;
+	int msecs, ret, fd, j;
+	bool call;
+
+	if (ioloop->handler_epoll_fallback) {
+		io_loop_epoll_handler_run_internal(ioloop);
+		return;
+	}
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	io_uring_flush_dirty(ctx);
+	if (ioloop->io_files != NULL && ctx->armed_count > 0) {
+		ret = io_uring_wait(ctx, msecs);
+		if (ret < 0 && errno != EINTR && errno != ETIME &&
+		    errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(): %m");
+	} else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		io_uring_submit(ctx);
+		i_sleep_intr_msecs(msecs);
+	}
+	events_count = io_uring_reap(ctx);
+
+	/* The reaped poll requests are finished. Mark all of them to be
+	   re-armed before calling any timeout or io callbacks, since those
+	   may stop the ioloop before all the events have been handled. */
+	for (i = 0; i < events_count; i++) {
+		cqe = array_idx_modifiable(&ctx->events, i);
+		if (!io_uring_cqe_consume(ctx, cqe))
+			cqe->user_data = IO_URING_USER_DATA_IGNORE;
+	}
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	if (!ioloop->running)
+		return;
+
+	for (i = 0; i < events_count; i++) {
+		cqe = array_idx_modifiable(&ctx->events, i);
+		if (cqe->user_data == IO_URING_USER_DATA_IGNORE)
+			continue;
+		fd = IO_URING_USER_DATA_FD(cqe->user_data);
+		state = array_idx_elem(&ctx->fd_index, fd);
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = state->list.ios[j];
+			if (io == NULL)
+				continue;
+
+			call = FALSE;
+			if ((cqe->res & (POLLHUP | POLLERR)) != 0)
+				call = TRUE;
+			else if ((io->io.condition & IO_READ) != 0)
+				call = (cqe->res & (POLLIN | POLLPRI)) != 0;
+			else if ((io->io.condition & IO_WRITE) != 0)
+				call = (cqe->res & POLLOUT) != 0;
+			else if ((io->io.condition & IO_ERROR) != 0)
+				call = (cqe->res & IO_URING_POLL_ERROR) != 0;
+
+			if (call) {
+				io_loop_call_io(&io->io);
+				if (!ioloop->running)
+					return;
+			}
+		}
+	}
+}
+
+void io_loop_handler_set_epoll_fallback(bool fallback)
+{
+	io_uring_fallback_forced = fallback;
+}
+
+#endif	/* IOLOOP_IO_URING */
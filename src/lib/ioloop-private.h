@@ -34,6 +34,9 @@ struct ioloop {
 	bool running:1;
 	bool iolooping:1;
 	bool stop_after_run_loop:1;
+	/* io_uring isn't available - handler_context belongs to the epoll
+	   handler. */
+	bool handler_epoll_fallback:1;
 };
 
 struct io {
@@ -121,6 +124,22 @@ void io_loop_handle_remove(struct io_file *io, bool closed);
 void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count);
 void io_loop_handler_deinit(struct ioloop *ioloop);
 
+#ifdef IOLOOP_IO_URING
+/* epoll handler, which io_uring handler falls back to if the kernel doesn't
+   allow using io_uring. */
+void io_loop_epoll_handler_run_internal(struct ioloop *ioloop);
+void io_loop_epoll_handle_add(struct io_file *io);
+void io_loop_epoll_handle_remove(struct io_file *io, bool closed);
+void io_loop_epoll_handler_init(struct ioloop *ioloop,
+				unsigned int initial_fd_count);
+void io_loop_epoll_handler_deinit(struct ioloop *ioloop);
+
+/* Use the epoll handler for ioloops created after this call. This is mainly
+   for unit tests. Setting IOLOOP_DISABLE_IO_URING environment does the same
+   for the whole process. */
+void io_loop_handler_set_epoll_fallback(bool fallback);
+#endif
+
 void io_loop_notify_remove(struct io *io);
 void io_loop_notify_handler_deinit(struct ioloop *ioloop);
 
@@ -866,6 +866,26 @@ struct ioloop *io_loop_create(void)
         return ioloop;
 }
 
+#ifndef IOLOOP_KQUEUE
+void io_loop_recreate(struct ioloop *ioloop)
+{
+	struct io_file *io;
+
+	if (ioloop == NULL || ioloop->handler_context == NULL)
+		return;
+
+	/* This only closes our references to the handler's kernel state,
+	   so the parent process isn't affected. */
+	io_loop_handler_deinit(ioloop);
+	ioloop->handler_context = NULL;
+	io_loop_initialize_handler(ioloop);
+	for (io = ioloop->io_files; io != NULL; io = io->next) {
+		if (io->fd != -1)
+			io_loop_handle_add(io);
+	}
+}
+#endif
+
 void io_loop_destroy(struct ioloop **_ioloop)
 {
 	struct ioloop *ioloop = *_ioloop;
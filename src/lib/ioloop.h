@@ -322,10 +322,10 @@ uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
 
-#ifdef IOLOOP_KQUEUE
+/* Recreate the ioloop's kernel handler (epoll, io_uring, kqueue) and add the
+   existing IOs to it. A forked child process must call this before using an
+   ioloop created by the parent, because an inherited epoll or io_uring
+   instance is shared with the parent process. */
 void io_loop_recreate(struct ioloop *ioloop);
-#else
-#  define io_loop_recreate(x)
-#endif
 
 #endif
@@ -78,6 +78,17 @@ iostream_proxy_create(struct istream *left_input, struct ostream *left_output,
 	return proxy;
 }
 
+bool iostream_proxy_set_splice(struct iostream_proxy *proxy)
+{
+	bool ltr, rtl;
+
+	i_assert(proxy != NULL);
+
+	ltr = iostream_pump_set_splice(proxy->ltr);
+	rtl = iostream_pump_set_splice(proxy->rtl);
+	return ltr && rtl;
+}
+
 void iostream_proxy_start(struct iostream_proxy *proxy)
 {
 	i_assert(proxy != NULL);
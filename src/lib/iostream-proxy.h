@@ -64,6 +64,14 @@ iostream_proxy_create(struct istream *left_input, struct ostream *left_output,
 struct istream *iostream_proxy_get_istream(struct iostream_proxy *proxy, enum iostream_proxy_side);
 struct ostream *iostream_proxy_get_ostream(struct iostream_proxy *proxy, enum iostream_proxy_side);
 
+/* Use splice() to move the data between the fds in both directions. Each
+   direction is spliced only when its streams give direct access to the fds,
+   i.e. there are no SSL (without kernel TLS), rawlog, multiplexing or other
+   such streams in between. Returns TRUE if splicing is used in both
+   directions. A direction that can't be spliced keeps using the regular
+   copying. See iostream_pump_set_splice(). */
+bool iostream_proxy_set_splice(struct iostream_proxy *proxy);
+
 void iostream_proxy_start(struct iostream_proxy *proxy);
 void iostream_proxy_stop(struct iostream_proxy *proxy);
 
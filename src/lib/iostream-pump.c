@@ -1,15 +1,28 @@
 /* Copyright (c) Dovecot authors, see top-level COPYING file */
 
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "buffer.h"
 #include "str.h"
 #include "iostream-pump.h"
-#include "istream.h"
-#include "ostream.h"
+#include "istream-private.h"
+#include "ostream-private.h"
 #include <unistd.h>
+#include <fcntl.h>
 
 #undef iostream_pump_set_completion_callback
 
+/* How much to try to splice() at once. This is the default pipe size in
+   Linux. */
+#define IOSTREAM_PUMP_SPLICE_SIZE (64*1024)
+/* Return to ioloop after this many bytes have been spliced, so a single
+   fast connection can't starve the others. */
+#define IOSTREAM_PUMP_SPLICE_MAX_BYTES (IOSTREAM_PUMP_SPLICE_SIZE*16)
+
 struct iostream_pump {
 	int refcount;
 
@@ -21,23 +34,124 @@ struct iostream_pump {
 	iostream_pump_callback_t *callback;
 	void *context;
 
+	/* splice() pipe, -1 if splicing isn't used. */
+	int splice_pipe[2];
+	/* Number of bytes in splice_pipe that haven't been written yet */
+	size_t splice_pipe_used;
+
 	bool waiting_output;
 	bool completed;
 };
 
+#ifdef HAVE_SPLICE
+static bool
+iostream_pump_splice(struct iostream_pump *pump,
+		     enum ostream_send_istream_result *res_r)
+{
+	struct istream *input = pump->input;
+	struct ostream *output = pump->output;
+	size_t total = 0;
+	ssize_t ret;
+
+	if (pump->splice_pipe[0] == -1)
+		return FALSE;
+	if (pump->splice_pipe_used == 0 &&
+	    i_stream_get_data_size(input) > 0) {
+		/* send the already buffered input via the ostream first */
+		return FALSE;
+	}
+
+	/* flush out any data in buffer */
+	if ((ret = o_stream_flush(output)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+
+	for (;;) {
+		if (pump->splice_pipe_used == 0) {
+			if (total >= IOSTREAM_PUMP_SPLICE_MAX_BYTES) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			ret = splice(i_stream_get_fd(input), NULL,
+				     pump->splice_pipe[1], NULL,
+				     IOSTREAM_PUMP_SPLICE_SIZE,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret == 0) {
+				input->eof = TRUE;
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+				return TRUE;
+			}
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN) {
+					*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+					return TRUE;
+				}
+				input->stream_errno = errno;
+				io_stream_set_error(&input->real_stream->iostream,
+						    "splice() failed: %m");
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+				return TRUE;
+			}
+			pump->splice_pipe_used = ret;
+		}
+
+		ret = splice(pump->splice_pipe[0], NULL,
+			     o_stream_get_fd(output), NULL,
+			     pump->splice_pipe_used,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				/* the ostream buffer is empty, so ask it to
+				   call the flush callback once the fd is
+				   writable again. */
+				o_stream_set_flush_pending(output, TRUE);
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+				return TRUE;
+			}
+			output->stream_errno = errno;
+			io_stream_set_error(&output->real_stream->iostream,
+					    "splice() failed: %m");
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+		i_assert((size_t)ret <= pump->splice_pipe_used);
+		pump->splice_pipe_used -= ret;
+		output->offset += ret;
+		total += ret;
+	}
+}
+#else
+static bool
+iostream_pump_splice(struct iostream_pump *pump ATTR_UNUSED,
+		     enum ostream_send_istream_result *res_r ATTR_UNUSED)
+{
+	return FALSE;
+}
+#endif
+
 static void iostream_pump_copy(struct iostream_pump *pump)
 {
 	enum ostream_send_istream_result res;
 	size_t old_size;
 
-	o_stream_cork(pump->output);
-	old_size = o_stream_get_max_buffer_size(pump->output);
-	o_stream_set_max_buffer_size(pump->output,
-		I_MIN(IO_BLOCK_SIZE,
-		      o_stream_get_max_buffer_size(pump->output)));
-	res = o_stream_send_istream(pump->output, pump->input);
-	o_stream_set_max_buffer_size(pump->output, old_size);
-	o_stream_uncork(pump->output);
+	if (!iostream_pump_splice(pump, &res)) {
+		o_stream_cork(pump->output);
+		old_size = o_stream_get_max_buffer_size(pump->output);
+		o_stream_set_max_buffer_size(pump->output,
+			I_MIN(IO_BLOCK_SIZE,
+			      o_stream_get_max_buffer_size(pump->output)));
+		res = o_stream_send_istream(pump->output, pump->input);
+		o_stream_set_max_buffer_size(pump->output, old_size);
+		o_stream_uncork(pump->output);
+	}
 
 	switch(res) {
 	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
@@ -127,10 +241,41 @@ iostream_pump_create(struct istream *input, struct ostream *output)
 	pump->refcount = 1;
 	pump->input = input;
 	pump->output = output;
+	pump->splice_pipe[0] = pump->splice_pipe[1] = -1;
 
 	return pump;
 }
 
+bool iostream_pump_set_splice(struct iostream_pump *pump)
+{
+	i_assert(pump->io == NULL);
+
+	if (pump->splice_pipe[0] != -1)
+		return TRUE;
+	/* The data is moved directly between the fds, so there can't be any
+	   parent streams that need to see it. */
+	if (pump->input->blocking || pump->output->blocking ||
+	    !pump->input->readable_fd || !pump->output->writable_fd ||
+	    pump->input->real_stream->parent != NULL ||
+	    o_stream_get_fd(pump->output) == -1)
+		return FALSE;
+
+#ifndef HAVE_SPLICE
+	return FALSE;
+#else
+	if (pipe(pump->splice_pipe) < 0) {
+		i_error("pipe() failed: %m");
+		pump->splice_pipe[0] = pump->splice_pipe[1] = -1;
+		return FALSE;
+	}
+	fd_close_on_exec(pump->splice_pipe[0], TRUE);
+	fd_close_on_exec(pump->splice_pipe[1], TRUE);
+	fd_set_nonblock(pump->splice_pipe[0], TRUE);
+	fd_set_nonblock(pump->splice_pipe[1], TRUE);
+	return TRUE;
+#endif
+}
+
 void iostream_pump_start(struct iostream_pump *pump)
 {
 	i_assert(pump != NULL);
@@ -200,6 +345,8 @@ void iostream_pump_unref(struct iostream_pump **_pump)
 
 	o_stream_unref(&pump->output);
 	i_stream_unref(&pump->input);
+	i_close_fd(&pump->splice_pipe[0]);
+	i_close_fd(&pump->splice_pipe[1]);
 	i_free(pump);
 }
 
@@ -220,10 +367,40 @@ void iostream_pump_destroy(struct iostream_pump **_pump)
 	iostream_pump_unref(&pump);
 }
 
+static void iostream_pump_splice_unbuffer(struct iostream_pump *pump)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	size_t old_size;
+	ssize_t ret;
+
+	/* Move the data still in the pipe to the ostream buffer, so it won't
+	   get lost if the streams are used after the pump is stopped. */
+	old_size = o_stream_get_max_buffer_size(pump->output);
+	o_stream_set_max_buffer_size(pump->output, SIZE_MAX);
+	while (pump->splice_pipe_used > 0) {
+		ret = read(pump->splice_pipe[0], buf,
+			   I_MIN(sizeof(buf), pump->splice_pipe_used));
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			i_error("read(splice pipe) failed: %m");
+			break;
+		}
+		i_assert(ret > 0);
+		if (o_stream_send(pump->output, buf, ret) < 0)
+			break;
+		pump->splice_pipe_used -= ret;
+	}
+	pump->splice_pipe_used = 0;
+	o_stream_set_max_buffer_size(pump->output, old_size);
+}
+
 void iostream_pump_stop(struct iostream_pump *pump)
 {
 	i_assert(pump != NULL);
 
+	if (pump->output != NULL && pump->splice_pipe_used > 0)
+		iostream_pump_splice_unbuffer(pump);
 	if (pump->output != NULL)
 		o_stream_unset_flush_callback(pump->output);
 
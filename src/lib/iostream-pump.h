@@ -40,6 +40,15 @@ iostream_pump_create(struct istream *input, struct ostream *output);
 struct istream *iostream_pump_get_input(struct iostream_pump *pump);
 struct ostream *iostream_pump_get_output(struct iostream_pump *pump);
 
+/* Move the data with splice() directly from the istream's fd to the ostream's
+   fd via a pipe, instead of copying it through the stream buffers. This must
+   be called before iostream_pump_start(). Anything already buffered in the
+   streams is still sent first. Returns TRUE if splicing is used, FALSE if
+   it's not supported or the streams' fds can't be accessed directly (see
+   istream.readable_fd and ostream.writable_fd). Only the ostream offset is
+   updated for the spliced data. */
+bool iostream_pump_set_splice(struct iostream_pump *pump);
+
 void iostream_pump_start(struct iostream_pump *pump);
 void iostream_pump_stop(struct iostream_pump *pump);
 
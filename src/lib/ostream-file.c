@@ -1066,6 +1066,7 @@ o_stream_create_file_common(struct file_ostream *fstream,
 
 	fstream->ostream.max_buffer_size = max_buffer_size;
 	ostream = o_stream_create(&fstream->ostream, NULL, fd);
+	ostream->writable_fd = TRUE;
 
 	if (max_buffer_size == 0)
 		fstream->ostream.max_buffer_size = fstream->optimal_block_size;
@@ -73,6 +73,8 @@ struct ostream *o_stream_create_unix(int fd, size_t max_buffer_size)
 	output = o_stream_create_file_common(&ustream->fstream, fd,
 					    max_buffer_size, FALSE);
 	output->real_stream->iostream.close = o_stream_unix_close;
+	/* fds are passed along with the written data */
+	output->writable_fd = FALSE;
 	ustream->fstream.writev = o_stream_unix_writev;
 
 	return output;
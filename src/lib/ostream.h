@@ -46,6 +46,8 @@ struct ostream {
 	/* o_stream_send() writes all the data or returns failure */
 	bool blocking:1;
 	bool closed:1;
+	bool writable_fd:1; /* fd can be written directly if necessary
+	                       (for splice()) */
 
 	struct ostream_private *real_stream;
 };
@@ -2,7 +2,9 @@
 
 #include "test-lib.h"
 #include "str.h"
+#include "randgen.h"
 #include "base64.h"
+#include "cpu-features.h"
 
 static unsigned int loop_count;
 
@@ -1211,6 +1213,94 @@ test_base64_random_lowlevel(void)
 	test_end();
 }
 
+static int
+test_base64_bulk_decode(const struct base64_scheme *b64,
+			const unsigned char *in, size_t in_size,
+			size_t chunk_size, buffer_t *out, size_t *in_pos_r)
+{
+	struct base64_decoder dec;
+	size_t pos = 0, size, chunk_pos;
+	int ret = 1;
+
+	base64_decode_init(&dec, b64, BASE64_DECODE_FLAG_EXPECT_BOUNDARY);
+	while (pos < in_size && ret > 0) {
+		size = I_MIN(chunk_size, in_size - pos);
+		ret = base64_decode_more(&dec, in + pos, size,
+					 &chunk_pos, out);
+		pos += chunk_pos;
+	}
+	if (ret >= 0 && base64_decode_finish(&dec) < 0)
+		ret = -1;
+	*in_pos_r = pos;
+	return ret;
+}
+
+static void
+test_base64_bulk_one(const struct base64_scheme *b64,
+		     const unsigned char *data, size_t data_size,
+		     size_t max_line_len)
+{
+	enum cpu_feature old_disabled;
+	buffer_t *enc_fast, *enc_slow, *dec_fast, *dec_slow, *input;
+	size_t i, chunk_size, pos_fast, pos_slow;
+	int ret_fast, ret_slow;
+
+	enc_fast = t_buffer_create(data_size * 2);
+	enc_slow = t_buffer_create(data_size * 2);
+	base64_scheme_encode(b64, BASE64_ENCODE_FLAG_CRLF, max_line_len,
+			     data, data_size, enc_fast);
+	old_disabled = cpu_features_disable(CPU_FEATURE_ALL);
+	base64_scheme_encode(b64, BASE64_ENCODE_FLAG_CRLF, max_line_len,
+			     data, data_size, enc_slow);
+	cpu_features_set_disabled(old_disabled);
+	test_assert(buffer_cmp(enc_fast, enc_slow));
+
+	/* add some extra whitespace and maybe an invalid character */
+	input = t_buffer_create(enc_fast->used + 16);
+	for (i = 0; i < enc_fast->used; i++) {
+		if (i_rand_limit(200) == 0)
+			buffer_append_c(input, ' ');
+		if (i_rand_limit(2000) == 0)
+			buffer_append_c(input, '*');
+		buffer_append_c(input,
+				((const unsigned char *)enc_fast->data)[i]);
+	}
+
+	chunk_size = i_rand_minmax(1, input->used + 1);
+	dec_fast = t_buffer_create(data_size);
+	dec_slow = t_buffer_create(data_size);
+	ret_fast = test_base64_bulk_decode(b64, input->data, input->used,
+					   chunk_size, dec_fast, &pos_fast);
+	old_disabled = cpu_features_disable(CPU_FEATURE_ALL);
+	ret_slow = test_base64_bulk_decode(b64, input->data, input->used,
+					   chunk_size, dec_slow, &pos_slow);
+	cpu_features_set_disabled(old_disabled);
+	test_assert(ret_fast == ret_slow);
+	test_assert(pos_fast == pos_slow);
+	test_assert(buffer_cmp(dec_fast, dec_slow));
+	if (ret_fast > 0)
+		test_assert(dec_fast->used == data_size &&
+			    memcmp(dec_fast->data, data, data_size) == 0);
+}
+
+static void test_base64_bulk(void)
+{
+	unsigned char data[4096];
+	size_t data_size, max_line_len;
+	unsigned int i;
+
+	test_begin("base64 bulk conversion");
+	for (i = 0; i < loop_count; i++) T_BEGIN {
+		data_size = i_rand_limit(sizeof(data) + 1);
+		random_fill(data, data_size);
+		max_line_len = i_rand_limit(3) == 0 ? 0 : i_rand_minmax(1, 100);
+		test_base64_bulk_one(i % 2 == 0 ?
+				     &base64_scheme : &base64url_scheme,
+				     data, data_size, max_line_len);
+	} T_END;
+	test_end();
+}
+
 static void
 _add_lines(const char *in, size_t max_line_len, bool crlf, string_t *out)
 {
@@ -1317,4 +1407,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_bulk();
 }
@@ -1,14 +1,48 @@
 /* Copyright (c) Dovecot authors, see top-level COPYING file */
 
 #include "test-lib.h"
+#include "randgen.h"
+#include "cpu-features.h"
 #include "crc32.h"
 
+static void test_crc32_random(void)
+{
+	unsigned char data[4096];
+	enum cpu_feature old_disabled;
+	uint32_t crc_fast, crc_slow;
+	size_t size, split;
+	unsigned int i;
+
+	test_begin("crc32 random");
+	for (i = 0; i < 1000; i++) {
+		size = i_rand_limit(sizeof(data) + 1);
+		split = i_rand_limit(size + 1);
+		random_fill(data, size);
+
+		crc_fast = crc32_data_more(CRC32_INIT, data, split);
+		crc_fast = crc32_data_more(crc_fast, data + split,
+					   size - split);
+		old_disabled = cpu_features_disable(CPU_FEATURE_ALL);
+		crc_slow = crc32_data(data, size);
+		cpu_features_set_disabled(old_disabled);
+		test_assert_idx(crc_fast == crc_slow, i);
+	}
+	test_end();
+}
+
 void test_crc32(void)
 {
 	const char str[] = "foo\0bar";
+	unsigned char data[256];
+	unsigned int i;
 
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+	test_assert(crc32_data(data, sizeof(data)) == 0x29058c73);
 	test_end();
+
+	test_crc32_random();
 }
@@ -0,0 +1,75 @@
+/* Copyright (c) Dovecot authors, see top-level COPYING file */
+
+#include "test-lib.h"
+#include "fsync-group.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_FILE_COUNT 200
+
+static int test_fsync_group_open(unsigned int i)
+{
+	const char *path = test_dir_prepend(t_strdup_printf("fsync-group.%u", i));
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write(fd, "data", 4) != 4)
+		i_fatal("write(%s) failed: %m", path);
+	return fd;
+}
+
+static void test_fsync_group_files(unsigned int max_threads)
+{
+	struct fsync_group *group;
+	const char *error;
+	unsigned int i;
+
+	group = fsync_group_init(max_threads);
+	test_assert(fsync_group_flush(group, &error) == 0);
+
+	/* more files than can be kept open at once */
+	for (i = 0; i < TEST_FILE_COUNT; i++)
+		fsync_group_add_fd(group, test_fsync_group_open(i), "file");
+	test_assert(fsync_group_pending_count(group) < TEST_FILE_COUNT);
+	test_assert(fsync_group_flush(group, &error) == 0);
+	test_assert(fsync_group_pending_count(group) == 0);
+
+	/* fdatasync() fails for a pipe */
+	int fds[2];
+	if (pipe(fds) < 0)
+		i_fatal("pipe() failed: %m");
+	fsync_group_add_fd(group, test_fsync_group_open(0), "file");
+	fsync_group_add_fd(group, fds[0], "pipe");
+	fsync_group_add_fd(group, test_fsync_group_open(1), "file");
+	test_assert(fsync_group_flush(group, &error) < 0);
+	test_assert(errno == EINVAL);
+	test_assert(str_begins_with(error, "fdatasync(pipe) failed"));
+	i_close_fd(&fds[1]);
+
+	/* the error was reset */
+	fsync_group_add_fd(group, test_fsync_group_open(0), "file");
+	test_assert(fsync_group_flush(group, &error) == 0);
+
+	/* the pending fds are closed without syncing */
+	fsync_group_add_fd(group, test_fsync_group_open(0), "file");
+	fsync_group_deinit(&group);
+	test_assert(group == NULL);
+
+	for (i = 0; i < TEST_FILE_COUNT; i++) {
+		i_unlink(test_dir_prepend(t_strdup_printf("fsync-group.%u", i)));
+	}
+}
+
+void test_fsync_group(void)
+{
+	test_begin("fsync group");
+	test_fsync_group_files(0);
+	test_end();
+
+	test_begin("fsync group threads");
+	test_fsync_group_files(4);
+	test_end();
+}
@@ -4,7 +4,7 @@
 #include "hash.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static void test_hash_random_pool(pool_t pool, bool open_addressing)
 {
 	const unsigned int keymax = ON_VALGRIND ? 10000 : 100000;
 	HASH_TABLE(void *, void *) hash;
@@ -12,7 +12,10 @@ static void test_hash_random_pool(pool_t pool)
 	unsigned int i, key, keyidx, delidx;
 
 	keys = i_new(unsigned int, keymax); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	if (open_addressing)
+		hash_table_create_direct_open(&hash, pool, 0);
+	else
+		hash_table_create_direct(&hash, pool, 0);
 	for (i = 0; i < keymax; i++) {
 		key = (i_rand_limit(keymax)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -35,15 +38,121 @@ static void test_hash_random_pool(pool_t pool)
 	i_free(keys);
 }
 
+static void test_hash_open_vs_chained(void)
+{
+	const unsigned int keymax = 1000;
+	HASH_TABLE(void *, void *) open, chained;
+	struct hash_iterate_context *iter;
+	void *key, *value, *value2, *orig_key;
+	bool existed[1000 + 1], seen[1000 + 1];
+	unsigned int i, j, count, n;
+
+	test_begin("hash table (open addressing vs. chained)");
+	hash_table_create_direct_open(&open, default_pool, 0);
+	hash_table_create_direct(&chained, default_pool, 0);
+	for (i = 0; i < 20000; i++) {
+		key = POINTER_CAST(i_rand_limit(keymax) + 1);
+		value = POINTER_CAST(i_rand_limit(100) + 1);
+		switch (i_rand_limit(6)) {
+		case 0:
+		case 1:
+			hash_table_update(open, key, value);
+			hash_table_update(chained, key, value);
+			break;
+		case 2:
+			test_assert_idx(hash_table_try_remove(open, key) ==
+					hash_table_try_remove(chained, key), i);
+			break;
+		case 3:
+			test_assert_idx(hash_table_lookup_full(open, key,
+							       &orig_key,
+							       &value) ==
+					(hash_table_lookup(chained, key) != NULL),
+					i);
+			break;
+		case 4:
+			/* iterate and remove some of the nodes */
+			count = 0;
+			n = i_rand_limit(4);
+			iter = hash_table_iterate_init(open);
+			while (hash_table_iterate(iter, open, &key, &value)) {
+				test_assert_idx(hash_table_lookup(chained, key) ==
+						value, i);
+				if (n > 0 && count % n == 0) {
+					hash_table_remove(open, key);
+					hash_table_remove(chained, key);
+				}
+				count++;
+			}
+			hash_table_iterate_deinit(&iter);
+			test_assert_idx(count == hash_table_count(chained) +
+					(n == 0 ? 0 : (count + n - 1) / n), i);
+			break;
+		case 5:
+			/* add and remove nodes while iterating, which may
+			   resize the table */
+			memset(seen, 0, sizeof(seen));
+			for (j = 1; j <= keymax; j++) {
+				existed[j] = hash_table_lookup(open,
+					POINTER_CAST(j)) != NULL;
+			}
+			iter = hash_table_iterate_init(open);
+			while (hash_table_iterate(iter, open, &key, &value)) {
+				j = POINTER_CAST_TO(key, unsigned int);
+				test_assert_idx(!seen[j], i);
+				seen[j] = TRUE;
+				test_assert_idx(hash_table_lookup(chained, key) ==
+						value, i);
+
+				key = POINTER_CAST(i_rand_limit(keymax) + 1);
+				if (i_rand_limit(3) == 0) {
+					(void)hash_table_try_remove(open, key);
+					(void)hash_table_try_remove(chained, key);
+					existed[POINTER_CAST_TO(key, unsigned int)] = FALSE;
+				} else {
+					hash_table_update(open, key, POINTER_CAST(2));
+					hash_table_update(chained, key, POINTER_CAST(2));
+				}
+			}
+			hash_table_iterate_deinit(&iter);
+			for (j = 1; j <= keymax; j++)
+				test_assert_idx(!existed[j] || seen[j], i);
+			break;
+		}
+		test_assert_idx(hash_table_count(open) ==
+				hash_table_count(chained), i);
+	}
+	for (i = 1; i <= keymax; i++) {
+		key = POINTER_CAST(i);
+		value = hash_table_lookup(open, key);
+		value2 = hash_table_lookup(chained, key);
+		test_assert_idx(value == value2, i);
+	}
+	hash_table_clear(open, TRUE);
+	test_assert(hash_table_count(open) == 0);
+	test_assert(hash_table_lookup(open, POINTER_CAST(1)) == NULL);
+	hash_table_copy(open, chained);
+	test_assert(hash_table_count(open) == hash_table_count(chained));
+	hash_table_destroy(&open);
+	hash_table_destroy(&chained);
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
 	test_begin("hash table (random)");
-	test_hash_random_pool(default_pool);
+	test_hash_random_pool(default_pool, FALSE);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, FALSE);
 	pool_unref(&pool);
 	test_end();
+
+	test_begin("hash table (open addressing, random)");
+	test_hash_random_pool(default_pool, TRUE);
+	test_end();
+
+	test_hash_open_vs_chained();
 }
@@ -3,10 +3,11 @@
 #include "test-lib.h"
 #include "net.h"
 #include "time-util.h"
-#include "ioloop.h"
+#include "ioloop-private.h"
 #include "istream.h"
 
 #include <unistd.h>
+#include <sys/wait.h>
 
 struct test_ctx {
 	bool got_left;
@@ -89,6 +90,273 @@ static void test_ioloop_fd(void)
 	test_end();
 }
 
+struct test_read_ctx {
+	int fd;
+	unsigned int count;
+};
+
+static void test_ioloop_fd_read_one_cb(struct test_read_ctx *ctx)
+{
+	char c;
+
+	if (read(ctx->fd, &c, 1) != 1)
+		i_fatal("read() failed: %m");
+	if (++ctx->count == 3)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_fd_level_triggered(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	struct test_ctx test_ctx;
+	struct test_read_ctx read_ctx;
+	struct io *io;
+	int fds[2];
+
+	test_begin("ioloop fd level triggered");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	i_zero(&test_ctx);
+	i_zero(&read_ctx);
+	read_ctx.fd = fds[0];
+
+	ioloop = io_loop_create();
+	io = io_add(fds[0], IO_READ, test_ioloop_fd_read_one_cb, &read_ctx);
+	to = timeout_add_short(1000, test_ioloop_fd_to, &test_ctx);
+
+	/* callback reads only one byte at a time, but it still needs to be
+	   called until all the input is read */
+	if (write(fds[1], "abc", 3) != 3)
+		i_fatal("write() failed: %m");
+	io_loop_run(ioloop);
+	test_assert(read_ctx.count == 3);
+	test_assert(!test_ctx.got_to);
+
+	timeout_remove(&to);
+	io_remove(&io);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	test_end();
+}
+
+static void test_ioloop_fd_reuse_cb(struct test_ctx *ctx)
+{
+	ctx->got_left = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_fd_reuse(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	struct test_ctx test_ctx;
+	struct io *io;
+	int fds[2], fds2[2], old_fd;
+
+	test_begin("ioloop fd reuse");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	i_zero(&test_ctx);
+
+	ioloop = io_loop_create();
+	to = timeout_add_short(1000, test_ioloop_fd_to, &test_ctx);
+
+	/* wait for input once, so the fd is actually polled */
+	io = io_add(fds[0], IO_READ, test_ioloop_fd_reuse_cb, &test_ctx);
+	if (write(fds[1], "a", 1) != 1)
+		i_fatal("write() failed: %m");
+	io_loop_run(ioloop);
+	test_assert(test_ctx.got_left);
+
+	/* close the fd and add an IO for another socket that gets the same
+	   fd number, without running the ioloop in between */
+	io_remove(&io);
+	old_fd = fds[0];
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds2) < 0)
+		i_fatal("socketpair() failed: %m");
+	test_assert(fds2[0] == old_fd);
+	test_ctx.got_left = FALSE;
+	io = io_add(fds2[0], IO_READ, test_ioloop_fd_reuse_cb, &test_ctx);
+	if (write(fds2[1], "b", 1) != 1)
+		i_fatal("write() failed: %m");
+	io_loop_run(ioloop);
+	test_assert(test_ctx.got_left);
+	test_assert(!test_ctx.got_to);
+
+	timeout_remove(&to);
+	io_remove(&io);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fds2[0]);
+	i_close_fd(&fds2[1]);
+	test_end();
+}
+
+static void test_ioloop_fd_stop_read_cb(struct test_read_ctx *ctx)
+{
+	char c;
+
+	if (read(ctx->fd, &c, 1) != 1)
+		i_fatal("read() failed: %m");
+	ctx->count++;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_fd_stop(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	struct test_ctx test_ctx;
+	struct test_read_ctx read_ctx[2];
+	struct io *io[2];
+	int fds[2][2];
+	unsigned int i;
+
+	test_begin("ioloop fd stop with pending events");
+	i_zero(&test_ctx);
+	i_zero(&read_ctx);
+	ioloop = io_loop_create();
+	for (i = 0; i < 2; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) < 0)
+			i_fatal("socketpair() failed: %m");
+		read_ctx[i].fd = fds[i][0];
+		io[i] = io_add(fds[i][0], IO_READ,
+			       test_ioloop_fd_stop_read_cb, &read_ctx[i]);
+	}
+	to = timeout_add_short(1000, test_ioloop_fd_to, &test_ctx);
+
+	/* both fds become readable in the same batch of events. The first
+	   callback stops the ioloop, but the other fd must still be called
+	   when the ioloop is run again. */
+	for (i = 0; i < 2; i++) {
+		if (write(fds[i][1], "a", 1) != 1)
+			i_fatal("write() failed: %m");
+	}
+	io_loop_run(ioloop);
+	test_assert(read_ctx[0].count + read_ctx[1].count == 1);
+	io_loop_run(ioloop);
+	test_assert(read_ctx[0].count == 1);
+	test_assert(read_ctx[1].count == 1);
+	test_assert(!test_ctx.got_to);
+
+	timeout_remove(&to);
+	for (i = 0; i < 2; i++) {
+		io_remove(&io[i]);
+		i_close_fd(&fds[i][0]);
+		i_close_fd(&fds[i][1]);
+	}
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+#define TEST_IOLOOP_MANY_FDS_PAIRS 300
+
+struct test_many_fds_ctx {
+	struct io *io;
+	unsigned int *called_count;
+};
+
+static void test_ioloop_many_fds_cb(struct test_many_fds_ctx *ctx)
+{
+	io_remove(&ctx->io);
+	if (++(*ctx->called_count) == TEST_IOLOOP_MANY_FDS_PAIRS * 2)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_many_fds(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	struct test_ctx test_ctx;
+	struct test_many_fds_ctx ctx[TEST_IOLOOP_MANY_FDS_PAIRS * 2];
+	int fds[TEST_IOLOOP_MANY_FDS_PAIRS * 2];
+	unsigned int i, called_count = 0;
+
+	/* More fds become ready at once than fit into the io_uring rings,
+	   so the submissions are flushed while the completion ring is
+	   full. All the callbacks must still be called. */
+	test_begin("ioloop many ready fds");
+	i_zero(&test_ctx);
+	ioloop = io_loop_create();
+	for (i = 0; i < TEST_IOLOOP_MANY_FDS_PAIRS; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i*2]) < 0)
+			i_fatal("socketpair() failed: %m");
+	}
+	for (i = 0; i < N_ELEMENTS(fds); i++) {
+		ctx[i].called_count = &called_count;
+		ctx[i].io = io_add(fds[i], IO_WRITE,
+				   test_ioloop_many_fds_cb, &ctx[i]);
+	}
+	to = timeout_add(2000, test_ioloop_fd_to, &test_ctx);
+	io_loop_run(ioloop);
+	test_assert(called_count == N_ELEMENTS(fds));
+	test_assert(!test_ctx.got_to);
+
+	timeout_remove(&to);
+	for (i = 0; i < N_ELEMENTS(fds); i++) {
+		io_remove(&ctx[i].io);
+		i_close_fd(&fds[i]);
+	}
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_ioloop_fork_recreate(void)
+{
+	struct ioloop *ioloop;
+	struct timeout *to;
+	struct test_ctx test_ctx;
+	struct io *io;
+	int fds[2], status;
+	pid_t pid;
+
+	test_begin("ioloop recreate after fork");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	i_zero(&test_ctx);
+
+	ioloop = io_loop_create();
+	io = io_add(fds[0], IO_READ, test_ioloop_fd_reuse_cb, &test_ctx);
+	/* run the ioloop once, so the handler is initialized */
+	to = timeout_add_short(0, test_ioloop_fd_to, &test_ctx);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		/* removing the IO in the child must not affect the parent */
+		io_loop_recreate(ioloop);
+		io_remove(&io);
+		io = io_add(fds[1], IO_WRITE, test_ioloop_fd_reuse_cb,
+			    &test_ctx);
+		io_loop_run(ioloop);
+		_exit(test_ctx.got_left ? 0 : 1);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		i_fatal("waitpid() failed: %m");
+	test_assert(status == 0);
+
+	test_ctx.got_left = FALSE;
+	test_ctx.got_to = FALSE;
+	to = timeout_add_short(1000, test_ioloop_fd_to, &test_ctx);
+	if (write(fds[1], "a", 1) != 1)
+		i_fatal("write() failed: %m");
+	io_loop_run(ioloop);
+	test_assert(test_ctx.got_left);
+	test_assert(!test_ctx.got_to);
+
+	timeout_remove(&to);
+	io_remove(&io);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	test_end();
+}
+
 static void test_ioloop_timeout(void)
 {
 	struct ioloop *ioloop, *ioloop2;
@@ -391,7 +659,7 @@ static void test_ioloop_context_events(void)
 	test_end();
 }
 
-void test_ioloop(void)
+static void test_ioloop_run(void)
 {
 	test_ioloop_timeout();
 	test_ioloop_zero_timeout();
@@ -399,6 +667,22 @@ void test_ioloop(void)
 	test_ioloop_find_fd_conditions();
 	test_ioloop_pending_io();
 	test_ioloop_fd();
+	test_ioloop_fd_level_triggered();
+	test_ioloop_fd_reuse();
+	test_ioloop_fd_stop();
+	test_ioloop_many_fds();
+	test_ioloop_fork_recreate();
 	test_ioloop_context();
 	test_ioloop_context_events();
 }
+
+void test_ioloop(void)
+{
+	test_ioloop_run();
+#ifdef IOLOOP_IO_URING
+	/* run the same tests with the epoll fallback handler */
+	io_loop_handler_set_epoll_fallback(TRUE);
+	test_ioloop_run();
+	io_loop_handler_set_epoll_fallback(FALSE);
+#endif
+}
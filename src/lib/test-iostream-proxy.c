@@ -21,11 +21,12 @@ void completed(enum iostream_proxy_side side ATTR_UNUSED,
 }
 
 static
-void test_iostream_proxy_simple(void)
+void test_iostream_proxy_simple(bool splice)
 {
 	size_t bytes;
 
-	test_begin("iostream_proxy");
+	test_begin(t_strdup_printf("iostream_proxy%s",
+				   splice ? " (splice)" : ""));
 	int sfdl[2];
 	int sfdr[2];
 
@@ -56,6 +57,10 @@ void test_iostream_proxy_simple(void)
 	o_stream_unref(&right_out);
 
 	iostream_proxy_set_completion_callback(proxy, completed, &counter);
+#ifdef HAVE_SPLICE
+	if (splice)
+		test_assert(iostream_proxy_set_splice(proxy));
+#endif
 	iostream_proxy_start(proxy);
 
 	left_in = i_stream_create_fd(sfdl[0], IO_BLOCK_SIZE);
@@ -76,6 +81,7 @@ void test_iostream_proxy_simple(void)
 	test_assert(i_stream_read(right_in) > 0);
 	test_assert(strcmp((const char*)i_stream_get_data(right_in, &bytes), "hello, world") == 0);
 	i_stream_skip(right_in, bytes);
+	test_assert(iostream_proxy_get_ostream(proxy, IOSTREAM_PROXY_SIDE_LEFT)->offset == 12);
 
 	test_assert(o_stream_send_str(right_out, "hello, world") > 0);
 	test_assert(o_stream_flush(right_out) > 0);
@@ -105,9 +111,135 @@ void test_iostream_proxy_simple(void)
 	test_end();
 }
 
+struct large_ctx {
+	struct ostream *output;
+	struct istream *input;
+	struct io *io;
+	size_t sent, received;
+};
+
+#define LARGE_DATA_SIZE (1024*1024)
+
+static unsigned char large_data_byte(size_t offset)
+{
+	return (offset * 7 + offset / 4099) & 0xff;
+}
+
+static int large_output(struct large_ctx *ctx)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	size_t i, size;
+	ssize_t ret;
+
+	while (ctx->sent < LARGE_DATA_SIZE) {
+		size = I_MIN(sizeof(buf), LARGE_DATA_SIZE - ctx->sent);
+		for (i = 0; i < size; i++)
+			buf[i] = large_data_byte(ctx->sent + i);
+		if ((ret = o_stream_send(ctx->output, buf, size)) < 0)
+			return -1;
+		ctx->sent += ret;
+		if ((size_t)ret < size)
+			return 0;
+	}
+	return o_stream_flush(ctx->output);
+}
+
+static void large_input(struct large_ctx *ctx)
+{
+	const unsigned char *data;
+	size_t i, size;
+
+	while (i_stream_read_more(ctx->input, &data, &size) > 0) {
+		for (i = 0; i < size; i++) {
+			if (data[i] != large_data_byte(ctx->received + i))
+				break;
+		}
+		test_assert(i == size);
+		ctx->received += size;
+		i_stream_skip(ctx->input, size);
+	}
+	if (ctx->received == LARGE_DATA_SIZE || ctx->input->eof ||
+	    ctx->input->stream_errno != 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_iostream_proxy_large(bool splice)
+{
+	struct large_ctx ctx;
+	int sfdl[2], sfdr[2];
+	int counter = 1;
+
+	test_begin(t_strdup_printf("iostream_proxy large%s",
+				   splice ? " (splice)" : ""));
+
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sfdl) == 0);
+	test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sfdr) == 0);
+	fd_set_nonblock(sfdl[0], TRUE);
+	fd_set_nonblock(sfdl[1], TRUE);
+	fd_set_nonblock(sfdr[0], TRUE);
+	fd_set_nonblock(sfdr[1], TRUE);
+
+	struct ioloop *ioloop = io_loop_create();
+
+	struct istream *left_in = i_stream_create_fd(sfdl[1], IO_BLOCK_SIZE);
+	struct ostream *left_out = o_stream_create_fd(sfdl[1], IO_BLOCK_SIZE);
+	struct istream *right_in = i_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
+	struct ostream *right_out = o_stream_create_fd(sfdr[1], IO_BLOCK_SIZE);
+	struct iostream_proxy *proxy =
+		iostream_proxy_create(left_in, left_out, right_in, right_out);
+	i_stream_unref(&left_in);
+	o_stream_unref(&left_out);
+	i_stream_unref(&right_in);
+	o_stream_unref(&right_out);
+
+	iostream_proxy_set_completion_callback(proxy, completed, &counter);
+#ifdef HAVE_SPLICE
+	if (splice)
+		test_assert(iostream_proxy_set_splice(proxy));
+#endif
+	iostream_proxy_start(proxy);
+
+	i_zero(&ctx);
+	ctx.output = o_stream_create_fd(sfdl[0], IO_BLOCK_SIZE);
+	ctx.input = i_stream_create_fd(sfdr[0], IO_BLOCK_SIZE);
+	o_stream_set_flush_callback(ctx.output, large_output, &ctx);
+	o_stream_set_flush_pending(ctx.output, TRUE);
+	ctx.io = io_add_istream(ctx.input, large_input, &ctx);
+
+	io_loop_run(ioloop);
+
+	test_assert(ctx.sent == LARGE_DATA_SIZE);
+	test_assert(ctx.received == LARGE_DATA_SIZE);
+	test_assert(iostream_proxy_get_ostream(proxy, IOSTREAM_PROXY_SIDE_LEFT)->offset ==
+		    LARGE_DATA_SIZE);
+
+	/* finish proxying in both directions */
+	io_remove(&ctx.io);
+	test_assert(o_stream_finish(ctx.output) > 0);
+	o_stream_unref(&ctx.output);
+	test_assert(shutdown(sfdl[0], SHUT_WR) == 0);
+	test_assert(shutdown(sfdr[0], SHUT_WR) == 0);
+	counter = 2;
+	io_loop_run(ioloop);
+	test_assert(counter == 0);
+	i_stream_unref(&ctx.input);
+	iostream_proxy_unref(&proxy);
+	io_loop_destroy(&ioloop);
+
+	i_close_fd(&sfdl[0]);
+	i_close_fd(&sfdl[1]);
+	i_close_fd(&sfdr[0]);
+	i_close_fd(&sfdr[1]);
+
+	test_end();
+}
+
 void test_iostream_proxy(void)
 {
 	T_BEGIN {
-		test_iostream_proxy_simple();
+		test_iostream_proxy_simple(FALSE);
+		test_iostream_proxy_simple(TRUE);
+		test_iostream_proxy_large(FALSE);
+		test_iostream_proxy_large(TRUE);
 	} T_END;
 }
@@ -1,8 +1,10 @@
 /* Copyright (c) Dovecot authors, see top-level COPYING file */
 
+#define _GNU_SOURCE /* for syncfs() */
 #include "lmtp-common.h"
 #include "smtp-server.h"
 #include "str.h"
+#include "seq-range-array.h"
 #include "istream.h"
 #include "strescape.h"
 #include "time-util.h"
@@ -25,6 +27,10 @@
 #include "lmtp-recipient.h"
 #include "lmtp-local.h"
 
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
 struct lmtp_local_recipient {
 	struct lmtp_recipient *rcpt;
 
@@ -34,15 +40,31 @@ struct lmtp_local_recipient {
 
 	struct lmtp_local_recipient *duplicate;
 	const struct lda_settings *lda_set;
+	/* lmtp_fsync_batch: Indexes to lmtp_local.fsync_fs that the mail
+	   was saved to */
+	ARRAY_TYPE(seq_range) fsync_fs_idx;
 
 	bool anvil_connect_sent:1;
 };
 
+struct lmtp_local_fsync_fs {
+	dev_t dev;
+	int fd;
+	char *path;
+	bool failed;
+};
+
 struct lmtp_local {
 	struct client *client;
 
 	ARRAY(struct lmtp_local_recipient *) rcpt_to;
 
+	/* lmtp_fsync_batch: Recipients whose mails have been saved without
+	   fsyncing. They are replied to after the filesystems are synced. */
+	ARRAY(struct lmtp_local_recipient *) fsync_rcpts;
+	/* The filesystems the mails were saved to */
+	ARRAY(struct lmtp_local_fsync_fs) fsync_fs;
+
 	struct mail *raw_mail, *first_saved_mail;
 	struct mail_user *rcpt_user;
 
@@ -75,6 +97,17 @@ void lmtp_local_deinit(struct lmtp_local **_local)
 
 	if (array_is_created(&local->rcpt_to))
 		array_free(&local->rcpt_to);
+	if (array_is_created(&local->fsync_fs)) {
+		struct lmtp_local_fsync_fs *fs;
+
+		array_foreach_modifiable(&local->fsync_fs, fs) {
+			i_close_fd(&fs->fd);
+			i_free(fs->path);
+		}
+		array_free(&local->fsync_fs);
+	}
+	if (array_is_created(&local->fsync_rcpts))
+		array_free(&local->fsync_rcpts);
 
 	if (local->raw_mail != NULL) {
 		struct mailbox_transaction_context *raw_trans =
@@ -417,6 +450,180 @@ void lmtp_local_add_headers(struct lmtp_local *local,
 	}
 }
 
+/*
+ * Batched fsyncs
+ */
+
+static bool lmtp_local_fsync_batch_enabled(struct lmtp_local *local)
+{
+#ifdef HAVE_SYNCFS
+	/* Only the default delivery adds the recipients to the batch. If a
+	   plugin has replaced it, keep fsyncing the mails as configured. */
+	return local->client->lmtp_set->lmtp_fsync_batch &&
+		local->client->v.local_deliver == lmtp_local_default_deliver &&
+		array_count(&local->rcpt_to) > 1;
+#else
+	return FALSE;
+#endif
+}
+
+static int
+lmtp_local_fsync_add_path(struct lmtp_local *local,
+			  struct lmtp_local_recipient *llrcpt, const char *path,
+			  const char **error_r)
+{
+	struct lmtp_local_fsync_fs *fs;
+	struct stat st;
+	const char *p;
+	int fd;
+
+	/* The directory may not have been created yet if the mail wasn't
+	   saved there. Use the nearest existing parent directory, which is
+	   most likely in the same filesystem. */
+	while ((fd = open(path, O_RDONLY)) == -1 && errno == ENOENT) {
+		p = strrchr(path, '/');
+		if (p == NULL || p == path)
+			break;
+		path = t_strdup_until(path, p);
+	}
+	if (fd == -1) {
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+
+	array_foreach_modifiable(&local->fsync_fs, fs) {
+		if (fs->dev == st.st_dev) {
+			i_close_fd(&fd);
+			seq_range_array_add(&llrcpt->fsync_fs_idx,
+				array_foreach_idx(&local->fsync_fs, fs));
+			return 0;
+		}
+	}
+	seq_range_array_add(&llrcpt->fsync_fs_idx,
+			    array_count(&local->fsync_fs));
+	fs = array_append_space(&local->fsync_fs);
+	fs->dev = st.st_dev;
+	fs->fd = fd;
+	fs->path = i_strdup(path);
+	return 0;
+}
+
+static int
+lmtp_local_fsync_add_user(struct lmtp_local *local,
+			  struct lmtp_local_recipient *llrcpt,
+			  struct mail_user *user, const char **error_r)
+{
+	static const enum mailbox_list_path_type path_types[] = {
+		MAILBOX_LIST_PATH_TYPE_DIR,
+		MAILBOX_LIST_PATH_TYPE_CONTROL,
+		MAILBOX_LIST_PATH_TYPE_INDEX,
+		MAILBOX_LIST_PATH_TYPE_INDEX_CACHE,
+		MAILBOX_LIST_PATH_TYPE_LIST_INDEX,
+	};
+	struct mail_namespace *ns;
+	const char *path;
+	unsigned int i;
+
+	if (!array_is_created(&local->fsync_fs)) {
+		i_array_init(&local->fsync_fs, 4);
+		i_array_init(&local->fsync_rcpts, array_count(&local->rcpt_to));
+	}
+	p_array_init(&llrcpt->fsync_fs_idx, llrcpt->rcpt->rcpt->pool, 4);
+
+	/* Shared namespaces are skipped, because their mailboxes are in
+	   the other users' directories. Delivering to them (e.g. with a
+	   Sieve script) isn't covered by the batched fsync. */
+	for (ns = user->namespaces; ns != NULL; ns = ns->next) {
+		if (ns->type == MAIL_NAMESPACE_TYPE_SHARED)
+			continue;
+		for (i = 0; i < N_ELEMENTS(path_types); i++) {
+			if (!mailbox_list_get_root_path(ns->list, path_types[i],
+							&path) ||
+			    path[0] == '\0')
+				continue;
+			if (lmtp_local_fsync_add_path(local, llrcpt, path,
+						      error_r) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static bool
+lmtp_local_fsync_rcpt_failed(struct lmtp_local *local,
+			     struct lmtp_local_recipient *llrcpt)
+{
+	const struct lmtp_local_fsync_fs *fs;
+	const struct seq_range *range;
+	uint32_t idx;
+
+	array_foreach(&llrcpt->fsync_fs_idx, range) {
+		for (idx = range->seq1; idx <= range->seq2; idx++) {
+			fs = array_idx(&local->fsync_fs, idx);
+			if (fs->failed)
+				return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void lmtp_local_fsync_flush(struct lmtp_local *local)
+{
+	struct lmtp_local_recipient *llrcpt;
+	struct lmtp_local_fsync_fs *fs;
+	unsigned int failed_count = 0;
+
+	if (!array_is_created(&local->fsync_fs))
+		return;
+
+#ifdef HAVE_SYNCFS
+	array_foreach_modifiable(&local->fsync_fs, fs) {
+		if (syncfs(fs->fd) < 0) {
+			e_error(local->client->event,
+				"syncfs(%s) failed: %m", fs->path);
+			fs->failed = TRUE;
+			failed_count++;
+		}
+	}
+#else
+	i_unreached();
+#endif
+	if (failed_count == 0) {
+		e_debug(local->client->event,
+			"Synced %u filesystems for %u recipients",
+			array_count(&local->fsync_fs),
+			array_count(&local->fsync_rcpts));
+	}
+
+	/* The mails have already been committed, so a recipient that is
+	   replied with 451 will most likely get a duplicate delivery when
+	   the mail is retried. Fail only the recipients whose mails were
+	   saved to the filesystems that couldn't be synced. */
+	array_foreach_elem(&local->fsync_rcpts, llrcpt) {
+		struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
+
+		if (failed_count == 0 ||
+		    !lmtp_local_fsync_rcpt_failed(local, llrcpt)) {
+			smtp_server_recipient_reply(rcpt, 250, "2.0.0",
+				"%s Saved", llrcpt->rcpt->session_id);
+		} else {
+			smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+				"Temporary internal error");
+		}
+	}
+	array_foreach_modifiable(&local->fsync_fs, fs) {
+		i_close_fd(&fs->fd);
+		i_free(fs->path);
+	}
+	array_clear(&local->fsync_fs);
+	array_clear(&local->fsync_rcpts);
+}
+
 static int
 lmtp_local_deliver(struct lmtp_local *local,
 		   struct smtp_server_cmd_ctx *cmd ATTR_UNUSED,
@@ -470,6 +677,15 @@ lmtp_local_deliver(struct lmtp_local *local,
 	}
 	settings_free(pre_mail_set);
 
+	if (lmtp_local_fsync_batch_enabled(local)) {
+		/* fsync the filesystems once after all the recipients have
+		   been delivered to */
+		struct settings_instance *set_instance =
+			mail_storage_service_user_get_settings_instance(service_user);
+		settings_override(set_instance, "*/mail_fsync", "never",
+				  SETTINGS_OVERRIDE_TYPE_CODE);
+	}
+
 	i_zero(&lldctx);
 	lldctx.session_id = lrcpt->session_id;
 	lldctx.src_mail = src_mail;
@@ -529,12 +745,27 @@ lmtp_local_default_do_deliver(struct lmtp_local *local,
 	struct smtp_server_recipient *rcpt = llrcpt->rcpt->rcpt;
 	enum mail_deliver_error error_code;
 	const char *error;
+	bool fsync_batch = lmtp_local_fsync_batch_enabled(local);
+
+	if (fsync_batch &&
+	    lmtp_local_fsync_add_user(local, llrcpt, lldctx->rcpt_user,
+				      &error) < 0) {
+		e_error(rcpt->event, "%s", error);
+		smtp_server_recipient_reply(rcpt, 451, "4.3.0",
+					    "Temporary internal error");
+		return -1;
+	}
 
 	if (mail_deliver(dctx, &error_code, &error) == 0) {
 		if (dctx->dest_mail != NULL) {
 			i_assert(local->first_saved_mail == NULL);
 			local->first_saved_mail = dctx->dest_mail;
 		}
+		if (fsync_batch) {
+			/* reply after the mail has been fsynced */
+			array_push_back(&local->fsync_rcpts, &llrcpt);
+			return 0;
+		}
 		smtp_server_recipient_reply(rcpt, 250, "2.0.0", "%s Saved",
 					    lldctx->session_id);
 		return 0;
@@ -694,6 +925,7 @@ lmtp_local_deliver_to_rcpts(struct lmtp_local *local,
 			mail_storage_service_io_deactivate_user(local->rcpt_user->service_user);
 		}
 	}
+	lmtp_local_fsync_flush(local);
 	return first_uid;
 }
 
@@ -92,6 +92,7 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(BOOL, lmtp_rcpt_check_quota),
 	DEF(BOOL, lmtp_add_received_header),
 	DEF(BOOL_HIDDEN, lmtp_verbose_replies),
+	DEF(BOOL, lmtp_fsync_batch),
 	DEF(UINT, lmtp_user_concurrency_limit),
 	DEF(ENUM, lmtp_hdr_delivery_address),
 	DEF(STR, lmtp_rawlog_dir),
@@ -115,6 +116,7 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_rcpt_check_quota = FALSE,
 	.lmtp_add_received_header = TRUE,
 	.lmtp_verbose_replies = FALSE,
+	.lmtp_fsync_batch = FALSE,
 	.lmtp_user_concurrency_limit = 10,
 	.lmtp_hdr_delivery_address = "final:none:original",
 	.lmtp_rawlog_dir = "",
@@ -1014,6 +1014,9 @@ int client_get_plaintext_fd(struct client *client, int *fd_r, bool *close_fd_r)
 	iostream_proxy_set_completion_callback(client->iostream_fd_proxy,
 					       iostream_fd_proxy_finished,
 					       client);
+	/* With kernel TLS the post-login process's output can be spliced
+	   directly to the client's socket. */
+	(void)iostream_proxy_set_splice(client->iostream_fd_proxy);
 	iostream_proxy_start(client->iostream_fd_proxy);
 
 	*fd_r = fds[1];
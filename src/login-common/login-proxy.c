@@ -1228,6 +1228,21 @@ client_get_alt_usernames(struct client *client,
 	return TRUE;
 }
 
+static bool login_proxy_can_splice(struct login_proxy *proxy)
+{
+	struct client *client = proxy->client;
+
+	/* splice() moves the data directly between the sockets, so nothing
+	   in this process may need to see or modify it. SSL streams are
+	   spliced only in the direction where kernel TLS is used
+	   (see iostream_pump_set_splice()). */
+	return client->rawlog_input == NULL &&
+		client->multiplex_output == NULL &&
+		proxy->server_ssl_iostream == NULL &&
+		proxy->rawlog_input == NULL &&
+		proxy->multiplex_input == NULL;
+}
+
 static void login_proxy_iostream_start(struct login_proxy *proxy)
 {
 	proxy->iostream_proxy =
@@ -1235,6 +1250,9 @@ static void login_proxy_iostream_start(struct login_proxy *proxy)
 				      proxy->server_input, proxy->server_output);
 	iostream_proxy_set_completion_callback(proxy->iostream_proxy,
 					       login_proxy_finished, proxy);
+	if (login_proxy_can_splice(proxy) &&
+	    iostream_proxy_set_splice(proxy->iostream_proxy))
+		e_debug(proxy->event, "Using splice() for proxying");
 	iostream_proxy_start(proxy->iostream_proxy);
 }
 
@@ -1507,8 +1525,8 @@ struct client *login_proxies_get_first_detached_client(void)
 void login_proxy_init(const char *proxy_notify_pipe_path)
 {
 	proxy_state = login_proxy_state_init(proxy_notify_pipe_path);
-	hash_table_create(&login_proxies_hash, default_pool, 0,
-			  str_hash, strcmp);
+	hash_table_create_open(&login_proxies_hash, default_pool, 0,
+			       str_hash, strcmp);
 }
 
 void login_proxy_deinit(void)
@@ -703,7 +703,9 @@ static void print_help(void)
 static void print_build_options(void)
 {
 	printf("Build options:"
-#ifdef IOLOOP_EPOLL
+#ifdef IOLOOP_IO_URING
+		" ioloop=io_uring"
+#elif defined(IOLOOP_EPOLL)
 		" ioloop=epoll"
 #endif
 #ifdef IOLOOP_KQUEUE
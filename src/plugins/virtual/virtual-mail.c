@@ -305,6 +305,24 @@ virtual_mail_get_parts(struct mail *mail, struct message_part **parts_r)
 	return 0;
 }
 
+static int
+virtual_mail_get_serialized_parts(struct mail *mail, buffer_t *parts_buf)
+{
+	struct virtual_mail *vmail = virtual_mail_container_of(mail);
+	struct mail *backend_mail;
+	int ret;
+
+	if (backend_mail_get(vmail, &backend_mail) < 0)
+		return -1;
+	if ((ret = mail_get_serialized_parts(backend_mail, parts_buf)) < 0) {
+		virtual_box_copy_error(mail->box, backend_mail->box);
+		return -1;
+	}
+	mail->has_nuls = backend_mail->has_nuls;
+	mail->has_no_nuls = backend_mail->has_no_nuls;
+	return ret;
+}
+
 static int
 virtual_mail_get_date(struct mail *mail, time_t *date_r, int *timezone_r)
 {
@@ -577,6 +595,7 @@ struct mail_vfuncs virtual_mail_vfuncs = {
 	index_mail_get_modseq,
 	index_mail_get_pvt_modseq,
 	virtual_mail_get_parts,
+	virtual_mail_get_serialized_parts,
 	virtual_mail_get_date,
 	virtual_mail_get_received_date,
 	virtual_mail_get_save_date,